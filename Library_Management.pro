@@ -15,12 +15,18 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+include(core.pri)
+
 SOURCES += \
+    columnstoremodel.cpp \
+    kioskwindow.cpp \
     librarymanager.cpp \
     main.cpp \
     mainwindow.cpp
 
 HEADERS += \
+    columnstoremodel.h \
+    kioskwindow.h \
     librarymanager.h \
     mainwindow.h
 
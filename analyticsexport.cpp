@@ -0,0 +1,877 @@
+﻿// analyticsexport.cpp
+#include "analyticsexport.h"
+#include "historyarchiver.h"
+#include "librarycore.h"
+#include "perfmonitor.h"
+#include "schema.h"
+#include <QtSql>
+#include <QtConcurrent>
+#include <QAtomicInt>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QtEndian>
+#include <algorithm>
+
+namespace {
+
+// 每个文件最多的行数（控制导出时的内存），以及文件内每个记录批的行数
+const int kPartRows = 512 * 1024;
+const int kBatchRows = 64 * 1024;
+
+struct ExportTable
+{
+    const Schema::Table *table;
+    bool incremental;  // 按 ID 水位线只导出新行；否则整表重写
+};
+
+const ExportTable kExportTables[] = {
+    {&Schema::kBorrowRecords, true},
+    {&Schema::kBorrowHistory, true},
+    {&Schema::kBooks, false},
+    {&Schema::kReaders, false},
+};
+
+QString manifestPath(const QString &directory)
+{
+    return directory + "/manifest.json";
+}
+
+// ---- FlatBuffers 编码 ----
+
+// Arrow 的元数据是 FlatBuffers。这里只实现用到的表、字符串、表向量与结构体向量：
+// 对象按从前往后的顺序写出，被引用的对象总在引用它的字段之后，偏移量都为正
+class FlatBuilder
+{
+public:
+    struct Field
+    {
+        int id;
+        int size;       // 标量的字节数；为 0 时是指向 child 的偏移
+        qint64 value;
+        int child;
+    };
+
+    static Field scalar(int id, int size, qint64 value) { return Field{id, size, value, -1}; }
+    static Field offset(int id, int child) { return Field{id, 0, 0, child}; }
+
+    int table(const QVector<Field> &fields)
+    {
+        Node node;
+        node.kind = Table;
+        node.fields = fields;
+        return add(node);
+    }
+
+    int string(const QByteArray &text)
+    {
+        Node node;
+        node.kind = String;
+        node.bytes = text;
+        return add(node);
+    }
+
+    int tables(const QVector<int> &children)
+    {
+        Node node;
+        node.kind = Tables;
+        node.children = children;
+        return add(node);
+    }
+
+    // 结构体按小端紧密排列在 packed 中，元素按 8 字节对齐
+    int structs(const QByteArray &packed, int count)
+    {
+        Node node;
+        node.kind = Structs;
+        node.bytes = packed;
+        node.count = count;
+        return add(node);
+    }
+
+    // 根偏移在最前，总长度补齐到 8 字节
+    QByteArray finish(int root)
+    {
+        out.clear();
+        put(0, 4);
+        patch(0, place(root));
+        align(8);
+        return out;
+    }
+
+private:
+    enum Kind { Table, String, Tables, Structs };
+
+    struct Node
+    {
+        Kind kind = Table;
+        QVector<Field> fields;
+        QByteArray bytes;
+        QVector<int> children;
+        int count = 0;
+    };
+
+    int add(const Node &node)
+    {
+        nodes.append(node);
+        return nodes.size() - 1;
+    }
+
+    static int width(const Field &field)
+    {
+        return field.size > 0 ? field.size : 4;
+    }
+
+    // 补零直到 (长度 + phase) 是 alignment 的倍数
+    void align(int alignment, int phase = 0)
+    {
+        while ((out.size() + phase) % alignment != 0) {
+            out.append('\0');
+        }
+    }
+
+    void put(qint64 value, int size)
+    {
+        for (int i = 0; i < size; ++i) {
+            out.append(static_cast<char>((value >> (8 * i)) & 0xFF));
+        }
+    }
+
+    void patch(int at, qint64 value)
+    {
+        for (int i = 0; i < 4; ++i) {
+            out[at + i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+        }
+    }
+
+    // 写出一个对象并返回其位置，再依次写出它引用的对象并回填偏移
+    int place(int index)
+    {
+        const Node node = nodes.at(index);
+        QVector<QPair<int, int> > links;
+        int position = 0;
+
+        switch (node.kind) {
+        case Table: {
+            // 字段从大到小排列，表起点按 8 字节对齐，各字段都自然对齐
+            QVector<Field> fields = node.fields;
+            std::stable_sort(fields.begin(), fields.end(), [](const Field &a, const Field &b) {
+                return width(a) > width(b);
+            });
+            int maxId = -1;
+            for (const Field &field : fields) {
+                maxId = qMax(maxId, field.id);
+            }
+            QVector<int> entries(maxId + 1, 0);
+            QVector<int> at;
+            int cursor = 4;
+            for (const Field &field : fields) {
+                cursor = (cursor + width(field) - 1) / width(field) * width(field);
+                at.append(cursor);
+                entries[field.id] = cursor;
+                cursor += width(field);
+            }
+
+            align(2);
+            const int vtable = out.size();
+            put(4 + 2 * entries.size(), 2);
+            put(cursor, 2);
+            for (int entry : entries) {
+                put(entry, 2);
+            }
+
+            align(8);
+            position = out.size();
+            put(position - vtable, 4);
+            for (int i = 0; i < fields.size(); ++i) {
+                while (out.size() < position + at.at(i)) {
+                    out.append('\0');
+                }
+                if (fields.at(i).size > 0) {
+                    put(fields.at(i).value, fields.at(i).size);
+                } else {
+                    links.append(qMakePair(out.size(), fields.at(i).child));
+                    put(0, 4);
+                }
+            }
+            break;
+        }
+        case String:
+            align(4);
+            position = out.size();
+            put(node.bytes.size(), 4);
+            out.append(node.bytes);
+            out.append('\0');
+            break;
+        case Tables:
+            align(4);
+            position = out.size();
+            put(node.children.size(), 4);
+            for (int child : node.children) {
+                links.append(qMakePair(out.size(), child));
+                put(0, 4);
+            }
+            break;
+        case Structs:
+            align(8, 4);
+            position = out.size();
+            put(node.count, 4);
+            out.append(node.bytes);
+            break;
+        }
+
+        for (const QPair<int, int> &link : links) {
+            patch(link.first, place(link.second) - link.first);
+        }
+        return position;
+    }
+
+    QVector<Node> nodes;
+    QByteArray out;
+};
+
+// ---- Arrow 列与文件 ----
+
+// Arrow 格式中的常量（Schema.fbs / Message.fbs）
+enum ArrowType { TypeInt = 2, TypeFloatingPoint = 3, TypeUtf8 = 5, TypeDate = 8, TypeTimestamp = 10 };
+enum MessageHeader { HeaderSchema = 1, HeaderDictionaryBatch = 2, HeaderRecordBatch = 3 };
+const int kMetadataV5 = 4;
+
+// 按列定义中的 SQLite 类型选择 Arrow 类型
+enum ColumnType { Int64, Float64, Date32, Timestamp, Utf8 };
+
+ColumnType columnType(const Schema::Column &column)
+{
+    const QString definition = column.definition;
+    if (definition.startsWith("INTEGER")) return Int64;
+    if (definition.startsWith("REAL")) return Float64;
+    if (definition.startsWith("DATE")) return Date32;
+    if (definition.startsWith("TIMESTAMP")) return Timestamp;
+    return Utf8;
+}
+
+// 一个文件内一列的全部值。文本列边读边建字典，写出时再决定是否按字典编码
+struct ColumnData
+{
+    QByteArray name;
+    ColumnType type = Utf8;
+    QVector<quint8> valid;
+    QVector<qint64> numbers;   // Int64、Date32（天）、Timestamp（秒）
+    QVector<double> reals;
+    QVector<qint32> indices;   // Utf8：在 values 中的下标
+    QVector<QByteArray> values;
+    QHash<QByteArray, qint32> lookup;
+    bool dictionary = false;
+
+    void append(const QVariant &value)
+    {
+        bool ok = !value.isNull();
+        qint64 number = 0;
+        double real = 0.0;
+        qint32 index = 0;
+        if (ok) {
+            switch (type) {
+            case Int64:
+                number = value.toLongLong(&ok);
+                break;
+            case Float64:
+                real = value.toDouble(&ok);
+                break;
+            case Date32: {
+                const QDate date = QDate::fromString(value.toString().left(10), Qt::ISODate);
+                ok = date.isValid();
+                number = QDate(1970, 1, 1).daysTo(date);
+                break;
+            }
+            case Timestamp: {
+                // 与 CURRENT_TIMESTAMP 相同的 UTC 格式
+                QDateTime time = QDateTime::fromString(value.toString().left(19), "yyyy-MM-dd hh:mm:ss");
+                time.setTimeSpec(Qt::UTC);
+                ok = time.isValid();
+                number = time.toMSecsSinceEpoch() / 1000;
+                break;
+            }
+            case Utf8: {
+                const QByteArray text = value.toString().toUtf8();
+                QHash<QByteArray, qint32>::const_iterator found = lookup.constFind(text);
+                if (found == lookup.constEnd()) {
+                    index = values.size();
+                    lookup.insert(text, index);
+                    values.append(text);
+                } else {
+                    index = found.value();
+                }
+                break;
+            }
+            }
+        }
+        valid.append(ok ? 1 : 0);
+        if (type == Float64) {
+            reals.append(ok ? real : 0.0);
+        } else if (type == Utf8) {
+            indices.append(ok ? index : 0);
+        } else {
+            numbers.append(ok ? number : 0);
+        }
+    }
+};
+
+// 消息体：各缓冲区依次排列，每个都从 8 字节边界开始
+class MessageBody
+{
+public:
+    void add(const QByteArray &buffer)
+    {
+        while (data.size() % 8 != 0) {
+            data.append('\0');
+        }
+        appendLong(&layout, data.size());
+        appendLong(&layout, buffer.size());
+        ++count;
+        data.append(buffer);
+        while (data.size() % 8 != 0) {
+            data.append('\0');
+        }
+    }
+
+    static void appendLong(QByteArray *bytes, qint64 value)
+    {
+        char raw[8];
+        qToLittleEndian<qint64>(value, reinterpret_cast<uchar *>(raw));
+        bytes->append(raw, 8);
+    }
+
+    static void appendInt(QByteArray *bytes, qint32 value)
+    {
+        char raw[4];
+        qToLittleEndian<qint32>(value, reinterpret_cast<uchar *>(raw));
+        bytes->append(raw, 4);
+    }
+
+    QByteArray data;
+    QByteArray layout;  // Buffer 结构体：offset、length
+    int count = 0;
+};
+
+// 一段行的文本编码为 Utf8 的偏移与数据缓冲区
+void addUtf8(MessageBody *body, const QVector<QByteArray> &texts)
+{
+    QByteArray offsets;
+    QByteArray data;
+    MessageBody::appendInt(&offsets, 0);
+    for (const QByteArray &text : texts) {
+        data.append(text);
+        MessageBody::appendInt(&offsets, data.size());
+    }
+    body->add(offsets);
+    body->add(data);
+}
+
+// 一列中 [begin, end) 的行：FieldNode 追加到 nodes，缓冲区追加到 body
+void encodeColumn(const ColumnData &column, int begin, int end, QByteArray *nodes, MessageBody *body)
+{
+    const int length = end - begin;
+    int nulls = 0;
+    QByteArray validity((length + 7) / 8, '\0');
+    for (int i = 0; i < length; ++i) {
+        if (column.valid.at(begin + i)) {
+            validity[i >> 3] = static_cast<char>(validity.at(i >> 3) | (1 << (i & 7)));
+        } else {
+            ++nulls;
+        }
+    }
+    MessageBody::appendLong(nodes, length);
+    MessageBody::appendLong(nodes, nulls);
+    // 没有空值时有效位图可以省略
+    body->add(nulls > 0 ? validity : QByteArray());
+
+    QByteArray values;
+    switch (column.type) {
+    case Int64:
+    case Timestamp:
+        for (int row = begin; row < end; ++row) {
+            MessageBody::appendLong(&values, column.numbers.at(row));
+        }
+        body->add(values);
+        break;
+    case Date32:
+        for (int row = begin; row < end; ++row) {
+            MessageBody::appendInt(&values, static_cast<qint32>(column.numbers.at(row)));
+        }
+        body->add(values);
+        break;
+    case Float64:
+        for (int row = begin; row < end; ++row) {
+            char raw[8];
+            qToLittleEndian<double>(column.reals.at(row), reinterpret_cast<uchar *>(raw));
+            values.append(raw, 8);
+        }
+        body->add(values);
+        break;
+    case Utf8:
+        if (column.dictionary) {
+            for (int row = begin; row < end; ++row) {
+                MessageBody::appendInt(&values, column.indices.at(row));
+            }
+            body->add(values);
+        } else {
+            QVector<QByteArray> texts;
+            texts.reserve(length);
+            for (int row = begin; row < end; ++row) {
+                texts.append(column.valid.at(row) ? column.values.at(column.indices.at(row)) : QByteArray());
+            }
+            addUtf8(body, texts);
+        }
+        break;
+    }
+}
+
+int intType(FlatBuilder *fb, int bitWidth)
+{
+    return fb->table({FlatBuilder::scalar(0, 4, bitWidth), FlatBuilder::scalar(1, 1, 1)});
+}
+
+// Schema 表；消息与文件尾各写一份。字典编码的列以列下标作为字典 ID
+int schemaTable(FlatBuilder *fb, const QVector<ColumnData> &columns)
+{
+    QVector<int> fields;
+    for (int i = 0; i < columns.size(); ++i) {
+        const ColumnData &column = columns.at(i);
+        int typeId = TypeUtf8;
+        int type = 0;
+        switch (column.type) {
+        case Int64:
+            typeId = TypeInt;
+            type = intType(fb, 64);
+            break;
+        case Float64:
+            typeId = TypeFloatingPoint;
+            type = fb->table({FlatBuilder::scalar(0, 2, 2)});                // DOUBLE
+            break;
+        case Date32:
+            typeId = TypeDate;
+            type = fb->table({FlatBuilder::scalar(0, 2, 0)});                // DAY
+            break;
+        case Timestamp:
+            typeId = TypeTimestamp;
+            type = fb->table({FlatBuilder::scalar(0, 2, 0),                  // SECOND
+                              FlatBuilder::offset(1, fb->string("UTC"))});
+            break;
+        case Utf8:
+            type = fb->table({});
+            break;
+        }
+
+        QVector<FlatBuilder::Field> field = {
+            FlatBuilder::offset(0, fb->string(column.name)),
+            FlatBuilder::scalar(1, 1, 1),
+            FlatBuilder::scalar(2, 1, typeId),
+            FlatBuilder::offset(3, type),
+            FlatBuilder::offset(5, fb->tables({})),
+        };
+        if (column.dictionary) {
+            field.append(FlatBuilder::offset(4, fb->table({FlatBuilder::scalar(0, 8, i),
+                                                           FlatBuilder::offset(1, intType(fb, 32)),
+                                                           FlatBuilder::scalar(2, 1, 0)})));
+        }
+        fields.append(fb->table(field));
+    }
+    return fb->table({FlatBuilder::scalar(0, 2, 0), FlatBuilder::offset(1, fb->tables(fields))});
+}
+
+int recordBatchTable(FlatBuilder *fb, qint64 length, const QByteArray &nodes, const MessageBody &body)
+{
+    return fb->table({FlatBuilder::scalar(0, 8, length),
+                      FlatBuilder::offset(1, fb->structs(nodes, nodes.size() / 16)),
+                      FlatBuilder::offset(2, fb->structs(body.layout, body.count))});
+}
+
+QByteArray message(FlatBuilder *fb, int headerType, int header, qint64 bodyLength)
+{
+    return fb->finish(fb->table({FlatBuilder::scalar(0, 2, kMetadataV5),
+                                 FlatBuilder::scalar(1, 1, headerType),
+                                 FlatBuilder::offset(2, header),
+                                 FlatBuilder::scalar(3, 8, bodyLength)}));
+}
+
+// 写 Arrow IPC 文件：魔数、Schema、各字典、各记录批、流结束标记、文件尾
+class ArrowFileWriter
+{
+public:
+    explicit ArrowFileWriter(const QString &path) : file(path), position(0) {}
+
+    bool write(const QVector<ColumnData> &columns, int rows, QString *error)
+    {
+        if (!file.open(QIODevice::WriteOnly)) {
+            if (error) *error = file.errorString();
+            return false;
+        }
+        writeRaw(QByteArray("ARROW1\0\0", 8));
+
+        {
+            FlatBuilder fb;
+            writeMessage(message(&fb, HeaderSchema, schemaTable(&fb, columns), 0), MessageBody(), nullptr);
+        }
+
+        for (int i = 0; i < columns.size(); ++i) {
+            if (!columns.at(i).dictionary) {
+                continue;
+            }
+            MessageBody body;
+            QByteArray nodes;
+            MessageBody::appendLong(&nodes, columns.at(i).values.size());
+            MessageBody::appendLong(&nodes, 0);
+            body.add(QByteArray());
+            addUtf8(&body, columns.at(i).values);
+
+            FlatBuilder fb;
+            const int batch = recordBatchTable(&fb, columns.at(i).values.size(), nodes, body);
+            const int dictionary = fb.table({FlatBuilder::scalar(0, 8, i), FlatBuilder::offset(1, batch),
+                                             FlatBuilder::scalar(2, 1, 0)});
+            writeMessage(message(&fb, HeaderDictionaryBatch, dictionary, body.data.size()), body, &dictionaryBlocks);
+        }
+
+        for (int begin = 0; begin < rows; begin += kBatchRows) {
+            const int end = qMin(rows, begin + kBatchRows);
+            MessageBody body;
+            QByteArray nodes;
+            for (const ColumnData &column : columns) {
+                encodeColumn(column, begin, end, &nodes, &body);
+            }
+            FlatBuilder fb;
+            const int batch = recordBatchTable(&fb, end - begin, nodes, body);
+            writeMessage(message(&fb, HeaderRecordBatch, batch, body.data.size()), body, &batchBlocks);
+        }
+
+        // 流结束标记，之后是文件尾（Footer）、其长度与结尾魔数
+        QByteArray tail;
+        MessageBody::appendInt(&tail, -1);
+        MessageBody::appendInt(&tail, 0);
+        writeRaw(tail);
+
+        FlatBuilder fb;
+        const int schema = schemaTable(&fb, columns);
+        const QByteArray footer = fb.finish(fb.table({FlatBuilder::scalar(0, 2, kMetadataV5),
+                                                      FlatBuilder::offset(1, schema),
+                                                      FlatBuilder::offset(2, fb.structs(dictionaryBlocks, dictionaryBlocks.size() / 24)),
+                                                      FlatBuilder::offset(3, fb.structs(batchBlocks, batchBlocks.size() / 24))}));
+        writeRaw(footer);
+        QByteArray end;
+        MessageBody::appendInt(&end, footer.size());
+        end.append("ARROW1");
+        writeRaw(end);
+
+        if (!ok || !file.commit()) {
+            if (error) *error = file.errorString();
+            return false;
+        }
+        return true;
+    }
+
+private:
+    void writeRaw(const QByteArray &bytes)
+    {
+        ok = ok && file.write(bytes) == bytes.size();
+        position += bytes.size();
+    }
+
+    // 封装的消息：继续标记、元数据长度、元数据、消息体；blocks 非空时记下 Block 结构体
+    void writeMessage(const QByteArray &metadata, const MessageBody &body, QByteArray *blocks)
+    {
+        if (blocks) {
+            MessageBody::appendLong(blocks, position);
+            MessageBody::appendInt(blocks, 8 + metadata.size());
+            MessageBody::appendInt(blocks, 0);
+            MessageBody::appendLong(blocks, body.data.size());
+        }
+        QByteArray prefix;
+        MessageBody::appendInt(&prefix, -1);
+        MessageBody::appendInt(&prefix, metadata.size());
+        writeRaw(prefix);
+        writeRaw(metadata);
+        writeRaw(body.data);
+    }
+
+    QSaveFile file;
+    qint64 position;
+    bool ok = true;
+    QByteArray dictionaryBlocks;
+    QByteArray batchBlocks;
+};
+
+// ---- 按表导出 ----
+
+struct Outcome
+{
+    QString table;
+    bool ok = false;
+    QString error;
+    qint64 rows = 0;
+    qint64 watermark = 0;
+    QStringList files;  // 相对于导出目录
+};
+
+QVector<ColumnData> emptyColumns(const Schema::Table &table)
+{
+    QVector<ColumnData> columns(table.columnCount);
+    for (int i = 0; i < table.columnCount; ++i) {
+        columns[i].name = table.columns[i].name;
+        columns[i].type = columnType(table.columns[i]);
+    }
+    return columns;
+}
+
+// 文本列的不同值不超过行数一半时按字典编码
+bool writeColumns(const QString &path, QVector<ColumnData> &columns, int rows, QString *error)
+{
+    for (ColumnData &column : columns) {
+        column.dictionary = column.type == Utf8 && column.values.size() * 2 <= rows;
+    }
+    return ArrowFileWriter(path).write(columns, rows, error);
+}
+
+// 供 QtConcurrent::blockingMapped 调用：每张表一个只读连接
+class TableExporter
+{
+public:
+    typedef Outcome result_type;
+
+    TableExporter(const QString &databasePath, const QString &directory, const QHash<QString, qint64> &watermarks)
+        : databasePath(databasePath), directory(directory), watermarks(watermarks)
+    {
+    }
+
+    Outcome operator()(const ExportTable &target) const
+    {
+        static QAtomicInt serial;
+        const QString connectionName = QString("analytics_export_%1").arg(serial.fetchAndAddRelaxed(1));
+        Outcome outcome;
+        outcome.table = target.table->name;
+        {
+            LibraryCore reader(connectionName);
+            if (reader.openReadOnly(databasePath, &outcome.error)) {
+                outcome.ok = target.incremental ? exportIncremental(reader.database(), *target.table, &outcome)
+                                                : exportSnapshot(reader.database(), *target.table, &outcome);
+            }
+            reader.close();
+        }
+        QSqlDatabase::removeDatabase(connectionName);
+        return outcome;
+    }
+
+private:
+    bool exportSnapshot(QSqlDatabase db, const Schema::Table &table, Outcome *outcome) const
+    {
+        ScopedTimer timer("分析导出-维度表");
+        QSqlQuery query(db);
+        query.setForwardOnly(true);
+        if (!query.exec(QString("SELECT %1 FROM %2 ORDER BY id").arg(Schema::columnList(table), table.name))) {
+            outcome->error = query.lastError().text();
+            return false;
+        }
+        QVector<ColumnData> columns = emptyColumns(table);
+        int rows = 0;
+        while (query.next()) {
+            for (int i = 0; i < columns.size(); ++i) {
+                columns[i].append(query.value(i));
+            }
+            ++rows;
+        }
+
+        const QString file = QString("%1.arrow").arg(table.name);
+        if (!writeColumns(directory + "/" + file, columns, rows, &outcome->error)) {
+            return false;
+        }
+        outcome->rows = rows;
+        outcome->files.append(file);
+        return true;
+    }
+
+    // 新行按 ID 升序分段写成若干文件，每个文件写完才推进水位线
+    bool exportIncremental(QSqlDatabase db, const Schema::Table &table, Outcome *outcome) const
+    {
+        ScopedTimer timer("分析导出-增量");
+        QSqlQuery query(db);
+
+        // 已归档的行在归档库中，只读附加后与主库合并读取；迁移的两次提交之间
+        // 同一行可能两边都有，归档库中只取主库里已经没有的
+        QString source = QString("SELECT %1 FROM main.%2 WHERE id > ?").arg(Schema::columnList(table), table.name);
+        bool archived = false;
+        const QString archive = HistoryArchiver::archivePath(databasePath);
+        if (QFile::exists(archive)) {
+            query.prepare("ATTACH DATABASE ? AS archive");
+            query.addBindValue(archive);
+            if (query.exec()) {
+                query.prepare("SELECT COUNT(*) FROM archive.sqlite_master WHERE type = 'table' AND name = ?");
+                query.addBindValue(table.name);
+                archived = query.exec() && query.next() && query.value(0).toInt() > 0;
+            }
+        }
+        if (archived) {
+            source += QString(" UNION ALL SELECT %1 FROM archive.%2 AS a WHERE id > ? "
+                              "AND NOT EXISTS (SELECT 1 FROM main.%2 AS m WHERE m.id = a.id)")
+                          .arg(Schema::columnList(table), table.name);
+        }
+
+        const QString subdirectory = table.name;
+        if (!QDir(directory).mkpath(subdirectory)) {
+            outcome->error = "无法创建目录 " + directory + "/" + subdirectory;
+            return false;
+        }
+
+        qint64 watermark = watermarks.value(table.name);
+        outcome->watermark = watermark;
+        for (;;) {
+            query.setForwardOnly(true);
+            query.prepare(source + " ORDER BY 1 LIMIT ?");
+            query.addBindValue(watermark);
+            if (archived) {
+                query.addBindValue(watermark);
+            }
+            query.addBindValue(kPartRows);
+            if (!query.exec()) {
+                outcome->error = query.lastError().text();
+                return false;
+            }
+
+            QVector<ColumnData> columns = emptyColumns(table);
+            int rows = 0;
+            qint64 firstId = 0;
+            qint64 lastId = watermark;
+            while (query.next()) {
+                for (int i = 0; i < columns.size(); ++i) {
+                    columns[i].append(query.value(i));
+                }
+                lastId = query.value(0).toLongLong();
+                if (rows++ == 0) {
+                    firstId = lastId;
+                }
+            }
+            query.finish();
+            if (rows == 0) {
+                break;
+            }
+
+            // 文件以首行 ID 命名，清单未更新时重新导出会覆盖同一个文件
+            const QString file = QString("%1/part-%2.arrow").arg(subdirectory).arg(firstId, 12, 10, QChar('0'));
+            if (!writeColumns(directory + "/" + file, columns, rows, &outcome->error)) {
+                return false;
+            }
+            outcome->files.append(file);
+            outcome->rows += rows;
+            outcome->watermark = watermark = lastId;
+            if (rows < kPartRows) {
+                break;
+            }
+        }
+        return true;
+    }
+
+    QString databasePath;
+    QString directory;
+    QHash<QString, qint64> watermarks;
+};
+
+} // namespace
+
+bool AnalyticsExport::run(const QString &databasePath, const QString &directory, Result *result, QString *error)
+{
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    if (!QDir().mkpath(directory)) {
+        if (error) *error = "无法创建导出目录 " + directory;
+        return false;
+    }
+
+    // 上次导出的清单：增量表从水位线之后继续
+    QJsonObject manifest;
+    QFile manifestFile(manifestPath(directory));
+    if (manifestFile.exists()) {
+        if (!manifestFile.open(QIODevice::ReadOnly)) {
+            if (error) *error = manifestFile.errorString();
+            return false;
+        }
+        QJsonParseError parseError;
+        const QJsonDocument document = QJsonDocument::fromJson(manifestFile.readAll(), &parseError);
+        manifestFile.close();
+        if (!document.isObject()) {
+            if (error) *error = "导出清单已损坏：" + parseError.errorString();
+            return false;
+        }
+        manifest = document.object();
+    }
+    QJsonObject tables = manifest.value("tables").toObject();
+    QHash<QString, qint64> watermarks;
+    for (const ExportTable &target : kExportTables) {
+        const QString name = target.table->name;
+        watermarks.insert(name, static_cast<qint64>(tables.value(name).toObject().value("watermark").toDouble()));
+    }
+
+    QVector<ExportTable> targets;
+    for (const ExportTable &target : kExportTables) {
+        targets.append(target);
+    }
+    const QList<Outcome> outcomes =
+        QtConcurrent::blockingMapped<QList<Outcome> >(targets, TableExporter(databasePath, directory, watermarks));
+
+    // 成功的表更新清单；失败的表保留原来的水位线，已写出的文件下次会被覆盖
+    QStringList failures;
+    const QString now = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    for (int i = 0; i < outcomes.size(); ++i) {
+        const Outcome &outcome = outcomes.at(i);
+        if (!outcome.ok) {
+            failures.append(QString("%1：%2").arg(outcome.table, outcome.error));
+            continue;
+        }
+
+        QJsonObject entry = tables.value(outcome.table).toObject();
+        entry.insert("exported", now);
+        if (targets.at(i).incremental) {
+            QJsonArray parts = entry.value("parts").toArray();
+            for (const QString &file : outcome.files) {
+                parts.append(file);
+            }
+            entry.insert("mode", "incremental");
+            entry.insert("watermark", static_cast<double>(outcome.watermark));
+            entry.insert("parts", parts);
+        } else {
+            entry.insert("mode", "snapshot");
+            entry.insert("file", outcome.files.value(0));
+            entry.insert("rows", static_cast<double>(outcome.rows));
+        }
+        tables.insert(outcome.table, entry);
+
+        if (result) {
+            TableResult tableResult;
+            tableResult.table = outcome.table;
+            tableResult.rows = outcome.rows;
+            tableResult.files = outcome.files.size();
+            tableResult.watermark = targets.at(i).incremental ? outcome.watermark : 0;
+            result->tables.append(tableResult);
+        }
+    }
+    manifest.insert("format", "arrow-ipc");
+    manifest.insert("tables", tables);
+
+    QSaveFile saved(manifestPath(directory));
+    if (!saved.open(QIODevice::WriteOnly) || saved.write(QJsonDocument(manifest).toJson()) < 0 || !saved.commit()) {
+        if (error) *error = "无法写入导出清单：" + saved.errorString();
+        return false;
+    }
+
+    if (result) {
+        result->elapsedMs = elapsed.elapsed();
+    }
+    if (!failures.isEmpty()) {
+        if (error) *error = failures.join("\n");
+        return false;
+    }
+    return true;
+}
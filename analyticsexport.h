@@ -0,0 +1,42 @@
+﻿// analyticsexport.h
+#ifndef ANALYTICSEXPORT_H
+#define ANALYTICSEXPORT_H
+
+#include <QString>
+#include <QVector>
+
+// 借阅数据的列式分析导出：把借阅记录、借阅历史及图书、读者两张维度表写成
+// Arrow IPC 文件（.arrow，即 Feather v2），分析人员直接用 pyarrow / pandas / DuckDB
+// 读取，不再复制或查询生产库。重复较多的文本列按字典编码。
+//
+// 目录布局：
+//   manifest.json                       各表的水位线与已导出的文件
+//   borrow_records/part-<首行ID>.arrow   按 ID 水位线增量导出，只追加新文件
+//   borrow_history/part-<首行ID>.arrow
+//   books.arrow、readers.arrow           维度表，每次整表重写
+//
+// 借阅记录在还书、续借时会被修改，导出的是借出时的行；之后的归还与续借
+// 以借阅历史中带借阅记录号的事件出现。
+class AnalyticsExport
+{
+public:
+    struct TableResult
+    {
+        QString table;
+        qint64 rows = 0;       // 本次导出的行数
+        int files = 0;         // 本次写出的文件数
+        qint64 watermark = 0;  // 增量表导出后的水位线，维度表为 0
+    };
+
+    struct Result
+    {
+        QVector<TableResult> tables;
+        qint64 elapsedMs = 0;
+    };
+
+    // 每张表在线程池中用各自的只读连接并行导出，归档库存在时一并读取。
+    // 某张表失败时其余表的结果仍写入清单，返回 false 并在 error 中说明失败的表
+    static bool run(const QString &databasePath, const QString &directory, Result *result, QString *error);
+};
+
+#endif // ANALYTICSEXPORT_H
@@ -0,0 +1,286 @@
+﻿// backuparchive.cpp
+#include "backuparchive.h"
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QThread>
+#include <QtConcurrent>
+#include <cstring>
+
+namespace {
+
+const char kMagic[4] = {'L', 'M', 'B', 'A'};
+const quint32 kVersion = 1;
+const int kHeaderSize = 8;
+const int kFooterSize = 8 + 4 + 4;
+
+struct PackedChunk
+{
+    QByteArray compressed;
+    QByteArray checksum;
+    int rawSize;
+};
+
+struct Chunk
+{
+    QByteArray data;
+    QByteArray checksum;
+    bool ok;
+};
+
+Chunk compressChunk(const QByteArray &raw)
+{
+    Chunk chunk;
+    chunk.checksum = QCryptographicHash::hash(raw, QCryptographicHash::Sha256);
+    chunk.data = qCompress(raw, 6);
+    chunk.ok = true;
+    return chunk;
+}
+
+Chunk decompressChunk(const PackedChunk &packed)
+{
+    Chunk chunk;
+    chunk.data = qUncompress(packed.compressed);
+    chunk.checksum = QCryptographicHash::hash(chunk.data, QCryptographicHash::Sha256);
+    chunk.ok = chunk.data.size() == packed.rawSize && chunk.checksum == packed.checksum;
+    return chunk;
+}
+
+// 每批交给线程池的块数：足够让所有核心忙碌，又不至于占用过多内存
+int batchSize()
+{
+    return qMax(1, QThread::idealThreadCount()) * 2;
+}
+
+bool readManifest(QFile &file, QJsonObject *manifest, QString *error)
+{
+    if (file.size() < kHeaderSize + kFooterSize) {
+        *error = "文件不是有效的备份归档";
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+
+    char magic[4];
+    quint32 version = 0;
+    file.seek(0);
+    stream.readRawData(magic, 4);
+    stream >> version;
+    if (memcmp(magic, kMagic, 4) != 0 || version != kVersion) {
+        *error = "文件不是有效的备份归档";
+        return false;
+    }
+
+    qint64 manifestOffset = 0;
+    quint32 manifestLength = 0;
+    file.seek(file.size() - kFooterSize);
+    stream >> manifestOffset >> manifestLength;
+    stream.readRawData(magic, 4);
+    if (memcmp(magic, kMagic, 4) != 0
+            || manifestOffset < kHeaderSize
+            || manifestOffset + manifestLength > file.size() - kFooterSize) {
+        *error = "备份归档尾部已损坏";
+        return false;
+    }
+
+    file.seek(manifestOffset);
+    QJsonParseError parseError;
+    QJsonDocument document = QJsonDocument::fromJson(file.read(manifestLength), &parseError);
+    if (parseError.error != QJsonParseError::NoError || !document.isObject()) {
+        *error = "备份归档清单已损坏";
+        return false;
+    }
+
+    *manifest = document.object();
+    return true;
+}
+
+} // namespace
+
+bool BackupArchive::create(const QString &sourcePath, const QString &archivePath,
+                           Result *result, QString *error, const ProgressCallback &progress)
+{
+    QFile source(sourcePath);
+    if (!source.open(QIODevice::ReadOnly)) {
+        *error = "无法读取数据库文件";
+        return false;
+    }
+
+    QSaveFile archive(archivePath);
+    if (!archive.open(QIODevice::WriteOnly)) {
+        *error = "无法创建备份归档";
+        return false;
+    }
+
+    QDataStream stream(&archive);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream.writeRawData(kMagic, 4);
+    stream << kVersion;
+
+    const int totalChunks = int((source.size() + ChunkSize - 1) / ChunkSize);
+    QCryptographicHash wholeFile(QCryptographicHash::Sha256);
+    QJsonArray chunkArray;
+    qint64 offset = kHeaderSize;
+    int done = 0;
+
+    while (!source.atEnd()) {
+        QList<QByteArray> batch;
+        while (batch.size() < batchSize() && !source.atEnd()) {
+            batch.append(source.read(ChunkSize));
+        }
+
+        // 压缩在线程池中并行进行，写出仍按原顺序
+        QList<Chunk> packed = QtConcurrent::blockingMapped(batch, compressChunk);
+
+        for (int i = 0; i < packed.size(); ++i) {
+            wholeFile.addData(batch.at(i));
+            if (archive.write(packed.at(i).data) != packed.at(i).data.size()) {
+                archive.cancelWriting();
+                *error = "写入备份归档失败";
+                return false;
+            }
+
+            QJsonObject chunk;
+            chunk["offset"] = offset;
+            chunk["size"] = packed.at(i).data.size();
+            chunk["rawSize"] = batch.at(i).size();
+            chunk["sha256"] = QString::fromLatin1(packed.at(i).checksum.toHex());
+            chunkArray.append(chunk);
+            offset += packed.at(i).data.size();
+        }
+
+        done += batch.size();
+        if (progress) {
+            progress(done, totalChunks);
+        }
+    }
+
+    QJsonObject manifest;
+    manifest["format"] = "LMBA";
+    manifest["version"] = int(kVersion);
+    manifest["source"] = QFileInfo(sourcePath).fileName();
+    manifest["created"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    manifest["compression"] = "zlib";
+    manifest["chunkSize"] = ChunkSize;
+    manifest["originalSize"] = source.size();
+    manifest["sha256"] = QString::fromLatin1(wholeFile.result().toHex());
+    manifest["chunks"] = chunkArray;
+
+    QByteArray manifestBytes = QJsonDocument(manifest).toJson(QJsonDocument::Compact);
+    archive.write(manifestBytes);
+    stream << offset << quint32(manifestBytes.size());
+    stream.writeRawData(kMagic, 4);
+
+    if (!archive.commit()) {
+        *error = "写入备份归档失败";
+        return false;
+    }
+
+    result->originalBytes = source.size();
+    result->archiveBytes = QFileInfo(archivePath).size();
+    result->chunks = chunkArray.size();
+    return true;
+}
+
+bool BackupArchive::verify(const QString &archivePath, Result *result, QString *error,
+                           const ProgressCallback &progress)
+{
+    return unpack(archivePath, QString(), result, error, progress);
+}
+
+bool BackupArchive::extract(const QString &archivePath, const QString &targetPath,
+                            Result *result, QString *error, const ProgressCallback &progress)
+{
+    return unpack(archivePath, targetPath, result, error, progress);
+}
+
+bool BackupArchive::isArchive(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    return file.read(4) == QByteArray(kMagic, 4);
+}
+
+bool BackupArchive::unpack(const QString &archivePath, const QString &targetPath,
+                           Result *result, QString *error, const ProgressCallback &progress)
+{
+    QFile archive(archivePath);
+    if (!archive.open(QIODevice::ReadOnly)) {
+        *error = "无法打开备份归档";
+        return false;
+    }
+
+    QJsonObject manifest;
+    if (!readManifest(archive, &manifest, error)) {
+        return false;
+    }
+
+    // 目标路径为空时只做校验
+    QSaveFile output(targetPath);
+    if (!targetPath.isEmpty() && !output.open(QIODevice::WriteOnly)) {
+        *error = "无法写入恢复文件";
+        return false;
+    }
+
+    QJsonArray chunks = manifest["chunks"].toArray();
+    QCryptographicHash wholeFile(QCryptographicHash::Sha256);
+    qint64 originalBytes = 0;
+
+    for (int first = 0; first < chunks.size(); first += batchSize()) {
+        QList<PackedChunk> batch;
+        for (int i = first; i < qMin(first + batchSize(), chunks.size()); ++i) {
+            QJsonObject chunk = chunks.at(i).toObject();
+            PackedChunk packed;
+            archive.seek(qint64(chunk["offset"].toDouble()));
+            packed.compressed = archive.read(chunk["size"].toInt());
+            packed.checksum = QByteArray::fromHex(chunk["sha256"].toString().toLatin1());
+            packed.rawSize = chunk["rawSize"].toInt();
+            batch.append(packed);
+        }
+
+        QList<Chunk> unpacked = QtConcurrent::blockingMapped(batch, decompressChunk);
+
+        for (int i = 0; i < unpacked.size(); ++i) {
+            if (!unpacked.at(i).ok) {
+                *error = QString("第 %1 块数据校验失败，备份归档已损坏").arg(first + i + 1);
+                return false;
+            }
+            wholeFile.addData(unpacked.at(i).data);
+            originalBytes += unpacked.at(i).data.size();
+            if (!targetPath.isEmpty()
+                    && output.write(unpacked.at(i).data) != unpacked.at(i).data.size()) {
+                *error = "写入恢复文件失败";
+                return false;
+            }
+        }
+
+        if (progress) {
+            progress(qMin(first + batchSize(), chunks.size()), chunks.size());
+        }
+    }
+
+    if (originalBytes != qint64(manifest["originalSize"].toDouble())
+            || QString::fromLatin1(wholeFile.result().toHex()) != manifest["sha256"].toString()) {
+        *error = "整体校验失败，备份归档不完整";
+        return false;
+    }
+
+    if (!targetPath.isEmpty() && !output.commit()) {
+        *error = "写入恢复文件失败";
+        return false;
+    }
+
+    result->originalBytes = originalBytes;
+    result->archiveBytes = archive.size();
+    result->chunks = chunks.size();
+    return true;
+}
@@ -0,0 +1,50 @@
+﻿// backuparchive.h
+#ifndef BACKUPARCHIVE_H
+#define BACKUPARCHIVE_H
+
+#include <QString>
+#include <functional>
+
+// 压缩备份归档（.lmba）：数据库文件按固定大小分块，各块在所有核心上并行压缩，
+// 每块带 SHA-256 校验，文件末尾的清单记录块位置、原始大小与整体校验值。
+//
+// 文件布局：
+//   "LMBA" 版本号(4字节)
+//   压缩块 0 .. n-1
+//   清单（JSON）
+//   清单偏移(8字节) 清单长度(4字节) "LMBA"
+class BackupArchive
+{
+public:
+    struct Result
+    {
+        qint64 originalBytes = 0;
+        qint64 archiveBytes = 0;
+        int chunks = 0;
+    };
+
+    // 参数为已处理块数与总块数
+    typedef std::function<void(int, int)> ProgressCallback;
+
+    static const int ChunkSize = 4 * 1024 * 1024;
+
+    static bool create(const QString &sourcePath, const QString &archivePath,
+                       Result *result, QString *error,
+                       const ProgressCallback &progress = ProgressCallback());
+
+    // 只解压校验，不写出文件
+    static bool verify(const QString &archivePath, Result *result, QString *error,
+                       const ProgressCallback &progress = ProgressCallback());
+
+    static bool extract(const QString &archivePath, const QString &targetPath,
+                        Result *result, QString *error,
+                        const ProgressCallback &progress = ProgressCallback());
+
+    static bool isArchive(const QString &path);
+
+private:
+    static bool unpack(const QString &archivePath, const QString &targetPath,
+                       Result *result, QString *error, const ProgressCallback &progress);
+};
+
+#endif // BACKUPARCHIVE_H
@@ -0,0 +1,370 @@
+﻿// barcodeindex.cpp
+#include "barcodeindex.h"
+#include "perfmonitor.h"
+#include <QSqlError>
+#include <algorithm>
+
+namespace {
+
+const int kMinCapacity = 16;
+
+int capacityFor(int count)
+{
+    int capacity = kMinCapacity;
+    while (capacity < count * 2) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+int bitsOf(int capacity)
+{
+    int bits = 0;
+    while ((1 << bits) < capacity) {
+        ++bits;
+    }
+    return bits;
+}
+
+quint32 hashId(int id)
+{
+    return static_cast<quint32>(id);
+}
+
+// 线性探测下，home 位于 (hole, slot] 区间（环形）的元素不能前移到空位
+bool staysInPlace(quint32 home, int hole, int slot)
+{
+    const quint32 h = static_cast<quint32>(hole);
+    const quint32 s = static_cast<quint32>(slot);
+    return h <= s ? (home > h && home <= s) : (home > h || home <= s);
+}
+
+} // namespace
+
+BarcodeIndex::BarcodeIndex()
+    : schema(nullptr), codeColumn(0), garbage(0), count(0), shift(32 - bitsOf(kMinCapacity))
+{
+    codeSlots.resize(kMinCapacity);
+    idSlots.resize(kMinCapacity);
+}
+
+BarcodeIndex::BarcodeIndex(const Schema::Table &table, int codeColumn)
+    : schema(&table), codeColumn(codeColumn), garbage(0), count(0), shift(32 - bitsOf(kMinCapacity))
+{
+    codeSlots.resize(kMinCapacity);
+    idSlots.resize(kMinCapacity);
+}
+
+BarcodeIndex BarcodeIndex::books()
+{
+    return BarcodeIndex(Schema::kBooks, Schema::Books::Isbn);
+}
+
+BarcodeIndex BarcodeIndex::readers()
+{
+    return BarcodeIndex(Schema::kReaders, Schema::Readers::CardNumber);
+}
+
+BarcodeIndex BarcodeIndex::copies()
+{
+    return BarcodeIndex(Schema::kCopies, Schema::Copies::Barcode);
+}
+
+QString BarcodeIndex::normalize(const QString &code)
+{
+    QString result;
+    result.reserve(code.size());
+    for (QChar c : code) {
+        const ushort u = c.unicode();
+        if (u == ' ' || u == '-' || u == '\t' || u == '\r' || u == '\n') {
+            continue;
+        }
+        result.append((u >= 'a' && u <= 'z') ? QChar(u - 0x20) : c);
+    }
+    return result;
+}
+
+quint32 BarcodeIndex::hashCode(const QChar *text, int length)
+{
+    // FNV-1a
+    quint32 hash = 2166136261u;
+    for (int i = 0; i < length; ++i) {
+        hash = (hash ^ text[i].unicode()) * 16777619u;
+    }
+    return hash;
+}
+
+bool BarcodeIndex::load(const QSqlDatabase &db, QString *error)
+{
+    const QByteArray operation = QByteArray("加载条码索引 ") + schema->name;
+    ScopedTimer timer(operation.constData());
+
+    TimedQuery countQuery(db);
+    int expected = 0;
+    if (countQuery.exec(QString("SELECT COUNT(*) FROM %1").arg(schema->name)) && countQuery.next()) {
+        expected = countQuery.value(0).toInt();
+    }
+
+    TimedQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec(QString("SELECT %1, %2 FROM %3")
+                        .arg(schema->columns[0].name, schema->columns[codeColumn].name, schema->name))) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+
+    const Schema::Table *table = schema;
+    const int column = codeColumn;
+    *this = BarcodeIndex(*table, column);
+    rehash(capacityFor(expected));
+    while (query.next()) {
+        insert(query.value(0).toInt(), query.value(1).toString());
+    }
+    codes.squeeze();
+    return true;
+}
+
+bool BarcodeIndex::refresh(const QSqlDatabase &db, int id, QString *error)
+{
+    TimedQuery query(db);
+    query.prepare(QString("SELECT %1 FROM %2 WHERE %3 = ?")
+                      .arg(schema->columns[codeColumn].name, schema->name, schema->columns[0].name));
+    query.addBindValue(id);
+    if (!query.exec()) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+    if (query.next()) {
+        insert(id, query.value(0).toString());
+    } else {
+        remove(id);
+    }
+    return true;
+}
+
+void BarcodeIndex::insert(int id, const QString &code)
+{
+    remove(id);
+    if ((count + 1) * 2 > codeSlots.size()) {
+        rehash(codeSlots.size() * 2);
+    }
+
+    const QString key = normalize(code);
+    TextArena::Ref ref;
+    if (!key.isEmpty()) {
+        const quint32 hash = hashCode(key.constData(), key.size());
+        const int existing = findCode(key.constData(), key.size(), hash);
+        if (existing >= 0) {
+            // 条码在表中唯一；万一重复，后写入的记录占用条码，先前的记录只能按 ID 查到
+            idSlots[findId(codeSlots.at(existing).id)].code = TextArena::Ref();
+            codeSlots[existing].id = id;
+            ref = codeSlots.at(existing).code;
+        } else {
+            ref = codes.append(key);
+            const int mask = codeSlots.size() - 1;
+            int slot = static_cast<int>(home(hash));
+            while (codeSlots.at(slot).id >= 0) {
+                slot = (slot + 1) & mask;
+            }
+            CodeSlot &entry = codeSlots[slot];
+            entry.hash = hash;
+            entry.id = id;
+            entry.code = ref;
+        }
+    }
+
+    const int mask = idSlots.size() - 1;
+    int slot = static_cast<int>(home(hashId(id)));
+    while (idSlots.at(slot).id >= 0) {
+        slot = (slot + 1) & mask;
+    }
+    idSlots[slot].id = id;
+    idSlots[slot].code = ref;
+    ++count;
+}
+
+void BarcodeIndex::remove(int id)
+{
+    const int slot = findId(id);
+    if (slot < 0) {
+        return;
+    }
+    const TextArena::Ref ref = idSlots.at(slot).code;
+    if (ref.length) {
+        const QChar *text = codes.data(ref);
+        const int length = static_cast<int>(ref.length);
+        eraseCode(findCode(text, length, hashCode(text, length)));
+        garbage += ref.length;
+    }
+    eraseId(slot);
+    --count;
+
+    // 删除与改码留下的废弃文本超过一半时原容量重建
+    if (garbage > codes.size() / 2 && codes.size() > 4096) {
+        rehash(codeSlots.size());
+    }
+}
+
+int BarcodeIndex::resolve(const QString &scanned) const
+{
+    const QString key = normalize(scanned);
+    if (key.isEmpty()) {
+        return -1;
+    }
+    const int slot = findCode(key.constData(), key.size(), hashCode(key.constData(), key.size()));
+    if (slot >= 0) {
+        return codeSlots.at(slot).id;
+    }
+    bool numeric = false;
+    const int id = key.toInt(&numeric);
+    return (numeric && id > 0 && containsId(id)) ? id : -1;
+}
+
+int BarcodeIndex::resolveInDatabase(const QSqlDatabase &db, const QString &scanned) const
+{
+    const QString key = normalize(scanned);
+    if (key.isEmpty()) {
+        return -1;
+    }
+
+    const int found = findCodeInDatabase(db, key);
+    if (found >= 0) {
+        return found;
+    }
+
+    TimedQuery query(db);
+    bool numeric = false;
+    const int id = key.toInt(&numeric);
+    if (!numeric || id <= 0) {
+        return -1;
+    }
+    query.prepare(QString("SELECT 1 FROM %1 WHERE %2 = ?").arg(schema->name, schema->columns[0].name));
+    query.addBindValue(id);
+    return (query.exec() && query.next()) ? id : -1;
+}
+
+int BarcodeIndex::resolveOrFetch(const QSqlDatabase &db, const QString &scanned)
+{
+    int id = resolve(scanned);
+    if (id < 0) {
+        id = resolveInDatabase(db, scanned);
+        if (id >= 0) {
+            refresh(db, id);
+        }
+    }
+    return id;
+}
+
+int BarcodeIndex::findCodeOrFetch(const QSqlDatabase &db, const QString &code)
+{
+    int id = findCode(code);
+    if (id < 0) {
+        id = findCodeInDatabase(db, code);
+        if (id >= 0) {
+            refresh(db, id);
+        }
+    }
+    return id;
+}
+
+int BarcodeIndex::findCodeInDatabase(const QSqlDatabase &db, const QString &code) const
+{
+    const QString key = normalize(code);
+    if (key.isEmpty()) {
+        return -1;
+    }
+
+    // 库中的条码可能带连字符或小写字母，与 normalize 做同样的处理后比较
+    TimedQuery query(db);
+    query.prepare(QString("SELECT %1 FROM %2 WHERE UPPER(REPLACE(REPLACE(%3, '-', ''), ' ', '')) = ? LIMIT 1")
+                      .arg(schema->columns[0].name, schema->name, schema->columns[codeColumn].name));
+    query.addBindValue(key);
+    return (query.exec() && query.next()) ? query.value(0).toInt() : -1;
+}
+
+int BarcodeIndex::findCode(const QString &code) const
+{
+    const QString key = normalize(code);
+    if (key.isEmpty()) {
+        return -1;
+    }
+    const int slot = findCode(key.constData(), key.size(), hashCode(key.constData(), key.size()));
+    return slot >= 0 ? codeSlots.at(slot).id : -1;
+}
+
+int BarcodeIndex::findCode(const QChar *text, int length, quint32 hash) const
+{
+    const int mask = codeSlots.size() - 1;
+    for (int slot = static_cast<int>(home(hash));; slot = (slot + 1) & mask) {
+        const CodeSlot &entry = codeSlots.at(slot);
+        if (entry.id < 0) {
+            return -1;
+        }
+        if (entry.hash == hash && entry.code.length == static_cast<quint32>(length)
+            && std::equal(text, text + length, codes.data(entry.code))) {
+            return slot;
+        }
+    }
+}
+
+int BarcodeIndex::findId(int id) const
+{
+    const int mask = idSlots.size() - 1;
+    for (int slot = static_cast<int>(home(hashId(id)));; slot = (slot + 1) & mask) {
+        const qint32 current = idSlots.at(slot).id;
+        if (current < 0) {
+            return -1;
+        }
+        if (current == id) {
+            return slot;
+        }
+    }
+}
+
+// 删除后把同一探测链上的后继元素前移填补空位，表中不留墓碑
+void BarcodeIndex::eraseCode(int hole)
+{
+    if (hole < 0) {
+        return;
+    }
+    const int mask = codeSlots.size() - 1;
+    for (int slot = (hole + 1) & mask; codeSlots.at(slot).id >= 0; slot = (slot + 1) & mask) {
+        if (!staysInPlace(home(codeSlots.at(slot).hash), hole, slot)) {
+            codeSlots[hole] = codeSlots.at(slot);
+            hole = slot;
+        }
+    }
+    codeSlots[hole] = CodeSlot();
+}
+
+void BarcodeIndex::eraseId(int hole)
+{
+    const int mask = idSlots.size() - 1;
+    for (int slot = (hole + 1) & mask; idSlots.at(slot).id >= 0; slot = (slot + 1) & mask) {
+        if (!staysInPlace(home(hashId(idSlots.at(slot).id)), hole, slot)) {
+            idSlots[hole] = idSlots.at(slot);
+            hole = slot;
+        }
+    }
+    idSlots[hole] = IdSlot();
+}
+
+// 换成 capacity 大小的新表并压缩条码存储区
+void BarcodeIndex::rehash(int capacity)
+{
+    const QVector<IdSlot> old = idSlots;
+    const TextArena oldCodes = codes;
+
+    codeSlots = QVector<CodeSlot>(capacity);
+    idSlots = QVector<IdSlot>(capacity);
+    codes = TextArena();
+    garbage = 0;
+    count = 0;
+    shift = 32 - bitsOf(capacity);
+
+    for (const IdSlot &entry : old) {
+        if (entry.id >= 0) {
+            insert(entry.id, oldCodes.text(entry.code));
+        }
+    }
+}
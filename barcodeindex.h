@@ -0,0 +1,104 @@
+﻿// barcodeindex.h
+#ifndef BARCODEINDEX_H
+#define BARCODEINDEX_H
+
+#include <QSqlDatabase>
+#include <QString>
+#include <QVector>
+#include "columnstore.h"
+#include "schema.h"
+
+// 条码到记录 ID 的内存索引，供扫码借还使用。
+// 两张线性探测的开放定址表：条码 → ID 与 ID → 条码，负载不超过一半，
+// 删除时把后继元素前移而不留墓碑，查找始终是连续的几次内存访问。
+// 条码统一去掉空格与连字符并转为大写，ISBN 带不带连字符都能命中。
+class BarcodeIndex
+{
+public:
+    BarcodeIndex();
+    BarcodeIndex(const Schema::Table &table, int codeColumn);
+
+    // 图书按 ISBN，读者按借书证号，单册按单册条码
+    static BarcodeIndex books();
+    static BarcodeIndex readers();
+    static BarcodeIndex copies();
+
+    static QString normalize(const QString &code);
+
+    // 整表加载，替换现有内容
+    bool load(const QSqlDatabase &db, QString *error = nullptr);
+
+    // 某一行在数据库中增删改之后，按 ID 重新读取它的条码
+    bool refresh(const QSqlDatabase &db, int id, QString *error = nullptr);
+
+    void insert(int id, const QString &code);
+    void remove(int id);
+
+    // 扫描或输入的内容先按条码查找，找不到且是数字时按 ID 查找；都没有时返回 -1
+    int resolve(const QString &scanned) const;
+
+    // 索引尚未加载时的退路：同样的规则直接查询数据库
+    int resolveInDatabase(const QSqlDatabase &db, const QString &scanned) const;
+
+    // 先查索引，没有时再查数据库，查到的记录补进索引。
+    // 索引加载之后其他服务台或进程新增、改码的记录由此也能扫到
+    int resolveOrFetch(const QSqlDatabase &db, const QString &scanned);
+
+    // 只按条码查找，不把数字当作 ID
+    int findCode(const QString &code) const;
+    int findCodeInDatabase(const QSqlDatabase &db, const QString &code) const;
+    int findCodeOrFetch(const QSqlDatabase &db, const QString &code);
+    bool containsId(int id) const { return findId(id) >= 0; }
+    int size() const { return count; }
+    bool isValid() const { return schema != nullptr; }
+
+private:
+    struct CodeSlot
+    {
+        quint32 hash = 0;
+        qint32 id = -1;  // -1 表示空位
+        TextArena::Ref code;
+    };
+
+    struct IdSlot
+    {
+        qint32 id = -1;
+        TextArena::Ref code;
+    };
+
+    static quint32 hashCode(const QChar *text, int length);
+    quint32 home(quint32 hash) const { return (hash * 0x9E3779B9u) >> shift; }
+
+    int findCode(const QChar *text, int length, quint32 hash) const;
+    int findId(int id) const;
+    void eraseCode(int slot);
+    void eraseId(int slot);
+    void rehash(int capacity);
+
+    const Schema::Table *schema;
+    int codeColumn;
+
+    QVector<CodeSlot> codeSlots;
+    QVector<IdSlot> idSlots;
+    TextArena codes;
+    qint64 garbage;
+    int count;
+    int shift;  // 32 减去容量的位数
+};
+
+// 借还书台使用的三份索引，启动时在后台一起加载；加载成功前 ready 为 false
+struct CirculationIndex
+{
+    BarcodeIndex books = BarcodeIndex::books();
+    BarcodeIndex readers = BarcodeIndex::readers();
+    BarcodeIndex copies = BarcodeIndex::copies();
+    bool ready = false;
+
+    bool load(const QSqlDatabase &db, QString *error = nullptr)
+    {
+        ready = books.load(db, error) && readers.load(db, error) && copies.load(db, error);
+        return ready;
+    }
+};
+
+#endif // BARCODEINDEX_H
@@ -0,0 +1,23 @@
+# 借还书、搜索、统计与报表的性能基准（QtTest QBENCHMARK）。
+#
+#   qmake && make && ./tst_librarybench -csv
+#
+# 环境变量：
+#   LIBRARY_BENCH_SCALES  借阅记录规模，逗号分隔，如 10k,1M,10M（默认 10k）
+#   LIBRARY_BENCH_OPS     借书/还书各计时的操作次数（默认 200）
+#   LIBRARY_BENCH_DIR     测试数据库所在目录，由 DatasetGenerator 生成后重复使用（默认系统临时目录）
+#   LIBRARY_BENCH_JSON    结果汇总文件（默认 librarybench_results.json）
+#   LIBRARY_TEXTSCAN      文本查找的实现 scalar/sse2/avx2；未设置时 textScanKernels 逐个起子进程核对
+
+QT += testlib
+QT -= gui
+
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_librarybench
+
+include(../core.pri)
+
+SOURCES += \
+    tst_librarybench.cpp
@@ -0,0 +1,844 @@
+﻿// tst_librarybench.cpp
+#include "librarycore.h"
+#include "barcodeindex.h"
+#include "columnstore.h"
+#include "textscan.h"
+#include "datasetgenerator.h"
+#include "historyarchiver.h"
+#include "coborrowindex.h"
+#include <QtTest>
+#include <QtSql>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <algorithm>
+#include <numeric>
+
+// 在不同规模的测试库上以无界面方式驱动 LibraryCore，
+// 每个操作输出 QtTest 基准结果（-csv / -xml 可直接比对），
+// 另外把延迟分位数与吞吐量汇总写入 JSON 文件，便于在版本之间做差异比较。
+class LibraryBench : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void borrowBook_data();
+    void borrowBook();
+    void returnBook_data();
+    void returnBook();
+    void borrowBookGrouped_data();
+    void borrowBookGrouped();
+    void searchBooks_data();
+    void searchBooks();
+    void searchCatalog_data();
+    void searchCatalog();
+    void scanTitles_data();
+    void scanTitles();
+    void scanEquivalence_data();
+    void scanEquivalence();
+    void textScanKernels();
+    void resolveScan_data();
+    void resolveScan();
+    void refreshStatistics_data();
+    void refreshStatistics();
+    void generateReport_data();
+    void generateReport();
+    void recommend_data();
+    void recommend();
+
+private:
+    void addScaleRows();
+    LibraryCore *coreForScale(qint64 loans, QString *error);
+    const ColumnStore &catalogForScale(qint64 loans, LibraryCore *core);
+    QVector<int> sqlBookIds(LibraryCore *core, const LibraryCore::BookSearch &search);
+    bool seedDatabase(const QString &path, qint64 loans, QString *error);
+    QList<int> borrowBatch(LibraryCore *core, int count, QVector<qint64> *samples);
+    void returnOutstanding(LibraryCore *core);
+    void record(const QString &operation, qint64 loans, const QVector<qint64> &samples);
+
+    QList<qint64> scales;
+    int operations = 200;
+    QString dataDir;
+    QString resultPath;
+    QMap<qint64, LibraryCore *> cores;
+    QMap<qint64, QList<int> > pendingReturns;
+    QMap<qint64, ColumnStore> catalogs;
+    QJsonArray results;
+};
+
+namespace {
+
+QString environment(const char *name, const QString &defaultValue)
+{
+    return qEnvironmentVariableIsSet(name) ? QString::fromLocal8Bit(qgetenv(name)) : defaultValue;
+}
+
+// 支持 10k、1M 这样的写法
+qint64 parseScale(QString text)
+{
+    text = text.trimmed().toLower();
+    qint64 factor = 1;
+    if (text.endsWith('k')) {
+        factor = 1000;
+        text.chop(1);
+    } else if (text.endsWith('m')) {
+        factor = 1000000;
+        text.chop(1);
+    }
+    return text.toLongLong() * factor;
+}
+
+QString scaleLabel(qint64 loans)
+{
+    if (loans % 1000000 == 0) return QString("%1M").arg(loans / 1000000);
+    if (loans % 1000 == 0) return QString("%1k").arg(loans / 1000);
+    return QString::number(loans);
+}
+
+// 与 LIKE '%...%' 相同的逐字比较：只有 ASCII 字母不区分大小写
+bool referenceContains(const QString &text, const QString &needle)
+{
+    auto fold = [](QChar c) { return (c.unicode() >= 'A' && c.unicode() <= 'Z') ? ushort(c.unicode() | 0x20) : c.unicode(); };
+    for (int i = 0; i + needle.size() <= text.size(); ++i) {
+        int matched = 0;
+        while (matched < needle.size() && fold(text.at(i + matched)) == fold(needle.at(matched))) {
+            ++matched;
+        }
+        if (matched == needle.size()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+QVector<int> storeIds(const ColumnStore &store, const QVector<int> &rows)
+{
+    QVector<int> ids;
+    ids.reserve(rows.size());
+    for (int row : rows) {
+        ids.append(store.id(row));
+    }
+    return ids;
+}
+
+} // namespace
+
+void LibraryBench::initTestCase()
+{
+    QString scaleList = environment("LIBRARY_BENCH_SCALES", "10k");
+    for (const QString &item : scaleList.split(',', QString::SkipEmptyParts)) {
+        qint64 loans = parseScale(item);
+        if (loans > 0) {
+            scales.append(loans);
+        }
+    }
+    QVERIFY2(!scales.isEmpty(), "LIBRARY_BENCH_SCALES 中没有有效的规模");
+
+    if (qEnvironmentVariableIsSet("LIBRARY_BENCH_OPS")) {
+        operations = qMax(1, qEnvironmentVariableIntValue("LIBRARY_BENCH_OPS"));
+    }
+
+    dataDir = environment("LIBRARY_BENCH_DIR", QDir::temp().filePath("library_bench"));
+    QVERIFY(QDir().mkpath(dataDir));
+    resultPath = environment("LIBRARY_BENCH_JSON", "librarybench_results.json");
+}
+
+void LibraryBench::cleanupTestCase()
+{
+    QStringList connections;
+    for (LibraryCore *core : cores) {
+        connections.append(core->database().connectionName());
+        core->close();
+        delete core;
+    }
+    cores.clear();
+    for (const QString &name : connections) {
+        QSqlDatabase::removeDatabase(name);
+    }
+
+    QJsonObject root;
+    root["generated"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    root["qt"] = QString(qVersion());
+    root["operationsPerRun"] = operations;
+    root["results"] = results;
+
+    QFile file(resultPath);
+    if (file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        file.write(QJsonDocument(root).toJson());
+        qInfo("基准结果已写入 %s", qPrintable(QFileInfo(file).absoluteFilePath()));
+    } else {
+        qWarning("无法写入基准结果 %s", qPrintable(resultPath));
+    }
+}
+
+void LibraryBench::addScaleRows()
+{
+    QTest::addColumn<qint64>("loans");
+    for (qint64 loans : scales) {
+        QTest::newRow(qPrintable(scaleLabel(loans))) << loans;
+    }
+}
+
+LibraryCore *LibraryBench::coreForScale(qint64 loans, QString *error)
+{
+    if (cores.contains(loans)) {
+        return cores.value(loans);
+    }
+
+    // 测试库按规模缓存，生成一次后重复使用
+    const QString path = QDir(dataDir).filePath(QString("bench_%1.db").arg(loans));
+    bool seeded = false;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "bench_probe");
+        db.setDatabaseName(path);
+        if (QFile::exists(path) && db.open()) {
+            QSqlQuery query(db);
+            seeded = query.exec("SELECT loans FROM bench_meta") && query.next()
+                     && query.value(0).toLongLong() == loans;
+        }
+        db.close();
+    }
+    QSqlDatabase::removeDatabase("bench_probe");
+
+    if (!seeded) {
+        qInfo("正在生成 %s 规模的测试库 %s ...", qPrintable(scaleLabel(loans)), qPrintable(path));
+        if (!seedDatabase(path, loans, error)) {
+            return nullptr;
+        }
+    }
+
+    LibraryCore *core = new LibraryCore(QString("bench_%1").arg(loans));
+    if (!core->open(path, error)) {
+        delete core;
+        return nullptr;
+    }
+    cores.insert(loans, core);
+    return core;
+}
+
+const ColumnStore &LibraryBench::catalogForScale(qint64 loans, LibraryCore *core)
+{
+    // 目录按规模加载一次，几个过滤基准共用
+    if (!catalogs.contains(loans)) {
+        ColumnStore store = ColumnStore::books();
+        QElapsedTimer timer;
+        timer.start();
+        QString error;
+        if (!store.load(core->database(), &error)) {
+            qWarning("加载图书目录失败：%s", qPrintable(error));
+        }
+        qInfo("图书目录 %d 本，加载 %lld ms，约 %.1f MB，文本匹配使用 %s", store.rowCount(), timer.elapsed(),
+              store.memoryBytes() / (1024.0 * 1024.0), TextScan::implementation());
+        catalogs.insert(loans, store);
+    }
+    return catalogs[loans];
+}
+
+// 图书管理页按数据库查询时的结果，用来核对内存目录的过滤
+QVector<int> LibraryBench::sqlBookIds(LibraryCore *core, const LibraryCore::BookSearch &search)
+{
+    QVector<int> ids;
+    const QString filter = LibraryCore::bookFilter(search);
+    QSqlQuery query(core->database());
+    query.setForwardOnly(true);
+    if (query.exec(QString("SELECT id FROM books%1 ORDER BY id").arg(filter.isEmpty() ? QString() : " WHERE " + filter))) {
+        while (query.next()) {
+            ids.append(query.value(0).toInt());
+        }
+    }
+    return ids;
+}
+
+bool LibraryBench::seedDatabase(const QString &path, qint64 loans, QString *error)
+{
+    for (const QString &suffix : QStringList{"", "-wal", "-shm"}) {
+        QFile::remove(path + suffix);
+        QFile::remove(HistoryArchiver::archivePath(path) + suffix);
+    }
+
+    // 固定种子，同一规模在任何机器上生成相同的数据
+    DatasetGenerator::Options options;
+    options.books = qMax<qint64>(100, loans / 10);
+    options.readers = qMax<qint64>(50, loans / 20);
+    options.loans = loans;
+    options.seed = 20240101;
+
+    DatasetGenerator::Result result;
+    if (!DatasetGenerator::generate(path, options, &result, error)) {
+        return false;
+    }
+    qInfo("测试库生成完成，用时 %.1f 秒", result.elapsedMs / 1000.0);
+
+    const QString connectionName = "bench_seed";
+    bool ok = false;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        db.setDatabaseName(path);
+        if (db.open()) {
+            db.transaction();
+            QSqlQuery query(db);
+
+            // 基准测试专用读者：借书上限足够大，借还书计时不受数量限制影响
+            query.prepare("INSERT INTO readers (card_number, name, reader_type, max_borrow, max_days) "
+                          "VALUES (?, ?, 'VIP', 1000000, 30)");
+            for (int i = 0; i < 100; ++i) {
+                query.addBindValue(QString("BENCH%1").arg(i, 4, 10, QChar('0')));
+                query.addBindValue(QString("基准读者%1").arg(i));
+                query.exec();
+            }
+
+            query.exec("CREATE TABLE IF NOT EXISTS bench_meta (loans INTEGER)");
+            query.prepare("INSERT INTO bench_meta (loans) VALUES (?)");
+            query.addBindValue(loans);
+            ok = query.exec() && db.commit();
+            if (!ok && error) *error = query.lastError().text();
+        } else if (error) {
+            *error = db.lastError().text();
+        }
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+    return ok;
+}
+
+QList<int> LibraryBench::borrowBatch(LibraryCore *core, int count, QVector<qint64> *samples)
+{
+    QSqlQuery query(core->database());
+    QList<int> readerIds;
+    query.exec("SELECT id FROM readers WHERE card_number LIKE 'BENCH%' ORDER BY id");
+    while (query.next()) {
+        readerIds.append(query.value(0).toInt());
+    }
+    QList<int> bookIds;
+    query.prepare("SELECT id FROM books WHERE available_copies > 0 ORDER BY id LIMIT ?");
+    query.addBindValue(count);
+    query.exec();
+    while (query.next()) {
+        bookIds.append(query.value(0).toInt());
+    }
+    if (readerIds.isEmpty() || bookIds.isEmpty()) {
+        return QList<int>();
+    }
+
+    // 每本书只借一次，不会触发“重复借阅”
+    QList<int> recordIds;
+    QElapsedTimer timer;
+    for (int i = 0; i < qMin(count, bookIds.size()); ++i) {
+        timer.start();
+        LibraryCore::BorrowResult result = core->borrowBook(bookIds.at(i), readerIds.at(i % readerIds.size()), 30);
+        if (samples) samples->append(timer.nsecsElapsed());
+        recordIds.append(result.recordId);
+    }
+    return recordIds;
+}
+
+void LibraryBench::returnOutstanding(LibraryCore *core)
+{
+    // 上一次运行中断时基准读者可能还有未还的书
+    QSqlQuery query(core->database());
+    query.exec("SELECT br.id FROM borrow_records br JOIN readers r ON br.reader_id = r.id "
+               "WHERE r.card_number LIKE 'BENCH%' AND br.status = '借出'");
+    QList<int> recordIds;
+    while (query.next()) {
+        recordIds.append(query.value(0).toInt());
+    }
+    for (int recordId : recordIds) {
+        core->returnBook(recordId);
+    }
+}
+
+void LibraryBench::record(const QString &operation, qint64 loans, const QVector<qint64> &samples)
+{
+    if (samples.isEmpty()) {
+        return;
+    }
+
+    QVector<qint64> sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+    qint64 total = 0;
+    for (qint64 sample : sorted) {
+        total += sample;
+    }
+    auto percentile = [&sorted](double p) {
+        int index = qBound(0, static_cast<int>(p * (sorted.size() - 1) + 0.5), sorted.size() - 1);
+        return sorted.at(index) / 1000.0;
+    };
+
+    QJsonObject entry;
+    entry["operation"] = operation;
+    entry["loans"] = static_cast<double>(loans);
+    entry["iterations"] = sorted.size();
+    entry["mean_us"] = total / 1000.0 / sorted.size();
+    entry["p50_us"] = percentile(0.50);
+    entry["p99_us"] = percentile(0.99);
+    entry["max_us"] = sorted.last() / 1000.0;
+    entry["ops_per_sec"] = total > 0 ? sorted.size() * 1e9 / total : 0.0;
+    results.append(entry);
+}
+
+void LibraryBench::borrowBook_data()
+{
+    addScaleRows();
+}
+
+void LibraryBench::borrowBook()
+{
+    QFETCH(qint64, loans);
+    QString error;
+    LibraryCore *core = coreForScale(loans, &error);
+    QVERIFY2(core, qPrintable(error));
+
+    QVector<qint64> samples;
+    try {
+        returnOutstanding(core);
+        pendingReturns[loans] = borrowBatch(core, operations, &samples);
+    } catch (const QString &message) {
+        QFAIL(qPrintable(message));
+    }
+    QVERIFY2(!samples.isEmpty(), "没有可借的图书");
+
+    // 借书会改变数据，不能由 QBENCHMARK 反复执行，直接报告单次操作的平均耗时
+    record("borrowBook", loans, samples);
+    qint64 total = std::accumulate(samples.begin(), samples.end(), qint64(0));
+    QTest::setBenchmarkResult(total / 1e6 / samples.size(), QTest::WalltimeMilliseconds);
+}
+
+void LibraryBench::returnBook_data()
+{
+    addScaleRows();
+}
+
+void LibraryBench::returnBook()
+{
+    QFETCH(qint64, loans);
+    QString error;
+    LibraryCore *core = coreForScale(loans, &error);
+    QVERIFY2(core, qPrintable(error));
+
+    QVector<qint64> samples;
+    QElapsedTimer timer;
+    try {
+        // 单独运行时先借出一批（不计时）
+        QList<int> recordIds = pendingReturns.take(loans);
+        if (recordIds.isEmpty()) {
+            returnOutstanding(core);
+            recordIds = borrowBatch(core, operations, nullptr);
+        }
+        for (int recordId : recordIds) {
+            timer.start();
+            core->returnBook(recordId);
+            samples.append(timer.nsecsElapsed());
+        }
+    } catch (const QString &message) {
+        QFAIL(qPrintable(message));
+    }
+    QVERIFY2(!samples.isEmpty(), "没有可还的借阅记录");
+
+    record("returnBook", loans, samples);
+    const auto books = core->bookCacheStats();
+    const auto readers = core->readerCacheStats();
+    qInfo("记录缓存命中：图书 %llu/%llu，读者 %llu/%llu", books.hits, books.hits + books.misses,
+          readers.hits, readers.hits + readers.misses);
+    qint64 total = std::accumulate(samples.begin(), samples.end(), qint64(0));
+    QTest::setBenchmarkResult(total / 1e6 / samples.size(), QTest::WalltimeMilliseconds);
+}
+
+void LibraryBench::borrowBookGrouped_data()
+{
+    addScaleRows();
+}
+
+void LibraryBench::borrowBookGrouped()
+{
+    QFETCH(qint64, loans);
+    QString error;
+    LibraryCore *core = coreForScale(loans, &error);
+    QVERIFY2(core, qPrintable(error));
+
+    // 与借还书服务的写线程相同：每 64 个借书操作提交一次。
+    // 单次操作的耗时取所在组的总耗时（含提交）按操作数平均
+    const int groupOps = 64;
+    QVector<qint64> samples;
+    QElapsedTimer timer;
+    try {
+        returnOutstanding(core);
+
+        QSqlQuery query(core->database());
+        QList<int> readerIds;
+        query.exec("SELECT id FROM readers WHERE card_number LIKE 'BENCH%' ORDER BY id");
+        while (query.next()) {
+            readerIds.append(query.value(0).toInt());
+        }
+        QList<int> bookIds;
+        query.prepare("SELECT id FROM books WHERE available_copies > 0 ORDER BY id LIMIT ?");
+        query.addBindValue(operations);
+        query.exec();
+        while (query.next()) {
+            bookIds.append(query.value(0).toInt());
+        }
+        QVERIFY2(!readerIds.isEmpty() && !bookIds.isEmpty(), "没有可借的图书");
+
+        for (int start = 0; start < bookIds.size(); start += groupOps) {
+            const int count = qMin(groupOps, bookIds.size() - start);
+            timer.start();
+            QVERIFY2(core->beginGroup(&error), qPrintable(error));
+            for (int i = start; i < start + count; ++i) {
+                core->borrowBook(bookIds.at(i), readerIds.at(i % readerIds.size()), 30);
+            }
+            QVERIFY2(core->commitGroup(&error), qPrintable(error));
+            const qint64 perOp = timer.nsecsElapsed() / count;
+            for (int i = 0; i < count; ++i) {
+                samples.append(perOp);
+            }
+        }
+        returnOutstanding(core);
+    } catch (const QString &message) {
+        core->rollbackGroup();
+        QFAIL(qPrintable(message));
+    }
+
+    record("borrowBook-grouped", loans, samples);
+    qint64 total = std::accumulate(samples.begin(), samples.end(), qint64(0));
+    QTest::setBenchmarkResult(total / 1e6 / samples.size(), QTest::WalltimeMilliseconds);
+}
+
+void LibraryBench::searchBooks_data()
+{
+    addScaleRows();
+}
+
+void LibraryBench::searchBooks()
+{
+    QFETCH(qint64, loans);
+    QString error;
+    LibraryCore *core = coreForScale(loans, &error);
+    QVERIFY2(core, qPrintable(error));
+
+    // 与图书管理页相同：按书名与分类过滤后重新查询表格模型
+    LibraryCore::BookSearch search;
+    search.title = "12";
+    search.category = "文学";
+    const QString filter = LibraryCore::bookFilter(search);
+
+    QSqlTableModel model(nullptr, core->database());
+    model.setTable("books");
+    model.setEditStrategy(QSqlTableModel::OnManualSubmit);
+
+    QVector<qint64> samples;
+    QElapsedTimer timer;
+    QBENCHMARK {
+        timer.start();
+        model.setFilter(filter);
+        model.select();
+        samples.append(timer.nsecsElapsed());
+    }
+    QVERIFY(model.lastError().type() == QSqlError::NoError);
+
+    record("searchBooks", loans, samples);
+}
+
+void LibraryBench::searchCatalog_data()
+{
+    addScaleRows();
+}
+
+void LibraryBench::searchCatalog()
+{
+    QFETCH(qint64, loans);
+    QString error;
+    LibraryCore *core = coreForScale(loans, &error);
+    QVERIFY2(core, qPrintable(error));
+
+    // 与 searchBooks 条件相同，改为过滤内存中的列式目录
+    const ColumnStore &store = catalogForScale(loans, core);
+
+    LibraryCore::BookSearch search;
+    search.title = "12";
+    search.category = "文学";
+    const QVector<ColumnStore::Condition> conditions = ColumnStore::bookConditions(search);
+
+    QVector<qint64> samples;
+    QElapsedTimer timer;
+    QVector<int> rows;
+    QBENCHMARK {
+        timer.start();
+        rows = store.filter(conditions);
+        samples.append(timer.nsecsElapsed());
+    }
+    QCOMPARE(storeIds(store, rows), sqlBookIds(core, search));
+
+    record("searchCatalog", loans, samples);
+}
+
+void LibraryBench::scanTitles_data()
+{
+    addScaleRows();
+}
+
+void LibraryBench::scanTitles()
+{
+    QFETCH(qint64, loans);
+    QString error;
+    LibraryCore *core = coreForScale(loans, &error);
+    QVERIFY2(core, qPrintable(error));
+
+    // 只按书名子串过滤，整列文本由 SIMD 查找扫描（LIBRARY_TEXTSCAN 可切换实现对比）
+    const ColumnStore &store = catalogForScale(loans, core);
+    LibraryCore::BookSearch search;
+    search.title = "12";
+    const QVector<ColumnStore::Condition> conditions = ColumnStore::bookConditions(search);
+
+    QVector<qint64> samples;
+    QElapsedTimer timer;
+    QVector<int> rows;
+    QBENCHMARK {
+        timer.start();
+        rows = store.filter(conditions);
+        samples.append(timer.nsecsElapsed());
+    }
+    QCOMPARE(storeIds(store, rows), sqlBookIds(core, search));
+
+    record(QString("scanTitles-%1").arg(TextScan::implementation()), loans, samples);
+}
+
+void LibraryBench::scanEquivalence_data()
+{
+    addScaleRows();
+}
+
+void LibraryBench::scanEquivalence()
+{
+    QFETCH(qint64, loans);
+    QString error;
+    LibraryCore *core = coreForScale(loans, &error);
+    QVERIFY2(core, qPrintable(error));
+    QSqlDatabase db = core->database();
+
+    // 生成的目录只有中文书名，另加几本带大小写英文的书，在事务中核对后回滚，不影响其他基准
+    QVERIFY(db.transaction());
+    QSqlQuery insert(db);
+    insert.prepare("INSERT INTO books (isbn, title, author, category) VALUES (?, ?, '测试作者', '编程')");
+    const QStringList asciiTitles = {"C++ Primer", "Qt5开发实战", "QT5 GUI 编程", "qt 快速入门",
+                                     "Effective C++ 中文版", "MySQL必知必会", "mysql 技术内幕",
+                                     "C_Programming 入门", "CXProgramming", "100%通过考试", "1000 题精选", "a!b 转义"};
+    bool inserted = true;
+    for (int i = 0; i < asciiTitles.size() && inserted; ++i) {
+        insert.addBindValue(QString("TEXTSCAN%1").arg(i));
+        insert.addBindValue(asciiTitles.at(i));
+        inserted = insert.exec();
+    }
+    const QString insertError = insert.lastError().text();
+
+    ColumnStore store = ColumnStore::books();
+    const bool loaded = store.load(db, &error);
+    QSqlQuery sample(db);
+    sample.exec("SELECT title, category FROM books WHERE isbn NOT LIKE 'TEXTSCAN%' ORDER BY id LIMIT 1");
+    const bool sampled = sample.next();
+    const QString longTitle = sampled ? sample.value(0).toString() : QString();
+    const QString category = sampled ? sample.value(1).toString() : QString();
+    sample.finish();
+
+    // ASCII 大小写折叠、中文、跨越向量块的长查找串、查不到的串，以及附加分类条件；
+    // % 与 _ 按原字符匹配，不能当作 LIKE 通配符（否则 "c_p" 会命中 CXProgramming）
+    const QStringList needles = {"qt", "QT5", "c++", "PRIMER", "MySql", "sql必知", "GUI 编",
+                                 "数据结构", "第3版", "精通线性代数", "（第", "不存在的书名",
+                                 "_", "%", "c_p", "0%", "100%通", "a!b", "!",
+                                 longTitle, longTitle.right(qMax(1, longTitle.size() / 2))};
+    QStringList mismatches;
+    for (const QString &needle : needles) {
+        for (const QString &withCategory : {QString(), category}) {
+            LibraryCore::BookSearch search;
+            search.title = needle;
+            search.category = withCategory;
+            const QVector<int> rows = store.filter(ColumnStore::bookConditions(search));
+
+            QVector<int> reference;
+            for (int row = 0; row < store.rowCount(); ++row) {
+                if (referenceContains(store.value(row, Schema::Books::Title).toString(), needle)
+                    && (withCategory.isEmpty() || store.value(row, Schema::Books::Category).toString() == withCategory)) {
+                    reference.append(row);
+                }
+            }
+            if (rows != reference || storeIds(store, rows) != sqlBookIds(core, search)) {
+                mismatches.append(withCategory.isEmpty() ? needle : needle + " / " + withCategory);
+            }
+        }
+    }
+    db.rollback();
+
+    QVERIFY2(inserted, qPrintable(insertError));
+    QVERIFY2(loaded, qPrintable(error));
+    QVERIFY(sampled);
+    QVERIFY2(mismatches.isEmpty(), qPrintable(QString("%1 实现与 LIKE 结果不一致：%2")
+                                                  .arg(TextScan::implementation(), mismatches.join("，"))));
+}
+
+void LibraryBench::textScanKernels()
+{
+    // 实现在进程启动时选定，每种实现各起一个子进程重跑 scanEquivalence
+    if (qEnvironmentVariableIsSet("LIBRARY_TEXTSCAN")) {
+        QSKIP("已由 LIBRARY_TEXTSCAN 指定实现，只核对这一种");
+    }
+    for (const char *kernel : {"scalar", "sse2", "avx2"}) {
+        QProcessEnvironment childEnvironment = QProcessEnvironment::systemEnvironment();
+        childEnvironment.insert("LIBRARY_TEXTSCAN", kernel);
+        childEnvironment.insert("LIBRARY_BENCH_DIR", dataDir);
+        childEnvironment.insert("LIBRARY_BENCH_JSON", QDir(dataDir).filePath(QString("textscan_%1.json").arg(kernel)));
+
+        QProcess child;
+        child.setProcessEnvironment(childEnvironment);
+        child.setProcessChannelMode(QProcess::ForwardedChannels);
+        child.start(QCoreApplication::applicationFilePath(), {"scanEquivalence"});
+        QVERIFY2(child.waitForFinished(-1), kernel);
+        QVERIFY2(child.exitStatus() == QProcess::NormalExit && child.exitCode() == 0, kernel);
+    }
+}
+
+void LibraryBench::resolveScan_data()
+{
+    addScaleRows();
+}
+
+void LibraryBench::resolveScan()
+{
+    QFETCH(qint64, loans);
+    QString error;
+    LibraryCore *core = coreForScale(loans, &error);
+    QVERIFY2(core, qPrintable(error));
+
+    CirculationIndex index;
+    QVERIFY2(index.load(core->database(), &error), qPrintable(error));
+
+    // 随机取一批 ISBN 与借书证号，模拟借书台交替扫描图书和读者
+    QStringList codes;
+    QSqlQuery query(core->database());
+    QVERIFY(query.exec(QString("SELECT isbn FROM books ORDER BY RANDOM() LIMIT %1").arg(operations / 2)));
+    while (query.next()) {
+        codes.append(query.value(0).toString());
+    }
+    QVERIFY(query.exec(QString("SELECT card_number FROM readers ORDER BY RANDOM() LIMIT %1").arg(operations / 2)));
+    while (query.next()) {
+        codes.append(query.value(0).toString());
+    }
+    const int bookCodes = qMin(operations / 2, codes.size());
+
+    // 内存索引与按数据库查询分别计时，每次解析一个条码记一个样本
+    QVector<qint64> indexSamples;
+    QVector<qint64> sqlSamples;
+    QElapsedTimer timer;
+    QBENCHMARK {
+        for (int i = 0; i < codes.size(); ++i) {
+            const BarcodeIndex &target = i < bookCodes ? index.books : index.readers;
+            timer.start();
+            int id = target.resolve(codes.at(i));
+            indexSamples.append(timer.nsecsElapsed());
+            QVERIFY(id > 0);
+
+            timer.start();
+            int sqlId = target.resolveInDatabase(core->database(), codes.at(i));
+            sqlSamples.append(timer.nsecsElapsed());
+            QCOMPARE(sqlId, id);
+        }
+    }
+
+    record("resolveScan", loans, indexSamples);
+    record("resolveScan-sql", loans, sqlSamples);
+}
+
+void LibraryBench::refreshStatistics_data()
+{
+    addScaleRows();
+}
+
+void LibraryBench::refreshStatistics()
+{
+    QFETCH(qint64, loans);
+    QString error;
+    LibraryCore *core = coreForScale(loans, &error);
+    QVERIFY2(core, qPrintable(error));
+
+    QVector<qint64> samples;
+    QElapsedTimer timer;
+    LibraryCore::Statistics stats;
+    QBENCHMARK {
+        timer.start();
+        stats = core->statistics();
+        samples.append(timer.nsecsElapsed());
+    }
+    QVERIFY(stats.totalBooks > 0);
+
+    record("refreshStatistics", loans, samples);
+}
+
+void LibraryBench::generateReport_data()
+{
+    addScaleRows();
+}
+
+void LibraryBench::generateReport()
+{
+    QFETCH(qint64, loans);
+    QString error;
+    LibraryCore *core = coreForScale(loans, &error);
+    QVERIFY2(core, qPrintable(error));
+
+    QVector<qint64> samples;
+    QElapsedTimer timer;
+    QString report;
+    QBENCHMARK {
+        timer.start();
+        report = core->generateReport();
+        samples.append(timer.nsecsElapsed());
+    }
+    QVERIFY(!report.isEmpty());
+
+    record("generateReport", loans, samples);
+}
+
+void LibraryBench::recommend_data()
+{
+    addScaleRows();
+}
+
+void LibraryBench::recommend()
+{
+    QFETCH(qint64, loans);
+    QString error;
+    LibraryCore *core = coreForScale(loans, &error);
+    QVERIFY2(core, qPrintable(error));
+
+    // 全量重建只测一次，改变的只是关联表本身
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY2(CoBorrowIndex::rebuild(core->database(), &error), qPrintable(error));
+    record("rebuildCoBorrow", loans, QVector<qint64>{timer.nsecsElapsed()});
+
+    QVector<int> bookIds;
+    QSqlQuery query(core->database());
+    QVERIFY(query.exec(QString("SELECT id FROM books ORDER BY RANDOM() LIMIT %1").arg(operations)));
+    while (query.next()) {
+        bookIds.append(query.value(0).toInt());
+    }
+
+    // 每本书的推荐记一个样本
+    QVector<qint64> samples;
+    int found = 0;
+    QBENCHMARK {
+        for (int bookId : bookIds) {
+            timer.start();
+            found += CoBorrowIndex::recommend(core->database(), bookId).size();
+            samples.append(timer.nsecsElapsed());
+        }
+    }
+    QVERIFY(found > 0);
+
+    record("recommend", loans, samples);
+}
+
+QTEST_GUILESS_MAIN(LibraryBench)
+
+#include "tst_librarybench.moc"
@@ -0,0 +1,519 @@
+﻿// catalogsnapshot.cpp
+#include "catalogsnapshot.h"
+#include "barcodeindex.h"
+#include "perfmonitor.h"
+#include "textscan.h"
+#include <QtSql>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSaveFile>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+namespace {
+
+// 按本机字节序写入；大端机器读到的魔数不一致，按格式不符拒绝
+const quint32 kMagic = 0x53434D4C;  // "LMCS"
+const quint32 kVersion = 1;
+
+// 检索文本中字段之间与行之间的分隔符，查找串中不会出现
+const QChar kFieldSeparator(0x1F);
+const QChar kRowSeparator(0x1E);
+
+struct Ref
+{
+    quint32 offset;  // 字符串堆中的位置，以 UTF-16 编码单元计
+    quint32 length;
+};
+
+quint64 align8(quint64 offset)
+{
+    return (offset + 7) & ~quint64(7);
+}
+
+int bitmapWords(int rows)
+{
+    return (rows + 63) / 64;
+}
+
+} // namespace
+
+struct CatalogSnapshot::Header
+{
+    quint32 magic;
+    quint32 version;
+    quint32 rowCount;
+    quint32 categoryCount;
+    qint64 builtAt;
+    quint64 rowsOffset;
+    quint64 categoriesOffset;
+    quint64 heapOffset;
+    quint64 heapChars;
+    quint64 searchOffset;
+    quint64 searchChars;
+    quint64 searchStartsOffset;   // rowCount + 1 个 quint32，最后一个是检索文本的总长
+    quint64 isbnOrderOffset;      // rowCount 个 quint32 行号
+    quint64 availableOffset;      // 可借位图
+    quint64 categoryBitmapsOffset;  // 每个分类一个位图，依次排列
+    quint64 fileSize;
+};
+
+struct CatalogSnapshot::Row
+{
+    qint32 id;
+    qint32 totalCopies;
+    qint32 availableCopies;
+    qint32 category;  // 分类表中的下标，没有分类时为 -1
+    Ref title;
+    Ref author;
+    Ref isbn;
+    Ref isbnKey;  // 规范化的 ISBN，ISBN 索引按它排序
+    Ref publisher;
+    Ref location;
+    Ref status;
+};
+
+struct CatalogSnapshot::Category
+{
+    Ref name;
+};
+
+namespace {
+
+// 生成时的字符串堆；重复出现的短字段（分类、出版社、位置、状态）只存一份
+class HeapBuilder
+{
+public:
+    Ref append(const QString &text)
+    {
+        const Ref ref = {static_cast<quint32>(chars.size()), static_cast<quint32>(text.size())};
+        chars.append(text);
+        return ref;
+    }
+
+    Ref shared(const QString &text)
+    {
+        QHash<QString, Ref>::const_iterator it = known.constFind(text);
+        if (it != known.constEnd()) {
+            return it.value();
+        }
+        const Ref ref = append(text);
+        known.insert(text, ref);
+        return ref;
+    }
+
+    QString chars;
+
+private:
+    QHash<QString, Ref> known;
+};
+
+void writePadded(QSaveFile &file, const char *data, qint64 size, bool *ok)
+{
+    if (*ok && size > 0) {
+        *ok = file.write(data, size) == size;
+    }
+    static const char zeros[8] = {0};
+    const qint64 padding = static_cast<qint64>(align8(quint64(size))) - size;
+    if (*ok && padding > 0) {
+        *ok = file.write(zeros, padding) == padding;
+    }
+}
+
+} // namespace
+
+CatalogSnapshot::CatalogSnapshot()
+    : base(nullptr)
+    , header(nullptr)
+    , rows(nullptr)
+    , categoryTable(nullptr)
+    , heap(nullptr)
+    , searchText(nullptr)
+    , searchStarts(nullptr)
+    , isbnOrder(nullptr)
+{
+}
+
+CatalogSnapshot::~CatalogSnapshot()
+{
+    // 关闭文件时解除映射
+    file.close();
+}
+
+bool CatalogSnapshot::build(const QSqlDatabase &db, const QString &path, BuildResult *result, QString *error)
+{
+    Q_STATIC_ASSERT(sizeof(Header) % 8 == 0);
+    ScopedTimer timer("生成目录快照");
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    QVector<Row> rowTable;
+    QVector<QString> isbnKeys;
+    QStringList categoryNames;
+    QHash<QString, int> categoryIndex;
+    HeapBuilder heapBuilder;
+    QString search;
+    QVector<quint32> starts;
+
+    TimedQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT id, isbn, title, author, publisher, category, total_copies, "
+                    "available_copies, location, status FROM books ORDER BY id")) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+    while (query.next()) {
+        const QString isbn = query.value(1).toString();
+        const QString title = query.value(2).toString();
+        const QString author = query.value(3).toString();
+        const QString category = query.value(5).toString();
+
+        Row row;
+        row.id = query.value(0).toInt();
+        row.totalCopies = query.value(6).toInt();
+        row.availableCopies = query.value(7).toInt();
+        row.category = -1;
+        if (!category.isEmpty()) {
+            QHash<QString, int>::const_iterator it = categoryIndex.constFind(category);
+            if (it == categoryIndex.constEnd()) {
+                it = categoryIndex.insert(category, categoryNames.size());
+                categoryNames.append(category);
+            }
+            row.category = it.value();
+        }
+        row.title = heapBuilder.append(title);
+        row.author = heapBuilder.append(author);
+        row.isbn = heapBuilder.append(isbn);
+        const QString key = BarcodeIndex::normalize(isbn);
+        row.isbnKey = key == isbn ? row.isbn : heapBuilder.append(key);
+        row.publisher = heapBuilder.shared(query.value(4).toString());
+        row.location = heapBuilder.shared(query.value(8).toString());
+        row.status = heapBuilder.shared(query.value(9).toString());
+        rowTable.append(row);
+        isbnKeys.append(key);
+
+        starts.append(static_cast<quint32>(search.size()));
+        search += title;
+        search += kFieldSeparator;
+        search += author;
+        search += kFieldSeparator;
+        search += isbn;
+        search += kRowSeparator;
+    }
+    if (query.lastError().isValid()) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+    starts.append(static_cast<quint32>(search.size()));
+
+    const int rowCount = rowTable.size();
+    QVector<quint32> order(rowCount);
+    for (int i = 0; i < rowCount; ++i) {
+        order[i] = static_cast<quint32>(i);
+    }
+    std::sort(order.begin(), order.end(), [&isbnKeys](quint32 a, quint32 b) {
+        return isbnKeys.at(a) < isbnKeys.at(b);
+    });
+
+    QVector<Category> categoryTableData;
+    for (const QString &name : categoryNames) {
+        Category category;
+        category.name = heapBuilder.shared(name);
+        categoryTableData.append(category);
+    }
+
+    const int words = bitmapWords(rowCount);
+    QVector<quint64> available(words, 0);
+    QVector<quint64> categoryBitmaps(words * categoryNames.size(), 0);
+    for (int i = 0; i < rowCount; ++i) {
+        const quint64 bit = quint64(1) << (i % 64);
+        if (rowTable.at(i).availableCopies > 0) {
+            available[i / 64] |= bit;
+        }
+        if (rowTable.at(i).category >= 0) {
+            categoryBitmaps[rowTable.at(i).category * words + i / 64] |= bit;
+        }
+    }
+
+    // 各段依次排在文件头之后，起点按 8 字节对齐
+    Header head;
+    memset(&head, 0, sizeof(head));
+    head.magic = kMagic;
+    head.version = kVersion;
+    head.rowCount = static_cast<quint32>(rowCount);
+    head.categoryCount = static_cast<quint32>(categoryNames.size());
+    head.builtAt = QDateTime::currentMSecsSinceEpoch();
+    head.heapChars = quint64(heapBuilder.chars.size());
+    head.searchChars = quint64(search.size());
+    quint64 offset = sizeof(Header);
+    head.rowsOffset = offset;
+    offset = align8(offset + quint64(rowCount) * sizeof(Row));
+    head.categoriesOffset = offset;
+    offset = align8(offset + quint64(categoryTableData.size()) * sizeof(Category));
+    head.heapOffset = offset;
+    offset = align8(offset + head.heapChars * sizeof(QChar));
+    head.searchOffset = offset;
+    offset = align8(offset + head.searchChars * sizeof(QChar));
+    head.searchStartsOffset = offset;
+    offset = align8(offset + quint64(starts.size()) * sizeof(quint32));
+    head.isbnOrderOffset = offset;
+    offset = align8(offset + quint64(rowCount) * sizeof(quint32));
+    head.availableOffset = offset;
+    offset += quint64(words) * sizeof(quint64);
+    head.categoryBitmapsOffset = offset;
+    offset += quint64(categoryBitmaps.size()) * sizeof(quint64);
+    head.fileSize = offset;
+
+    QSaveFile saved(path);
+    if (!saved.open(QIODevice::WriteOnly)) {
+        if (error) *error = saved.errorString();
+        return false;
+    }
+    bool ok = true;
+    writePadded(saved, reinterpret_cast<const char *>(&head), sizeof(head), &ok);
+    writePadded(saved, reinterpret_cast<const char *>(rowTable.constData()), qint64(rowCount) * sizeof(Row), &ok);
+    writePadded(saved, reinterpret_cast<const char *>(categoryTableData.constData()),
+                qint64(categoryTableData.size()) * sizeof(Category), &ok);
+    writePadded(saved, reinterpret_cast<const char *>(heapBuilder.chars.constData()),
+                qint64(head.heapChars) * sizeof(QChar), &ok);
+    writePadded(saved, reinterpret_cast<const char *>(search.constData()), qint64(head.searchChars) * sizeof(QChar), &ok);
+    writePadded(saved, reinterpret_cast<const char *>(starts.constData()), qint64(starts.size()) * sizeof(quint32), &ok);
+    writePadded(saved, reinterpret_cast<const char *>(order.constData()), qint64(rowCount) * sizeof(quint32), &ok);
+    writePadded(saved, reinterpret_cast<const char *>(available.constData()), qint64(words) * sizeof(quint64), &ok);
+    writePadded(saved, reinterpret_cast<const char *>(categoryBitmaps.constData()),
+                qint64(categoryBitmaps.size()) * sizeof(quint64), &ok);
+    if (!ok || !saved.commit()) {
+        if (error) *error = saved.errorString();
+        return false;
+    }
+
+    if (result) {
+        result->books = rowCount;
+        result->bytes = static_cast<qint64>(head.fileSize);
+        result->elapsedMs = elapsed.elapsed();
+    }
+    return true;
+}
+
+bool CatalogSnapshot::open(const QString &path, QString *error)
+{
+    file.close();
+    header = nullptr;
+
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (error) *error = file.errorString();
+        return false;
+    }
+    const qint64 size = file.size();
+    base = size >= qint64(sizeof(Header)) ? file.map(0, size) : nullptr;
+    if (!base) {
+        if (error) *error = size >= qint64(sizeof(Header)) ? file.errorString() : QString("快照文件不完整");
+        file.close();
+        return false;
+    }
+
+    // 只校验文件头与各段的范围，不逐行检查，打开的耗时与图书数量无关；
+    // 行内的位置在读取时再核对，损坏的文件不会读越界
+    const Header *head = reinterpret_cast<const Header *>(base);
+    const quint64 words = quint64(bitmapWords(static_cast<int>(qMin<quint32>(head->rowCount, INT_MAX))));
+    const auto fits = [head](quint64 offset, quint64 bytes) -> bool {
+        return offset % 8 == 0 && offset <= head->fileSize && bytes <= head->fileSize - offset;
+    };
+    QString problem;
+    if (head->magic != kMagic) {
+        problem = "不是目录快照文件";
+    } else if (head->version != kVersion) {
+        problem = QString("快照格式版本 %1 不受支持").arg(head->version);
+    } else if (head->fileSize != quint64(size) || head->rowCount > quint32(INT_MAX)
+               || !fits(head->rowsOffset, quint64(head->rowCount) * sizeof(Row))
+               || !fits(head->categoriesOffset, quint64(head->categoryCount) * sizeof(Category))
+               || !fits(head->heapOffset, head->heapChars * sizeof(QChar))
+               || !fits(head->searchOffset, head->searchChars * sizeof(QChar))
+               || !fits(head->searchStartsOffset, (quint64(head->rowCount) + 1) * sizeof(quint32))
+               || !fits(head->isbnOrderOffset, quint64(head->rowCount) * sizeof(quint32))
+               || !fits(head->availableOffset, words * sizeof(quint64))
+               || !fits(head->categoryBitmapsOffset, words * head->categoryCount * sizeof(quint64))
+               || head->searchChars > quint64(INT_MAX)) {
+        problem = "快照文件不完整";
+    }
+    if (!problem.isEmpty()) {
+        if (error) *error = problem;
+        file.close();
+        base = nullptr;
+        return false;
+    }
+
+    header = head;
+    rows = reinterpret_cast<const Row *>(base + head->rowsOffset);
+    categoryTable = reinterpret_cast<const Category *>(base + head->categoriesOffset);
+    heap = reinterpret_cast<const QChar *>(base + head->heapOffset);
+    searchText = reinterpret_cast<const QChar *>(base + head->searchOffset);
+    searchStarts = reinterpret_cast<const quint32 *>(base + head->searchStartsOffset);
+    isbnOrder = reinterpret_cast<const quint32 *>(base + head->isbnOrderOffset);
+    return true;
+}
+
+int CatalogSnapshot::rowCount() const
+{
+    return header ? static_cast<int>(header->rowCount) : 0;
+}
+
+qint64 CatalogSnapshot::builtAt() const
+{
+    return header ? header->builtAt : 0;
+}
+
+QStringList CatalogSnapshot::categories() const
+{
+    QStringList names;
+    for (quint32 i = 0; header && i < header->categoryCount; ++i) {
+        names.append(text(categoryTable[i].name.offset, categoryTable[i].name.length));
+    }
+    return names;
+}
+
+QString CatalogSnapshot::text(quint32 offset, quint32 length) const
+{
+    if (quint64(offset) + length > header->heapChars) {
+        return QString();
+    }
+    // 复制出来，返回的字符串不依赖映射，快照被换下后仍然有效
+    return QString(heap + offset, static_cast<int>(length));
+}
+
+CatalogSnapshot::Book CatalogSnapshot::book(int row) const
+{
+    Book book;
+    if (!header || row < 0 || row >= rowCount()) {
+        return book;
+    }
+    const Row &entry = rows[row];
+    book.id = entry.id;
+    book.title = text(entry.title.offset, entry.title.length);
+    book.author = text(entry.author.offset, entry.author.length);
+    book.isbn = text(entry.isbn.offset, entry.isbn.length);
+    book.publisher = text(entry.publisher.offset, entry.publisher.length);
+    book.location = text(entry.location.offset, entry.location.length);
+    book.status = text(entry.status.offset, entry.status.length);
+    if (entry.category >= 0 && quint32(entry.category) < header->categoryCount) {
+        const Ref &name = categoryTable[entry.category].name;
+        book.category = text(name.offset, name.length);
+    }
+    book.totalCopies = entry.totalCopies;
+    book.availableCopies = entry.availableCopies;
+    return book;
+}
+
+int CatalogSnapshot::findIsbn(const QString &key) const
+{
+    // ISBN 索引按规范化 ISBN 排序，二分查找
+    int low = 0;
+    int high = rowCount();
+    while (low < high) {
+        const int middle = low + (high - low) / 2;
+        const quint32 row = isbnOrder[middle];
+        if (row >= header->rowCount) {
+            return -1;
+        }
+        const Ref &ref = rows[row].isbnKey;
+        if (text(ref.offset, ref.length) < key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low < rowCount() && isbnOrder[low] < header->rowCount) {
+        const Ref &ref = rows[isbnOrder[low]].isbnKey;
+        if (text(ref.offset, ref.length) == key) {
+            return static_cast<int>(isbnOrder[low]);
+        }
+    }
+    return -1;
+}
+
+QVector<int> CatalogSnapshot::search(const Query &query, int limit) const
+{
+    ScopedTimer timer("目录快照检索");
+    QVector<int> result;
+    if (!header || limit <= 0) {
+        return result;
+    }
+
+    const int count = rowCount();
+    const int words = bitmapWords(count);
+    const quint64 *available = query.availableOnly ? reinterpret_cast<const quint64 *>(base + header->availableOffset)
+                                                   : nullptr;
+    const quint64 *category = nullptr;
+    if (!query.category.isEmpty()) {
+        for (quint32 i = 0; i < header->categoryCount && !category; ++i) {
+            if (text(categoryTable[i].name.offset, categoryTable[i].name.length) == query.category) {
+                category = reinterpret_cast<const quint64 *>(base + header->categoryBitmapsOffset) + quint64(i) * words;
+            }
+        }
+        if (!category) {
+            return result;
+        }
+    }
+    const auto accepted = [available, category](int row) -> bool {
+        const quint64 bit = quint64(1) << (row % 64);
+        return (!available || (available[row / 64] & bit)) && (!category || (category[row / 64] & bit));
+    };
+
+    const QString pattern = query.text.trimmed();
+    if (pattern.isEmpty()) {
+        // 只按位图筛选，一次处理 64 行
+        for (int word = 0; word < words && result.size() < limit; ++word) {
+            quint64 bits = ~quint64(0);
+            if (available) bits &= available[word];
+            if (category) bits &= category[word];
+            for (int bit = 0; bits && bit < 64 && result.size() < limit; ++bit, bits >>= 1) {
+                const int row = word * 64 + bit;
+                if ((bits & 1) && row < count) {
+                    result.append(row);
+                }
+            }
+        }
+        return result;
+    }
+
+    // 扫描到的是完整的 ISBN 时直接查索引。只含分隔符的文本（如 "-"）规范化后为空，
+    // 会匹配上没有 ISBN 的书，这时按文本检索
+    const QString isbnKey = BarcodeIndex::normalize(pattern);
+    const int exact = isbnKey.isEmpty() ? -1 : findIsbn(isbnKey);
+    if (exact >= 0) {
+        if (accepted(exact)) {
+            result.append(exact);
+        }
+        return result;
+    }
+
+    // 整段检索文本交给 SIMD 查找一次扫描，再把匹配位置换算成行号；
+    // 分隔符不会出现在查找串中，匹配不会跨越字段或行
+    const TextScan::Needle needle(pattern);
+    const qint64 total = qint64(header->searchChars);
+    qint64 pos = 0;
+    while (pos < total && result.size() < limit) {
+        const int found = TextScan::find(searchText + pos, static_cast<int>(total - pos), needle);
+        if (found < 0) {
+            break;
+        }
+        const quint32 match = static_cast<quint32>(pos + found);
+        const int row = static_cast<int>(std::upper_bound(searchStarts, searchStarts + count + 1, match) - searchStarts) - 1;
+        if (row < 0 || row >= count) {
+            break;
+        }
+        if (accepted(row)) {
+            result.append(row);
+        }
+        // 同一行只取一次，从下一行开头继续；损坏的文件中起点不递增时停止
+        const qint64 next = searchStarts[row + 1];
+        if (next <= pos) {
+            break;
+        }
+        pos = next;
+    }
+    return result;
+}
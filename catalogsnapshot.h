@@ -0,0 +1,92 @@
+﻿// catalogsnapshot.h
+#ifndef CATALOGSNAPSHOT_H
+#define CATALOGSNAPSHOT_H
+
+#include <QFile>
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+// 图书目录快照：公共检索终端（OPAC）只读的不可变文件，打开时整体内存映射，
+// 不解析、不复制，也不连接借还书数据库。文件由后台定期生成并整体替换，
+// 终端发现新文件后打开新快照再切换，旧快照在最后一个使用者释放后解除映射。
+//
+// 文件布局（小端，各段按 8 字节对齐）：
+//   文件头     魔数 "LMCS"、版本、行数、各段偏移
+//   行表       每本图书定长一行：ID、册数与各文本字段在字符串堆中的位置
+//   字符串堆   UTF-16 文本；分类、出版社、位置等重复的值只存一份
+//   检索文本   各行“书名、作者、ISBN”首尾相接，整段交给 TextScan 查找
+//   ISBN 索引  按规范化 ISBN 排序的行号，扫码时二分查找
+//   位图       可借位图，以及每个分类一个位图
+class CatalogSnapshot
+{
+public:
+    struct Book
+    {
+        int id = 0;
+        QString title;
+        QString author;
+        QString isbn;
+        QString publisher;
+        QString category;
+        QString location;
+        QString status;
+        int totalCopies = 0;
+        int availableCopies = 0;
+    };
+
+    struct Query
+    {
+        QString text;          // 书名、作者或 ISBN 的一部分；完整的 ISBN 直接按索引查找
+        QString category;      // 为空表示不限
+        bool availableOnly = false;
+    };
+
+    struct BuildResult
+    {
+        int books = 0;
+        qint64 bytes = 0;
+        qint64 elapsedMs = 0;
+    };
+
+    CatalogSnapshot();
+    ~CatalogSnapshot();
+
+    // 读取 books 表写出快照；先写临时文件再改名，正在读旧文件的终端不受影响
+    static bool build(const QSqlDatabase &db, const QString &path, BuildResult *result, QString *error);
+
+    // 映射并校验文件；之后的读取都不加锁，可在多个线程中同时进行
+    bool open(const QString &path, QString *error = nullptr);
+    bool isOpen() const { return header != nullptr; }
+
+    int rowCount() const;
+    qint64 builtAt() const;  // 生成时间，UTC 毫秒
+    QStringList categories() const;
+    Book book(int row) const;
+
+    // 按行号顺序返回匹配的行，最多 limit 行
+    QVector<int> search(const Query &query, int limit) const;
+
+private:
+    struct Header;
+    struct Row;
+    struct Category;
+
+    QString text(quint32 offset, quint32 length) const;
+    int findIsbn(const QString &key) const;
+
+    QFile file;
+    const uchar *base;
+    const Header *header;
+    const Row *rows;
+    const Category *categoryTable;
+    const QChar *heap;
+    const QChar *searchText;
+    const quint32 *searchStarts;
+    const quint32 *isbnOrder;
+
+    Q_DISABLE_COPY(CatalogSnapshot)
+};
+
+#endif // CATALOGSNAPSHOT_H
@@ -0,0 +1,645 @@
+﻿// changejournal.cpp
+#include "changejournal.h"
+#include <QtSql>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <algorithm>
+
+namespace {
+
+const quint32 kSegmentMagicV1 = 0x4C4D4A31; // "LMJ1"，没有事务编号
+const quint32 kSegmentMagic = 0x4C4D4A32;   // "LMJ2"
+const int kBaseSnapshotDays = 7;          // 基础快照的保留周期
+
+// 以毫秒为单位的 UTC 时间戳
+const char *kNowMsecs = "CAST((julianday('now') - 2440587.5) * 86400000.0 AS INTEGER)";
+
+qint64 journalHighWaterMark(QSqlDatabase db)
+{
+    QSqlQuery query(db);
+    query.exec("SELECT seq FROM sqlite_sequence WHERE name = 'change_journal'");
+    return query.next() ? query.value(0).toLongLong() : 0;
+}
+
+// 各业务表的列清单，触发器中写死了它们，变化时才需要重新生成触发器
+QString tableSignature(QSqlDatabase db, QHash<QString, QStringList> *columns)
+{
+    QSqlQuery query(db);
+    QStringList parts;
+    for (const QString &table : ChangeJournal::trackedTables()) {
+        QStringList names;
+        query.exec(QString("PRAGMA table_info(%1)").arg(table));
+        while (query.next()) {
+            names.append(query.value(1).toString());
+        }
+        columns->insert(table, names);
+        parts.append(table + "(" + names.join(",") + ")");
+    }
+    return parts.join(";");
+}
+
+int journalTriggerCount(QSqlDatabase db)
+{
+    QSqlQuery query(db);
+    query.exec("SELECT COUNT(*) FROM sqlite_master WHERE type = 'trigger' AND name LIKE 'journal!_%' ESCAPE '!'");
+    return query.next() ? query.value(0).toInt() : 0;
+}
+
+} // namespace
+
+QStringList ChangeJournal::trackedTables()
+{
+    return {"books", "readers", "borrow_records", "borrow_history", "copies", "holds"};
+}
+
+bool ChangeJournal::install(QSqlDatabase db, QString *error)
+{
+    QSqlQuery query(db);
+
+    if (!query.exec("CREATE TABLE IF NOT EXISTS change_journal ("
+                    "seq INTEGER PRIMARY KEY AUTOINCREMENT,"
+                    "ts INTEGER NOT NULL,"
+                    "txn INTEGER,"
+                    "tbl TEXT NOT NULL,"
+                    "stmt TEXT NOT NULL)")) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+    bool hasTxn = false;
+    query.exec("PRAGMA table_info(change_journal)");
+    while (query.next()) {
+        hasTxn = hasTxn || query.value(1).toString() == "txn";
+    }
+    if (!hasTxn && !query.exec("ALTER TABLE change_journal ADD COLUMN txn INTEGER")) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+
+    // enabled：设置了增量备份目录后才记录变更；txn：当前多语句事务的编号，0 表示没有
+    query.exec("SELECT name FROM sqlite_master WHERE type = 'table' AND name = 'change_journal_state'");
+    const bool hasState = query.next();
+    if (!hasState) {
+        if (!query.exec("CREATE TABLE IF NOT EXISTS change_journal_state ("
+                        "id INTEGER PRIMARY KEY CHECK (id = 1),"
+                        "enabled INTEGER NOT NULL DEFAULT 0,"
+                        "signature TEXT,"
+                        "txn INTEGER NOT NULL DEFAULT 0,"
+                        "last_txn INTEGER NOT NULL DEFAULT 0)")) {
+            if (error) *error = query.lastError().text();
+            return false;
+        }
+
+        // 旧版本无条件安装触发器。日志导出过（最小序号不是 1）说明在做增量备份，继续记录；
+        // 从未导出的日志只会一直增长，连同触发器一起删除
+        qint64 firstSeq = 0;
+        query.exec("SELECT MIN(seq) FROM change_journal");
+        if (query.next() && !query.value(0).isNull()) {
+            firstSeq = query.value(0).toLongLong();
+        }
+        const qint64 highWater = journalHighWaterMark(db);
+        const bool inUse = journalTriggerCount(db) > 0 && highWater > 0 && (firstSeq == 0 || firstSeq > 1);
+        query.exec(QString("INSERT OR IGNORE INTO change_journal_state (id, enabled) VALUES (1, %1)").arg(inUse ? 1 : 0));
+        if (!inUse) {
+            removeTriggers(db);
+            query.exec("DELETE FROM change_journal");
+        }
+    }
+
+    return refreshTriggers(db, false, error);
+}
+
+bool ChangeJournal::isEnabled(QSqlDatabase db)
+{
+    QSqlQuery query(db);
+    return query.exec("SELECT enabled FROM change_journal_state WHERE id = 1") && query.next()
+        && query.value(0).toBool();
+}
+
+bool ChangeJournal::enable(QSqlDatabase db, QString *error)
+{
+    if (isEnabled(db)) {
+        return true;
+    }
+
+    QSqlQuery query(db);
+    db.transaction();
+    // 停用期间的变更没有记录：清掉残留的日志，并让序号跳过一个，
+    // 下次备份时 needsBaseSnapshot 发现断档而先做基础快照
+    query.exec("DELETE FROM change_journal");
+    query.exec("UPDATE sqlite_sequence SET seq = seq + 1 WHERE name = 'change_journal'");
+    if (!query.exec("UPDATE change_journal_state SET enabled = 1, signature = NULL WHERE id = 1")) {
+        if (error) *error = query.lastError().text();
+        db.rollback();
+        return false;
+    }
+    if (!db.commit()) {
+        if (error) *error = db.lastError().text();
+        db.rollback();
+        return false;
+    }
+    return refreshTriggers(db, true, error);
+}
+
+bool ChangeJournal::refreshTriggers(QSqlDatabase db, bool force, QString *error)
+{
+    QSqlQuery query(db);
+    if (!query.exec("SELECT enabled, signature FROM change_journal_state WHERE id = 1") || !query.next()) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+    if (!query.value(0).toBool()) {
+        return true;
+    }
+    const QString stored = query.value(1).toString();
+    query.finish();
+
+    // 重建触发器是一次表结构变更，会使其他连接已准备的语句全部失效，
+    // 所以只在列清单变化或触发器缺失（如按时间点恢复后）时重建
+    QHash<QString, QStringList> columns;
+    const QString signature = tableSignature(db, &columns);
+    int expected = 0;
+    for (const QString &table : trackedTables()) {
+        expected += columns.value(table).isEmpty() ? 0 : 3;
+    }
+    if (!force && signature == stored && journalTriggerCount(db) == expected) {
+        return true;
+    }
+
+    db.transaction();
+    removeTriggers(db);
+    for (const QString &table : trackedTables()) {
+        const QStringList tableColumns = columns.value(table);
+        if (tableColumns.isEmpty()) {
+            continue;
+        }
+
+        // 新增与修改都记录为整行的 INSERT OR REPLACE，重放时与顺序无关地幂等
+        QStringList values;
+        for (const QString &column : tableColumns) {
+            values.append(QString("quote(NEW.%1)").arg(column));
+        }
+        QString upsert = QString("'INSERT OR REPLACE INTO %1 (%2) VALUES (' || %3 || ')'")
+                             .arg(table, tableColumns.join(", "), values.join(" || ', ' || "));
+        QString remove = QString("'DELETE FROM %1 WHERE id = ' || quote(OLD.id)").arg(table);
+
+        // 多语句事务中的变更带上事务编号，恢复时整个事务要么全部重放、要么都不重放
+        const QString triggerTemplate =
+            "CREATE TRIGGER journal_%1_%2 AFTER %3 ON %1 BEGIN "
+            "INSERT INTO change_journal (ts, txn, tbl, stmt) VALUES (%4, "
+            "(SELECT NULLIF(txn, 0) FROM change_journal_state WHERE id = 1), '%1', %5); END";
+
+        QStringList statements = {
+            triggerTemplate.arg(table, "insert", "INSERT", kNowMsecs, upsert),
+            triggerTemplate.arg(table, "update", "UPDATE", kNowMsecs, upsert),
+            triggerTemplate.arg(table, "delete", "DELETE", kNowMsecs, remove)
+        };
+        for (const QString &statement : statements) {
+            if (!query.exec(statement)) {
+                if (error) *error = query.lastError().text();
+                db.rollback();
+                return false;
+            }
+        }
+    }
+    query.prepare("UPDATE change_journal_state SET signature = ? WHERE id = 1");
+    query.addBindValue(signature);
+    if (!query.exec() || !db.commit()) {
+        if (error) *error = query.lastError().isValid() ? query.lastError().text() : db.lastError().text();
+        db.rollback();
+        return false;
+    }
+    return true;
+}
+
+bool ChangeJournal::beginTransaction(QSqlDatabase db, bool *marked, QSqlError *error)
+{
+    *marked = false;
+    QSqlQuery query(db);
+    if (!query.exec("SELECT enabled FROM change_journal_state WHERE id = 1")) {
+        if (error) *error = query.lastError();
+        return false;
+    }
+    if (!query.next() || !query.value(0).toBool()) {
+        return true;
+    }
+    query.finish();
+    if (!query.exec("UPDATE change_journal_state SET txn = last_txn + 1, last_txn = last_txn + 1 WHERE id = 1")) {
+        if (error) *error = query.lastError();
+        return false;
+    }
+    *marked = true;
+    return true;
+}
+
+bool ChangeJournal::endTransaction(QSqlDatabase db, QSqlError *error)
+{
+    QSqlQuery query(db);
+    if (!query.exec("UPDATE change_journal_state SET txn = 0 WHERE id = 1")) {
+        if (error) *error = query.lastError();
+        return false;
+    }
+    return true;
+}
+
+void ChangeJournal::removeTriggers(QSqlDatabase db)
+{
+    QSqlQuery query(db);
+    QStringList triggers;
+    query.exec("SELECT name FROM sqlite_master WHERE type = 'trigger' AND name LIKE 'journal!_%' ESCAPE '!'");
+    while (query.next()) {
+        triggers.append(query.value(0).toString());
+    }
+    for (const QString &trigger : triggers) {
+        query.exec(QString("DROP TRIGGER IF EXISTS %1").arg(trigger));
+    }
+}
+
+bool ChangeJournal::needsBaseSnapshot(QSqlDatabase db, const QString &dir)
+{
+    QList<BaseSnapshot> bases = listBaseSnapshots(dir);
+    if (bases.isEmpty()) {
+        return true;
+    }
+
+    const BaseSnapshot &newest = bases.last();
+    QDateTime baseTime = QDateTime::fromMSecsSinceEpoch(newest.timestamp);
+    if (baseTime.daysTo(QDateTime::currentDateTime()) >= kBaseSnapshotDays) {
+        return true;
+    }
+
+    // 目录中已覆盖到的日志位置
+    qint64 covered = newest.lastSeq;
+    for (const Segment &segment : listSegments(dir)) {
+        covered = qMax(covered, segment.lastSeq);
+    }
+
+    // 目录属于其他数据库或旧的时间线
+    if (covered > journalHighWaterMark(db)) {
+        return true;
+    }
+
+    // 待导出的日志与已备份部分之间出现断档
+    QSqlQuery query(db);
+    query.exec("SELECT MIN(seq) FROM change_journal");
+    if (query.next() && !query.value(0).isNull()) {
+        return query.value(0).toLongLong() > covered + 1;
+    }
+    return false;
+}
+
+bool ChangeJournal::registerBaseSnapshot(QSqlDatabase db, const QString &dir,
+                                         const QString &snapshotPath, const QDateTime &startedAt,
+                                         QString *error)
+{
+    const QString connectionName = "change_journal_snapshot";
+    qint64 lastSeq = 0;
+    bool ok = false;
+    {
+        QSqlDatabase snapshot = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        snapshot.setDatabaseName(snapshotPath);
+        if (snapshot.open()) {
+            lastSeq = journalHighWaterMark(snapshot);
+            // 快照中已经包含这些变更，日志本身不再需要
+            QSqlQuery query(snapshot);
+            query.exec("DELETE FROM change_journal");
+            snapshot.close();
+            ok = true;
+        } else if (error) {
+            *error = snapshot.lastError().text();
+        }
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+
+    if (!ok) {
+        return false;
+    }
+
+    QString basePath = QDir(dir).filePath(QString("base_%1_%2.db")
+                                              .arg(startedAt.toMSecsSinceEpoch())
+                                              .arg(lastSeq, 12, 10, QChar('0')));
+    QFile::remove(basePath);
+    if (!QFile::rename(snapshotPath, basePath)) {
+        if (error) *error = "无法保存基础快照文件";
+        return false;
+    }
+
+    QSqlQuery query(db);
+    query.prepare("DELETE FROM change_journal WHERE seq <= ?");
+    query.addBindValue(lastSeq);
+    query.exec();
+    return true;
+}
+
+bool ChangeJournal::exportSegment(QSqlDatabase db, const QString &dir,
+                                  BackupStats *stats, QString *error)
+{
+    QList<Entry> entries;
+    QSqlQuery query(db);
+    if (!query.exec("SELECT seq, ts, txn, stmt FROM change_journal ORDER BY seq")) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+    while (query.next()) {
+        Entry entry;
+        entry.seq = query.value(0).toLongLong();
+        entry.timestamp = query.value(1).toLongLong();
+        entry.txn = query.value(2).toLongLong();
+        entry.statement = query.value(3).toString();
+        entries.append(entry);
+    }
+
+    *stats = BackupStats();
+    if (entries.isEmpty()) {
+        return true;
+    }
+
+    QString path = QDir(dir).filePath(segmentFileName(entries.first().seq, entries.last().seq));
+    if (!writeSegment(path, entries, &stats->bytes)) {
+        if (error) *error = "无法写入日志分段文件";
+        return false;
+    }
+
+    // 导出期间新产生的日志序号更大，不会被误删
+    query.prepare("DELETE FROM change_journal WHERE seq <= ?");
+    query.addBindValue(entries.last().seq);
+    query.exec();
+
+    stats->entries = entries.size();
+    stats->lastSeq = entries.last().seq;
+    return true;
+}
+
+bool ChangeJournal::restoreToPointInTime(const QString &dir, const QDateTime &target,
+                                         const QString &outputPath, BackupStats *stats,
+                                         QString *error)
+{
+    const qint64 targetMsecs = target.toMSecsSinceEpoch();
+
+    // 选择不晚于目标时间的最近一个基础快照
+    QList<BaseSnapshot> bases = listBaseSnapshots(dir);
+    const BaseSnapshot *base = nullptr;
+    for (const BaseSnapshot &candidate : bases) {
+        if (candidate.timestamp <= targetMsecs
+                && (!base || candidate.lastSeq > base->lastSeq)) {
+            base = &candidate;
+        }
+    }
+    if (!base) {
+        if (error) *error = "没有早于该时间点的基础快照";
+        return false;
+    }
+
+    // 收集快照之后的日志，按序号重放到目标时间为止
+    QList<Entry> entries;
+    for (const Segment &segment : listSegments(dir)) {
+        if (segment.lastSeq <= base->lastSeq) {
+            continue;
+        }
+        if (!readSegment(segment.path, &entries)) {
+            if (error) *error = QString("日志分段已损坏：%1").arg(QFileInfo(segment.path).fileName());
+            return false;
+        }
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.seq < b.seq;
+    });
+    // 重复导出的分段
+    entries.erase(std::unique(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.seq == b.seq;
+    }), entries.end());
+
+    QFile::remove(outputPath);
+    if (!QFile::copy(base->path, outputPath)) {
+        if (error) *error = "无法复制基础快照";
+        return false;
+    }
+    QFile::setPermissions(outputPath, QFile::permissions(outputPath) | QFile::WriteOwner);
+
+    const QString connectionName = "change_journal_restore";
+    qint64 lastApplied = base->lastSeq;
+    int applied = 0;
+    QString replayError;
+    {
+        QSqlDatabase restored = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        restored.setDatabaseName(outputPath);
+        if (!restored.open()) {
+            replayError = restored.lastError().text();
+        } else {
+            // 重放时不能再次触发日志记录
+            removeTriggers(restored);
+
+            QSqlQuery query(restored);
+            restored.transaction();
+
+            // 以事务为单位重放：同一事务的日志序号连续（同一时刻只有一个写事务），
+            // 整个事务的最后一条不晚于目标时间才重放，恢复点不会落在一次借还书的中间。
+            // 没有事务编号的是单条语句的自动提交，同一语句产生的日志时间相同，归为一组
+            int i = 0;
+            while (i < entries.size() && entries.at(i).seq <= lastApplied) {
+                ++i;  // 快照中已包含
+            }
+            while (i < entries.size() && replayError.isEmpty()) {
+                const Entry &first = entries.at(i);
+                int end = i + 1;
+                qint64 committed = first.timestamp;
+                while (end < entries.size()
+                       && (first.txn ? entries.at(end).txn == first.txn
+                                     : !entries.at(end).txn && entries.at(end).timestamp == first.timestamp)) {
+                    committed = qMax(committed, entries.at(end).timestamp);
+                    ++end;
+                }
+                if (committed > targetMsecs) {
+                    break;
+                }
+                for (; i < end; ++i) {
+                    const Entry &entry = entries.at(i);
+                    if (!query.exec(entry.statement)) {
+                        replayError = QString("重放第 %1 条日志失败：%2")
+                                          .arg(entry.seq).arg(query.lastError().text());
+                        break;
+                    }
+                    lastApplied = entry.seq;
+                    ++applied;
+                }
+            }
+
+            if (replayError.isEmpty()) {
+                // 新时间线从恢复点继续编号
+                query.exec("DELETE FROM change_journal");
+                query.prepare("UPDATE sqlite_sequence SET seq = ? WHERE name = 'change_journal'");
+                query.addBindValue(lastApplied);
+                query.exec();
+                restored.commit();
+            } else {
+                restored.rollback();
+            }
+            restored.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+
+    if (!replayError.isEmpty()) {
+        QFile::remove(outputPath);
+        if (error) *error = replayError;
+        return false;
+    }
+
+    stats->entries = applied;
+    stats->bytes = QFileInfo(outputPath).size();
+    stats->lastSeq = lastApplied;
+    return true;
+}
+
+void ChangeJournal::retireLaterHistory(const QString &dir, qint64 lastAppliedSeq)
+{
+    QDir backupDir(dir);
+    const QString retiredName = "superseded_" + QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss");
+    auto retire = [&](const QString &path) {
+        backupDir.mkpath(retiredName);
+        QString fileName = QFileInfo(path).fileName();
+        QFile::rename(path, backupDir.filePath(retiredName + "/" + fileName));
+    };
+
+    for (const BaseSnapshot &base : listBaseSnapshots(dir)) {
+        if (base.lastSeq > lastAppliedSeq) {
+            retire(base.path);
+        }
+    }
+
+    for (const Segment &segment : listSegments(dir)) {
+        if (segment.lastSeq <= lastAppliedSeq) {
+            continue;
+        }
+        if (segment.firstSeq <= lastAppliedSeq) {
+            // 跨越恢复点的分段：保留恢复点之前的部分
+            QList<Entry> entries;
+            QList<Entry> kept;
+            if (readSegment(segment.path, &entries)) {
+                for (const Entry &entry : entries) {
+                    if (entry.seq <= lastAppliedSeq) {
+                        kept.append(entry);
+                    }
+                }
+            }
+            retire(segment.path);
+            if (!kept.isEmpty()) {
+                qint64 bytes = 0;
+                writeSegment(backupDir.filePath(segmentFileName(kept.first().seq, kept.last().seq)),
+                             kept, &bytes);
+            }
+        } else {
+            retire(segment.path);
+        }
+    }
+}
+
+QList<ChangeJournal::BaseSnapshot> ChangeJournal::listBaseSnapshots(const QString &dir)
+{
+    QList<BaseSnapshot> bases;
+    QRegularExpression pattern("^base_(\\d+)_(\\d+)\\.db$");
+    for (const QFileInfo &info : QDir(dir).entryInfoList({"base_*.db"}, QDir::Files)) {
+        QRegularExpressionMatch match = pattern.match(info.fileName());
+        if (match.hasMatch()) {
+            BaseSnapshot base;
+            base.path = info.absoluteFilePath();
+            base.timestamp = match.captured(1).toLongLong();
+            base.lastSeq = match.captured(2).toLongLong();
+            bases.append(base);
+        }
+    }
+    std::sort(bases.begin(), bases.end(), [](const BaseSnapshot &a, const BaseSnapshot &b) {
+        return a.lastSeq < b.lastSeq || (a.lastSeq == b.lastSeq && a.timestamp < b.timestamp);
+    });
+    return bases;
+}
+
+QList<ChangeJournal::Segment> ChangeJournal::listSegments(const QString &dir)
+{
+    QList<Segment> segments;
+    QRegularExpression pattern("^journal_(\\d+)_(\\d+)\\.lmj$");
+    for (const QFileInfo &info : QDir(dir).entryInfoList({"journal_*.lmj"}, QDir::Files, QDir::Name)) {
+        QRegularExpressionMatch match = pattern.match(info.fileName());
+        if (match.hasMatch()) {
+            Segment segment;
+            segment.path = info.absoluteFilePath();
+            segment.firstSeq = match.captured(1).toLongLong();
+            segment.lastSeq = match.captured(2).toLongLong();
+            segments.append(segment);
+        }
+    }
+    return segments;
+}
+
+QString ChangeJournal::segmentFileName(qint64 firstSeq, qint64 lastSeq)
+{
+    return QString("journal_%1_%2.lmj")
+        .arg(firstSeq, 12, 10, QChar('0'))
+        .arg(lastSeq, 12, 10, QChar('0'));
+}
+
+bool ChangeJournal::readSegment(const QString &path, QList<Entry> *entries)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream header(&file);
+    header.setVersion(QDataStream::Qt_5_6);
+    quint32 magic = 0;
+    QByteArray compressed;
+    header >> magic >> compressed;
+    if ((magic != kSegmentMagic && magic != kSegmentMagicV1) || header.status() != QDataStream::Ok) {
+        return false;
+    }
+
+    QByteArray payload = qUncompress(compressed);
+    QDataStream stream(payload);
+    stream.setVersion(QDataStream::Qt_5_6);
+    quint32 count = 0;
+    stream >> count;
+    for (quint32 i = 0; i < count; ++i) {
+        Entry entry;
+        entry.txn = 0;
+        stream >> entry.seq >> entry.timestamp;
+        if (magic == kSegmentMagic) {
+            stream >> entry.txn;
+        }
+        stream >> entry.statement;
+        entries->append(entry);
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+bool ChangeJournal::writeSegment(const QString &path, const QList<Entry> &entries, qint64 *bytes)
+{
+    // 语句中的列清单高度重复，压缩后体积通常只有原文的一小部分
+    QByteArray payload;
+    {
+        QDataStream stream(&payload, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_5_6);
+        stream << quint32(entries.size());
+        for (const Entry &entry : entries) {
+            stream << entry.seq << entry.timestamp << entry.txn << entry.statement;
+        }
+    }
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << kSegmentMagic << qCompress(payload);
+    if (!file.commit()) {
+        return false;
+    }
+
+    *bytes = QFileInfo(path).size();
+    return true;
+}
@@ -0,0 +1,98 @@
+﻿// changejournal.h
+#ifndef CHANGEJOURNAL_H
+#define CHANGEJOURNAL_H
+
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QDateTime>
+#include <QString>
+#include <QStringList>
+
+// 变更日志：由触发器把每次增删改记录成可重放的 SQL 语句，
+// 增量备份只导出新增的日志分段，恢复时在基础快照上重放到任意时间点。
+// 触发器在设置了增量备份目录后才安装（enable），未做增量备份的库不记录变更。
+// 多语句事务以 beginTransaction / endTransaction 标出，日志带上事务编号，
+// 恢复时只重放完整的事务。
+//
+// 备份目录结构：
+//   base_<时间戳>_<日志序号>.db       基础快照（在线备份生成）
+//   journal_<起始序号>_<结束序号>.lmj  日志分段
+class ChangeJournal
+{
+public:
+    struct BackupStats
+    {
+        int entries = 0;
+        qint64 bytes = 0;
+        qint64 lastSeq = 0;
+    };
+
+    // 需要记录变更的业务表
+    static QStringList trackedTables();
+
+    // 创建日志表；已启用时在表结构变化后重新生成触发器，否则不做任何表结构变更
+    static bool install(QSqlDatabase db, QString *error = nullptr);
+    static void removeTriggers(QSqlDatabase db);
+
+    // 开始记录变更（设置增量备份目录时调用），已启用时什么也不做
+    static bool enable(QSqlDatabase db, QString *error = nullptr);
+    static bool isEnabled(QSqlDatabase db);
+
+    // 在写事务开头与提交之前调用，之间的日志带同一个事务编号。
+    // 未启用时不写任何数据，marked 为 false，也不必调用 endTransaction
+    static bool beginTransaction(QSqlDatabase db, bool *marked, QSqlError *error = nullptr);
+    static bool endTransaction(QSqlDatabase db, QSqlError *error = nullptr);
+
+    // 目录中没有可衔接的基础快照，或最近的快照已超过保留周期时需要重新做快照
+    static bool needsBaseSnapshot(QSqlDatabase db, const QString &dir);
+
+    // 在线备份完成后登记基础快照：按快照内的日志位置重命名，并清理已包含的日志
+    static bool registerBaseSnapshot(QSqlDatabase db, const QString &dir,
+                                     const QString &snapshotPath, const QDateTime &startedAt,
+                                     QString *error = nullptr);
+
+    // 把尚未导出的日志写成一个分段文件，成功后从数据库中删除这些日志
+    static bool exportSegment(QSqlDatabase db, const QString &dir,
+                              BackupStats *stats, QString *error = nullptr);
+
+    // 选择不晚于 target 的最近快照，重放在 target 之前提交的事务，结果写入 outputPath
+    static bool restoreToPointInTime(const QString &dir, const QDateTime &target,
+                                     const QString &outputPath, BackupStats *stats,
+                                     QString *error = nullptr);
+
+    // 恢复后的数据库成为新的主库时调用：把晚于恢复点的快照和日志移到
+    // superseded_* 子目录，使后续增量备份与新的时间线衔接
+    static void retireLaterHistory(const QString &dir, qint64 lastAppliedSeq);
+
+private:
+    struct Entry
+    {
+        qint64 seq;
+        qint64 timestamp;
+        qint64 txn;  // 0 表示自动提交的单条语句
+        QString statement;
+    };
+
+    struct BaseSnapshot
+    {
+        QString path;
+        qint64 timestamp;
+        qint64 lastSeq;
+    };
+
+    struct Segment
+    {
+        QString path;
+        qint64 firstSeq;
+        qint64 lastSeq;
+    };
+
+    static bool refreshTriggers(QSqlDatabase db, bool force, QString *error);
+    static QList<BaseSnapshot> listBaseSnapshots(const QString &dir);
+    static QList<Segment> listSegments(const QString &dir);
+    static bool readSegment(const QString &path, QList<Entry> *entries);
+    static bool writeSegment(const QString &path, const QList<Entry> &entries, qint64 *bytes);
+    static QString segmentFileName(qint64 firstSeq, qint64 lastSeq);
+};
+
+#endif // CHANGEJOURNAL_H
@@ -0,0 +1,214 @@
+﻿// circulationclient.cpp
+#include "circulationclient.h"
+#include "circulationprotocol.h"
+#include "perfmonitor.h"
+#include <QElapsedTimer>
+#include <QLocalSocket>
+#include <QTcpSocket>
+
+CirculationClient::CirculationClient()
+    : socket(nullptr), nextId(1), timeoutMs(5000)
+{
+}
+
+CirculationClient::~CirculationClient()
+{
+    disconnectFromServer();
+}
+
+bool CirculationClient::connectTo(const QString &address, QString *error)
+{
+    disconnectFromServer();
+    serverAddress = address;
+
+    const int colon = address.lastIndexOf(':');
+    bool isPort = false;
+    const quint16 port = colon > 0 ? address.mid(colon + 1).toUShort(&isPort) : 0;
+
+    if (isPort) {
+        QTcpSocket *tcp = new QTcpSocket;
+        tcp->connectToHost(address.left(colon), port);
+        if (!tcp->waitForConnected(timeoutMs)) {
+            if (error) *error = tcp->errorString();
+            delete tcp;
+            return false;
+        }
+        tcp->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        socket = tcp;
+    } else {
+        QLocalSocket *local = new QLocalSocket;
+        local->connectToServer(address);
+        if (!local->waitForConnected(timeoutMs)) {
+            if (error) *error = local->errorString();
+            delete local;
+            return false;
+        }
+        socket = local;
+    }
+
+    // 确认对端是借还书服务且协议版本一致
+    try {
+        QJsonObject request;
+        request.insert("op", "ping");
+        if (!accessToken.isEmpty()) {
+            request.insert("token", accessToken);
+        }
+        if (call(request).value("version").toInt() != CirculationProtocol::Version) {
+            if (error) *error = "服务端协议版本不一致";
+            disconnectFromServer();
+            return false;
+        }
+    } catch (const QString &message) {
+        if (error) *error = message;
+        disconnectFromServer();
+        return false;
+    }
+    return true;
+}
+
+void CirculationClient::disconnectFromServer()
+{
+    delete socket;
+    socket = nullptr;
+}
+
+bool CirculationClient::isConnected() const
+{
+    if (QLocalSocket *local = qobject_cast<QLocalSocket *>(socket)) {
+        return local->state() == QLocalSocket::ConnectedState;
+    }
+    if (QTcpSocket *tcp = qobject_cast<QTcpSocket *>(socket)) {
+        return tcp->state() == QAbstractSocket::ConnectedState;
+    }
+    return false;
+}
+
+QJsonObject CirculationClient::call(QJsonObject request)
+{
+    // 连接断开时在发送之前重连一次；已发出的请求不重发，以免同一次借书执行两遍
+    if (!isConnected()) {
+        QString error;
+        QString address = serverAddress;
+        if (!connectTo(address, &error)) {
+            throw QString("无法连接借还书服务：" + error);
+        }
+    }
+
+    const int id = nextId++;
+    request.insert("id", id);
+    socket->write(CirculationProtocol::encode(request));
+
+    QElapsedTimer timer;
+    timer.start();
+    for (;;) {
+        while (!socket->canReadLine()) {
+            const int remaining = timeoutMs - static_cast<int>(timer.elapsed());
+            if (remaining <= 0 || !socket->waitForReadyRead(remaining)) {
+                // 应答可能只是迟到，断开连接以免之后读到错位的应答
+                disconnectFromServer();
+                throw QString("借还书服务无响应");
+            }
+        }
+
+        QJsonObject response;
+        QString error;
+        if (!CirculationProtocol::decode(socket->readLine(), &response, &error)) {
+            throw error;
+        }
+        if (response.value("id").toInt() != id) {
+            continue;  // 不是本次请求的应答，跳过
+        }
+        if (!response.value("ok").toBool()) {
+            throw response.value("error").toString();
+        }
+        return response;
+    }
+}
+
+LibraryCore::BorrowResult CirculationClient::borrowBook(int bookId, int readerId, int days)
+{
+    ScopedTimer timer("借书(服务)");
+    QJsonObject request;
+    request.insert("op", "borrow");
+    request.insert("bookId", bookId);
+    request.insert("readerId", readerId);
+    request.insert("days", days);
+    return CirculationProtocol::borrowResult(call(request));
+}
+
+LibraryCore::BorrowResult CirculationClient::borrowCopy(int copyId, int readerId, int days)
+{
+    ScopedTimer timer("借书(服务)");
+    QJsonObject request;
+    request.insert("op", "borrow");
+    request.insert("copyId", copyId);
+    request.insert("readerId", readerId);
+    request.insert("days", days);
+    return CirculationProtocol::borrowResult(call(request));
+}
+
+LibraryCore::ReturnResult CirculationClient::returnBook(int recordId)
+{
+    ScopedTimer timer("还书(服务)");
+    QJsonObject request;
+    request.insert("op", "return");
+    request.insert("recordId", recordId);
+    return CirculationProtocol::returnResult(call(request));
+}
+
+LibraryCore::RenewResult CirculationClient::renewBook(int recordId)
+{
+    ScopedTimer timer("续借(服务)");
+    QJsonObject request;
+    request.insert("op", "renew");
+    request.insert("recordId", recordId);
+    return CirculationProtocol::renewResult(call(request));
+}
+
+LibraryCore::HoldResult CirculationClient::placeHold(int bookId, int readerId)
+{
+    ScopedTimer timer("预约(服务)");
+    QJsonObject request;
+    request.insert("op", "hold");
+    request.insert("bookId", bookId);
+    request.insert("readerId", readerId);
+    return CirculationProtocol::holdResult(call(request));
+}
+
+void CirculationClient::cancelHold(int holdId)
+{
+    QJsonObject request;
+    request.insert("op", "cancel-hold");
+    request.insert("holdId", holdId);
+    call(request);
+}
+
+int CirculationClient::expireHolds()
+{
+    QJsonObject request;
+    request.insert("op", "expire-holds");
+    return call(request).value("expired").toInt();
+}
+
+LibraryCore::Statistics CirculationClient::statistics()
+{
+    QJsonObject request;
+    request.insert("op", "statistics");
+    return CirculationProtocol::statistics(call(request));
+}
+
+void CirculationClient::invalidateBook(int id)
+{
+    QJsonObject request;
+    request.insert("op", "invalidate");
+    request.insert("book", id);
+    call(request);
+}
+
+void CirculationClient::invalidateReader(int id)
+{
+    QJsonObject request;
+    request.insert("op", "invalidate");
+    request.insert("reader", id);
+    call(request);
+}
@@ -0,0 +1,57 @@
+﻿// circulationclient.h
+#ifndef CIRCULATIONCLIENT_H
+#define CIRCULATIONCLIENT_H
+
+#include <QJsonObject>
+#include <QString>
+#include "librarycore.h"
+
+class QIODevice;
+
+// 借还书服务的同步客户端。接口与 LibraryCore 的同名操作一致，
+// 业务错误与通信错误都以 QString 异常抛出，界面代码可以原样切换。
+class CirculationClient
+{
+public:
+    CirculationClient();
+    ~CirculationClient();
+
+    // address 为 "主机:端口" 时使用 TCP，否则为本地服务名
+    bool connectTo(const QString &address, QString *error = nullptr);
+    void disconnectFromServer();
+    bool isConnected() const;
+    QString address() const { return serverAddress; }
+
+    // 等待应答的最长时间
+    void setTimeout(int ms) { timeoutMs = ms; }
+
+    // 服务端设置了访问令牌时，连接后在 ping 中带上；在 connectTo 之前设置
+    void setToken(const QString &token) { accessToken = token; }
+
+    LibraryCore::BorrowResult borrowBook(int bookId, int readerId, int days);
+    LibraryCore::BorrowResult borrowCopy(int copyId, int readerId, int days);
+    LibraryCore::ReturnResult returnBook(int recordId);
+    LibraryCore::RenewResult renewBook(int recordId);
+    LibraryCore::HoldResult placeHold(int bookId, int readerId);
+    void cancelHold(int holdId);
+    int expireHolds();
+    LibraryCore::Statistics statistics();
+
+    // 客户端直接修改了图书或读者后通知服务端作废缓存的记录
+    void invalidateBook(int id);
+    void invalidateReader(int id);
+
+    // 发送一条请求并等待对应的应答；ok 为 false 时抛出其中的错误
+    QJsonObject call(QJsonObject request);
+
+private:
+    QIODevice *socket;
+    QString serverAddress;
+    QString accessToken;
+    int nextId;
+    int timeoutMs;
+
+    Q_DISABLE_COPY(CirculationClient)
+};
+
+#endif // CIRCULATIONCLIENT_H
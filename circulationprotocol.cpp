@@ -0,0 +1,266 @@
+﻿// circulationprotocol.cpp
+#include "circulationprotocol.h"
+#include "perfmonitor.h"
+#include "schema.h"
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSqlError>
+
+namespace CirculationProtocol {
+
+QByteArray encode(const QJsonObject &message)
+{
+    return QJsonDocument(message).toJson(QJsonDocument::Compact) + '\n';
+}
+
+bool decode(const QByteArray &line, QJsonObject *message, QString *error)
+{
+    QJsonParseError parseError;
+    QJsonDocument document = QJsonDocument::fromJson(line, &parseError);
+    if (parseError.error != QJsonParseError::NoError || !document.isObject()) {
+        if (error) *error = "无效的请求：" + parseError.errorString();
+        return false;
+    }
+    *message = document.object();
+    return true;
+}
+
+bool isWrite(const QString &op)
+{
+    return op == "borrow" || op == "return" || op == "renew" || op == "hold" || op == "cancel-hold"
+        || op == "expire-holds" || op == "invalidate";
+}
+
+QJsonObject reply(const QJsonObject &request, const QJsonObject &fields)
+{
+    QJsonObject message = fields;
+    message.insert("id", request.value("id"));
+    message.insert("ok", true);
+    return message;
+}
+
+QJsonObject failure(const QJsonObject &request, const QString &error)
+{
+    QJsonObject message;
+    message.insert("id", request.value("id"));
+    message.insert("ok", false);
+    message.insert("error", error);
+    return message;
+}
+
+QJsonObject execute(LibraryCore &core, const QJsonObject &request)
+{
+    const QString op = request.value("op").toString();
+    try {
+        if (op == "borrow") {
+            if (request.contains("copyId")) {
+                return reply(request, toJson(core.borrowCopy(request.value("copyId").toInt(),
+                                                             request.value("readerId").toInt(),
+                                                             request.value("days").toInt(30))));
+            }
+            return reply(request, toJson(core.borrowBook(request.value("bookId").toInt(),
+                                                         request.value("readerId").toInt(),
+                                                         request.value("days").toInt(30))));
+        }
+        if (op == "return") {
+            return reply(request, toJson(core.returnBook(request.value("recordId").toInt())));
+        }
+        if (op == "renew") {
+            return reply(request, toJson(core.renewBook(request.value("recordId").toInt())));
+        }
+        if (op == "hold") {
+            return reply(request, toJson(core.placeHold(request.value("bookId").toInt(),
+                                                        request.value("readerId").toInt())));
+        }
+        if (op == "cancel-hold") {
+            core.cancelHold(request.value("holdId").toInt());
+            return reply(request);
+        }
+        if (op == "expire-holds") {
+            QJsonObject fields;
+            fields.insert("expired", core.expireHolds());
+            return reply(request, fields);
+        }
+        if (op == "invalidate") {
+            if (request.contains("book")) {
+                core.invalidateBook(request.value("book").toInt());
+            } else if (request.contains("reader")) {
+                core.invalidateReader(request.value("reader").toInt());
+            } else {
+                core.clearRecordCache();
+            }
+            return reply(request);
+        }
+    } catch (const QString &error) {
+        return failure(request, error);
+    }
+    return failure(request, "未知的操作：" + op);
+}
+
+QJsonObject query(const LibraryCore &core, const QJsonObject &request)
+{
+    const QString op = request.value("op").toString();
+    if (op == "ping") {
+        QJsonObject fields;
+        fields.insert("version", Version);
+        return reply(request, fields);
+    }
+    if (op == "statistics") {
+        return reply(request, toJson(core.statistics()));
+    }
+    if (op == "search") {
+        LibraryCore::BookSearch search;
+        search.id = request.value("id").isDouble() ? QString::number(request.value("id").toInt()) : QString();
+        search.title = request.value("title").toString();
+        search.author = request.value("author").toString();
+        search.isbn = request.value("isbn").toString();
+        search.category = request.value("category").toString();
+        search.status = request.value("status").toString();
+        const int limit = qBound(1, request.value("limit").toInt(100), 10000);
+
+        QString sql = QString("SELECT %1 FROM books").arg(Schema::columnList(Schema::kBooks));
+        const QString filter = LibraryCore::bookFilter(search);
+        if (!filter.isEmpty()) {
+            sql += " WHERE " + filter;
+        }
+        sql += QString(" ORDER BY id LIMIT %1").arg(limit);
+
+        TimedQuery sqlQuery(core.database());
+        sqlQuery.setForwardOnly(true);
+        if (!sqlQuery.exec(sql)) {
+            return failure(request, sqlQuery.lastError().text());
+        }
+        QJsonArray rows;
+        while (sqlQuery.next()) {
+            QJsonArray row;
+            for (int i = 0; i < Schema::Books::ColumnCount; ++i) {
+                row.append(QJsonValue::fromVariant(sqlQuery.value(i)));
+            }
+            rows.append(row);
+        }
+        QJsonObject fields;
+        fields.insert("rows", rows);
+        return reply(request, fields);
+    }
+    return failure(request, "未知的操作：" + op);
+}
+
+QJsonObject toJson(const LibraryCore::BorrowResult &result)
+{
+    QJsonObject fields;
+    fields.insert("recordId", result.recordId);
+    fields.insert("bookId", result.bookId);
+    fields.insert("bookTitle", result.bookTitle);
+    fields.insert("readerName", result.readerName);
+    fields.insert("dueDate", result.dueDate.toString(Qt::ISODate));
+    fields.insert("copyBarcode", result.copyBarcode);
+    return fields;
+}
+
+QJsonObject toJson(const LibraryCore::ReturnResult &result)
+{
+    QJsonObject fields;
+    fields.insert("bookId", result.bookId);
+    fields.insert("bookTitle", result.bookTitle);
+    fields.insert("readerName", result.readerName);
+    fields.insert("overdueDays", result.overdueDays);
+    fields.insert("overdueFee", result.overdueFee);
+    if (result.holdId) {
+        fields.insert("holdId", result.holdId);
+        fields.insert("holdReaderId", result.holdReaderId);
+        fields.insert("holdReaderName", result.holdReaderName);
+        fields.insert("pickupDeadline", result.pickupDeadline.toString(Qt::ISODate));
+    }
+    return fields;
+}
+
+QJsonObject toJson(const LibraryCore::RenewResult &result)
+{
+    QJsonObject fields;
+    fields.insert("bookTitle", result.bookTitle);
+    fields.insert("readerName", result.readerName);
+    fields.insert("newDueDate", result.newDueDate.toString(Qt::ISODate));
+    return fields;
+}
+
+QJsonObject toJson(const LibraryCore::HoldResult &result)
+{
+    QJsonObject fields;
+    fields.insert("holdId", result.holdId);
+    fields.insert("bookTitle", result.bookTitle);
+    fields.insert("readerName", result.readerName);
+    fields.insert("position", result.position);
+    return fields;
+}
+
+QJsonObject toJson(const LibraryCore::Statistics &stats)
+{
+    QJsonObject fields;
+    fields.insert("totalBooks", stats.totalBooks);
+    fields.insert("totalReaders", stats.totalReaders);
+    fields.insert("borrowedBooks", stats.borrowedBooks);
+    fields.insert("overdueBooks", stats.overdueBooks);
+    fields.insert("popularCategory", stats.popularCategory);
+    fields.insert("activeReaders", stats.activeReaders);
+    return fields;
+}
+
+LibraryCore::BorrowResult borrowResult(const QJsonObject &message)
+{
+    LibraryCore::BorrowResult result;
+    result.recordId = message.value("recordId").toInt();
+    result.bookId = message.value("bookId").toInt();
+    result.bookTitle = message.value("bookTitle").toString();
+    result.readerName = message.value("readerName").toString();
+    result.dueDate = QDate::fromString(message.value("dueDate").toString(), Qt::ISODate);
+    result.copyBarcode = message.value("copyBarcode").toString();
+    return result;
+}
+
+LibraryCore::ReturnResult returnResult(const QJsonObject &message)
+{
+    LibraryCore::ReturnResult result;
+    result.bookId = message.value("bookId").toInt();
+    result.bookTitle = message.value("bookTitle").toString();
+    result.readerName = message.value("readerName").toString();
+    result.overdueDays = message.value("overdueDays").toInt();
+    result.overdueFee = message.value("overdueFee").toDouble();
+    result.holdId = message.value("holdId").toInt();
+    result.holdReaderId = message.value("holdReaderId").toInt();
+    result.holdReaderName = message.value("holdReaderName").toString();
+    result.pickupDeadline = QDate::fromString(message.value("pickupDeadline").toString(), Qt::ISODate);
+    return result;
+}
+
+LibraryCore::RenewResult renewResult(const QJsonObject &message)
+{
+    LibraryCore::RenewResult result;
+    result.bookTitle = message.value("bookTitle").toString();
+    result.readerName = message.value("readerName").toString();
+    result.newDueDate = QDate::fromString(message.value("newDueDate").toString(), Qt::ISODate);
+    return result;
+}
+
+LibraryCore::HoldResult holdResult(const QJsonObject &message)
+{
+    LibraryCore::HoldResult result;
+    result.holdId = message.value("holdId").toInt();
+    result.bookTitle = message.value("bookTitle").toString();
+    result.readerName = message.value("readerName").toString();
+    result.position = message.value("position").toInt();
+    return result;
+}
+
+LibraryCore::Statistics statistics(const QJsonObject &message)
+{
+    LibraryCore::Statistics stats;
+    stats.totalBooks = message.value("totalBooks").toInt();
+    stats.totalReaders = message.value("totalReaders").toInt();
+    stats.borrowedBooks = message.value("borrowedBooks").toInt();
+    stats.overdueBooks = message.value("overdueBooks").toInt();
+    stats.popularCategory = message.value("popularCategory").toString();
+    stats.activeReaders = message.value("activeReaders").toInt();
+    return stats;
+}
+
+} // namespace CirculationProtocol
@@ -0,0 +1,65 @@
+﻿// circulationprotocol.h
+#ifndef CIRCULATIONPROTOCOL_H
+#define CIRCULATIONPROTOCOL_H
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QString>
+#include "librarycore.h"
+
+// 借还书服务的通信协议：每条消息是一行紧凑 JSON，以 '\n' 结尾。
+//
+//   请求  {"id":1,"op":"borrow","bookId":12,"readerId":3,"days":30}
+//   成功  {"id":1,"ok":true,"recordId":88,"bookId":12,"bookTitle":"…","readerName":"…","dueDate":"2024-02-01"}
+//   失败  {"id":1,"ok":false,"error":"该图书已全部借出！"}
+//
+// id 由客户端分配，服务端原样带回；同一连接上的应答可能不按请求顺序返回。
+//
+// 写操作（由服务端唯一的写线程执行）：
+//   borrow      bookId 或 copyId（单册）, readerId, days；应答另带 copyBarcode
+//   return      recordId；归还的这一册分给了预约时应答另带 holdId、holdReaderName、pickupDeadline
+//   renew       recordId
+//   hold        bookId, readerId → holdId, position
+//   cancel-hold holdId
+//   expire-holds → expired：过期的保留数
+//   invalidate  book 或 reader（ID）；都不给时清空记录缓存。客户端直接改了图书或读者后发送
+// 读操作（在线程池中用只读连接执行）：
+//   ping        token（服务端设置了访问令牌时必须带上，TCP 连接的第一条请求）→ version
+//   statistics
+//   search      title, author, isbn, category, status, id, limit（默认 100）→ rows：按 Schema 列顺序的数组
+namespace CirculationProtocol {
+
+const int Version = 4;
+
+// 客户端未指定时使用的本地服务名
+const char *const DefaultServerName = "library-circulation";
+
+QByteArray encode(const QJsonObject &message);
+
+// 解析一行；格式错误时返回 false
+bool decode(const QByteArray &line, QJsonObject *message, QString *error = nullptr);
+
+bool isWrite(const QString &op);
+
+QJsonObject reply(const QJsonObject &request, const QJsonObject &fields = QJsonObject());
+QJsonObject failure(const QJsonObject &request, const QString &error);
+
+// 在给定的 LibraryCore 上执行一条请求并生成应答，业务错误转换为 ok:false
+QJsonObject execute(LibraryCore &core, const QJsonObject &request);
+QJsonObject query(const LibraryCore &core, const QJsonObject &request);
+
+QJsonObject toJson(const LibraryCore::BorrowResult &result);
+QJsonObject toJson(const LibraryCore::ReturnResult &result);
+QJsonObject toJson(const LibraryCore::RenewResult &result);
+QJsonObject toJson(const LibraryCore::HoldResult &result);
+QJsonObject toJson(const LibraryCore::Statistics &stats);
+
+LibraryCore::BorrowResult borrowResult(const QJsonObject &message);
+LibraryCore::ReturnResult returnResult(const QJsonObject &message);
+LibraryCore::RenewResult renewResult(const QJsonObject &message);
+LibraryCore::HoldResult holdResult(const QJsonObject &message);
+LibraryCore::Statistics statistics(const QJsonObject &message);
+
+} // namespace CirculationProtocol
+
+#endif // CIRCULATIONPROTOCOL_H
@@ -0,0 +1,167 @@
+﻿// circulationrollup.cpp
+#include "circulationrollup.h"
+#include <QtSql>
+
+namespace {
+
+struct Dimension
+{
+    const char *table;
+    const char *keyColumn;
+    const char *keyType;
+    const char *triggerKey;  // 触发器中由 NEW 行求出维度值
+    const char *rebuildKey;  // 重建时由事件行 e 求出维度值
+    const char *rebuildJoin;
+};
+
+const Dimension kDimensions[] = {
+    {"rollup_daily_book", "book_id", "INTEGER",
+     "NEW.book_id", "e.book_id", ""},
+    {"rollup_daily_reader", "reader_id", "INTEGER",
+     "NEW.reader_id", "e.reader_id", ""},
+    {"rollup_daily_category", "category", "TEXT",
+     "COALESCE((SELECT category FROM books WHERE id = NEW.book_id), '未分类')",
+     "COALESCE(b.category, '未分类')", "LEFT JOIN books b ON b.id = e.book_id"},
+    {"rollup_daily_reader_type", "reader_type", "TEXT",
+     "COALESCE((SELECT reader_type FROM readers WHERE id = NEW.reader_id), '未分类')",
+     "COALESCE(r.reader_type, '未分类')", "LEFT JOIN readers r ON r.id = e.reader_id"},
+};
+
+// 对所有维度的当天计数加一
+QString incrementStatements(const QString &dayExpr, const QString &counter)
+{
+    QString statements;
+    for (const Dimension &dimension : kDimensions) {
+        statements += QString("INSERT OR IGNORE INTO %1 (day, %2) VALUES (%3, %4); "
+                              "UPDATE %1 SET %5 = %5 + 1 WHERE day = %3 AND %2 = %4; ")
+                          .arg(dimension.table, dimension.keyColumn, dayExpr,
+                               dimension.triggerKey, counter);
+    }
+    return statements;
+}
+
+} // namespace
+
+bool CirculationRollup::install(QSqlDatabase db, QString *error)
+{
+    QSqlQuery query(db);
+
+    query.exec("SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'rollup_daily_book'");
+    bool created = query.next() && query.value(0).toInt() == 0;
+
+    for (const Dimension &dimension : kDimensions) {
+        // 按 (day, 维度) 聚簇，时间范围查询只扫描对应日期的行
+        if (!query.exec(QString("CREATE TABLE IF NOT EXISTS %1 ("
+                                "day DATE NOT NULL,"
+                                "%2 %3 NOT NULL,"
+                                "loans INTEGER NOT NULL DEFAULT 0,"
+                                "returns INTEGER NOT NULL DEFAULT 0,"
+                                "renewals INTEGER NOT NULL DEFAULT 0,"
+                                "PRIMARY KEY (day, %2)) WITHOUT ROWID")
+                            .arg(dimension.table, dimension.keyColumn, dimension.keyType))) {
+            if (error) *error = query.lastError().text();
+            return false;
+        }
+    }
+
+    // 已有汇总表的旧数据库升级时不需要重建
+    if (!query.exec("CREATE TABLE IF NOT EXISTS rollup_state ("
+                    "id INTEGER PRIMARY KEY CHECK (id = 1),"
+                    "stale INTEGER NOT NULL DEFAULT 0)")
+        || !query.exec(QString("INSERT OR IGNORE INTO rollup_state (id, stale) VALUES (1, %1)").arg(created ? 1 : 0))) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+
+    const QString today = "date('now', 'localtime')";
+    QStringList triggers = {
+        "CREATE TRIGGER rollup_loan AFTER INSERT ON borrow_records BEGIN "
+            + incrementStatements("NEW.borrow_date", "loans") + "END",
+        "CREATE TRIGGER rollup_return AFTER UPDATE OF status ON borrow_records "
+        "WHEN OLD.status = '借出' AND NEW.status = '已还' BEGIN "
+            + incrementStatements(QString("COALESCE(NEW.return_date, %1)").arg(today), "returns") + "END",
+        "CREATE TRIGGER rollup_renew AFTER UPDATE OF renew_count ON borrow_records "
+        "WHEN NEW.renew_count > OLD.renew_count BEGIN "
+            + incrementStatements(today, "renewals") + "END"
+    };
+
+    for (const QString &name : QStringList{"rollup_loan", "rollup_return", "rollup_renew"}) {
+        query.exec(QString("DROP TRIGGER IF EXISTS %1").arg(name));
+    }
+    for (const QString &trigger : triggers) {
+        if (!query.exec(trigger)) {
+            if (error) *error = query.lastError().text();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool CirculationRollup::isStale(QSqlDatabase db)
+{
+    QSqlQuery query(db);
+    return query.exec("SELECT stale FROM rollup_state WHERE id = 1") && query.next() && query.value(0).toInt() != 0;
+}
+
+bool CirculationRollup::markFresh(QSqlDatabase db, QString *error)
+{
+    QSqlQuery query(db);
+    if (!query.exec("UPDATE rollup_state SET stale = 0 WHERE id = 1")) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool CirculationRollup::markStale(QSqlDatabase db, QString *error)
+{
+    QSqlQuery query(db);
+    if (!query.exec("UPDATE rollup_state SET stale = 1 WHERE id = 1")) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool CirculationRollup::rebuild(QSqlDatabase db, QString *error)
+{
+    QSqlQuery query(db);
+
+    // 归档库不可用时只汇总主库
+    query.exec("SELECT COUNT(*) FROM sqlite_temp_master WHERE type = 'view' AND name = 'all_borrow_records'");
+    bool hasArchive = query.next() && query.value(0).toInt() > 0;
+    const QString records = hasArchive ? "all_borrow_records" : "borrow_records";
+    const QString history = hasArchive ? "all_borrow_history" : "borrow_history";
+
+    const QString events = QString(
+        "SELECT borrow_date AS day, book_id, reader_id, 1 AS loans, 0 AS returns, 0 AS renewals FROM %1 "
+        "UNION ALL "
+        "SELECT return_date, book_id, reader_id, 0, 1, 0 FROM %1 WHERE return_date IS NOT NULL "
+        "UNION ALL "
+        "SELECT date(action_date, 'localtime'), book_id, reader_id, 0, 0, 1 FROM %2 WHERE action = '续借'")
+        .arg(records, history);
+
+    db.transaction();
+    for (const Dimension &dimension : kDimensions) {
+        query.exec(QString("DELETE FROM %1").arg(dimension.table));
+        if (!query.exec(QString("INSERT INTO %1 (day, %2, loans, returns, renewals) "
+                                "SELECT e.day, %3, SUM(e.loans), SUM(e.returns), SUM(e.renewals) "
+                                "FROM (%4) e %5 "
+                                "WHERE e.day IS NOT NULL "
+                                "GROUP BY 1, 2")
+                            .arg(dimension.table, dimension.keyColumn, dimension.rebuildKey,
+                                 events, dimension.rebuildJoin))) {
+            if (error) *error = query.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+    // 写锁在 DELETE 时取得，汇总期间的借还书要等提交后才能写入，不会漏算
+    if (!query.exec("UPDATE rollup_state SET stale = 0 WHERE id = 1")) {
+        if (error) *error = query.lastError().text();
+        db.rollback();
+        return false;
+    }
+    return db.commit();
+}
@@ -0,0 +1,31 @@
+﻿// circulationrollup.h
+#ifndef CIRCULATIONROLLUP_H
+#define CIRCULATIONROLLUP_H
+
+#include <QSqlDatabase>
+#include <QString>
+
+// 借阅汇总表：按天统计每本书、每位读者、每个分类、每种读者类型的
+// 借出、归还、续借次数。触发器在每次借还书时增量维护，报表只需
+// 扫描汇总行而不是全部借阅记录；汇总表可随时从历史数据重新生成。
+class CirculationRollup
+{
+public:
+    // 建表与触发器。汇总表首次创建时是空的，只标记为待重建，
+    // 由调用方另开连接调用 rebuild，不在打开数据库时汇总全部历史
+    static bool install(QSqlDatabase db, QString *error = nullptr);
+
+    // 汇总表还没有按历史数据生成过
+    static bool isStale(QSqlDatabase db);
+
+    // 汇总行由别处直接写入（如测试数据生成器）后清除待重建标记
+    static bool markFresh(QSqlDatabase db, QString *error = nullptr);
+
+    // 汇总不再可信（如按时间点恢复重放了日志）时标记为待重建，由调用方在后台重建
+    static bool markStale(QSqlDatabase db, QString *error = nullptr);
+
+    // 清空并按 all_borrow_records / all_borrow_history 重新汇总，同时清除待重建标记
+    static bool rebuild(QSqlDatabase db, QString *error = nullptr);
+};
+
+#endif // CIRCULATIONROLLUP_H
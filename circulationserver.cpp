@@ -0,0 +1,302 @@
+﻿// circulationserver.cpp
+#include "circulationserver.h"
+#include "circulationprotocol.h"
+#include "perfmonitor.h"
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QMutexLocker>
+#include <QSqlDatabase>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+namespace {
+
+// 一行请求的上限，超出说明对端不是本协议的客户端
+const qint64 kMaxLineBytes = 1024 * 1024;
+
+const char *const kWriterConnection = "circulation_writer";
+
+// 连接上的动态属性：已通过令牌认证（本地套接字与未设令牌时的 TCP 连接一开始就是）
+const char *const kAuthenticatedProperty = "circulationAuthenticated";
+
+// 默认每组最多 64 个操作、最多等待 5 毫秒
+const int kDefaultGroupOps = 64;
+const int kDefaultGroupDelayMs = 5;
+
+} // namespace
+
+CirculationWriter::CirculationWriter(const QString &databasePath, QObject *parent)
+    : QObject(parent)
+    , databasePath(databasePath)
+    , core(QLatin1String(kWriterConnection))
+    , maxGroupOps(kDefaultGroupOps)
+    , maxGroupDelayMs(kDefaultGroupDelayMs)
+    , scheduled(false)
+{
+}
+
+void CirculationWriter::setGroupLimits(int maxOps, int maxDelayMs)
+{
+    maxGroupOps = qMax(1, maxOps);
+    maxGroupDelayMs = qMax(0, maxDelayMs);
+}
+
+bool CirculationWriter::open()
+{
+    if (!core.open(databasePath, &openError)) {
+        return false;
+    }
+    // 服务在打开数据库之后才开始监听，新建的汇总表在写线程上直接生成，不会有请求在等
+    core.rebuildStaleExtensions();
+    return true;
+}
+
+void CirculationWriter::close()
+{
+    core.close();
+    QSqlDatabase::removeDatabase(QLatin1String(kWriterConnection));
+}
+
+void CirculationWriter::enqueue(quint64 ticket, const QJsonObject &request)
+{
+    bool wake;
+    {
+        QMutexLocker locker(&mutex);
+        pending.enqueue(Pending{ticket, request});
+        wake = !scheduled;
+        scheduled = true;
+    }
+    // 正在攒组的写线程直接被唤醒取走新请求；空闲时才投递一次 drain
+    arrived.wakeOne();
+    if (wake) {
+        QMetaObject::invokeMethod(this, "drain", Qt::QueuedConnection);
+    }
+}
+
+void CirculationWriter::drain()
+{
+    for (;;) {
+        {
+            QMutexLocker locker(&mutex);
+            if (pending.isEmpty()) {
+                scheduled = false;
+                return;
+            }
+        }
+
+        ScopedTimer timer("成组提交");
+        QString error;
+        const bool grouped = maxGroupOps > 1 && core.beginGroup(&error);
+        QElapsedTimer window;
+        window.start();
+
+        QVector<quint64> tickets;
+        QVector<QJsonObject> requests;
+        QVector<QJsonObject> responses;
+        while (tickets.size() < maxGroupOps) {
+            Pending item;
+            {
+                QMutexLocker locker(&mutex);
+                // 组内还有名额时在时限内等后续请求，单独提交时只取已到达的
+                while (pending.isEmpty() && grouped) {
+                    const qint64 remaining = maxGroupDelayMs - window.elapsed();
+                    if (remaining <= 0 || !arrived.wait(&mutex, static_cast<unsigned long>(remaining))) {
+                        break;
+                    }
+                }
+                if (pending.isEmpty()) {
+                    break;
+                }
+                item = pending.dequeue();
+            }
+            tickets.append(item.ticket);
+            requests.append(item.request);
+            responses.append(CirculationProtocol::execute(core, item.request));
+        }
+
+        // 整组提交失败时组内的操作都没有生效，逐个改为失败应答
+        if (grouped && !core.commitGroup(&error)) {
+            for (int i = 0; i < responses.size(); ++i) {
+                responses[i] = CirculationProtocol::failure(requests.at(i), "借还书提交失败：" + error);
+            }
+        }
+        for (int i = 0; i < responses.size(); ++i) {
+            emit replied(tickets.at(i), CirculationProtocol::encode(responses.at(i)));
+        }
+    }
+}
+
+CirculationServer::CirculationServer(const QString &databasePath, QObject *parent)
+    : QObject(parent)
+    , databasePath(databasePath)
+    , localServer(new QLocalServer(this))
+    , tcpServer(new QTcpServer(this))
+    , tcpAddress(QHostAddress::LocalHost)
+    , writer(new CirculationWriter(databasePath))
+    , nextTicket(1)
+    , connections(0)
+{
+    writer->moveToThread(&writerThread);
+    connect(&writerThread, &QThread::finished, writer, &QObject::deleteLater);
+    connect(writer, &CirculationWriter::replied, this, &CirculationServer::sendReply);
+    connect(localServer, &QLocalServer::newConnection, this, &CirculationServer::acceptLocal);
+    connect(tcpServer, &QTcpServer::newConnection, this, &CirculationServer::acceptTcp);
+    writerThread.setObjectName("CirculationWriter");
+}
+
+CirculationServer::~CirculationServer()
+{
+    localServer->close();
+    tcpServer->close();
+    if (writerThread.isRunning()) {
+        QMetaObject::invokeMethod(writer, "close", Qt::BlockingQueuedConnection);
+        writerThread.quit();
+        writerThread.wait();
+    } else {
+        delete writer;
+    }
+}
+
+bool CirculationServer::listen(const QString &name, quint16 tcpPort, QString *error)
+{
+    // 其他主机能连上的端口可以借还任何书，不能没有认证
+    if (tcpPort && !tcpAddress.isLoopback() && accessToken.isEmpty()) {
+        if (error) *error = QString("在 %1 上监听时必须设置访问令牌").arg(tcpAddress.toString());
+        return false;
+    }
+
+    writerThread.start();
+    bool opened = false;
+    QMetaObject::invokeMethod(writer, "open", Qt::BlockingQueuedConnection, Q_RETURN_ARG(bool, opened));
+    if (!opened) {
+        if (error) *error = "无法打开数据库：" + writer->lastError();
+        return false;
+    }
+
+    // 上次异常退出可能留下同名的套接字文件
+    QLocalServer::removeServer(name);
+    if (!localServer->listen(name)) {
+        if (error) *error = "无法监听本地服务 " + name + "：" + localServer->errorString();
+        return false;
+    }
+    if (tcpPort && !tcpServer->listen(tcpAddress, tcpPort)) {
+        if (error) *error = QString("无法监听端口 %1：%2").arg(tcpPort).arg(tcpServer->errorString());
+        return false;
+    }
+    return true;
+}
+
+void CirculationServer::setTcpAccess(const QHostAddress &address, const QByteArray &token)
+{
+    tcpAddress = address;
+    accessToken = token;
+}
+
+bool CirculationServer::tokenMatches(const QByteArray &token) const
+{
+    // 逐字节比较全部内容，比较耗时不随第一个不同字节的位置变化
+    if (token.size() != accessToken.size()) {
+        return false;
+    }
+    char difference = 0;
+    for (int i = 0; i < token.size(); ++i) {
+        difference |= token.at(i) ^ accessToken.at(i);
+    }
+    return difference == 0;
+}
+
+void CirculationServer::setGroupLimits(int maxOps, int maxDelayMs)
+{
+    writer->setGroupLimits(maxOps, maxDelayMs);
+}
+
+void CirculationServer::acceptLocal()
+{
+    while (QLocalSocket *socket = localServer->nextPendingConnection()) {
+        connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+        addConnection(socket, true);
+    }
+}
+
+void CirculationServer::acceptTcp()
+{
+    while (QTcpSocket *socket = tcpServer->nextPendingConnection()) {
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+        addConnection(socket, accessToken.isEmpty());
+    }
+}
+
+void CirculationServer::addConnection(QIODevice *socket, bool authenticated)
+{
+    ++connections;
+    socket->setProperty(kAuthenticatedProperty, authenticated);
+    connect(socket, &QObject::destroyed, this, [this]() { --connections; });
+    connect(socket, &QIODevice::readyRead, this, [this, socket]() { readRequests(socket); });
+}
+
+void CirculationServer::readRequests(QIODevice *socket)
+{
+    while (socket->canReadLine()) {
+        const QByteArray line = socket->readLine().trimmed();
+        if (line.isEmpty()) {
+            continue;
+        }
+
+        QJsonObject request;
+        QString error;
+        if (!CirculationProtocol::decode(line, &request, &error)) {
+            socket->write(CirculationProtocol::encode(CirculationProtocol::failure(QJsonObject(), error)));
+            continue;
+        }
+
+        // 未认证的连接只接受带正确令牌的 ping，否则应答后断开
+        if (!socket->property(kAuthenticatedProperty).toBool()) {
+            if (request.value("op").toString() != "ping" || !tokenMatches(request.value("token").toString().toUtf8())) {
+                socket->write(CirculationProtocol::encode(CirculationProtocol::failure(request, "访问令牌不正确")));
+                socket->close();
+                return;
+            }
+            socket->setProperty(kAuthenticatedProperty, true);
+        }
+
+        const quint64 ticket = nextTicket++;
+        waiting.insert(ticket, socket);
+        if (CirculationProtocol::isWrite(request.value("op").toString())) {
+            writer->enqueue(ticket, request);
+        } else {
+            runQuery(ticket, request);
+        }
+    }
+
+    if (socket->bytesAvailable() > kMaxLineBytes) {
+        socket->close();
+    }
+}
+
+void CirculationServer::runQuery(quint64 ticket, const QJsonObject &request)
+{
+    QFutureWatcher<QByteArray> *watcher = new QFutureWatcher<QByteArray>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, ticket, request]() {
+        QByteArray response = watcher->result();
+        if (response.isEmpty()) {
+            response = CirculationProtocol::encode(CirculationProtocol::failure(request, "无法打开数据库"));
+        }
+        sendReply(ticket, response);
+        watcher->deleteLater();
+    });
+    watcher->setFuture(LibraryCore::runReadOnly<QByteArray>(databasePath,
+        [request](const LibraryCore &reader) -> QByteArray {
+            return CirculationProtocol::encode(CirculationProtocol::query(reader, request));
+        }));
+}
+
+void CirculationServer::sendReply(quint64 ticket, const QByteArray &response)
+{
+    QPointer<QIODevice> socket = waiting.take(ticket);
+    if (socket && socket->isOpen()) {
+        socket->write(response);
+    }
+}
@@ -0,0 +1,120 @@
+﻿// circulationserver.h
+#ifndef CIRCULATIONSERVER_H
+#define CIRCULATIONSERVER_H
+
+#include <QHash>
+#include <QHostAddress>
+#include <QJsonObject>
+#include <QMutex>
+#include <QObject>
+#include <QPointer>
+#include <QQueue>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+#include "librarycore.h"
+
+class QIODevice;
+class QLocalServer;
+class QTcpServer;
+
+// 服务端唯一的写线程：借还书请求排队后按到达顺序在同一个连接上执行，
+// 各服务台之间不再争抢 SQLite 的写锁。
+// 请求成组提交：一组最多 maxGroupOps 个操作，或从组开始起最多再等 maxGroupDelayMs
+// 毫秒，整组只提交（落盘）一次；每个操作在自己的保存点中执行，失败互不影响。
+// 应答在整组提交之后才发出。
+class CirculationWriter : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CirculationWriter(const QString &databasePath, QObject *parent = nullptr);
+
+    // 可在任意线程调用；应答通过 replied 信号发出
+    void enqueue(quint64 ticket, const QJsonObject &request);
+
+    QString lastError() const { return openError; }
+
+    // maxOps 为 1 时每个操作单独提交；在 open 之前设置
+    void setGroupLimits(int maxOps, int maxDelayMs);
+
+public slots:
+    // 须在写线程中调用
+    bool open();
+    void close();
+
+signals:
+    void replied(quint64 ticket, const QByteArray &response);
+
+private slots:
+    void drain();
+
+private:
+    struct Pending
+    {
+        quint64 ticket;
+        QJsonObject request;
+    };
+
+    QString databasePath;
+    QString openError;
+    LibraryCore core;
+
+    int maxGroupOps;
+    int maxGroupDelayMs;
+
+    QMutex mutex;
+    QWaitCondition arrived;
+    QQueue<Pending> pending;
+    bool scheduled;
+};
+
+// 借还书服务：在本地套接字（可选再加 TCP 端口）上接收 CirculationProtocol 请求。
+// 写操作交给写线程，读操作在线程池中用只读连接执行，连接本身由主线程的事件循环处理。
+// TCP 默认只监听本机；设置了访问令牌时，TCP 连接要先用带正确令牌的 ping 认证，
+// 认证之前的其他请求一律拒绝并断开。
+class CirculationServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CirculationServer(const QString &databasePath, QObject *parent = nullptr);
+    ~CirculationServer();
+
+    // tcpPort 为 0 时不监听 TCP
+    bool listen(const QString &name, quint16 tcpPort = 0, QString *error = nullptr);
+
+    // TCP 监听的地址（默认 127.0.0.1）与访问令牌；监听非本机地址时必须设置令牌。在 listen 之前设置
+    void setTcpAccess(const QHostAddress &address, const QByteArray &token);
+
+    // 写操作成组提交的上限，见 CirculationWriter；在 listen 之前设置
+    void setGroupLimits(int maxOps, int maxDelayMs);
+
+    int connectionCount() const { return connections; }
+
+private slots:
+    void acceptLocal();
+    void acceptTcp();
+    void sendReply(quint64 ticket, const QByteArray &response);
+
+private:
+    void addConnection(QIODevice *socket, bool authenticated);
+    bool tokenMatches(const QByteArray &token) const;
+    void readRequests(QIODevice *socket);
+    void runQuery(quint64 ticket, const QJsonObject &request);
+
+    QString databasePath;
+    QLocalServer *localServer;
+    QTcpServer *tcpServer;
+    QHostAddress tcpAddress;
+    QByteArray accessToken;
+    QThread writerThread;
+    CirculationWriter *writer;
+
+    // 等待应答的请求所属的连接，连接断开后应答直接丢弃
+    QHash<quint64, QPointer<QIODevice> > waiting;
+    quint64 nextTicket;
+    int connections;
+};
+
+#endif // CIRCULATIONSERVER_H
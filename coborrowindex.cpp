@@ -0,0 +1,351 @@
+﻿// coborrowindex.cpp
+#include "coborrowindex.h"
+#include "perfmonitor.h"
+#include <QtSql>
+#include <QtConcurrent>
+#include <QThread>
+#include <algorithm>
+
+namespace {
+
+// 每本书保留的关联图书数；触发器在超过两倍时才裁剪，新出现的关联有机会累计起来
+const int kKeep = 20;
+
+struct Pair
+{
+    int bookId;
+    int otherId;
+    int together;
+};
+
+// 计算一段连续图书编号的关联，供 QtConcurrent::blockingMapped 调用。
+// 各段只写自己的计数数组，互不加锁
+class RangeCounter
+{
+public:
+    typedef QVector<Pair> result_type;
+
+    RangeCounter(const QVector<QVector<int> > *baskets, const QVector<QVector<int> > *postings)
+        : baskets(baskets), postings(postings)
+    {
+    }
+
+    QVector<Pair> operator()(const QPair<int, int> &range) const
+    {
+        QVector<Pair> pairs;
+        QVector<int> counts(postings->size(), 0);
+        QVector<int> touched;
+        for (int book = range.first; book < range.second; ++book) {
+            for (int basket : postings->at(book)) {
+                for (int other : baskets->at(basket)) {
+                    if (other != book && counts[other]++ == 0) {
+                        touched.append(other);
+                    }
+                }
+            }
+
+            const int keep = qMin(kKeep, touched.size());
+            std::partial_sort(touched.begin(), touched.begin() + keep, touched.end(), [&counts](int a, int b) {
+                return counts.at(a) != counts.at(b) ? counts.at(a) > counts.at(b) : a < b;
+            });
+            for (int i = 0; i < keep; ++i) {
+                pairs.append(Pair{book, touched.at(i), counts.at(touched.at(i))});
+            }
+            for (int other : touched) {
+                counts[other] = 0;
+            }
+            touched.clear();
+        }
+        return pairs;
+    }
+
+private:
+    const QVector<QVector<int> > *baskets;
+    const QVector<QVector<int> > *postings;
+};
+
+// 读者第一次借某本书时维护关联的语句，reader 与 book 为读者与图书编号的 SQL 表达式。
+// 该读者借过的其他书取自 coborrow_seen，已归档的借阅也在其中；两个方向都加了一行，
+// 新书与其他每本书的列表都要裁剪。最后把这本书记为该读者借过
+QStringList loanStatements(const QString &reader, const QString &book)
+{
+    const QString others = QString("SELECT book_id FROM coborrow_seen WHERE reader_id = %1 AND book_id <> %2")
+                               .arg(reader, book);
+    return QStringList{
+        QString("INSERT OR IGNORE INTO coborrow (book_id, other_id) SELECT %1, book_id FROM (%2)").arg(book, others),
+        QString("UPDATE coborrow SET together = together + 1 WHERE book_id = %1 AND other_id IN (%2)").arg(book, others),
+        QString("INSERT OR IGNORE INTO coborrow (book_id, other_id) SELECT book_id, %1 FROM (%2)").arg(book, others),
+        QString("UPDATE coborrow SET together = together + 1 WHERE book_id IN (%2) AND other_id = %1").arg(book, others),
+        QString("DELETE FROM coborrow WHERE book_id = %1 "
+                "AND (SELECT COUNT(*) FROM coborrow WHERE book_id = %1) > %3 "
+                "AND other_id NOT IN (SELECT other_id FROM coborrow WHERE book_id = %1 "
+                "ORDER BY together DESC, other_id LIMIT %2)").arg(book).arg(kKeep).arg(2 * kKeep),
+        QString("DELETE FROM coborrow WHERE book_id IN (%1) "
+                "AND (SELECT COUNT(*) FROM coborrow c WHERE c.book_id = coborrow.book_id) > %3 "
+                "AND other_id NOT IN (SELECT c.other_id FROM coborrow c WHERE c.book_id = coborrow.book_id "
+                "ORDER BY c.together DESC, c.other_id LIMIT %2)").arg(others).arg(kKeep).arg(2 * kKeep),
+        QString("INSERT OR IGNORE INTO coborrow_seen (reader_id, book_id) VALUES (%1, %2)").arg(reader, book)
+    };
+}
+
+} // namespace
+
+bool CoBorrowIndex::install(QSqlDatabase db, QString *error)
+{
+    QSqlQuery query(db);
+
+    query.exec("SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'coborrow'");
+    bool created = query.next() && query.value(0).toInt() == 0;
+
+    // 按 (book_id, other_id) 聚簇，一本书的关联是一段连续的行
+    if (!query.exec("CREATE TABLE IF NOT EXISTS coborrow ("
+                    "book_id INTEGER NOT NULL,"
+                    "other_id INTEGER NOT NULL,"
+                    "together INTEGER NOT NULL DEFAULT 0,"
+                    "PRIMARY KEY (book_id, other_id)) WITHOUT ROWID")) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+
+    // 每位读者借过哪些书（含已归档的借阅）。触发器不能引用附加的归档库，
+    // 读者是否第一次借某本书、借过哪些别的书都按此表判断，由重建按全部借阅记录生成
+    query.exec("SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'coborrow_seen'");
+    created = (query.next() && query.value(0).toInt() == 0) || created;
+    if (!query.exec("CREATE TABLE IF NOT EXISTS coborrow_seen ("
+                    "reader_id INTEGER NOT NULL,"
+                    "book_id INTEGER NOT NULL,"
+                    "PRIMARY KEY (reader_id, book_id)) WITHOUT ROWID")) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+
+    // 已有关联表的旧数据库升级时不需要重建；新增了借过表的要重建一次
+    if (!query.exec("CREATE TABLE IF NOT EXISTS coborrow_state ("
+                    "id INTEGER PRIMARY KEY CHECK (id = 1),"
+                    "stale INTEGER NOT NULL DEFAULT 0)")
+        || !query.exec(QString("INSERT OR IGNORE INTO coborrow_state (id, stale) VALUES (1, %1)").arg(created ? 1 : 0))
+        || (created && !query.exec("UPDATE coborrow_state SET stale = 1 WHERE id = 1"))) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+
+    // 借书时按读者与图书查重
+    if (!query.exec("CREATE INDEX IF NOT EXISTS idx_borrow_records_reader_book ON borrow_records(reader_id, book_id)")) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+
+    // 同一读者重复借同一本书（包括早先的借阅已归档的）不再计数
+    const QString trigger = QString(
+        "CREATE TRIGGER coborrow_loan AFTER INSERT ON borrow_records "
+        "WHEN NOT EXISTS (SELECT 1 FROM coborrow_seen "
+        "WHERE reader_id = NEW.reader_id AND book_id = NEW.book_id) BEGIN %1; END")
+        .arg(loanStatements("NEW.reader_id", "NEW.book_id").join("; "));
+
+    query.exec("DROP TRIGGER IF EXISTS coborrow_loan");
+    if (!query.exec(trigger)) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
+bool CoBorrowIndex::isStale(QSqlDatabase db)
+{
+    QSqlQuery query(db);
+    return query.exec("SELECT stale FROM coborrow_state WHERE id = 1") && query.next() && query.value(0).toInt() != 0;
+}
+
+bool CoBorrowIndex::markStale(QSqlDatabase db, QString *error)
+{
+    QSqlQuery query(db);
+    if (!query.exec("UPDATE coborrow_state SET stale = 1 WHERE id = 1")) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool CoBorrowIndex::rebuild(QSqlDatabase db, QString *error)
+{
+    ScopedTimer timer("重建借阅关联");
+    QSqlQuery query(db);
+
+    // 归档库不可用时只统计主库
+    query.exec("SELECT COUNT(*) FROM sqlite_temp_master WHERE type = 'view' AND name = 'all_borrow_records'");
+    bool hasArchive = query.next() && query.value(0).toInt() > 0;
+    const QString records = hasArchive ? "all_borrow_records" : "borrow_records";
+
+    // 最大记录号与篮子在同一个读事务中读取，是同一时刻的快照；不持有写锁，借还书照常进行。
+    // 快照之后新增的借阅记录在写回时补算
+    if (!db.transaction()) {
+        if (error) *error = db.lastError().text();
+        return false;
+    }
+    query.setForwardOnly(true);
+    if (!query.exec(QString("SELECT IFNULL(MAX(id), 0) FROM %1").arg(records)) || !query.next()) {
+        if (error) *error = query.lastError().text();
+        db.rollback();
+        return false;
+    }
+    const qint64 snapshotId = query.value(0).toLongLong();
+
+    // 每位读者借过的图书（去重）为一个篮子；只借过一本书的读者没有关联，但仍记为借过
+    QVector<QVector<int> > baskets;
+    QVector<QPair<int, int> > seen;
+    int maxBookId = 0;
+    if (!query.exec(QString("SELECT reader_id, book_id FROM %1 GROUP BY reader_id, book_id ORDER BY reader_id").arg(records))) {
+        if (error) *error = query.lastError().text();
+        db.rollback();
+        return false;
+    }
+    int currentReader = -1;
+    QVector<int> basket;
+    auto closeBasket = [&baskets, &basket]() {
+        if (basket.size() > 1) {
+            baskets.append(basket);
+        }
+        basket.clear();
+    };
+    while (query.next()) {
+        const int readerId = query.value(0).toInt();
+        const int bookId = query.value(1).toInt();
+        if (readerId != currentReader) {
+            closeBasket();
+            currentReader = readerId;
+        }
+        if (bookId > 0) {
+            basket.append(bookId);
+            seen.append(qMakePair(readerId, bookId));
+            maxBookId = qMax(maxBookId, bookId);
+        }
+    }
+    closeBasket();
+    query.finish();
+    db.commit();
+
+    // 倒排：每本书出现在哪些篮子中
+    QVector<QVector<int> > postings(maxBookId + 1);
+    for (int i = 0; i < baskets.size(); ++i) {
+        for (int bookId : baskets.at(i)) {
+            postings[bookId].append(i);
+        }
+    }
+
+    // 图书编号分段并行计数，段数多于线程数以平衡热门图书集中的段
+    const int threads = qMax(1, QThread::idealThreadCount());
+    const int chunkBooks = qMax(1, (maxBookId + threads * 4) / (threads * 4));
+    QVector<QPair<int, int> > chunks;
+    for (int first = 1; first <= maxBookId; first += chunkBooks) {
+        chunks.append(qMakePair(first, qMin(maxBookId + 1, first + chunkBooks)));
+    }
+    const QList<QVector<Pair> > parts =
+        QtConcurrent::blockingMapped<QList<QVector<Pair> > >(chunks, RangeCounter(&baskets, &postings));
+
+    // 写回在一个事务中完成，事务开始后其他连接的借书要等提交后才能插入，不会漏算
+    if (!db.transaction()) {
+        if (error) *error = db.lastError().text();
+        return false;
+    }
+    query.setForwardOnly(false);
+    if (!query.exec("DELETE FROM coborrow") || !query.exec("DELETE FROM coborrow_seen")) {
+        if (error) *error = query.lastError().text();
+        db.rollback();
+        return false;
+    }
+    query.prepare("INSERT INTO coborrow_seen (reader_id, book_id) VALUES (?, ?)");
+    for (const QPair<int, int> &pair : seen) {
+        query.addBindValue(pair.first);
+        query.addBindValue(pair.second);
+        if (!query.exec()) {
+            if (error) *error = query.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+    query.prepare("INSERT INTO coborrow (book_id, other_id, together) VALUES (?, ?, ?)");
+    for (const QVector<Pair> &pairs : parts) {
+        for (const Pair &pair : pairs) {
+            query.addBindValue(pair.bookId);
+            query.addBindValue(pair.otherId);
+            query.addBindValue(pair.together);
+            if (!query.exec()) {
+                if (error) *error = query.lastError().text();
+                db.rollback();
+                return false;
+            }
+        }
+    }
+
+    // 快照之后借出的记录：触发器当时累计在旧行上，已随旧行删除，按记录号顺序照触发器的做法补算
+    QVector<QPair<int, int> > later;
+    query.setForwardOnly(true);
+    query.prepare("SELECT reader_id, book_id FROM borrow_records WHERE id > ? ORDER BY id");
+    query.addBindValue(snapshotId);
+    if (!query.exec()) {
+        if (error) *error = query.lastError().text();
+        db.rollback();
+        return false;
+    }
+    while (query.next()) {
+        later.append(qMakePair(query.value(0).toInt(), query.value(1).toInt()));
+    }
+    query.finish();
+    query.setForwardOnly(false);
+    for (const QPair<int, int> &loan : later) {
+        query.prepare("SELECT 1 FROM coborrow_seen WHERE reader_id = ? AND book_id = ?");
+        query.addBindValue(loan.first);
+        query.addBindValue(loan.second);
+        if (!query.exec()) {
+            if (error) *error = query.lastError().text();
+            db.rollback();
+            return false;
+        }
+        if (query.next()) {
+            continue;
+        }
+        for (const QString &statement : loanStatements(QString::number(loan.first), QString::number(loan.second))) {
+            if (!query.exec(statement)) {
+                if (error) *error = query.lastError().text();
+                db.rollback();
+                return false;
+            }
+        }
+    }
+
+    if (!query.exec("UPDATE coborrow_state SET stale = 0 WHERE id = 1")) {
+        if (error) *error = query.lastError().text();
+        db.rollback();
+        return false;
+    }
+    if (!db.commit()) {
+        if (error) *error = db.lastError().text();
+        db.rollback();
+        return false;
+    }
+    return true;
+}
+
+QVector<CoBorrowIndex::Recommendation> CoBorrowIndex::recommend(QSqlDatabase db, int bookId, int limit)
+{
+    // 主键前缀查找，只读出这本书保留的几十行
+    QVector<Recommendation> recommendations;
+    TimedQuery query(db);
+    query.prepare("SELECT c.other_id, b.title, c.together FROM coborrow c "
+                  "JOIN books b ON b.id = c.other_id "
+                  "WHERE c.book_id = ? ORDER BY c.together DESC, c.other_id LIMIT ?");
+    query.addBindValue(bookId);
+    query.addBindValue(limit);
+    if (!query.exec()) {
+        return recommendations;
+    }
+    while (query.next()) {
+        Recommendation recommendation;
+        recommendation.bookId = query.value(0).toInt();
+        recommendation.title = query.value(1).toString();
+        recommendation.together = query.value(2).toInt();
+        recommendations.append(recommendation);
+    }
+    return recommendations;
+}
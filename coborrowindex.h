@@ -0,0 +1,42 @@
+﻿// coborrowindex.h
+#ifndef COBORROWINDEX_H
+#define COBORROWINDEX_H
+
+#include <QSqlDatabase>
+#include <QString>
+#include <QVector>
+
+// 借阅关联索引：“借过这本书的读者也借了”。稀疏的共现矩阵存于 coborrow 表，
+// 每对图书一行，together 为两本书都借过的读者数；coborrow_seen 记着每位读者借过的书
+// （含已归档的借阅）。读者第一次借某本书时由触发器给它与该读者借过的其他书的计数
+// 各加一；涉及的每本书只保留计数最高的一部分，裁剪是近似的，定期全量重建恢复精确计数。
+class CoBorrowIndex
+{
+public:
+    struct Recommendation
+    {
+        int bookId = 0;
+        QString title;
+        int together = 0;  // 两本书都借过的读者数
+    };
+
+    // 建表、索引与触发器。关联表首次创建时是空的，只标记为待重建，
+    // 与借阅汇总一样由调用方另开连接调用 rebuild
+    static bool install(QSqlDatabase db, QString *error = nullptr);
+
+    // 关联表还没有按历史数据生成过
+    static bool isStale(QSqlDatabase db);
+
+    // 关联计数不再可信时标记为待重建，由调用方在后台重建
+    static bool markStale(QSqlDatabase db, QString *error = nullptr);
+
+    // 清空并按 all_borrow_records 重新生成，同时清除待重建标记。在一个读事务的快照上
+    // 按图书分段交给线程池并行计数，每本书取计数最高的若干条后在一个事务中写回，
+    // 并补算快照之后借出的记录；重建期间可以照常借还书
+    static bool rebuild(QSqlDatabase db, QString *error = nullptr);
+
+    // 借过 bookId 的读者还借得最多的图书，按共现次数从高到低；只读连接也可调用
+    static QVector<Recommendation> recommend(QSqlDatabase db, int bookId, int limit = 5);
+};
+
+#endif // COBORROWINDEX_H
@@ -0,0 +1,640 @@
+﻿// columnstore.cpp
+#include "columnstore.h"
+#include "perfmonitor.h"
+#include "textscan.h"
+#include <QDate>
+#include <QPair>
+#include <QSqlError>
+#include <QThread>
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtNumeric>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+const qint32 kNullInteger = std::numeric_limits<qint32>::min();
+
+// 行数少于此值时直接在调用线程中过滤
+const int kMinChunkRows = 16384;
+
+ColumnStore::Storage storageFor(const char *definition)
+{
+    if (std::strncmp(definition, "INTEGER", 7) == 0) return ColumnStore::Integer;
+    if (std::strncmp(definition, "REAL", 4) == 0) return ColumnStore::Real;
+    if (std::strncmp(definition, "DATE", 4) == 0) return ColumnStore::Date;
+    return ColumnStore::Text;
+}
+
+qint64 vectorBytes(int capacity, size_t elementSize)
+{
+    return qint64(capacity) * qint64(elementSize);
+}
+
+QString dateText(qint32 julianDay)
+{
+    return julianDay ? QDate::fromJulianDay(julianDay).toString(Qt::ISODate) : QString();
+}
+
+} // namespace
+
+// ---- StringPool ----
+
+StringPool::StringPool()
+{
+    values.append(QString());
+    codes.insert(QString(), 0);
+}
+
+quint32 StringPool::intern(const QString &value)
+{
+    if (value.isEmpty()) {
+        return 0;
+    }
+    auto it = codes.constFind(value);
+    if (it != codes.constEnd()) {
+        return it.value();
+    }
+    quint32 code = static_cast<quint32>(values.size());
+    values.append(value);
+    codes.insert(value, code);
+    return code;
+}
+
+int StringPool::find(const QString &value) const
+{
+    if (value.isEmpty()) {
+        return 0;
+    }
+    auto it = codes.constFind(value);
+    return it == codes.constEnd() ? -1 : static_cast<int>(it.value());
+}
+
+qint64 StringPool::memoryBytes() const
+{
+    // 字符串与哈希表各保存一份引用，字符数据共享
+    qint64 bytes = vectorBytes(values.capacity(), sizeof(QString));
+    for (const QString &value : values) {
+        bytes += qint64(value.capacity()) * sizeof(QChar);
+    }
+    return bytes + qint64(codes.capacity()) * (sizeof(QString) + sizeof(quint32) + 2 * sizeof(void *));
+}
+
+// ---- TextArena ----
+
+TextArena::Ref TextArena::append(const QString &text)
+{
+    Ref ref;
+    ref.offset = static_cast<quint32>(chars.size());
+    ref.length = static_cast<quint32>(text.size());
+    if (!text.isEmpty()) {
+        int required = chars.size() + text.size();
+        if (required > chars.capacity()) {
+            chars.reserve(qMax(required, chars.capacity() * 2));
+        }
+        chars.resize(required);
+        std::copy(text.constBegin(), text.constEnd(), chars.begin() + ref.offset);
+    }
+    return ref;
+}
+
+TextArena::Ref TextArena::replace(Ref old, const QString &text)
+{
+    // 不超过原长度时原地覆盖，行的先后顺序保持不变
+    if (static_cast<quint32>(text.size()) > old.length) {
+        return append(text);
+    }
+    std::copy(text.constBegin(), text.constEnd(), chars.begin() + old.offset);
+    Ref ref;
+    ref.offset = old.offset;
+    ref.length = static_cast<quint32>(text.size());
+    return ref;
+}
+
+QString TextArena::text(Ref ref) const
+{
+    return ref.length == 0 ? QString() : QString(data(ref), static_cast<int>(ref.length));
+}
+
+// ---- 过滤 ----
+
+// 编译后的单个条件，只读，可在多个线程中共用
+struct ColumnStore::Predicate
+{
+    const ColumnData *column = nullptr;
+    Condition::Match match = Condition::Equals;
+    qint32 number = 0;
+    QVector<bool> codes;
+    TextScan::Needle needle;
+    QString text;
+
+    bool scansText() const { return column->storage == Text && match == Condition::Contains; }
+
+    bool test(int row) const
+    {
+        switch (column->storage) {
+        case Integer:
+        case Date:
+            if (match == Condition::Equals) {
+                return column->numbers.at(row) == number;
+            }
+            break;
+        case Pooled:
+            if (match == Condition::Equals) {
+                return column->numbers.at(row) == number;
+            }
+            return codes.at(column->numbers.at(row));
+        case Text: {
+            const TextArena::Ref ref = column->texts.at(row);
+            const QChar *data = column->arena.data(ref);
+            if (match == Condition::Contains) {
+                return TextScan::contains(data, static_cast<int>(ref.length), needle);
+            }
+            return ref.length == static_cast<quint32>(text.size())
+                   && std::equal(text.constBegin(), text.constEnd(), data);
+        }
+        case Real:
+            break;
+        }
+
+        // 数值与日期列上的 LIKE 和实数相等很少用到，按显示文本比较
+        QString value;
+        switch (column->storage) {
+        case Integer:
+            value = column->numbers.at(row) == kNullInteger ? QString() : QString::number(column->numbers.at(row));
+            break;
+        case Date:
+            value = dateText(column->numbers.at(row));
+            break;
+        case Real:
+            value = qIsNaN(column->reals.at(row)) ? QString() : QString::number(column->reals.at(row));
+            break;
+        default:
+            break;
+        }
+        return match == Condition::Equals
+               ? value == text
+               : TextScan::contains(value.constData(), value.size(), needle);
+    }
+};
+
+// 过滤一段连续的行，供 QtConcurrent::blockingMapped 调用
+class ColumnStore::ChunkFilter
+{
+public:
+    typedef QVector<int> result_type;
+
+    ChunkFilter(const QVector<Predicate> *predicates, int driver)
+        : predicates(predicates), driver(driver)
+    {
+    }
+
+    QVector<int> operator()(const QPair<int, int> &range) const
+    {
+        QVector<int> rows;
+        if (driver >= 0) {
+            scanText(range.first, range.second, &rows);
+        } else {
+            for (int row = range.first; row < range.second; ++row) {
+                if (matches(row)) {
+                    rows.append(row);
+                }
+            }
+        }
+        return rows;
+    }
+
+private:
+    // 除扫描驱动条件以外的条件都满足
+    bool matches(int row) const
+    {
+        for (int i = 0; i < predicates->size(); ++i) {
+            if (i != driver && !predicates->at(i).test(row)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 各行文本在存储区中按行号先后排列时，把整段文本交给 SIMD 查找一次扫描，
+    // 再把匹配位置换算成行号；跨越两行或落在已废弃文本上的匹配跳过
+    void scanText(int begin, int end, QVector<int> *rows) const
+    {
+        const Predicate &predicate = predicates->at(driver);
+        const ColumnData &column = *predicate.column;
+        const QChar *base = column.arena.data();
+        const qint64 size = predicate.needle.size();
+
+        int row = begin;
+        qint64 pos = column.texts.at(begin).offset;
+        const qint64 stop = qint64(column.texts.at(end - 1).offset) + column.texts.at(end - 1).length;
+        while (pos < stop) {
+            int found = TextScan::find(base + pos, static_cast<int>(stop - pos), predicate.needle);
+            if (found < 0) {
+                break;
+            }
+            const qint64 match = pos + found;
+            while (row < end && qint64(column.texts.at(row).offset) + column.texts.at(row).length < match + size) {
+                ++row;
+            }
+            if (row >= end) {
+                break;
+            }
+            const TextArena::Ref ref = column.texts.at(row);
+            if (match < ref.offset) {
+                pos = ref.offset;
+                continue;
+            }
+            if (matches(row)) {
+                rows->append(row);
+            }
+            pos = qint64(ref.offset) + ref.length;
+            ++row;
+        }
+    }
+
+    const QVector<Predicate> *predicates;
+    int driver;
+};
+
+// ---- ColumnStore ----
+
+ColumnStore::ColumnStore()
+    : schema(nullptr)
+{
+}
+
+ColumnStore::ColumnStore(const Schema::Table &table, std::initializer_list<int> pooledColumns)
+    : schema(&table)
+{
+    columns.resize(table.columnCount);
+    for (int c = 0; c < table.columnCount; ++c) {
+        columns[c].storage = storageFor(table.columns[c].definition);
+    }
+    for (int c : pooledColumns) {
+        columns[c].storage = Pooled;
+    }
+}
+
+ColumnStore ColumnStore::books()
+{
+    return ColumnStore(Schema::kBooks, {Schema::Books::Author, Schema::Books::Publisher, Schema::Books::Category,
+                                        Schema::Books::Location, Schema::Books::Status});
+}
+
+ColumnStore ColumnStore::readers()
+{
+    return ColumnStore(Schema::kReaders, {Schema::Readers::Gender, Schema::Readers::ReaderType,
+                                          Schema::Readers::Status});
+}
+
+QVector<ColumnStore::Condition> ColumnStore::bookConditions(const LibraryCore::BookSearch &search)
+{
+    QVector<Condition> conditions;
+    if (!search.id.isEmpty()) conditions.append({Schema::Books::Id, Condition::Equals, search.id});
+    if (!search.title.isEmpty()) conditions.append({Schema::Books::Title, Condition::Contains, search.title});
+    if (!search.author.isEmpty()) conditions.append({Schema::Books::Author, Condition::Contains, search.author});
+    if (!search.isbn.isEmpty()) conditions.append({Schema::Books::Isbn, Condition::Contains, search.isbn});
+    if (!search.category.isEmpty()) conditions.append({Schema::Books::Category, Condition::Equals, search.category});
+    if (!search.status.isEmpty()) conditions.append({Schema::Books::Status, Condition::Equals, search.status});
+    return conditions;
+}
+
+QVector<ColumnStore::Condition> ColumnStore::readerConditions(const LibraryCore::ReaderSearch &search)
+{
+    QVector<Condition> conditions;
+    if (!search.id.isEmpty()) conditions.append({Schema::Readers::Id, Condition::Equals, search.id});
+    if (!search.name.isEmpty()) conditions.append({Schema::Readers::Name, Condition::Contains, search.name});
+    if (!search.phone.isEmpty()) conditions.append({Schema::Readers::Phone, Condition::Contains, search.phone});
+    if (!search.readerType.isEmpty()) {
+        conditions.append({Schema::Readers::ReaderType, Condition::Equals, search.readerType});
+    }
+    return conditions;
+}
+
+QFuture<ColumnStore> ColumnStore::loadInBackground(const ColumnStore &layout, const QString &databasePath)
+{
+    ColumnStore empty;
+    empty.schema = layout.schema;
+    empty.columns.resize(layout.columns.size());
+    for (int c = 0; c < layout.columns.size(); ++c) {
+        empty.columns[c].storage = layout.columns.at(c).storage;
+    }
+
+    return LibraryCore::runReadOnly<ColumnStore>(databasePath, [empty](const LibraryCore &reader) -> ColumnStore {
+        ColumnStore store = empty;
+        store.load(reader.database());
+        return store;
+    });
+}
+
+bool ColumnStore::load(const QSqlDatabase &db, QString *error)
+{
+    const QByteArray operation = QByteArray("加载内存表 ") + schema->name;
+    ScopedTimer timer(operation.constData());
+
+    TimedQuery countQuery(db);
+    int expected = 0;
+    if (countQuery.exec(QString("SELECT COUNT(*) FROM %1").arg(schema->name)) && countQuery.next()) {
+        expected = countQuery.value(0).toInt();
+    }
+
+    TimedQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec(QString("SELECT %1 FROM %2 ORDER BY %3")
+                        .arg(Schema::columnList(*schema), schema->name, schema->columns[0].name))) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+
+    for (ColumnData &column : columns) {
+        Storage storage = column.storage;
+        column = ColumnData();
+        column.storage = storage;
+        if (storage == Real) {
+            column.reals.reserve(expected);
+        } else if (storage == Text) {
+            column.texts.reserve(expected);
+        } else {
+            column.numbers.reserve(expected);
+        }
+    }
+
+    while (query.next()) {
+        int row = rowCount();
+        insertRow(row);
+        readRow(query, row);
+    }
+    for (ColumnData &column : columns) {
+        column.arena.squeeze();
+    }
+    return true;
+}
+
+ColumnStore::Change ColumnStore::refreshRow(const QSqlDatabase &db, int id, QString *error)
+{
+    TimedQuery query(db);
+    query.prepare(QString("SELECT %1 FROM %2 WHERE %3 = ?")
+                      .arg(Schema::columnList(*schema), schema->name, schema->columns[0].name));
+    query.addBindValue(id);
+    if (!query.exec()) {
+        if (error) *error = query.lastError().text();
+        return Failed;
+    }
+
+    int row = rowOf(id);
+    if (!query.next()) {
+        if (row < 0) {
+            return Unchanged;
+        }
+        removeRow(row);
+        return Removed;
+    }
+
+    Change change = Updated;
+    if (row < 0) {
+        const QVector<qint32> &ids = columns.first().numbers;
+        row = static_cast<int>(std::lower_bound(ids.constBegin(), ids.constEnd(), id) - ids.constBegin());
+        insertRow(row);
+        change = Inserted;
+    }
+    readRow(query, row);
+
+    for (ColumnData &column : columns) {
+        if (column.storage == Text && column.garbage > column.arena.size() / 2) {
+            compact(column);
+        }
+    }
+    return change;
+}
+
+int ColumnStore::rowOf(int id) const
+{
+    if (columns.isEmpty()) {
+        return -1;
+    }
+    const QVector<qint32> &ids = columns.first().numbers;
+    auto it = std::lower_bound(ids.constBegin(), ids.constEnd(), id);
+    return (it != ids.constEnd() && *it == id) ? static_cast<int>(it - ids.constBegin()) : -1;
+}
+
+QVariant ColumnStore::value(int row, int column) const
+{
+    const ColumnData &data = columns.at(column);
+    switch (data.storage) {
+    case Integer:
+        return data.numbers.at(row) == kNullInteger ? QVariant() : QVariant(data.numbers.at(row));
+    case Real:
+        return qIsNaN(data.reals.at(row)) ? QVariant() : QVariant(data.reals.at(row));
+    case Date:
+        // 表中按 yyyy-MM-dd 文本保存，显示方式与直接查询一致
+        return data.numbers.at(row) ? QVariant(dateText(data.numbers.at(row))) : QVariant();
+    case Pooled:
+        return data.pool.at(static_cast<quint32>(data.numbers.at(row)));
+    case Text:
+        return data.arena.text(data.texts.at(row));
+    }
+    return QVariant();
+}
+
+QVector<int> ColumnStore::filter(const QVector<Condition> &conditions) const
+{
+    QVector<int> rows;
+    int first = 0;
+    int last = rowCount();
+
+    // 条件先编译成驻留池编号、数值或折叠后的查找串；不可能满足时直接返回
+    QVector<Predicate> predicates;
+    for (const Condition &condition : conditions) {
+        Predicate predicate;
+        predicate.column = &columns.at(condition.column);
+        predicate.match = condition.match;
+        predicate.text = condition.text;
+        predicate.needle = TextScan::Needle(condition.text);
+
+        const ColumnData &column = *predicate.column;
+        if (condition.match == Condition::Equals) {
+            if (column.storage == Integer) {
+                predicate.number = condition.text.toInt();
+                if (condition.column == 0) {
+                    // 主键有序，只需定位一行
+                    int row = rowOf(predicate.number);
+                    if (row < first || row >= last) {
+                        return rows;
+                    }
+                    first = row;
+                    last = row + 1;
+                    continue;
+                }
+            } else if (column.storage == Date) {
+                QDate date = QDate::fromString(condition.text, Qt::ISODate);
+                if (!date.isValid()) {
+                    return rows;
+                }
+                predicate.number = static_cast<qint32>(date.toJulianDay());
+            } else if (column.storage == Pooled) {
+                predicate.number = column.pool.find(condition.text);
+                if (predicate.number < 0) {
+                    return rows;
+                }
+            }
+        } else if (column.storage == Pooled) {
+            // 低基数列对每个不同的值只判断一次
+            predicate.codes.resize(column.pool.size());
+            bool any = false;
+            for (int code = 0; code < column.pool.size(); ++code) {
+                const QString &value = column.pool.at(static_cast<quint32>(code));
+                predicate.codes[code] = TextScan::contains(value.constData(), value.size(), predicate.needle);
+                any = any || predicate.codes.at(code);
+            }
+            if (!any) {
+                return rows;
+            }
+        }
+        predicates.append(predicate);
+    }
+
+    // 便宜的编号比较在前，文本查找在后
+    std::stable_sort(predicates.begin(), predicates.end(), [](const Predicate &a, const Predicate &b) {
+        return !a.scansText() && b.scansText();
+    });
+
+    if (predicates.isEmpty()) {
+        rows.reserve(last - first);
+        for (int row = first; row < last; ++row) {
+            rows.append(row);
+        }
+        return rows;
+    }
+
+    // 文本按行号顺序存放时由第一个文本条件整段扫描
+    int driver = -1;
+    for (int i = 0; i < predicates.size(); ++i) {
+        if (predicates.at(i).scansText() && predicates.at(i).column->ordered && last - first > 1) {
+            driver = i;
+            break;
+        }
+    }
+
+    const ChunkFilter chunkFilter(&predicates, driver);
+    const int total = last - first;
+    const int threads = qMax(1, QThread::idealThreadCount());
+    if (total < 2 * kMinChunkRows || threads == 1) {
+        return chunkFilter(qMakePair(first, last));
+    }
+
+    // 分块交给线程池，结果按块的顺序拼接，行号保持升序
+    const int chunkRows = qMax(kMinChunkRows, (total + threads * 4 - 1) / (threads * 4));
+    QVector<QPair<int, int> > chunks;
+    for (int begin = first; begin < last; begin += chunkRows) {
+        chunks.append(qMakePair(begin, qMin(last, begin + chunkRows)));
+    }
+    const QList<QVector<int> > parts = QtConcurrent::blockingMapped<QList<QVector<int> > >(chunks, chunkFilter);
+    for (const QVector<int> &part : parts) {
+        rows += part;
+    }
+    return rows;
+}
+
+qint64 ColumnStore::memoryBytes() const
+{
+    qint64 bytes = 0;
+    for (const ColumnData &column : columns) {
+        bytes += vectorBytes(column.numbers.capacity(), sizeof(qint32));
+        bytes += vectorBytes(column.reals.capacity(), sizeof(double));
+        bytes += vectorBytes(column.texts.capacity(), sizeof(TextArena::Ref));
+        if (column.storage == Pooled) {
+            bytes += column.pool.memoryBytes();
+        }
+        bytes += column.arena.memoryBytes();
+    }
+    return bytes;
+}
+
+void ColumnStore::readRow(const QSqlQuery &query, int row)
+{
+    const bool lastRow = row == rowCount() - 1;
+    for (int c = 0; c < columns.size(); ++c) {
+        ColumnData &column = columns[c];
+        const QVariant value = query.value(c);
+        switch (column.storage) {
+        case Integer:
+            column.numbers[row] = value.isNull() ? kNullInteger : value.toInt();
+            break;
+        case Real:
+            column.reals[row] = value.isNull() ? qQNaN() : value.toDouble();
+            break;
+        case Date: {
+            QDate date = value.toDate();
+            column.numbers[row] = date.isValid() ? static_cast<qint32>(date.toJulianDay()) : 0;
+            break;
+        }
+        case Pooled:
+            column.numbers[row] = static_cast<qint32>(column.pool.intern(value.toString()));
+            break;
+        case Text: {
+            const TextArena::Ref old = column.texts.at(row);
+            const TextArena::Ref ref = column.arena.replace(old, value.toString());
+            if (ref.length <= old.length) {
+                column.garbage += old.length - ref.length;
+            } else {
+                // 追加到存储区末尾的文本只有属于最后一行时才不打乱行的先后顺序
+                column.garbage += old.length;
+                if (!lastRow) {
+                    column.ordered = false;
+                }
+            }
+            column.texts[row] = ref;
+            break;
+        }
+        }
+    }
+}
+
+void ColumnStore::insertRow(int row)
+{
+    const bool append = row == rowCount();
+    for (ColumnData &column : columns) {
+        if (column.storage == Real) {
+            column.reals.insert(row, 0.0);
+        } else if (column.storage == Text) {
+            // 新行的文本追加在存储区末尾，插在中间时行的先后顺序被打乱
+            TextArena::Ref ref;
+            ref.offset = static_cast<quint32>(column.arena.size());
+            column.texts.insert(row, ref);
+            if (!append) {
+                column.ordered = false;
+            }
+        } else {
+            column.numbers.insert(row, 0);
+        }
+    }
+}
+
+void ColumnStore::removeRow(int row)
+{
+    for (ColumnData &column : columns) {
+        if (column.storage == Real) {
+            column.reals.remove(row);
+        } else if (column.storage == Text) {
+            column.garbage += column.texts.at(row).length;
+            column.texts.remove(row);
+        } else {
+            column.numbers.remove(row);
+        }
+    }
+}
+
+void ColumnStore::compact(ColumnData &column)
+{
+    // 按行号重新写入仍在使用的文本，丢弃修改与删除留下的旧值，同时恢复行的先后顺序
+    TextArena compacted;
+    for (int row = 0; row < column.texts.size(); ++row) {
+        column.texts[row] = compacted.append(column.arena.text(column.texts.at(row)));
+    }
+    compacted.squeeze();
+    column.arena = compacted;
+    column.garbage = 0;
+    column.ordered = true;
+}
@@ -0,0 +1,146 @@
+﻿// columnstore.h
+#ifndef COLUMNSTORE_H
+#define COLUMNSTORE_H
+
+#include <QFuture>
+#include <QHash>
+#include <QSqlDatabase>
+#include <QString>
+#include <QVariant>
+#include <QVector>
+#include <initializer_list>
+#include "librarycore.h"
+#include "schema.h"
+
+class QSqlQuery;
+
+// 字符串驻留池：重复出现的值只保存一份，表中每行只存 4 字节编号。
+// 编号 0 固定为空字符串（包括 NULL）。
+class StringPool
+{
+public:
+    StringPool();
+
+    quint32 intern(const QString &value);
+    int find(const QString &value) const;  // 不存在时返回 -1
+
+    const QString &at(quint32 code) const { return values.at(static_cast<int>(code)); }
+    int size() const { return values.size(); }
+    qint64 memoryBytes() const;
+
+private:
+    QVector<QString> values;
+    QHash<QString, quint32> codes;
+};
+
+// 自由文本的连续存储区，每行只存偏移与长度，避免每个值一次堆分配
+class TextArena
+{
+public:
+    struct Ref
+    {
+        quint32 offset = 0;
+        quint32 length = 0;
+    };
+
+    Ref append(const QString &text);
+
+    // 新值不长于旧值时原地覆盖，否则追加到末尾
+    Ref replace(Ref old, const QString &text);
+    QString text(Ref ref) const;
+
+    // 不复制的只读视图，存储区变动前有效
+    const QChar *data(Ref ref) const { return chars.constData() + ref.offset; }
+    const QChar *data() const { return chars.constData(); }
+
+    void squeeze() { chars.squeeze(); }
+    qint64 size() const { return chars.size(); }
+    qint64 memoryBytes() const { return qint64(chars.capacity()) * sizeof(QChar); }
+
+private:
+    QVector<QChar> chars;
+};
+
+// 一张表的列式内存缓存：每列一个数组，低基数文本列用驻留池编号，
+// 其余文本列各自放在一段连续存储区中，过滤时可以整段扫描。
+// 列的类型按 Schema 中的列定义推断，第一列须为升序的整数主键。
+// 缓存本身不加锁，只能在一个线程中修改；过滤是只读的，会分块交给线程池并行执行。
+class ColumnStore
+{
+public:
+    enum Storage { Integer, Real, Date, Pooled, Text };
+    enum Change { Failed, Unchanged, Updated, Inserted, Removed };
+
+    // 过滤条件：Equals 为整值相等，Contains 与转义了 % 和 _ 的 LIKE '%...%' 相同
+    struct Condition
+    {
+        enum Match { Equals, Contains };
+
+        int column;
+        Match match;
+        QString text;
+    };
+
+    ColumnStore();
+    ColumnStore(const Schema::Table &table, std::initializer_list<int> pooledColumns);
+
+    // 图书管理页与读者管理页使用的缓存布局
+    static ColumnStore books();
+    static ColumnStore readers();
+
+    // 与 LibraryCore::bookFilter / readerFilter 相同的条件
+    static QVector<Condition> bookConditions(const LibraryCore::BookSearch &search);
+    static QVector<Condition> readerConditions(const LibraryCore::ReaderSearch &search);
+
+    // 按 layout 的布局在后台线程中用只读连接整表加载
+    static QFuture<ColumnStore> loadInBackground(const ColumnStore &layout, const QString &databasePath);
+
+    const Schema::Table &table() const { return *schema; }
+
+    // 整表加载，替换现有内容
+    bool load(const QSqlDatabase &db, QString *error = nullptr);
+
+    // 某一行在数据库中增删改之后，按主键重新读取这一行
+    Change refreshRow(const QSqlDatabase &db, int id, QString *error = nullptr);
+
+    int rowCount() const { return columns.isEmpty() ? 0 : columns.first().numbers.size(); }
+    int rowOf(int id) const;  // 不存在时返回 -1
+    int id(int row) const { return columns.first().numbers.at(row); }
+
+    // 与 SELECT * 的取值一致，日期按 yyyy-MM-dd 文本返回
+    QVariant value(int row, int column) const;
+
+    // 满足全部条件的行号（升序）
+    QVector<int> filter(const QVector<Condition> &conditions) const;
+
+    // 缓存占用的内存估计（字节）
+    qint64 memoryBytes() const;
+
+    bool isValid() const { return schema != nullptr; }
+
+private:
+    struct ColumnData
+    {
+        Storage storage = Text;
+        QVector<qint32> numbers;         // Integer、Date（儒略日）与 Pooled（编号）
+        QVector<double> reals;
+        QVector<TextArena::Ref> texts;
+        StringPool pool;
+        TextArena arena;
+        qint64 garbage = 0;              // 被修改或删除的行遗留在存储区中的字符数
+        bool ordered = true;             // 各行文本在存储区中按行号先后排列，可以整段扫描
+    };
+
+    struct Predicate;
+    class ChunkFilter;
+
+    void readRow(const QSqlQuery &query, int row);
+    void insertRow(int row);
+    void removeRow(int row);
+    void compact(ColumnData &column);
+
+    const Schema::Table *schema;
+    QVector<ColumnData> columns;
+};
+
+#endif // COLUMNSTORE_H
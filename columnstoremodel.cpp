@@ -0,0 +1,117 @@
+﻿// columnstoremodel.cpp
+#include "columnstoremodel.h"
+#include <algorithm>
+
+ColumnStoreModel::ColumnStoreModel(const ColumnStore &layout, QObject *parent)
+    : QAbstractTableModel(parent)
+    , cache(layout)
+    , loadWatcher(new QFutureWatcher<ColumnStore>(this))
+    , reloadPending(false)
+{
+    connect(loadWatcher, &QFutureWatcherBase::finished, this, &ColumnStoreModel::finishLoad);
+}
+
+int ColumnStoreModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid()) {
+        return 0;
+    }
+    return conditions.isEmpty() ? cache.rowCount() : rows.size();
+}
+
+int ColumnStoreModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : cache.table().columnCount;
+}
+
+QVariant ColumnStoreModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || (role != Qt::DisplayRole && role != Qt::EditRole)) {
+        return QVariant();
+    }
+    return cache.value(storeRow(index.row()), index.column());
+}
+
+QVariant ColumnStoreModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (role != Qt::DisplayRole) {
+        return QVariant();
+    }
+    if (orientation == Qt::Vertical) {
+        return section + 1;
+    }
+    if (section < 0 || section >= cache.table().columnCount) {
+        return QVariant();
+    }
+    return QString(cache.table().columns[section].label);
+}
+
+void ColumnStoreModel::reload(const QString &databasePath)
+{
+    this->databasePath = databasePath;
+    if (loadWatcher->isRunning()) {
+        reloadPending = true;
+        return;
+    }
+    loadWatcher->setFuture(ColumnStore::loadInBackground(cache, databasePath));
+}
+
+void ColumnStoreModel::waitForLoad()
+{
+    loadWatcher->waitForFinished();
+}
+
+void ColumnStoreModel::finishLoad()
+{
+    if (reloadPending) {
+        reloadPending = false;
+        reload(databasePath);
+        return;
+    }
+
+    // 只读连接打不开时保留原有数据
+    ColumnStore result = loadWatcher->result();
+    if (!result.isValid()) {
+        return;
+    }
+    beginResetModel();
+    cache = result;
+    applyFilter();
+    endResetModel();
+    emit loaded();
+}
+
+void ColumnStoreModel::refreshRow(const QSqlDatabase &db, int id)
+{
+    // 正在进行的加载可能读到修改之前的数据，完成后再加载一次
+    if (loadWatcher->isRunning()) {
+        reloadPending = true;
+    }
+
+    ColumnStore::Change change = cache.refreshRow(db, id);
+    if (change == ColumnStore::Updated && conditions.isEmpty()) {
+        int row = cache.rowOf(id);
+        emit dataChanged(index(row, 0), index(row, columnCount() - 1));
+    } else if (change == ColumnStore::Updated || change == ColumnStore::Inserted
+               || change == ColumnStore::Removed) {
+        // 行号有变化，或修改后可能不再满足过滤条件
+        beginResetModel();
+        applyFilter();
+        endResetModel();
+    } else if (change == ColumnStore::Failed && !databasePath.isEmpty()) {
+        reload(databasePath);
+    }
+}
+
+void ColumnStoreModel::setFilter(const QVector<ColumnStore::Condition> &conditions)
+{
+    beginResetModel();
+    this->conditions = conditions;
+    applyFilter();
+    endResetModel();
+}
+
+void ColumnStoreModel::applyFilter()
+{
+    rows = conditions.isEmpty() ? QVector<int>() : cache.filter(conditions);
+}
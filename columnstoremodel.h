@@ -0,0 +1,53 @@
+﻿// columnstoremodel.h
+#ifndef COLUMNSTOREMODEL_H
+#define COLUMNSTOREMODEL_H
+
+#include <QAbstractTableModel>
+#include <QFutureWatcher>
+#include <QVector>
+#include "columnstore.h"
+
+// 图书、读者管理页的表格模型：持有一份 ColumnStore，单元格取值在显示时才生成。
+// 整表加载在后台线程中进行，加载期间继续显示旧数据；单行增删改只重读这一行。
+// 过滤条件为空时显示全部行，否则显示过滤结果。
+class ColumnStoreModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    explicit ColumnStoreModel(const ColumnStore &layout, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+    const ColumnStore &store() const { return cache; }
+
+    // 后台整表重新加载；正在加载时合并为加载完成后再加载一次
+    void reload(const QString &databasePath);
+    void waitForLoad();
+
+    // 数据库中某一行增删改之后调用
+    void refreshRow(const QSqlDatabase &db, int id);
+
+    void setFilter(const QVector<ColumnStore::Condition> &conditions);
+
+signals:
+    void loaded();
+
+private:
+    void finishLoad();
+    void applyFilter();
+    int storeRow(int row) const { return conditions.isEmpty() ? row : rows.at(row); }
+
+    ColumnStore cache;
+    QVector<ColumnStore::Condition> conditions;
+    QVector<int> rows;
+
+    QFutureWatcher<ColumnStore> *loadWatcher;
+    QString databasePath;
+    bool reloadPending;
+};
+
+#endif // COLUMNSTOREMODEL_H
@@ -0,0 +1,66 @@
+# 不依赖界面组件的业务与存储模块。
+# 主程序、基准测试和命令行工具通过 include(core.pri) 共用同一份源码。
+
+QT += sql concurrent network
+CONFIG += c++11
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+SOURCES += \
+    $$PWD/analyticsexport.cpp \
+    $$PWD/backuparchive.cpp \
+    $$PWD/barcodeindex.cpp \
+    $$PWD/catalogsnapshot.cpp \
+    $$PWD/changejournal.cpp \
+    $$PWD/circulationclient.cpp \
+    $$PWD/circulationprotocol.cpp \
+    $$PWD/circulationrollup.cpp \
+    $$PWD/circulationserver.cpp \
+    $$PWD/coborrowindex.cpp \
+    $$PWD/columnstore.cpp \
+    $$PWD/datasetgenerator.cpp \
+    $$PWD/historyarchiver.cpp \
+    $$PWD/historylog.cpp \
+    $$PWD/librarycore.cpp \
+    $$PWD/onlinebackup.cpp \
+    $$PWD/perfmonitor.cpp \
+    $$PWD/schema.cpp \
+    $$PWD/stallwatchdog.cpp \
+    $$PWD/tableio.cpp \
+    $$PWD/textscan.cpp
+
+HEADERS += \
+    $$PWD/analyticsexport.h \
+    $$PWD/backuparchive.h \
+    $$PWD/barcodeindex.h \
+    $$PWD/catalogsnapshot.h \
+    $$PWD/changejournal.h \
+    $$PWD/circulationclient.h \
+    $$PWD/circulationprotocol.h \
+    $$PWD/circulationrollup.h \
+    $$PWD/circulationserver.h \
+    $$PWD/coborrowindex.h \
+    $$PWD/columnstore.h \
+    $$PWD/datasetgenerator.h \
+    $$PWD/historyarchiver.h \
+    $$PWD/historylog.h \
+    $$PWD/librarycore.h \
+    $$PWD/onlinebackup.h \
+    $$PWD/perfmonitor.h \
+    $$PWD/recordcache.h \
+    $$PWD/schema.h \
+    $$PWD/stallwatchdog.h \
+    $$PWD/tableio.h \
+    $$PWD/textscan.h
+
+# 在线备份直接使用 SQLite 备份 API（sqlite3_backup_*），需要链接 SQLite 库。
+# 备份 API 作用于 QSQLITE 连接的句柄，Qt 须以 -system-sqlite 构建，使驱动与这里链接同一份库；
+# 否则界面中的在线备份在运行时拒绝执行（见 onlinebackup.cpp），命令行工具 backup 不受影响。
+# Windows 下通过环境变量 SQLITE_DIR 指定 sqlite3.h 与 sqlite3 库所在目录。
+win32 {
+    INCLUDEPATH += $$(SQLITE_DIR)
+    LIBS += -L$$(SQLITE_DIR) -lsqlite3
+} else {
+    LIBS += -lsqlite3
+}
@@ -0,0 +1,824 @@
+﻿// datasetgenerator.cpp
+#include "datasetgenerator.h"
+#include "librarycore.h"
+#include "changejournal.h"
+#include "circulationrollup.h"
+#include "coborrowindex.h"
+#include "historyarchiver.h"
+#include <QtSql>
+#include <QtConcurrent>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QVector>
+#include <sqlite3.h>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+namespace {
+
+// 随机数只使用 mt19937_64 的原始输出：标准库的分布类在不同编译器上结果不同，
+// 会破坏跨平台的可重复性
+typedef std::mt19937_64 Random;
+
+double uniform(Random &random)
+{
+    return (random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int below(Random &random, int bound)
+{
+    return bound > 0 ? static_cast<int>(random() % static_cast<quint64>(bound)) : 0;
+}
+
+quint64 streamSeed(quint64 seed, quint64 stream)
+{
+    // splitmix64，使相邻块号得到互不相关的种子
+    quint64 z = seed + (stream + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+enum Stream : quint64 {
+    BookStream = 0x100000000ULL,
+    CatalogStream,
+    ReaderStream,
+    PermutationStream
+};
+
+struct Weighted
+{
+    const char *name;
+    int weight;
+};
+
+const Weighted kCategories[] = {
+    {"文学", 30}, {"编程", 15}, {"科学", 15}, {"历史", 15}, {"教育", 15}, {"艺术", 10}
+};
+
+struct ReaderType
+{
+    const char *name;
+    int weight;
+    int maxBorrow;
+    int maxDays;
+};
+
+const ReaderType kReaderTypes[] = {
+    {"普通读者", 50, 5, 30}, {"学生", 35, 10, 60}, {"教师", 10, 20, 90}, {"VIP", 5, 30, 90}
+};
+
+const char *const kSurnames[] = {
+    "王", "李", "张", "刘", "陈", "杨", "黄", "赵", "吴", "周",
+    "徐", "孙", "马", "朱", "胡", "郭", "何", "高", "林", "罗"
+};
+const char *const kGivenNames[] = {
+    "伟", "芳", "娜", "敏", "静", "丽", "强", "磊", "军", "洋", "勇", "艳", "杰", "娟",
+    "涛", "明", "超", "秀英", "华", "平", "刚", "文", "晨", "欣怡", "子涵", "浩然", "宇轩", "思远"
+};
+const char *const kTitlePrefixes[] = {
+    "深入理解", "精通", "实用", "现代", "图解", "漫谈", "简明", "走进", "探索", "细说"
+};
+const char *const kTitleSubjects[] = {
+    "数据结构", "算法", "中国古代史", "世界文学", "量子力学", "线性代数", "唐诗宋词", "西方美术",
+    "心理学", "经济学", "计算机网络", "操作系统", "红楼梦", "天文学", "教育学", "摄影", "书法", "生物学"
+};
+const char *const kPublishers[] = {
+    "人民文学出版社", "机械工业出版社", "清华大学出版社", "电子工业出版社", "科学出版社",
+    "中华书局", "商务印书馆", "高等教育出版社", "三联书店", "译林出版社"
+};
+
+template <typename T, size_t N>
+int countOf(const T (&)[N])
+{
+    return static_cast<int>(N);
+}
+
+template <typename T, size_t N>
+int pickWeighted(const T (&items)[N], Random &random)
+{
+    int total = 0;
+    for (const T &item : items) total += item.weight;
+    int value = below(random, total);
+    for (int i = 0; i < countOf(items); ++i) {
+        value -= items[i].weight;
+        if (value < 0) return i;
+    }
+    return countOf(items) - 1;
+}
+
+// 第 k 名（从0开始）被选中的概率与 1/(k+1)^s 成正比
+QVector<double> zipfCdf(int n, double skew)
+{
+    QVector<double> cdf(n);
+    double sum = 0.0;
+    for (int i = 0; i < n; ++i) {
+        sum += 1.0 / std::pow(i + 1.0, skew);
+        cdf[i] = sum;
+    }
+    for (double &value : cdf) {
+        value /= sum;
+    }
+    return cdf;
+}
+
+int sampleZipf(const QVector<double> &cdf, double u)
+{
+    int index = static_cast<int>(std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin());
+    return qMin(index, cdf.size() - 1);
+}
+
+// 热度排名与编号之间做一次随机置换，热门图书不会集中在编号最小的一段
+QVector<qint32> permutation(int n, Random &random)
+{
+    QVector<qint32> order(n);
+    for (int i = 0; i < n; ++i) order[i] = i;
+    for (int i = n - 1; i > 0; --i) {
+        std::swap(order[i], order[below(random, i + 1)]);
+    }
+    return order;
+}
+
+const int kNotReturned = INT_MIN;
+const int kActiveWindow = 90;  // 在借记录的借出日期不早于这么多天之前
+
+struct LoanRow
+{
+    qint32 book;
+    qint32 reader;
+    int borrowDay;      // 相对今天的天数，负数为过去
+    int borrowSecond;   // 借出时刻（当天的秒数）
+    int firstDueDay;    // 借出时的应还日期
+    int dueDay;         // 续借后的应还日期
+    int returnDay;      // 未归还时为 kNotReturned
+    int renewCount;
+};
+
+struct LoanChunk
+{
+    qint64 first = 0;
+    QVector<LoanRow> rows;
+};
+
+struct Context
+{
+    DatasetGenerator::Options options;
+    QVector<double> bookCdf;
+    QVector<double> readerCdf;
+    QVector<qint32> bookByRank;
+    QVector<qint32> readerByRank;
+    QVector<qint8> readerTypes;
+    double activeProbability = 0.0;
+};
+
+// 生成一块借阅记录；只读共享上下文，可在任意线程并行调用
+struct GenerateLoans
+{
+    typedef LoanChunk result_type;
+
+    const Context *context;
+
+    LoanChunk operator()(int chunkIndex) const
+    {
+        const DatasetGenerator::Options &options = context->options;
+        Random random(streamSeed(options.seed, static_cast<quint64>(chunkIndex)));
+
+        LoanChunk chunk;
+        chunk.first = static_cast<qint64>(chunkIndex) * DatasetGenerator::ChunkRows;
+        qint64 last = qMin(chunk.first + DatasetGenerator::ChunkRows, options.loans);
+        chunk.rows.reserve(static_cast<int>(last - chunk.first));
+
+        for (qint64 i = chunk.first; i < last; ++i) {
+            LoanRow row;
+            row.book = context->bookByRank.at(sampleZipf(context->bookCdf, uniform(random)));
+            row.reader = context->readerByRank.at(sampleZipf(context->readerCdf, uniform(random)));
+            const int loanDays = kReaderTypes[context->readerTypes.at(row.reader)].maxDays;
+
+            // 借出日期随记录编号递增，均匀覆盖整个历史区间
+            row.borrowDay = -options.historyDays + static_cast<int>(i * options.historyDays / options.loans);
+            row.borrowSecond = 8 * 3600 + below(random, 12 * 3600);
+            row.dueDay = row.borrowDay + loanDays;
+            row.firstDueDay = row.dueDay;
+            row.renewCount = 0;
+
+            if (row.borrowDay >= -kActiveWindow && uniform(random) < context->activeProbability) {
+                row.returnDay = kNotReturned;
+                if (uniform(random) < options.overdueRatio) {
+                    // 已逾期：应还日期在过去30天内
+                    row.dueDay = -1 - below(random, 30);
+                    if (row.dueDay <= row.borrowDay) {
+                        row.borrowDay = row.dueDay - loanDays;
+                    }
+                    row.firstDueDay = row.dueDay;
+                } else if (row.dueDay < 0) {
+                    // 未逾期但借期已过：视为续借过
+                    row.renewCount = 1 + below(random, 2);
+                    row.dueDay = below(random, loanDays) + 1;
+                }
+            } else {
+                if (below(random, 10) == 0) {
+                    row.renewCount = 1;
+                    row.dueDay += loanDays;
+                }
+                // 多数按期归还，少数逾期十几天
+                int kept = 1 + below(random, row.dueDay - row.borrowDay + 15);
+                row.returnDay = qMin(row.borrowDay + kept, 0);
+            }
+            chunk.rows.append(row);
+        }
+        return chunk;
+    }
+};
+
+QByteArray isbn13(qint64 serial)
+{
+    QByteArray digits = "978" + QByteArray::number(serial % 1000000000LL).rightJustified(9, '0');
+    int sum = 0;
+    for (int i = 0; i < 12; ++i) {
+        sum += (digits.at(i) - '0') * (i % 2 ? 3 : 1);
+    }
+    digits += char('0' + (10 - sum % 10) % 10);
+    return digits;
+}
+
+QByteArray personName(Random &random)
+{
+    QByteArray name = kSurnames[below(random, countOf(kSurnames))];
+    name += kGivenNames[below(random, countOf(kGivenNames))];
+    if (below(random, 2)) {
+        name += kGivenNames[below(random, countOf(kGivenNames))];
+    }
+    return name;
+}
+
+// 日期文本按天预先格式化，写入时只做查表
+class DateTable
+{
+public:
+    DateTable(int firstDay, int lastDay)
+        : firstDay(firstDay)
+        , utcOffset(QDateTime::currentDateTime().offsetFromUtc())
+    {
+        const QDate today = QDate::currentDate();
+        for (int day = firstDay; day <= lastDay; ++day) {
+            texts.append(today.addDays(day).toString("yyyy-MM-dd").toLatin1());
+        }
+    }
+
+    const QByteArray &date(int day) const
+    {
+        return texts.at(qBound(0, day - firstDay, texts.size() - 1));
+    }
+
+    // 当地时间转成 UTC 的 "yyyy-MM-dd hh:mm:ss"，与 CURRENT_TIMESTAMP 写入的格式一致；
+    // buffer 至少 20 字节
+    void utcTimestamp(int day, int second, char *buffer) const
+    {
+        second -= utcOffset;
+        while (second < 0) {
+            second += 86400;
+            --day;
+        }
+        while (second >= 86400) {
+            second -= 86400;
+            ++day;
+        }
+        std::memcpy(buffer, date(day).constData(), 10);
+        int hour = second / 3600;
+        int minute = second / 60 % 60;
+        int sec = second % 60;
+        buffer[10] = ' ';
+        buffer[11] = char('0' + hour / 10);
+        buffer[12] = char('0' + hour % 10);
+        buffer[13] = ':';
+        buffer[14] = char('0' + minute / 10);
+        buffer[15] = char('0' + minute % 10);
+        buffer[16] = ':';
+        buffer[17] = char('0' + sec / 10);
+        buffer[18] = char('0' + sec % 10);
+        buffer[19] = '\0';
+    }
+
+private:
+    int firstDay;
+    int utcOffset;
+    QVector<QByteArray> texts;
+};
+
+// 批量写入使用的原生 SQLite 连接
+class BulkWriter
+{
+public:
+    ~BulkWriter()
+    {
+        for (sqlite3_stmt *statement : statements) {
+            sqlite3_finalize(statement);
+        }
+        if (handle) {
+            sqlite3_close(handle);
+        }
+    }
+
+    bool open(const QString &path)
+    {
+        if (sqlite3_open_v2(QFile::encodeName(path).constData(), &handle,
+                            SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK) {
+            return fail();
+        }
+        // 生成期间不需要崩溃保护：失败时整个文件作废重来
+        return exec("PRAGMA journal_mode = OFF")
+            && exec("PRAGMA synchronous = OFF")
+            && exec("PRAGMA locking_mode = EXCLUSIVE")
+            && exec("PRAGMA temp_store = MEMORY")
+            && exec("PRAGMA cache_size = -262144");
+    }
+
+    bool exec(const char *sql)
+    {
+        char *message = nullptr;
+        if (sqlite3_exec(handle, sql, nullptr, nullptr, &message) != SQLITE_OK) {
+            error = QString::fromUtf8(message);
+            sqlite3_free(message);
+            return false;
+        }
+        return true;
+    }
+
+    sqlite3_stmt *prepare(const char *sql)
+    {
+        sqlite3_stmt *statement = nullptr;
+        if (sqlite3_prepare_v2(handle, sql, -1, &statement, nullptr) != SQLITE_OK) {
+            fail();
+            return nullptr;
+        }
+        statements.append(statement);
+        return statement;
+    }
+
+    // 绑定的文本在 step() 之前必须保持有效
+    static void bindText(sqlite3_stmt *statement, int index, const QByteArray &text)
+    {
+        sqlite3_bind_text(statement, index, text.constData(), text.size(), SQLITE_STATIC);
+    }
+
+    static void bindText(sqlite3_stmt *statement, int index, const char *text)
+    {
+        sqlite3_bind_text(statement, index, text, -1, SQLITE_STATIC);
+    }
+
+    bool step(sqlite3_stmt *statement)
+    {
+        int rc = sqlite3_step(statement);
+        sqlite3_reset(statement);
+        return rc == SQLITE_DONE || fail();
+    }
+
+    bool fail()
+    {
+        error = handle ? QString::fromUtf8(sqlite3_errmsg(handle)) : QString("无法打开数据库");
+        return false;
+    }
+
+    sqlite3 *handle = nullptr;
+    QVector<sqlite3_stmt *> statements;
+    QString error;
+};
+
+// 借阅汇总：事件按天暂存，确定某一天不会再有新事件后排序合并，
+// 写入与 CirculationRollup::rebuild 相同的汇总行（从 SQL 重新汇总千万级记录太慢）
+class RollupAccumulator
+{
+public:
+    enum Dimension { BookDimension, ReaderDimension, CategoryDimension, ReaderTypeDimension };
+    enum Event { Loan, Return, Renewal };
+
+    bool prepare(BulkWriter &writer)
+    {
+        const char *const tables[] = {"rollup_daily_book (day, book_id",
+                                      "rollup_daily_reader (day, reader_id",
+                                      "rollup_daily_category (day, category",
+                                      "rollup_daily_reader_type (day, reader_type"};
+        for (int i = 0; i < 4; ++i) {
+            QByteArray sql = QByteArray("INSERT INTO ") + tables[i]
+                           + ", loans, returns, renewals) VALUES (?, ?, ?, ?, ?)";
+            statements[i] = writer.prepare(sql.constData());
+            if (!statements[i]) return false;
+        }
+        return true;
+    }
+
+    // 一条借阅事件同时计入四个维度
+    void add(int day, Event event, qint32 bookId, qint32 readerId, int category, int readerType)
+    {
+        QVector<quint64> &bucket = events[day];
+        bucket.append(encode(BookDimension, static_cast<quint32>(bookId), event));
+        bucket.append(encode(ReaderDimension, static_cast<quint32>(readerId), event));
+        bucket.append(encode(CategoryDimension, static_cast<quint32>(category), event));
+        bucket.append(encode(ReaderTypeDimension, static_cast<quint32>(readerType), event));
+    }
+
+    // 写入并释放早于 day 的各天
+    bool flushBefore(int day, BulkWriter &writer, const DateTable &dates)
+    {
+        while (!events.isEmpty() && events.firstKey() < day) {
+            int current = events.firstKey();
+            QVector<quint64> bucket = events.take(current);
+            std::sort(bucket.begin(), bucket.end());
+
+            const QByteArray &dayText = dates.date(current);
+            for (int i = 0; i < bucket.size();) {
+                quint64 group = bucket.at(i) >> 2;
+                int counts[3] = {0, 0, 0};
+                for (; i < bucket.size() && bucket.at(i) >> 2 == group; ++i) {
+                    ++counts[bucket.at(i) & 3];
+                }
+
+                int dimension = static_cast<int>(group >> 60);
+                quint32 key = static_cast<quint32>(group & 0xFFFFFFFFULL);
+                sqlite3_stmt *statement = statements[dimension];
+                BulkWriter::bindText(statement, 1, dayText);
+                if (dimension == CategoryDimension) {
+                    BulkWriter::bindText(statement, 2, kCategories[key].name);
+                } else if (dimension == ReaderTypeDimension) {
+                    BulkWriter::bindText(statement, 2, kReaderTypes[key].name);
+                } else {
+                    sqlite3_bind_int64(statement, 2, key);
+                }
+                sqlite3_bind_int(statement, 3, counts[Loan]);
+                sqlite3_bind_int(statement, 4, counts[Return]);
+                sqlite3_bind_int(statement, 5, counts[Renewal]);
+                if (!writer.step(statement)) return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    static quint64 encode(Dimension dimension, quint32 key, Event event)
+    {
+        return (static_cast<quint64>(dimension) << 62) | (static_cast<quint64>(key) << 2) | event;
+    }
+
+    sqlite3_stmt *statements[4];
+    QMap<int, QVector<quint64> > events;
+};
+
+// 建表并去掉批量写入期间不需要的触发器和示例数据
+bool prepareSchema(const QString &path, QString *error)
+{
+    const QString connectionName = "dataset_generator";
+    bool ok = false;
+    {
+        LibraryCore core(connectionName);
+        if (core.open(path, error)) {
+            QSqlDatabase db = core.database();
+            QSqlQuery query(db);
+            ChangeJournal::removeTriggers(db);
+            for (const QString &name : QStringList{"rollup_loan", "rollup_return", "rollup_renew", "coborrow_loan"}) {
+                query.exec(QString("DROP TRIGGER IF EXISTS %1").arg(name));
+            }
+            ok = query.exec("DELETE FROM books") && query.exec("DELETE FROM sqlite_sequence");
+            if (!ok && error) *error = query.lastError().text();
+            core.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+    return ok;
+}
+
+// 恢复 WAL 与触发器；汇总行已随借阅一起写入，清除新建汇总表的待重建标记。
+// 借阅关联表在批量写入时是空的，按生成的借阅记录并行重建
+bool finishSchema(const QString &path, QString *error)
+{
+    const QString connectionName = "dataset_generator";
+    bool ok = false;
+    {
+        LibraryCore core(connectionName);
+        if (core.open(path, error)) {
+            ok = core.warnings().isEmpty();
+            if (!ok && error) *error = core.warnings().join("\n");
+            ok = ok && CirculationRollup::markFresh(core.database(), error);
+            ok = ok && CoBorrowIndex::rebuild(core.database(), error);
+            core.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+    return ok;
+}
+
+} // namespace
+
+bool DatasetGenerator::generate(const QString &path, const Options &options,
+                                Result *result, QString *error,
+                                const ProgressCallback &progress)
+{
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    if (options.books <= 0 || options.readers <= 0 || options.loans < 0 || options.historyDays <= 0
+        || options.books > INT_MAX || options.readers > INT_MAX) {
+        if (error) *error = "生成规模无效";
+        return false;
+    }
+    // 已有的归档库会被合并视图一起查询，同样不能沿用
+    for (const QString &existing : QStringList{path, HistoryArchiver::archivePath(path)}) {
+        if (QFile::exists(existing)) {
+            if (error) *error = "目标文件已存在：" + existing;
+            return false;
+        }
+    }
+    if (!prepareSchema(path, error)) {
+        return false;
+    }
+
+    Context context;
+    context.options = options;
+    const int bookCount = static_cast<int>(options.books);
+    const int readerCount = static_cast<int>(options.readers);
+    const qint64 totalRows = options.books + options.readers + options.loans;
+
+    Random permutationRandom(streamSeed(options.seed, PermutationStream));
+    context.bookCdf = zipfCdf(bookCount, options.bookSkew);
+    context.readerCdf = zipfCdf(readerCount, options.readerSkew);
+    context.bookByRank = permutation(bookCount, permutationRandom);
+    context.readerByRank = permutation(readerCount, permutationRandom);
+
+    // 在借记录只出现在最近 kActiveWindow 天内，按窗口占比换算出窗口内的在借概率
+    int window = qMin(kActiveWindow, options.historyDays);
+    context.activeProbability = qMin(1.0, options.activeRatio * options.historyDays / window);
+
+    BulkWriter writer;
+    if (!writer.open(path)) {
+        if (error) *error = writer.error;
+        return false;
+    }
+
+    DateTable dates(-options.historyDays - 365 * 75, 400);
+    QElapsedTimer progressTimer;
+    progressTimer.start();
+    qint64 written = 0;
+    auto report = [&](qint64 rows) {
+        written += rows;
+        if (progress && (progressTimer.elapsed() >= 200 || written == totalRows)) {
+            progress(written, totalRows);
+            progressTimer.restart();
+        }
+    };
+    // 出错返回前等待仍在生成的批次，它们引用了栈上的 context
+    QFuture<LoanChunk> pending;
+    auto fail = [&]() -> bool {
+        pending.waitForFinished();
+        if (error) *error = writer.error;
+        return false;
+    };
+
+    if (!writer.exec("BEGIN")) return fail();
+
+    // 读者：类型决定借书上限与借期，借阅生成时需要用到
+    sqlite3_stmt *readerInsert = writer.prepare(
+        "INSERT INTO readers (id, card_number, name, gender, birth_date, phone, email, address, "
+        "reader_type, max_borrow, max_days, status, registration_date, expiry_date) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+    if (!readerInsert) return fail();
+
+    Random readerRandom(streamSeed(options.seed, ReaderStream));
+    context.readerTypes.resize(readerCount);
+    for (int i = 0; i < readerCount; ++i) {
+        int type = pickWeighted(kReaderTypes, readerRandom);
+        context.readerTypes[i] = static_cast<qint8>(type);
+
+        QByteArray card = "R" + QByteArray::number(i + 1).rightJustified(10, '0');
+        QByteArray name = personName(readerRandom);
+        QByteArray phone = "1" + QByteArray::number(3 + below(readerRandom, 7))
+                         + QByteArray::number(static_cast<qint64>(readerRandom() % 1000000000ULL)).rightJustified(9, '0');
+        QByteArray email = "reader" + QByteArray::number(i + 1) + "@example.com";
+        QByteArray address = QByteArray("幸福路") + QByteArray::number(1 + below(readerRandom, 999)) + "号";
+        int age = kReaderTypes[type].maxDays == 60 ? 18 + below(readerRandom, 8) : 20 + below(readerRandom, 50);
+        int registered = -below(readerRandom, options.historyDays + 365);
+
+        sqlite3_bind_int64(readerInsert, 1, i + 1);
+        BulkWriter::bindText(readerInsert, 2, card);
+        BulkWriter::bindText(readerInsert, 3, name);
+        BulkWriter::bindText(readerInsert, 4, below(readerRandom, 2) ? "男" : "女");
+        BulkWriter::bindText(readerInsert, 5, dates.date(-age * 365 - below(readerRandom, 365)));
+        BulkWriter::bindText(readerInsert, 6, phone);
+        BulkWriter::bindText(readerInsert, 7, email);
+        BulkWriter::bindText(readerInsert, 8, address);
+        BulkWriter::bindText(readerInsert, 9, kReaderTypes[type].name);
+        sqlite3_bind_int(readerInsert, 10, kReaderTypes[type].maxBorrow);
+        sqlite3_bind_int(readerInsert, 11, kReaderTypes[type].maxDays);
+        BulkWriter::bindText(readerInsert, 12, below(readerRandom, 100) == 0 ? "挂失" : "正常");
+        BulkWriter::bindText(readerInsert, 13, dates.date(registered));
+        BulkWriter::bindText(readerInsert, 14, dates.date(qMin(registered + 3 * 365, 400)));
+        if (!writer.step(readerInsert)) return fail();
+        if ((i + 1) % ChunkRows == 0) report(ChunkRows);
+    }
+    report(readerCount % ChunkRows);
+
+    // 书名与分类先生成好：历史记录的说明文字需要书名，汇总表需要分类，
+    // 而图书的总数量与可借数量要等借阅记录生成后才能确定，图书最后写入
+    Random catalogRandom(streamSeed(options.seed, CatalogStream));
+    QVector<QByteArray> titles(bookCount);
+    QVector<qint8> categories(bookCount);
+    for (int i = 0; i < bookCount; ++i) {
+        QByteArray &title = titles[i];
+        title = kTitlePrefixes[below(catalogRandom, countOf(kTitlePrefixes))];
+        title += kTitleSubjects[below(catalogRandom, countOf(kTitleSubjects))];
+        title += "（第" + QByteArray::number(1 + below(catalogRandom, 5)) + "版）";
+        categories[i] = static_cast<qint8>(pickWeighted(kCategories, catalogRandom));
+    }
+
+    // 借阅记录：并行生成下一批的同时写入当前批
+    sqlite3_stmt *loanInsert = writer.prepare(
+        "INSERT INTO borrow_records (id, book_id, reader_id, borrow_date, due_date, return_date, "
+        "renew_count, status, overdue_fee) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)");
+    sqlite3_stmt *historyInsert = writer.prepare(
+        "INSERT INTO borrow_history (book_id, reader_id, action, action_date, record_id, due_date, "
+        "overdue_days, fee) VALUES (?, ?, ?, ?, ?, ?, ?, ?)");
+    RollupAccumulator rollups;
+    if (!loanInsert || !historyInsert || !rollups.prepare(writer)) return fail();
+
+    QVector<int> activePerBook(bookCount, 0);
+    qint64 historyRows = 0;
+    const int chunkCount = static_cast<int>((options.loans + ChunkRows - 1) / ChunkRows);
+    const int batchChunks = qMax(1, QThread::idealThreadCount()) * 2;
+    GenerateLoans generateLoans;
+    generateLoans.context = &context;
+
+    auto batchIndices = [&](int firstChunk) -> QList<int> {
+        QList<int> indices;
+        for (int i = firstChunk; i < qMin(firstChunk + batchChunks, chunkCount); ++i) {
+            indices.append(i);
+        }
+        return indices;
+    };
+
+    char stamp[20];
+    pending = QtConcurrent::mapped(batchIndices(0), generateLoans);
+    for (int firstChunk = 0; firstChunk < chunkCount; firstChunk += batchChunks) {
+        pending.waitForFinished();
+        QList<LoanChunk> batch = pending.results();
+        if (firstChunk + batchChunks < chunkCount) {
+            pending = QtConcurrent::mapped(batchIndices(firstChunk + batchChunks), generateLoans);
+        }
+
+        for (const LoanChunk &chunk : batch) {
+            qint64 id = chunk.first;
+            for (const LoanRow &row : chunk.rows) {
+                ++id;
+                const bool returned = row.returnDay != kNotReturned;
+                const QByteArray &borrowDate = dates.date(row.borrowDay);
+                const QByteArray &dueDate = dates.date(row.dueDay);
+                int overdueDays = returned ? qMax(0, row.returnDay - row.dueDay) : 0;
+
+                sqlite3_bind_int64(loanInsert, 1, id);
+                sqlite3_bind_int(loanInsert, 2, row.book + 1);
+                sqlite3_bind_int(loanInsert, 3, row.reader + 1);
+                BulkWriter::bindText(loanInsert, 4, borrowDate);
+                BulkWriter::bindText(loanInsert, 5, dueDate);
+                if (returned) {
+                    BulkWriter::bindText(loanInsert, 6, dates.date(row.returnDay));
+                } else {
+                    sqlite3_bind_null(loanInsert, 6);
+                    ++activePerBook[row.book];
+                }
+                sqlite3_bind_int(loanInsert, 7, row.renewCount);
+                BulkWriter::bindText(loanInsert, 8, returned ? "已还" : "借出");
+                sqlite3_bind_double(loanInsert, 9, overdueDays * 0.5);
+                if (!writer.step(loanInsert)) return fail();
+
+                const int category = categories.at(row.book);
+                const int readerType = context.readerTypes.at(row.reader);
+                rollups.add(row.borrowDay, RollupAccumulator::Loan, row.book + 1, row.reader + 1, category, readerType);
+                if (returned) {
+                    rollups.add(row.returnDay, RollupAccumulator::Return, row.book + 1, row.reader + 1, category, readerType);
+                }
+
+                if (!options.history) continue;
+
+                // 与界面借还书时写入的历史字段一致
+                sqlite3_bind_int(historyInsert, 1, row.book + 1);
+                sqlite3_bind_int(historyInsert, 2, row.reader + 1);
+                sqlite3_bind_int64(historyInsert, 5, id);
+
+                dates.utcTimestamp(row.borrowDay, row.borrowSecond, stamp);
+                BulkWriter::bindText(historyInsert, 3, "借出");
+                BulkWriter::bindText(historyInsert, 4, stamp);
+                BulkWriter::bindText(historyInsert, 6, dates.date(row.firstDueDay));
+                sqlite3_bind_null(historyInsert, 7);
+                sqlite3_bind_null(historyInsert, 8);
+                if (!writer.step(historyInsert)) return fail();
+                ++historyRows;
+
+                // 每次续借一条历史，均匀分布在借出与归还（或今天）之间；
+                // 汇总表的续借次数按历史记录的日期统计
+                const int lastDay = returned ? row.returnDay : 0;
+                for (int renewal = 1; renewal <= row.renewCount; ++renewal) {
+                    int day = row.borrowDay + (lastDay - row.borrowDay) * renewal / (row.renewCount + 1);
+                    int due = row.firstDueDay + (row.dueDay - row.firstDueDay) * renewal / row.renewCount;
+                    dates.utcTimestamp(day, row.borrowSecond, stamp);
+                    BulkWriter::bindText(historyInsert, 3, "续借");
+                    BulkWriter::bindText(historyInsert, 4, stamp);
+                    BulkWriter::bindText(historyInsert, 6, dates.date(due));
+                    if (!writer.step(historyInsert)) return fail();
+                    rollups.add(day, RollupAccumulator::Renewal, row.book + 1, row.reader + 1, category, readerType);
+                    ++historyRows;
+                }
+
+                if (returned) {
+                    dates.utcTimestamp(row.returnDay, qMin(row.borrowSecond + 3600, 86399), stamp);
+                    BulkWriter::bindText(historyInsert, 3, "归还");
+                    BulkWriter::bindText(historyInsert, 4, stamp);
+                    sqlite3_bind_null(historyInsert, 6);
+                    if (overdueDays > 0) {
+                        sqlite3_bind_int(historyInsert, 7, overdueDays);
+                        sqlite3_bind_double(historyInsert, 8, overdueDays * 0.5);
+                    }
+                    if (!writer.step(historyInsert)) return fail();
+                    ++historyRows;
+                }
+            }
+            report(chunk.rows.size());
+        }
+
+        // 后续批次的借出日期不早于下一批的起始日期，逾期在借记录最多提前到
+        // 约 kActiveWindow + 30 天前，更早的日期已不会再有新事件
+        qint64 nextRow = qMin(static_cast<qint64>(firstChunk + batchChunks) * ChunkRows, options.loans);
+        int settledDay = -options.historyDays + static_cast<int>(nextRow * options.historyDays / options.loans);
+        if (nextRow < options.loans) settledDay = qMin(settledDay, -kActiveWindow - 30);
+        else settledDay = INT_MAX;
+        if (!rollups.flushBefore(settledDay, writer, dates)) return fail();
+
+        // 每批提交一次，控制内存中的脏页数量
+        if (!writer.exec("COMMIT") || !writer.exec("BEGIN")) return fail();
+    }
+
+    // 图书
+    sqlite3_stmt *bookInsert = writer.prepare(
+        "INSERT INTO books (id, isbn, title, author, publisher, publish_date, category, price, "
+        "total_copies, available_copies, location, status) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+    if (!bookInsert) return fail();
+
+    Random bookRandom(streamSeed(options.seed, BookStream));
+    QVector<int> rankOfBook(bookCount);
+    for (int rank = 0; rank < bookCount; ++rank) {
+        rankOfBook[context.bookByRank.at(rank)] = rank;
+    }
+    for (int i = 0; i < bookCount; ++i) {
+        QByteArray isbn = isbn13(i + 1);
+        QByteArray author = personName(bookRandom);
+        QByteArray location = QByteArray(1, char('A' + below(bookRandom, 8))) + "区"
+                            + QByteArray::number(1 + below(bookRandom, 50)) + "架";
+        int publishDay = -365 * (1 + below(bookRandom, 40)) - below(bookRandom, 365);
+        double price = 15.0 + below(bookRandom, 13500) / 100.0;
+
+        // 热门图书多备几本，总数量不少于在借数量
+        int rank = rankOfBook.at(i);
+        int copies = 1 + below(bookRandom, 3) + (rank < bookCount / 100 ? 5 : 0) + (rank < bookCount / 10 ? 2 : 0);
+        int total = qMax(copies, activePerBook.at(i));
+        int available = total - activePerBook.at(i);
+
+        sqlite3_bind_int64(bookInsert, 1, i + 1);
+        BulkWriter::bindText(bookInsert, 2, isbn);
+        BulkWriter::bindText(bookInsert, 3, titles.at(i));
+        BulkWriter::bindText(bookInsert, 4, author);
+        BulkWriter::bindText(bookInsert, 5, kPublishers[below(bookRandom, countOf(kPublishers))]);
+        BulkWriter::bindText(bookInsert, 6, dates.date(publishDay));
+        BulkWriter::bindText(bookInsert, 7, kCategories[categories.at(i)].name);
+        sqlite3_bind_double(bookInsert, 8, price);
+        sqlite3_bind_int(bookInsert, 9, total);
+        sqlite3_bind_int(bookInsert, 10, available);
+        BulkWriter::bindText(bookInsert, 11, location);
+        BulkWriter::bindText(bookInsert, 12, available > 0 ? "在库" : "借出");
+        if (!writer.step(bookInsert)) return fail();
+        if ((i + 1) % ChunkRows == 0) report(ChunkRows);
+    }
+    report(bookCount % ChunkRows);
+
+    if (!writer.exec("COMMIT")) return fail();
+
+    // 关闭批量连接后恢复 WAL、触发器与汇总表
+    for (sqlite3_stmt *statement : writer.statements) {
+        sqlite3_finalize(statement);
+    }
+    writer.statements.clear();
+    writer.exec("PRAGMA journal_mode = DELETE");
+    sqlite3_close(writer.handle);
+    writer.handle = nullptr;
+
+    if (!finishSchema(path, error)) {
+        return false;
+    }
+
+    if (result) {
+        result->books = options.books;
+        result->readers = options.readers;
+        result->loans = options.loans;
+        result->historyRows = historyRows;
+        result->elapsedMs = elapsed.elapsed();
+    }
+    return true;
+}
@@ -0,0 +1,50 @@
+﻿// datasetgenerator.h
+#ifndef DATASETGENERATOR_H
+#define DATASETGENERATOR_H
+
+#include <QString>
+#include <functional>
+
+// 合成测试数据：按给定规模生成图书、读者、借阅记录与借阅历史。
+// 图书与读者的借阅热度服从 Zipf 分布，分类、读者类型按比例混合，
+// 在借与逾期比例可调。同一组参数和种子在任何机器上生成完全相同的数据：
+// 借阅记录按固定大小分块，每块使用由种子和块号导出的独立随机序列，
+// 各块在所有核心上并行生成，再由单个连接按顺序批量写入。
+class DatasetGenerator
+{
+public:
+    struct Options
+    {
+        qint64 books = 10000;
+        qint64 readers = 5000;
+        qint64 loans = 100000;
+        quint64 seed = 1;
+        int historyDays = 730;       // 借阅记录覆盖的天数（截止到今天）
+        double activeRatio = 0.05;   // 在借记录占全部借阅的比例
+        double overdueRatio = 0.15;  // 在借记录中已逾期的比例
+        double bookSkew = 1.0;       // 图书热度的 Zipf 指数
+        double readerSkew = 0.6;     // 读者活跃度的 Zipf 指数
+        bool history = true;         // 同时生成借出、续借、归还的历史记录
+    };
+
+    struct Result
+    {
+        qint64 books = 0;
+        qint64 readers = 0;
+        qint64 loans = 0;
+        qint64 historyRows = 0;
+        qint64 elapsedMs = 0;
+    };
+
+    // 参数为已写入行数与总行数（不含历史记录）
+    typedef std::function<void(qint64, qint64)> ProgressCallback;
+
+    static const int ChunkRows = 50000;
+
+    // 目标文件必须不存在；生成的数据库与主程序的表结构、触发器和汇总表一致
+    static bool generate(const QString &path, const Options &options,
+                         Result *result, QString *error,
+                         const ProgressCallback &progress = ProgressCallback());
+};
+
+#endif // DATASETGENERATOR_H
@@ -0,0 +1,260 @@
+﻿// historyarchiver.cpp
+#include "historyarchiver.h"
+#include <QtSql>
+#include <QDir>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QThread>
+
+namespace {
+
+const char *const kArchivedTables[] = {"borrow_records", "borrow_history"};
+
+struct ColumnInfo
+{
+    QString name;
+    QString type;
+};
+
+QList<ColumnInfo> tableColumns(QSqlDatabase db, const QString &schema, const QString &table)
+{
+    QList<ColumnInfo> columns;
+    QSqlQuery query(db);
+    query.exec(QString("PRAGMA %1.table_info(%2)").arg(schema, table));
+    while (query.next()) {
+        ColumnInfo column;
+        column.name = query.value(1).toString();
+        column.type = query.value(2).toString();
+        columns.append(column);
+    }
+    return columns;
+}
+
+QString columnList(const QList<ColumnInfo> &columns)
+{
+    QStringList names;
+    for (const ColumnInfo &column : columns) {
+        names.append(column.name);
+    }
+    return names.join(", ");
+}
+
+} // namespace
+
+HistoryArchiver::HistoryArchiver(const QString &databasePath, const QDate &cutoff, QObject *parent)
+    : QObject(parent)
+    , databasePath(databasePath)
+    , cutoff(cutoff)
+    , batchSize(2000)
+    , cancelled(0)
+{
+}
+
+QString HistoryArchiver::archivePath(const QString &databasePath)
+{
+    QFileInfo info(databasePath);
+    return info.absoluteDir().filePath(info.completeBaseName() + "_archive.db");
+}
+
+bool HistoryArchiver::attach(QSqlDatabase db, QString *error)
+{
+    QSqlQuery query(db);
+
+    bool attached = false;
+    query.exec("PRAGMA database_list");
+    while (query.next()) {
+        if (query.value(1).toString() == "archive") {
+            attached = true;
+        }
+    }
+
+    if (!attached) {
+        query.prepare("ATTACH DATABASE ? AS archive");
+        query.addBindValue(archivePath(db.databaseName()));
+        if (!query.exec()) {
+            if (error) *error = query.lastError().text();
+            return false;
+        }
+    }
+
+    for (const char *name : kArchivedTables) {
+        const QString table = name;
+
+        // 归档表沿用主库中的表定义
+        query.prepare("SELECT sql FROM main.sqlite_master WHERE type = 'table' AND name = ?");
+        query.addBindValue(table);
+        if (!query.exec() || !query.next()) {
+            continue;
+        }
+        QString createSql = query.value(0).toString();
+        createSql.replace(QRegularExpression(QString("^CREATE TABLE\\s+\"?%1\"?").arg(table)),
+                          QString("CREATE TABLE IF NOT EXISTS archive.%1").arg(table));
+        if (!query.exec(createSql)) {
+            if (error) *error = query.lastError().text();
+            return false;
+        }
+
+        // 主表后来新增的列同步到归档表
+        QList<ColumnInfo> mainColumns = tableColumns(db, "main", table);
+        QStringList archiveColumns;
+        for (const ColumnInfo &column : tableColumns(db, "archive", table)) {
+            archiveColumns.append(column.name);
+        }
+        for (const ColumnInfo &column : mainColumns) {
+            if (!archiveColumns.contains(column.name)) {
+                query.exec(QString("ALTER TABLE archive.%1 ADD COLUMN %2 %3")
+                               .arg(table, column.name, column.type));
+            }
+        }
+
+        // 合并视图：热数据在前，归档数据在后；两边都有的行只取主库中的一份
+        QString columns = columnList(mainColumns);
+        query.exec(QString("DROP VIEW IF EXISTS temp.all_%1").arg(table));
+        if (!query.exec(QString("CREATE TEMP VIEW all_%1 AS "
+                                "SELECT %2 FROM main.%1 UNION ALL SELECT %2 FROM archive.%1 AS a "
+                                "WHERE NOT EXISTS (SELECT 1 FROM main.%1 AS m WHERE m.id = a.id)")
+                            .arg(table, columns))) {
+            if (error) *error = query.lastError().text();
+            return false;
+        }
+    }
+
+    // 历史报表按图书、读者和时间查询归档数据
+    query.exec("CREATE INDEX IF NOT EXISTS archive.idx_archive_records_book ON borrow_records(book_id)");
+    query.exec("CREATE INDEX IF NOT EXISTS archive.idx_archive_records_reader ON borrow_records(reader_id)");
+    query.exec("CREATE INDEX IF NOT EXISTS archive.idx_archive_history_date ON borrow_history(action_date)");
+
+    return true;
+}
+
+bool HistoryArchiver::reconcile(QSqlDatabase db, QString *error)
+{
+    QSqlQuery query(db);
+    db.transaction();
+    for (const char *name : kArchivedTables) {
+        const QString table = name;
+        // 主库中没有该表的自增序号时比较结果为 NULL，不会误删
+        if (!query.exec(QString("DELETE FROM archive.%1 WHERE id IN (SELECT id FROM main.%1) "
+                                "OR id > (SELECT seq FROM main.sqlite_sequence WHERE name = '%1')").arg(table))) {
+            if (error) *error = query.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+    if (!db.commit()) {
+        if (error) *error = db.lastError().text();
+        db.rollback();
+        return false;
+    }
+    return true;
+}
+
+void HistoryArchiver::setBatchSize(int rows)
+{
+    batchSize = qMax(1, rows);
+}
+
+void HistoryArchiver::cancel()
+{
+    cancelled.storeRelease(1);
+}
+
+void HistoryArchiver::run()
+{
+    const QString connectionName = "history_archiver";
+    QString error;
+    int archivedRecords = 0;
+    int archivedHistory = 0;
+
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        db.setDatabaseName(databasePath);
+        db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+
+        if (!db.open()) {
+            error = db.lastError().text();
+        } else if (attach(db, &error)) {
+            QSqlQuery query(db);
+            query.exec("CREATE TEMP TABLE IF NOT EXISTS archive_batch (id INTEGER PRIMARY KEY)");
+
+            // 在借记录永远留在主库
+            while (!cancelled.loadAcquire()) {
+                int rows = archiveBatch(db, "borrow_records", "status = '已还' AND return_date < ?", &error);
+                if (rows < 0) break;
+                archivedRecords += rows;
+                emit progress(archivedRecords, archivedHistory);
+                if (rows < batchSize) break;
+                QThread::msleep(50); // 批次之间让出写锁
+            }
+
+            while (error.isEmpty() && !cancelled.loadAcquire()) {
+                int rows = archiveBatch(db, "borrow_history", "action_date < ?", &error);
+                if (rows < 0) break;
+                archivedHistory += rows;
+                emit progress(archivedRecords, archivedHistory);
+                if (rows < batchSize) break;
+                QThread::msleep(50);
+            }
+
+            // 启用了增量清理时归还空闲页，主库文件随之缩小
+            query.exec("PRAGMA main.auto_vacuum");
+            if (error.isEmpty() && query.next() && query.value(0).toInt() == 2) {
+                query.exec("PRAGMA main.incremental_vacuum");
+                while (query.next()) {}
+            }
+        }
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+
+    if (!error.isEmpty()) {
+        emit finished(false, "归档失败：" + error);
+    } else if (cancelled.loadAcquire()) {
+        emit finished(false, QString("归档已取消，已迁移 %1 条借阅记录、%2 条历史记录")
+                                 .arg(archivedRecords).arg(archivedHistory));
+    } else {
+        emit finished(true, QString("归档完成，已迁移 %1 条借阅记录、%2 条历史记录")
+                                .arg(archivedRecords).arg(archivedHistory));
+    }
+}
+
+int HistoryArchiver::archiveBatch(QSqlDatabase db, const QString &table,
+                                  const QString &condition, QString *error)
+{
+    QSqlQuery query(db);
+    const QString columns = columnList(tableColumns(db, "main", table));
+
+    query.exec("DELETE FROM temp.archive_batch");
+    query.prepare(QString("INSERT INTO temp.archive_batch "
+                          "SELECT id FROM main.%1 WHERE %2 ORDER BY id LIMIT %3")
+                      .arg(table, condition).arg(batchSize));
+    query.addBindValue(cutoff.toString("yyyy-MM-dd"));
+    if (!query.exec()) {
+        *error = query.lastError().text();
+        return -1;
+    }
+    int rows = query.numRowsAffected();
+    if (rows <= 0) {
+        return 0;
+    }
+
+    // 先提交到归档库，再从主库删除：两步之间中断只会留下一份可被下次覆盖的副本，不会丢数据
+    db.transaction();
+    if (!query.exec(QString("INSERT OR REPLACE INTO archive.%1 (%2) SELECT %2 FROM main.%1 "
+                            "WHERE id IN (SELECT id FROM temp.archive_batch)").arg(table, columns))) {
+        *error = query.lastError().text();
+        db.rollback();
+        return -1;
+    }
+    db.commit();
+
+    db.transaction();
+    if (!query.exec(QString("DELETE FROM main.%1 WHERE id IN (SELECT id FROM temp.archive_batch)").arg(table))) {
+        *error = query.lastError().text();
+        db.rollback();
+        return -1;
+    }
+    db.commit();
+
+    return rows;
+}
@@ -0,0 +1,50 @@
+﻿// historyarchiver.h
+#ifndef HISTORYARCHIVER_H
+#define HISTORYARCHIVER_H
+
+#include <QObject>
+#include <QSqlDatabase>
+#include <QDate>
+#include <QAtomicInt>
+
+// 冷热分离：把截止日期之前已归还的借阅记录和借阅历史分批迁移到
+// 归档库（library_archive.db），主库只保留在借与近期数据。
+// 归档库以 archive 名称附加到连接上，all_borrow_records / all_borrow_history
+// 两个临时视图把主库与归档库合并，历史报表透明地查询两者；
+// 同一 ID 同时在两边时（迁移的两次提交之间，或主库恢复到归档之前的快照）以主库为准。
+class HistoryArchiver : public QObject
+{
+    Q_OBJECT
+
+public:
+    HistoryArchiver(const QString &databasePath, const QDate &cutoff, QObject *parent = nullptr);
+
+    static QString archivePath(const QString &databasePath);
+
+    // 附加归档库、同步表结构并创建合并视图，每次打开主库连接后调用
+    static bool attach(QSqlDatabase db, QString *error = nullptr);
+
+    // 主库被恢复替换后调用：删去归档库中仍在主库里的副本，以及恢复点之后才产生、
+    // 在恢复后的时间线上并不存在的行（ID 超出主库的自增序号）
+    static bool reconcile(QSqlDatabase db, QString *error = nullptr);
+
+    void setBatchSize(int rows);
+    void cancel();
+
+public slots:
+    void run();
+
+signals:
+    void progress(int archivedRecords, int archivedHistory);
+    void finished(bool ok, const QString &message);
+
+private:
+    int archiveBatch(QSqlDatabase db, const QString &table, const QString &condition, QString *error);
+
+    QString databasePath;
+    QDate cutoff;
+    int batchSize;
+    QAtomicInt cancelled;
+};
+
+#endif // HISTORYARCHIVER_H
@@ -0,0 +1,441 @@
+﻿// historylog.cpp
+#include "historylog.h"
+#include "perfmonitor.h"
+#include <QtSql>
+#include <QAtomicInt>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QLockFile>
+#include <QMutexLocker>
+
+namespace {
+
+const quint32 kRecordMagic = 0x4C4D4831; // "LMH1"
+const int kSlots = 8;                    // 同一数据库最多同时打开队列的进程数
+const int kMaxQueued = 4096;             // 内存中等待写入的事件上限
+const int kRetryMs = 1000;               // 写入失败后重试的间隔
+
+QString queuePath(const QString &dir, int slot)
+{
+    return QString("%1/slot-%2.queue").arg(dir).arg(slot);
+}
+
+// 每条事件单独成帧并带校验和，进程在写入中途退出时只丢弃末尾不完整的一条
+void writeRecord(QDataStream &stream, qint64 seq, const HistoryLog::Event &event)
+{
+    QByteArray payload;
+    {
+        QDataStream fields(&payload, QIODevice::WriteOnly);
+        fields.setVersion(QDataStream::Qt_5_6);
+        fields << seq << event.action << event.timestamp << qint32(event.bookId) << qint32(event.readerId)
+               << qint32(event.recordId) << event.dueDate << qint32(event.overdueDays) << event.fee;
+    }
+    stream << kRecordMagic << payload << qChecksum(payload.constData(), payload.size());
+}
+
+bool readRecord(QDataStream &stream, qint64 *seq, HistoryLog::Event *event)
+{
+    quint32 magic = 0;
+    QByteArray payload;
+    quint16 checksum = 0;
+    stream >> magic >> payload >> checksum;
+    if (stream.status() != QDataStream::Ok || magic != kRecordMagic
+        || checksum != qChecksum(payload.constData(), payload.size())) {
+        return false;
+    }
+
+    QDataStream fields(payload);
+    fields.setVersion(QDataStream::Qt_5_6);
+    qint32 bookId = 0, readerId = 0, recordId = 0, overdueDays = 0;
+    fields >> *seq >> event->action >> event->timestamp >> bookId >> readerId
+           >> recordId >> event->dueDate >> overdueDays >> event->fee;
+    event->bookId = bookId;
+    event->readerId = readerId;
+    event->recordId = recordId;
+    event->overdueDays = overdueDays;
+    return fields.status() == QDataStream::Ok;
+}
+
+// 0 表示没有，写入 NULL
+QVariant optionalId(int id)
+{
+    return id ? QVariant(id) : QVariant(QVariant::Int);
+}
+
+} // namespace
+
+HistoryLog::HistoryLog(QObject *parent)
+    : QThread(parent)
+    , lock(nullptr)
+    , slot(-1)
+    , maxBatch(256)
+    , maxDelayMs(50)
+    , stagedOffset(0)
+    , nextSeq(1)
+    , stopping(false)
+{
+}
+
+HistoryLog::~HistoryLog()
+{
+    close();
+}
+
+QString HistoryLog::queueDirectory(const QString &databasePath)
+{
+    return databasePath + ".history";
+}
+
+void HistoryLog::setBatchLimits(int maxEvents, int maxDelayMs)
+{
+    QMutexLocker locker(&mutex);
+    maxBatch = qMax(1, maxEvents);
+    this->maxDelayMs = qMax(0, maxDelayMs);
+}
+
+bool HistoryLog::open(QSqlDatabase db, QString *error)
+{
+    close();
+
+    QSqlQuery query(db);
+    if (!query.exec("CREATE TABLE IF NOT EXISTS history_queue ("
+                    "slot INTEGER PRIMARY KEY,"
+                    "applied_seq INTEGER NOT NULL,"
+                    "committed_seq INTEGER)")) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+    // 旧版本在提交之后才追加，已提交序号为 NULL 的槽位里的事件都已提交
+    bool hasCommitted = false;
+    query.exec("PRAGMA table_info(history_queue)");
+    while (query.next()) {
+        hasCommitted = hasCommitted || query.value(1).toString() == "committed_seq";
+    }
+    if (!hasCommitted && !query.exec("ALTER TABLE history_queue ADD COLUMN committed_seq INTEGER")) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+
+    databasePath = db.databaseName();
+    const QString dir = queueDirectory(databasePath);
+    if (!QDir().mkpath(dir)) {
+        if (error) *error = "无法创建队列目录 " + dir;
+        return false;
+    }
+
+    // 能锁住的槽位都没有进程在用，先补写其中残留的事件，再占用第一个
+    for (int candidate = 0; candidate < kSlots; ++candidate) {
+        QLockFile *candidateLock = new QLockFile(QString("%1/slot-%2.lock").arg(dir).arg(candidate));
+        // 锁一直持有到关闭，不能按时长判为过期；持有进程已退出的锁 QLockFile 仍会识别
+        candidateLock->setStaleLockTime(0);
+        if (!candidateLock->tryLock(0)) {
+            delete candidateLock;
+            continue;
+        }
+        if (!replay(db, candidate, queuePath(dir, candidate), error) || slot >= 0) {
+            delete candidateLock;
+            continue;
+        }
+        slot = candidate;
+        lock = candidateLock;
+    }
+    if (slot < 0) {
+        if (error && error->isEmpty()) *error = "没有空闲的队列槽位";
+        return false;
+    }
+
+    // 补写之后已提交的都已写入；没有提交的序号可能被别的进程登记过，新事件从两者之后编号
+    query.prepare("SELECT MAX(applied_seq, IFNULL(committed_seq, 0)) FROM history_queue WHERE slot = ?");
+    query.addBindValue(slot);
+    nextSeq = query.exec() && query.next() ? query.value(0).toLongLong() + 1 : 1;
+    query.prepare("INSERT OR IGNORE INTO history_queue (slot, applied_seq) VALUES (?, 0)");
+    query.addBindValue(slot);
+    query.exec();
+    query.prepare("UPDATE history_queue SET committed_seq = ? WHERE slot = ?");
+    query.addBindValue(nextSeq - 1);
+    query.addBindValue(slot);
+    if (!query.exec()) {
+        if (error) *error = query.lastError().text();
+        delete lock;
+        lock = nullptr;
+        slot = -1;
+        return false;
+    }
+
+    queueFile.setFileName(queuePath(dir, slot));
+    if (!queueFile.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        if (error) *error = queueFile.errorString();
+        delete lock;
+        lock = nullptr;
+        slot = -1;
+        return false;
+    }
+
+    static QAtomicInt serial;
+    connectionName = QString("history_log_%1").arg(serial.fetchAndAddRelaxed(1));
+    stopping = false;
+    start(QThread::LowPriority);
+    return true;
+}
+
+void HistoryLog::close()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+    }
+    arrived.wakeAll();
+    wait();
+
+    // 没能写入的事件还在队列文件中
+    queue.clear();
+    staged.clear();
+    queueFile.close();
+    delete lock;
+    lock = nullptr;
+    slot = -1;
+}
+
+bool HistoryLog::stage(QSqlDatabase db, const QVector<Event> &events)
+{
+    if (events.isEmpty()) {
+        return true;
+    }
+
+    qint64 lastSeq = 0;
+    {
+        QMutexLocker locker(&mutex);
+        // 调用方的事务持有写锁，后台线程此时写不进数据库，队列满时等待也无济于事
+        if (slot < 0 || stopping || !staged.isEmpty() || queue.size() + events.size() > kMaxQueued) {
+            return false;
+        }
+
+        QByteArray records;
+        {
+            QDataStream stream(&records, QIODevice::WriteOnly);
+            stream.setVersion(QDataStream::Qt_5_6);
+            for (int i = 0; i < events.size(); ++i) {
+                writeRecord(stream, nextSeq + i, events.at(i));
+            }
+        }
+
+        // 写到一半失败时截掉残缺的部分，后续追加的记录才能被完整读出
+        const qint64 previousSize = queueFile.size();
+        if (queueFile.write(records) != records.size() || !queueFile.flush()) {
+            queueFile.resize(previousSize);
+            return false;
+        }
+
+        stagedOffset = previousSize;
+        for (const Event &event : events) {
+            staged.append(Queued{nextSeq++, event});
+        }
+        lastSeq = nextSeq - 1;
+    }
+
+    // 已提交序号随调用方的事务一起提交或回滚
+    TimedQuery mark(db);
+    mark.prepare("UPDATE history_queue SET committed_seq = ? WHERE slot = ?");
+    mark.addBindValue(lastSeq);
+    mark.addBindValue(slot);
+    if (!mark.exec() || mark.numRowsAffected() != 1) {
+        discard();
+        return false;
+    }
+    return true;
+}
+
+void HistoryLog::publish()
+{
+    QMutexLocker locker(&mutex);
+    if (staged.isEmpty()) {
+        return;
+    }
+    queue += staged;
+    staged.clear();
+    arrived.wakeOne();
+}
+
+void HistoryLog::discard()
+{
+    QMutexLocker locker(&mutex);
+    if (staged.isEmpty()) {
+        return;
+    }
+    // 有暂存的事件时后台线程不会清空队列文件，暂存之前的长度仍然有效；
+    // 已提交序号随事务回滚，这些序号留给下一批
+    queueFile.resize(stagedOffset);
+    nextSeq -= staged.size();
+    staged.clear();
+}
+
+bool HistoryLog::write(QSqlDatabase db, const QVector<Event> &events, QString *error, int slot, qint64 lastSeq)
+{
+    ScopedTimer timer("写入借阅历史");
+    if (!db.transaction()) {
+        if (error) *error = db.lastError().text();
+        return false;
+    }
+
+    if (!insert(db, events, error)) {
+        db.rollback();
+        return false;
+    }
+
+    if (slot >= 0) {
+        // 保留已提交序号，只推进已写序号
+        TimedQuery mark(db);
+        mark.prepare("INSERT OR IGNORE INTO history_queue (slot, applied_seq) VALUES (?, 0)");
+        mark.addBindValue(slot);
+        bool marked = mark.exec();
+        mark.prepare("UPDATE history_queue SET applied_seq = ? WHERE slot = ?");
+        mark.addBindValue(lastSeq);
+        mark.addBindValue(slot);
+        marked = marked && mark.exec();
+        if (!marked) {
+            if (error) *error = mark.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+
+    if (!db.commit()) {
+        if (error) *error = db.lastError().text();
+        db.rollback();
+        return false;
+    }
+    return true;
+}
+
+bool HistoryLog::insert(QSqlDatabase db, const QVector<Event> &events, QString *error)
+{
+    // 提醒只带借阅记录号，图书与读者从借阅记录中取
+    TimedQuery insert(db);
+    insert.prepare("INSERT INTO borrow_history (book_id, reader_id, action, action_date, "
+                   "record_id, due_date, overdue_days, fee) VALUES ("
+                   "COALESCE(?, (SELECT book_id FROM borrow_records WHERE id = ?)), "
+                   "COALESCE(?, (SELECT reader_id FROM borrow_records WHERE id = ?)), "
+                   "?, ?, ?, ?, ?, ?)");
+    for (const Event &event : events) {
+        insert.addBindValue(optionalId(event.bookId));
+        insert.addBindValue(event.recordId);
+        insert.addBindValue(optionalId(event.readerId));
+        insert.addBindValue(event.recordId);
+        insert.addBindValue(event.action);
+        // 与 CURRENT_TIMESTAMP 相同的 UTC 格式
+        insert.addBindValue(QDateTime::fromMSecsSinceEpoch(event.timestamp, Qt::UTC).toString("yyyy-MM-dd hh:mm:ss"));
+        insert.addBindValue(optionalId(event.recordId));
+        insert.addBindValue(event.dueDate.isValid() ? QVariant(event.dueDate) : QVariant(QVariant::Date));
+        insert.addBindValue(event.overdueDays ? QVariant(event.overdueDays) : QVariant(QVariant::Int));
+        insert.addBindValue(event.fee > 0 ? QVariant(event.fee) : QVariant(QVariant::Double));
+        if (!insert.exec()) {
+            if (error) *error = insert.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool HistoryLog::replay(QSqlDatabase db, int slot, const QString &path, QString *error)
+{
+    QFile file(path);
+    if (!file.exists()) {
+        return true;
+    }
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (error) *error = file.errorString();
+        return false;
+    }
+
+    QSqlQuery query(db);
+    query.prepare("SELECT applied_seq, committed_seq FROM history_queue WHERE slot = ?");
+    query.addBindValue(slot);
+    const bool found = query.exec() && query.next();
+    const qint64 applied = found ? query.value(0).toLongLong() : 0;
+    const bool bounded = found && !query.value(1).isNull();
+    const qint64 committed = bounded ? query.value(1).toLongLong() : 0;
+
+    // 序号不大于已写序号的事件在上次退出前已经写入，只是还没来得及清空文件；
+    // 大于已提交序号的事件所在的事务没有提交，进程就退出了
+    QVector<Event> events;
+    qint64 lastSeq = applied;
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    qint64 seq = 0;
+    Event event;
+    while (!stream.atEnd() && readRecord(stream, &seq, &event)) {
+        if (seq > applied && (!bounded || seq <= committed)) {
+            events.append(event);
+            lastSeq = qMax(lastSeq, seq);
+        }
+    }
+    file.close();
+
+    if (!events.isEmpty() && !write(db, events, error, slot, lastSeq)) {
+        return false;
+    }
+    return file.remove();
+}
+
+void HistoryLog::run()
+{
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+        db.setDatabaseName(databasePath);
+        db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+        const bool opened = db.open();
+
+        QMutexLocker locker(&mutex);
+        for (;;) {
+            while (queue.isEmpty() && !stopping) {
+                arrived.wait(&mutex);
+            }
+            if (queue.isEmpty()) {
+                break;
+            }
+
+            // 第一条到达后再等一小段时间凑成一批；停止时不再等
+            QElapsedTimer window;
+            window.start();
+            while (queue.size() < maxBatch && !stopping) {
+                const qint64 remaining = maxDelayMs - window.elapsed();
+                if (remaining <= 0 || !arrived.wait(&mutex, static_cast<unsigned long>(remaining))) {
+                    break;
+                }
+            }
+
+            const int count = qMin(queue.size(), maxBatch);
+            QVector<Event> events;
+            events.reserve(count);
+            for (int i = 0; i < count; ++i) {
+                events.append(queue.at(i).event);
+            }
+            const qint64 lastSeq = queue.at(count - 1).seq;
+
+            locker.unlock();
+            const bool written = opened && write(db, events, nullptr, slot, lastSeq);
+            locker.relock();
+
+            if (!written) {
+                // 数据库暂时不可写：事件仍在队列文件中，稍后重试；停止时留给下次打开时补写
+                if (stopping) {
+                    break;
+                }
+                locker.unlock();
+                msleep(kRetryMs);
+                locker.relock();
+                continue;
+            }
+
+            queue.remove(0, count);
+            if (queue.isEmpty() && staged.isEmpty()) {
+                // 全部写入后清空队列文件；序号继续递增，已写序号仍然有效
+                queueFile.resize(0);
+            }
+        }
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+}
@@ -0,0 +1,100 @@
+﻿// historylog.h
+#ifndef HISTORYLOG_H
+#define HISTORYLOG_H
+
+#include <QDate>
+#include <QFile>
+#include <QMutex>
+#include <QSqlDatabase>
+#include <QString>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+class QLockFile;
+
+// 借阅历史的后写队列。借还书在提交之前把结构化的事件追加到本地队列文件
+// （进程异常退出后仍在），由后台线程攒批写入 borrow_history，借还书的事务中
+// 不再插入历史。
+// 每个进程占用一个队列槽位（<数据库>.history/slot-N.queue，用锁文件互斥），
+// 打开时先把无主槽位里残留的事件补写进数据库。history_queue 表记着各槽位的两个序号：
+// 已提交序号与借还书在同一事务中推进，进程在追加之后、提交之前退出时，补写据此跳过
+// 没有提交的事件；已写入序号与历史行在同一事务中提交，补写时据此跳过已写过的事件。
+class HistoryLog : public QThread
+{
+    Q_OBJECT
+
+public:
+    struct Event
+    {
+        QString action;          // 借出、归还、续借、逾期提醒、预约到书
+        qint64 timestamp = 0;    // UTC 毫秒
+        int bookId = 0;          // 为 0 时按 recordId 取借阅记录中的图书与读者
+        int readerId = 0;
+        int recordId = 0;
+        QDate dueDate;           // 借出、续借后的应还日期；提醒时为原应还日期；到书时为取书期限
+        int overdueDays = 0;
+        double fee = 0.0;
+    };
+
+    explicit HistoryLog(QObject *parent = nullptr);
+    ~HistoryLog();
+
+    static QString queueDirectory(const QString &databasePath);
+
+    // 占用一个槽位、补写残留事件并启动后台线程。db 为调用线程上已打开的连接，
+    // 后台线程另开一个连接到同一个数据库
+    bool open(QSqlDatabase db, QString *error = nullptr);
+
+    // 写完队列中的事件后停止；写入失败的事件留在队列文件中，下次打开时补写
+    void close();
+
+    bool isOpen() const { return slot >= 0; }
+
+    // 在调用方的写事务提交之前调用：事件追加到队列文件，并在 db 的当前事务中登记已提交序号。
+    // 事务提交后调用 publish 交给后台线程写入，回滚时调用 discard 从队列文件中截掉。
+    // 未打开、队列已满或写入失败时返回 false，调用方应在事务中用 insert 直接写入
+    bool stage(QSqlDatabase db, const QVector<Event> &events);
+    void publish();
+    void discard();
+
+    // 每批最多 maxEvents 条，第一条到达后最多再等 maxDelayMs 毫秒
+    void setBatchLimits(int maxEvents, int maxDelayMs);
+
+    // 在调用方的事务之外直接写入一批事件；slot 不小于 0 时同时推进该槽位的已写序号
+    static bool write(QSqlDatabase db, const QVector<Event> &events, QString *error = nullptr,
+                      int slot = -1, qint64 lastSeq = 0);
+
+    // 在调用方的事务中插入历史行
+    static bool insert(QSqlDatabase db, const QVector<Event> &events, QString *error = nullptr);
+
+protected:
+    void run() override;
+
+private:
+    struct Queued
+    {
+        qint64 seq;
+        Event event;
+    };
+
+    bool replay(QSqlDatabase db, int slot, const QString &path, QString *error);
+
+    QString databasePath;
+    QString connectionName;
+    QLockFile *lock;
+    int slot;
+    int maxBatch;
+    int maxDelayMs;
+
+    QMutex mutex;
+    QWaitCondition arrived;
+    QFile queueFile;
+    QVector<Queued> queue;
+    QVector<Queued> staged;  // 已追加到队列文件、等待调用方提交的一批
+    qint64 stagedOffset;     // 追加这一批之前队列文件的长度
+    qint64 nextSeq;
+    bool stopping;
+};
+
+#endif // HISTORYLOG_H
@@ -0,0 +1,222 @@
+﻿// kioskwindow.cpp
+#include "kioskwindow.h"
+#include <QCheckBox>
+#include <QComboBox>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QLabel>
+#include <QLineEdit>
+#include <QStandardPaths>
+#include <QTableWidget>
+#include <QTimer>
+#include <QVBoxLayout>
+
+namespace {
+
+const int kMaxResults = 200;          // 每次最多显示的条数
+const int kSearchDelayMs = 250;       // 输入停顿多久后检索
+const int kRefreshIntervalMs = 60 * 1000;  // 检查快照是否更新的间隔
+
+// 快照文件的修改时间与大小，作为本机副本的文件名；生成一次快照变一次
+QString snapshotKey(const QFileInfo &info)
+{
+    return QString("%1-%2").arg(info.lastModified().toMSecsSinceEpoch()).arg(info.size());
+}
+
+} // namespace
+
+KioskWindow::KioskWindow(const QString &snapshotPath, QWidget *parent)
+    : QWidget(parent)
+    , sourcePath(snapshotPath)
+    , cacheDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/catalog")
+    , searchEdit(new QLineEdit)
+    , categoryCombo(new QComboBox)
+    , availableCheck(new QCheckBox("只看可借"))
+    , resultTable(new QTableWidget)
+    , statusLabel(new QLabel)
+    , searchDelay(new QTimer(this))
+    , refreshTimer(new QTimer(this))
+{
+    QFont font = this->font();
+    font.setPointSize(font.pointSize() + 4);
+    setFont(font);
+
+    QLabel *titleLabel = new QLabel("馆藏查询");
+    QFont titleFont = font;
+    titleFont.setPointSize(font.pointSize() + 10);
+    titleFont.setBold(true);
+    titleLabel->setFont(titleFont);
+    titleLabel->setAlignment(Qt::AlignCenter);
+
+    searchEdit->setPlaceholderText("输入书名、作者或 ISBN，也可以扫描图书条码");
+    searchEdit->setClearButtonEnabled(true);
+
+    QHBoxLayout *searchLayout = new QHBoxLayout;
+    searchLayout->addWidget(searchEdit, 1);
+    searchLayout->addWidget(categoryCombo);
+    searchLayout->addWidget(availableCheck);
+
+    resultTable->setColumnCount(7);
+    resultTable->setHorizontalHeaderLabels(QStringList() << "书名" << "作者" << "ISBN" << "出版社"
+                                                         << "分类" << "位置" << "可借/总数");
+    resultTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    resultTable->setSelectionBehavior(QAbstractItemView::SelectRows);
+    resultTable->verticalHeader()->hide();
+    resultTable->horizontalHeader()->setSectionResizeMode(0, QHeaderView::Stretch);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addWidget(titleLabel);
+    layout->addLayout(searchLayout);
+    layout->addWidget(resultTable, 1);
+    layout->addWidget(statusLabel);
+
+    searchDelay->setSingleShot(true);
+    searchDelay->setInterval(kSearchDelayMs);
+    connect(searchDelay, &QTimer::timeout, this, &KioskWindow::search);
+    connect(searchEdit, &QLineEdit::textChanged, searchDelay, static_cast<void (QTimer::*)()>(&QTimer::start));
+    connect(searchEdit, &QLineEdit::returnPressed, this, &KioskWindow::search);
+    connect(categoryCombo, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged),
+            this, &KioskWindow::search);
+    connect(availableCheck, &QCheckBox::toggled, this, &KioskWindow::search);
+
+    QString error;
+    if (!loadSnapshot(&error)) {
+        statusLabel->setText("馆藏目录暂时无法打开：" + error);
+    }
+    search();
+
+    connect(refreshTimer, &QTimer::timeout, this, &KioskWindow::checkForUpdate);
+    refreshTimer->start(kRefreshIntervalMs);
+}
+
+bool KioskWindow::loadSnapshot(QString *error)
+{
+    QDir().mkpath(cacheDir);
+    const QFileInfo source(sourcePath);
+    QString key = source.exists() ? snapshotKey(source) : QString();
+
+    // 快照所在的共享目录暂时不可用时，沿用本机缓存中最新的一份
+    if (key.isEmpty()) {
+        const QStringList copies = QDir(cacheDir).entryList(QStringList() << "catalog-*.snapshot",
+                                                            QDir::Files, QDir::Time);
+        if (copies.isEmpty() || snapshot) {
+            if (error) *error = "找不到快照文件 " + sourcePath;
+            return false;
+        }
+        key = copies.first().mid(8, copies.first().size() - 8 - 9);
+    }
+    if (key == currentKey) {
+        return true;
+    }
+
+    // 本机已有这一版的副本时直接映射，启动时不必复制也不必解析
+    const QString copyPath = QString("%1/catalog-%2.snapshot").arg(cacheDir, key);
+    if (!QFile::exists(copyPath)) {
+        const QString partial = copyPath + ".part";
+        QFile::remove(partial);
+        if (!QFile::copy(sourcePath, partial) || !QFile::rename(partial, copyPath)) {
+            QFile::remove(partial);
+            if (error) *error = "无法复制快照文件到 " + cacheDir;
+            return false;
+        }
+    }
+
+    QSharedPointer<CatalogSnapshot> fresh(new CatalogSnapshot);
+    if (!fresh->open(copyPath, error)) {
+        QFile::remove(copyPath);
+        return false;
+    }
+
+    // 读取不加锁：新快照完整打开后才换上，正在使用旧快照的检索持有它直到结束
+    snapshot = fresh;
+    currentKey = key;
+    currentCopy = copyPath;
+
+    // 旧副本已不再映射，连同其他过时的副本一起删除
+    const QStringList stale = QDir(cacheDir).entryList(QStringList() << "catalog-*", QDir::Files);
+    for (const QString &name : stale) {
+        const QString path = cacheDir + "/" + name;
+        if (path != currentCopy) {
+            QFile::remove(path);
+        }
+    }
+
+    updateCategories();
+    updateStatus();
+    return true;
+}
+
+void KioskWindow::checkForUpdate()
+{
+    const QFileInfo source(sourcePath);
+    if (!source.exists() || snapshotKey(source) == currentKey) {
+        return;
+    }
+    // 生成方写完才改名替换，看到新文件时它已完整；复制或打开失败时继续用旧快照，下次再试
+    QString error;
+    if (loadSnapshot(&error)) {
+        search();
+    }
+}
+
+void KioskWindow::updateCategories()
+{
+    const QString selected = categoryCombo->currentIndex() > 0 ? categoryCombo->currentText() : QString();
+    categoryCombo->blockSignals(true);
+    categoryCombo->clear();
+    categoryCombo->addItem("全部分类");
+    QStringList names = snapshot->categories();
+    names.sort();
+    categoryCombo->addItems(names);
+    const int index = selected.isEmpty() ? 0 : categoryCombo->findText(selected);
+    categoryCombo->setCurrentIndex(qMax(0, index));
+    categoryCombo->blockSignals(false);
+}
+
+void KioskWindow::updateStatus()
+{
+    statusLabel->setText(QString("共 %1 种图书，目录更新于 %2")
+                             .arg(snapshot->rowCount())
+                             .arg(QDateTime::fromMSecsSinceEpoch(snapshot->builtAt()).toString("yyyy-MM-dd hh:mm")));
+}
+
+void KioskWindow::search()
+{
+    searchDelay->stop();
+    resultTable->setRowCount(0);
+    if (!snapshot) {
+        return;
+    }
+
+    CatalogSnapshot::Query query;
+    query.text = searchEdit->text();
+    query.category = categoryCombo->currentIndex() > 0 ? categoryCombo->currentText() : QString();
+    query.availableOnly = availableCheck->isChecked();
+
+    // 检索期间持有这一份快照，即使定时刷新换上了新的也不会被解除映射
+    const QSharedPointer<const CatalogSnapshot> current = snapshot;
+    const QVector<int> rows = current->search(query, kMaxResults);
+
+    resultTable->setRowCount(rows.size());
+    for (int i = 0; i < rows.size(); ++i) {
+        const CatalogSnapshot::Book book = current->book(rows.at(i));
+        const QStringList cells = QStringList()
+            << book.title << book.author << book.isbn << book.publisher << book.category << book.location
+            << QString("%1/%2").arg(book.availableCopies).arg(book.totalCopies);
+        for (int column = 0; column < cells.size(); ++column) {
+            resultTable->setItem(i, column, new QTableWidgetItem(cells.at(column)));
+        }
+    }
+    resultTable->resizeColumnsToContents();
+
+    updateStatus();
+    if (rows.size() >= kMaxResults) {
+        statusLabel->setText(statusLabel->text() + QString("，仅显示前 %1 条，请输入更多关键字").arg(kMaxResults));
+    } else if (!query.text.trimmed().isEmpty() || !query.category.isEmpty() || query.availableOnly) {
+        statusLabel->setText(statusLabel->text() + QString("，找到 %1 种").arg(rows.size()));
+    }
+}
@@ -0,0 +1,51 @@
+﻿// kioskwindow.h
+#ifndef KIOSKWINDOW_H
+#define KIOSKWINDOW_H
+
+#include <QSharedPointer>
+#include <QWidget>
+#include "catalogsnapshot.h"
+
+class QCheckBox;
+class QComboBox;
+class QLabel;
+class QLineEdit;
+class QTableWidget;
+class QTimer;
+
+// 公共检索终端（OPAC）：只读查询馆藏，数据来自后台定期生成的目录快照，
+// 不连接借还书数据库。快照先复制到本机缓存再映射（Windows 下被映射的文件
+// 不能被替换，网络共享上的文件也不宜直接映射），定时发现新快照后换上新的一份。
+class KioskWindow : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit KioskWindow(const QString &snapshotPath, QWidget *parent = nullptr);
+
+private slots:
+    void search();
+    void checkForUpdate();
+
+private:
+    // 打开与快照文件当前版本对应的本机副本，没有时先复制；成功后换下旧快照
+    bool loadSnapshot(QString *error);
+    void updateCategories();
+    void updateStatus();
+
+    QString sourcePath;
+    QString cacheDir;
+    QString currentKey;
+    QString currentCopy;
+    QSharedPointer<const CatalogSnapshot> snapshot;
+
+    QLineEdit *searchEdit;
+    QComboBox *categoryCombo;
+    QCheckBox *availableCheck;
+    QTableWidget *resultTable;
+    QLabel *statusLabel;
+    QTimer *searchDelay;
+    QTimer *refreshTimer;
+};
+
+#endif // KIOSKWINDOW_H
@@ -0,0 +1,1796 @@
+﻿// librarycore.cpp
+#include "librarycore.h"
+#include "changejournal.h"
+#include "historyarchiver.h"
+#include "historylog.h"
+#include "circulationrollup.h"
+#include "coborrowindex.h"
+#include "perfmonitor.h"
+#include "schema.h"
+#include <QtSql>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QThreadStorage>
+
+namespace {
+
+// 过滤条件直接拼进 SQL，文本中的单引号需要转义
+QString quoted(const QString &text)
+{
+    QString escaped = text;
+    escaped.replace("'", "''");
+    return escaped;
+}
+
+// 按子串过滤的条件。% 与 _ 按原字符匹配，和内存目录的扫描一致
+QString containsFilter(const QString &column, const QString &text)
+{
+    QString escaped = quoted(text);
+    escaped.replace("!", "!!");
+    escaped.replace("%", "!%");
+    escaped.replace("_", "!_");
+    return QString("%1 LIKE '%%2%' ESCAPE '!'").arg(column, escaped);
+}
+
+// 借还书台常用的图书与读者各保留的记录数
+const int kDefaultCachedRecords = 2048;
+
+// 并发修改或数据库忙时借还书最多执行的次数，以及第一次重试前的等待（之后逐次加倍）
+const int kMaxAttempts = 4;
+const int kBackoffMs = 5;
+
+// 退避的随机部分。qrand 的种子按线程保存，未播种时各线程、各进程得到相同的序列，
+// 同时冲突的借还台会按同样的间隔重试、再次冲突，所以每个线程第一次使用前各自播种
+int backoffJitter()
+{
+    static QThreadStorage<bool> seeded;
+    if (!seeded.hasLocalData()) {
+        qsrand(uint(QDateTime::currentMSecsSinceEpoch() ^ QCoreApplication::applicationPid()
+                    ^ quintptr(QThread::currentThreadId())));
+        seeded.setLocalData(true);
+    }
+    return qrand() % kBackoffMs;
+}
+
+// 预约的书到馆后为读者保留的天数
+const int kPickupDays = 3;
+
+// 排队时的优先级：同一优先级内按预约的先后
+int holdPriority(const QString &readerType)
+{
+    if (readerType == "VIP") {
+        return 3;
+    }
+    if (readerType == "教师") {
+        return 2;
+    }
+    return readerType == "学生" ? 1 : 0;
+}
+
+// 重建标记为待重建的辅助表；连接需已附加归档库，汇总才包含归档的借阅
+QStringList rebuildStale(QSqlDatabase db)
+{
+    QStringList errors;
+    QString error;
+    if (CirculationRollup::isStale(db) && !CirculationRollup::rebuild(db, &error)) {
+        errors.append("借阅汇总生成失败：" + error);
+    }
+    if (CoBorrowIndex::isStale(db) && !CoBorrowIndex::rebuild(db, &error)) {
+        errors.append("借阅关联生成失败：" + error);
+    }
+    return errors;
+}
+
+} // namespace
+
+LibraryCore::LibraryCore(const QString &connectionName)
+    : connectionName(connectionName)
+    , bookCache(kDefaultCachedRecords)
+    , readerCache(kDefaultCachedRecords)
+    , grouped(false)
+    , journalTransaction(false)
+    , operationHistoryStart(0)
+{
+}
+
+bool LibraryCore::openConnection(const QString &path, QString *error)
+{
+    QSqlDatabase db = QSqlDatabase::contains(connectionName)
+        ? QSqlDatabase::database(connectionName, false)
+        : QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(path);
+    // 写锁冲突时等待而不是立即失败（在线备份等后台连接会短暂持有锁）
+    db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+
+    if (!db.isOpen() && !db.open()) {
+        if (error) *error = db.lastError().text();
+        return false;
+    }
+    initWarnings.clear();
+    return true;
+}
+
+bool LibraryCore::open(const QString &path, QString *error)
+{
+    if (!openConnection(path, error)) {
+        return false;
+    }
+    createSchema();
+    installExtensions();
+    openHistoryLog();
+    return true;
+}
+
+bool LibraryCore::openPrepared(const QString &path, QString *error)
+{
+    if (!openConnection(path, error)) {
+        return false;
+    }
+    QString archiveError;
+    if (!HistoryArchiver::attach(database(), &archiveError)) {
+        initWarnings.append("归档库附加失败：" + archiveError);
+    }
+    openHistoryLog();
+    return true;
+}
+
+bool LibraryCore::openReadOnly(const QString &path, QString *error)
+{
+    QSqlDatabase db = QSqlDatabase::contains(connectionName)
+        ? QSqlDatabase::database(connectionName, false)
+        : QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(path);
+    db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000;QSQLITE_OPEN_READONLY");
+
+    initWarnings.clear();
+    if (!db.isOpen() && !db.open()) {
+        if (error) *error = db.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+QFuture<LibraryCore::PrepareResult> LibraryCore::prepare(const QString &path)
+{
+    return QtConcurrent::run([path]() -> PrepareResult {
+        static QAtomicInt serial;
+        const QString connectionName = QString("library_prepare_%1").arg(serial.fetchAndAddRelaxed(1));
+        PrepareResult result;
+        {
+            LibraryCore worker(connectionName);
+            if (worker.open(path, &result.error)) {
+                result.warnings = worker.warnings();
+            }
+            worker.close();
+        }
+        QSqlDatabase::removeDatabase(connectionName);
+        return result;
+    });
+}
+
+bool LibraryCore::reopen(QString *error)
+{
+    QSqlDatabase db = database();
+    if (!db.isOpen() && !db.open()) {
+        if (error) *error = db.lastError().text();
+        return false;
+    }
+
+    // 数据库文件已被替换，缓存的记录全部作废
+    clearRecordCache();
+
+    // 旧备份可能还没有变更日志；归档库的附加和临时视图只对当前连接有效
+    initWarnings.clear();
+    upgradeSchema();
+    installExtensions();
+    openHistoryLog();
+    return true;
+}
+
+void LibraryCore::close()
+{
+    // 先把排队的借阅历史写完
+    historyLog.close();
+    QSqlDatabase db = database();
+    if (db.isOpen()) {
+        db.close();
+    }
+}
+
+QSqlDatabase LibraryCore::database() const
+{
+    return QSqlDatabase::database(connectionName, false);
+}
+
+void LibraryCore::invalidateBook(int id)
+{
+    bookCache.remove(id);
+}
+
+void LibraryCore::invalidateReader(int id)
+{
+    readerCache.remove(id);
+}
+
+void LibraryCore::clearRecordCache()
+{
+    bookCache.clear();
+    readerCache.clear();
+}
+
+void LibraryCore::setRecordCacheCapacity(int records)
+{
+    bookCache.setCapacity(records);
+    readerCache.setCapacity(records);
+}
+
+void LibraryCore::resetRecordCacheStats()
+{
+    bookCache.resetStats();
+    readerCache.resetStats();
+}
+
+bool LibraryCore::fetchBook(int id, Schema::BookRow *book)
+{
+    if (bookCache.find(id, book)) {
+        return true;
+    }
+    TimedQuery query(database());
+    query.prepare(QString("SELECT %1 FROM books WHERE id = ?").arg(Schema::columnList(Schema::kBooks)));
+    query.addBindValue(id);
+    if (!query.exec() || !query.next()) {
+        return false;
+    }
+    *book = Schema::readBook(query);
+    bookCache.insert(id, *book);
+    return true;
+}
+
+bool LibraryCore::fetchReader(int id, Schema::ReaderRow *reader)
+{
+    if (readerCache.find(id, reader)) {
+        return true;
+    }
+    TimedQuery query(database());
+    query.prepare(QString("SELECT %1 FROM readers WHERE id = ?").arg(Schema::columnList(Schema::kReaders)));
+    query.addBindValue(id);
+    if (!query.exec() || !query.next()) {
+        return false;
+    }
+    *reader = Schema::readReader(query);
+    readerCache.insert(id, *reader);
+    return true;
+}
+
+bool LibraryCore::fetchBookForCirculation(int id, Schema::BookRow *book)
+{
+    TimedQuery query(database());
+    query.prepare(QString("SELECT %1 FROM books WHERE id = ?").arg(Schema::columnList(Schema::kBooks)));
+    query.addBindValue(id);
+    if (!query.exec()) {
+        throwSqlError(query.lastError(), "查询图书失败：");
+    }
+    if (!query.next()) {
+        bookCache.remove(id);
+        return false;
+    }
+    *book = Schema::readBook(query);
+    bookCache.insert(id, *book);
+    return true;
+}
+
+bool LibraryCore::fetchReaderForCirculation(int id, Schema::ReaderRow *reader)
+{
+    TimedQuery query(database());
+    query.prepare(QString("SELECT %1 FROM readers WHERE id = ?").arg(Schema::columnList(Schema::kReaders)));
+    query.addBindValue(id);
+    if (!query.exec()) {
+        throwSqlError(query.lastError(), "查询读者失败：");
+    }
+    if (!query.next()) {
+        readerCache.remove(id);
+        return false;
+    }
+    *reader = Schema::readReader(query);
+    readerCache.insert(id, *reader);
+    return true;
+}
+
+bool LibraryCore::fetchCopy(int id, Schema::CopyRow *copy)
+{
+    TimedQuery query(database());
+    query.prepare(QString("SELECT %1 FROM copies WHERE id = ?").arg(Schema::columnList(Schema::kCopies)));
+    query.addBindValue(id);
+    if (!query.exec()) {
+        throwSqlError(query.lastError(), "查询单册失败：");
+    }
+    if (!query.next()) {
+        return false;
+    }
+    *copy = Schema::readCopy(query);
+    return true;
+}
+
+void LibraryCore::syncCopyCounts(int bookId)
+{
+    // 总数量为未遗失的单册加上按书目借出、尚未归还的册数，可借数量为在架的单册数
+    TimedQuery query(database());
+    query.prepare("UPDATE books SET "
+                  "total_copies = (SELECT COUNT(*) FROM copies WHERE book_id = ? AND state <> '遗失') "
+                  "+ (SELECT COUNT(*) FROM borrow_records WHERE book_id = ? AND status = '借出' AND copy_id IS NULL), "
+                  "available_copies = (SELECT COUNT(*) FROM copies WHERE book_id = ? AND state = '在架'), "
+                  "version = version + 1 WHERE id = ?");
+    for (int i = 0; i < 4; ++i) {
+        query.addBindValue(bookId);
+    }
+    if (!query.exec()) {
+        throwSqlError(query.lastError(), "更新图书数量失败：");
+    }
+    bookCache.remove(bookId);
+}
+
+bool LibraryCore::fetchHold(int id, Schema::HoldRow *hold)
+{
+    TimedQuery query(database());
+    query.prepare(QString("SELECT %1 FROM holds WHERE id = ?").arg(Schema::columnList(Schema::kHolds)));
+    query.addBindValue(id);
+    if (!query.exec()) {
+        throwSqlError(query.lastError(), "查询预约失败：");
+    }
+    if (!query.next()) {
+        return false;
+    }
+    *hold = Schema::readHold(query);
+    return true;
+}
+
+bool LibraryCore::allocateHold(int bookId, int copyId, ReturnResult *result)
+{
+    // 队首为优先级最高、其中最早提出的等待中预约，由 idx_holds_queue 直接给出
+    QSqlDatabase db = database();
+    TimedQuery nextQuery(db);
+    nextQuery.prepare("SELECT id, reader_id FROM holds WHERE book_id = ? AND status = '等待' "
+                      "ORDER BY priority DESC, id LIMIT 1");
+    nextQuery.addBindValue(bookId);
+    if (!nextQuery.exec()) {
+        throwSqlError(nextQuery.lastError(), "查询预约队列失败：");
+    }
+    if (!nextQuery.next()) {
+        return false;
+    }
+    const int holdId = nextQuery.value(0).toInt();
+    const int readerId = nextQuery.value(1).toInt();
+
+    const QDate readyDate = QDate::currentDate();
+    const QDate deadline = readyDate.addDays(kPickupDays);
+    TimedQuery allocateQuery(db);
+    allocateQuery.prepare("UPDATE holds SET status = '待取', copy_id = ?, ready_date = ?, pickup_deadline = ? "
+                          "WHERE id = ? AND status = '等待'");
+    allocateQuery.addBindValue(copyId > 0 ? QVariant(copyId) : QVariant(QVariant::Int));
+    allocateQuery.addBindValue(readyDate);
+    allocateQuery.addBindValue(deadline);
+    allocateQuery.addBindValue(holdId);
+    if (!allocateQuery.exec()) {
+        throwSqlError(allocateQuery.lastError(), "更新预约失败：");
+    }
+    if (allocateQuery.numRowsAffected() == 0) {
+        throw Conflict{"预约队列刚被其他服务台修改，请重试！"};
+    }
+
+    // 到书通知随借阅历史进入后写队列，通知渠道从 borrow_history 中读取
+    HistoryLog::Event event;
+    event.action = "预约到书";
+    event.bookId = bookId;
+    event.readerId = readerId;
+    event.dueDate = deadline;
+    recordHistory(event);
+
+    result->holdId = holdId;
+    result->holdReaderId = readerId;
+    result->pickupDeadline = deadline;
+    Schema::ReaderRow reader;
+    if (fetchReader(readerId, &reader)) {
+        result->holdReaderName = reader.name;
+    }
+    return true;
+}
+
+void LibraryCore::releaseHold(const Schema::HoldRow &hold)
+{
+    QSqlDatabase db = database();
+    ReturnResult next;
+    const bool held = allocateHold(hold.bookId, hold.copyId, &next);
+
+    if (hold.copyId > 0) {
+        TimedQuery copyQuery(db);
+        copyQuery.prepare("UPDATE copies SET state = ?, version = version + 1 WHERE id = ? AND state = '预留'");
+        copyQuery.addBindValue(QString(held ? "预留" : "在架"));
+        copyQuery.addBindValue(hold.copyId);
+        if (!copyQuery.exec()) {
+            throwSqlError(copyQuery.lastError(), "更新单册状态失败：");
+        }
+        if (!held && copyQuery.numRowsAffected() == 0) {
+            return;  // 保留的单册已不在，没有书可以放回书架
+        }
+    }
+
+    if (!held) {
+        TimedQuery bookQuery(db);
+        bookQuery.prepare(hold.copyId > 0
+            ? "UPDATE books SET available_copies = available_copies + 1 WHERE id = ?"
+            : "UPDATE books SET available_copies = available_copies + 1, version = version + 1 WHERE id = ?");
+        bookQuery.addBindValue(hold.bookId);
+        if (!bookQuery.exec()) {
+            throwSqlError(bookQuery.lastError(), "更新图书信息失败：");
+        }
+        bookCache.remove(hold.bookId);
+    }
+}
+
+bool LibraryCore::beginGroup(QString *error)
+{
+    QSqlDatabase db = database();
+    if (!db.transaction()) {
+        if (error) *error = db.lastError().text();
+        return false;
+    }
+    QSqlError journalError;
+    if (!ChangeJournal::beginTransaction(db, &journalTransaction, &journalError)) {
+        if (error) *error = journalError.text();
+        db.rollback();
+        return false;
+    }
+    grouped = true;
+    return true;
+}
+
+bool LibraryCore::commitGroup(QString *error)
+{
+    grouped = false;
+    QSqlDatabase db = database();
+    QSqlError journalError;
+    if (journalTransaction && !ChangeJournal::endTransaction(db, &journalError)) {
+        if (error) *error = journalError.text();
+        rollbackGroup();
+        return false;
+    }
+    journalTransaction = false;
+    if (!stageHistory(error)) {
+        rollbackGroup();
+        return false;
+    }
+    if (!db.commit()) {
+        if (error) *error = db.lastError().text();
+        rollbackGroup();
+        return false;
+    }
+    publishHistory();
+    return true;
+}
+
+void LibraryCore::rollbackGroup()
+{
+    grouped = false;
+    journalTransaction = false;
+    database().rollback();
+    // 组内已完成的操作随整组撤销，它们对缓存的修改与历史也不再成立
+    clearRecordCache();
+    historyLog.discard();
+    pendingHistory.clear();
+}
+
+void LibraryCore::beginOperation()
+{
+    operationHistoryStart = pendingHistory.size();
+    if (grouped) {
+        TimedQuery query(database());
+        if (!query.exec("SAVEPOINT circulation_op")) {
+            throwSqlError(query.lastError(), "开始操作失败：");
+        }
+    } else {
+        // 变更日志启用时标出事务的范围，按时间点恢复不会只重放借还书的一部分
+        QSqlDatabase db = database();
+        // 开始失败时不能在自动提交下继续执行；数据库忙时为 Conflict，由 retrying 退避重试
+        if (!db.transaction()) {
+            throwSqlError(db.lastError(), "开始操作失败：");
+        }
+        QSqlError journalError;
+        if (!ChangeJournal::beginTransaction(db, &journalTransaction, &journalError)) {
+            db.rollback();
+            throwSqlError(journalError, "开始操作失败：");
+        }
+    }
+}
+
+void LibraryCore::commitOperation(const QString &context)
+{
+    QSqlDatabase db = database();
+    if (grouped) {
+        TimedQuery query(db);
+        if (!query.exec("RELEASE SAVEPOINT circulation_op")) {
+            throwSqlError(query.lastError(), context);
+        }
+        return;
+    }
+    QSqlError journalError;
+    if (journalTransaction && !ChangeJournal::endTransaction(db, &journalError)) {
+        throwSqlError(journalError, context);
+    }
+    journalTransaction = false;
+    QString historyError;
+    if (!stageHistory(&historyError)) {
+        throw QString(context + historyError);
+    }
+    if (!db.commit()) {
+        throwSqlError(db.lastError(), context);
+    }
+    publishHistory();
+}
+
+void LibraryCore::throwSqlError(const QSqlError &error, const QString &context)
+{
+    // SQLITE_BUSY / SQLITE_LOCKED：WAL 下读过快照后再写，若其间其他连接已提交，
+    // 写入会立即以 SQLITE_BUSY 失败（忙等待无济于事），整个操作需要重新执行
+    const QString code = error.nativeErrorCode();
+    if (code == "5" || code == "6") {
+        throw Conflict{context + error.text()};
+    }
+    throw QString(context + error.text());
+}
+
+template <typename Result>
+Result LibraryCore::retrying(const std::function<Result()> &operation)
+{
+    for (int attempt = 1; ; ++attempt) {
+        try {
+            return operation();
+        } catch (const Conflict &conflict) {
+            // 成组提交时组内共用一个事务，冲突只能由调用方整组处理
+            if (grouped || attempt >= kMaxAttempts) {
+                throw conflict.message;
+            }
+            ScopedTimer timer("冲突退避");
+            QThread::msleep(static_cast<unsigned long>((kBackoffMs << (attempt - 1)) + backoffJitter()));
+        }
+    }
+}
+
+void LibraryCore::rollbackOperation()
+{
+    pendingHistory.resize(operationHistoryStart);
+    if (grouped) {
+        // ROLLBACK TO 只撤销保存点之后的修改，保存点本身还要释放
+        TimedQuery query(database());
+        query.exec("ROLLBACK TO SAVEPOINT circulation_op");
+        query.exec("RELEASE SAVEPOINT circulation_op");
+    } else {
+        journalTransaction = false;
+        database().rollback();
+        historyLog.discard();
+    }
+}
+
+void LibraryCore::recordHistory(HistoryLog::Event event)
+{
+    event.timestamp = QDateTime::currentMSecsSinceEpoch();
+    pendingHistory.append(event);
+}
+
+bool LibraryCore::stageHistory(QString *error)
+{
+    if (pendingHistory.isEmpty() || historyLog.stage(database(), pendingHistory)) {
+        return true;
+    }
+    // 队列不可用时在当前事务中直接插入，历史与借还书一起提交
+    return HistoryLog::insert(database(), pendingHistory, error);
+}
+
+void LibraryCore::publishHistory()
+{
+    historyLog.publish();
+    pendingHistory.clear();
+}
+
+void LibraryCore::logReminder(int recordId, const QDate &dueDate, int overdueDays)
+{
+    HistoryLog::Event event;
+    event.action = "逾期提醒";
+    event.recordId = recordId;
+    event.dueDate = dueDate;
+    event.overdueDays = overdueDays;
+    recordHistory(event);
+    if (grouped) {
+        return;
+    }
+
+    // 提醒不属于借还书的事务，单独用一个事务登记
+    QSqlDatabase db = database();
+    if (db.transaction() && stageHistory(nullptr) && db.commit()) {
+        publishHistory();
+        return;
+    }
+    db.rollback();
+    historyLog.discard();
+    HistoryLog::write(db, pendingHistory);
+    pendingHistory.clear();
+}
+
+void LibraryCore::openHistoryLog()
+{
+    QString historyError;
+    if (!historyLog.open(database(), &historyError)) {
+        initWarnings.append("借阅历史队列不可用，历史改为直接写入：" + historyError);
+    }
+}
+
+QStringList LibraryCore::warnings() const
+{
+    return initWarnings;
+}
+
+void LibraryCore::createSchema()
+{
+    TimedQuery query(database());
+
+    // 新建的数据库启用增量清理，归档后可以归还空闲页（必须在建表之前设置）
+    query.exec("PRAGMA auto_vacuum = INCREMENTAL");
+
+    // WAL 模式下读写互不阻塞，在线备份可以在借还书的同时进行
+    query.exec("PRAGMA journal_mode=WAL");
+
+    // 建表语句由 schema.h 中的列定义生成
+    for (const Schema::Table *table : {&Schema::kBooks, &Schema::kReaders, &Schema::kBorrowRecords,
+                                       &Schema::kBorrowHistory, &Schema::kCopies, &Schema::kHolds}) {
+        query.exec(Schema::createSql(*table));
+    }
+    upgradeSchema();
+
+    // 插入一些示例数据（如果表为空）
+    query.exec("SELECT COUNT(*) FROM books");
+    if (query.next() && query.value(0).toInt() == 0) {
+        query.exec("INSERT INTO books (isbn, title, author, publisher, category, price, total_copies, available_copies) "
+                   "VALUES ('9787111636664', 'C++ Primer', 'Stanley Lippman', '机械工业出版社', '编程', 128.0, 5, 5)");
+        query.exec("INSERT INTO books (isbn, title, author, publisher, category, price, total_copies, available_copies) "
+                   "VALUES ('9787302518014', 'Qt5开发实战', '王维波', '清华大学出版社', '编程', 89.0, 3, 3)");
+    }
+}
+
+void LibraryCore::upgradeSchema()
+{
+    // 旧库缺少后来新增的表或在末尾新增的列时补上
+    TimedQuery query(database());
+    for (const Schema::Table *table : {&Schema::kBooks, &Schema::kReaders, &Schema::kBorrowRecords,
+                                       &Schema::kBorrowHistory, &Schema::kCopies, &Schema::kHolds}) {
+        QStringList existing;
+        query.exec(QString("PRAGMA table_info(%1)").arg(table->name));
+        while (query.next()) {
+            existing.append(query.value(1).toString());
+        }
+        if (existing.isEmpty()) {
+            query.exec(Schema::createSql(*table));
+            continue;
+        }
+        for (int i = 0; i < table->columnCount; ++i) {
+            if (!existing.contains(table->columns[i].name)) {
+                query.exec(QString("ALTER TABLE %1 ADD COLUMN %2 %3")
+                               .arg(table->name, table->columns[i].name, table->columns[i].definition));
+            }
+        }
+    }
+
+    // 借书时按图书挑在架的单册、盘点时按位置列出单册、还书时按单册找借阅记录
+    query.exec("CREATE INDEX IF NOT EXISTS idx_copies_book_state ON copies(book_id, state)");
+    query.exec("CREATE INDEX IF NOT EXISTS idx_copies_location ON copies(location)");
+    query.exec("CREATE INDEX IF NOT EXISTS idx_borrow_records_copy ON borrow_records(copy_id, status)");
+
+    // 每本书的预约队列：只收录等待中的预约，按出队顺序排列，取队首是一次索引查找
+    query.exec("CREATE INDEX IF NOT EXISTS idx_holds_queue ON holds(book_id, priority DESC, id) WHERE status = '等待'");
+    query.exec("CREATE INDEX IF NOT EXISTS idx_holds_reader ON holds(reader_id, status)");
+    query.exec("CREATE INDEX IF NOT EXISTS idx_holds_pickup ON holds(pickup_deadline) WHERE status = '待取'");
+}
+
+void LibraryCore::installExtensions()
+{
+    QSqlDatabase db = database();
+
+    // 变更日志（增量备份与按时间点恢复）
+    QString journalError;
+    if (!ChangeJournal::install(db, &journalError)) {
+        initWarnings.append("变更日志初始化失败，增量备份不可用：" + journalError);
+    }
+
+    // 归档库（历史报表通过 all_borrow_records / all_borrow_history 视图查询）
+    QString archiveError;
+    if (!HistoryArchiver::attach(db, &archiveError)) {
+        initWarnings.append("归档库附加失败：" + archiveError);
+    }
+
+    // 按天汇总的借阅统计，供报表使用
+    QString rollupError;
+    if (!CirculationRollup::install(db, &rollupError)) {
+        initWarnings.append("借阅汇总表初始化失败：" + rollupError);
+    }
+
+    // 借阅关联（“借过这本书的读者也借了”），借书时增量维护
+    QString coborrowError;
+    if (!CoBorrowIndex::install(db, &coborrowError)) {
+        initWarnings.append("借阅关联索引初始化失败：" + coborrowError);
+    }
+}
+
+bool LibraryCore::hasStaleExtensions() const
+{
+    return CirculationRollup::isStale(database()) || CoBorrowIndex::isStale(database());
+}
+
+QStringList LibraryCore::rebuildStaleExtensions()
+{
+    return rebuildStale(database());
+}
+
+QFuture<QStringList> LibraryCore::rebuildStaleExtensionsInBackground(const QString &path)
+{
+    return QtConcurrent::run([path]() -> QStringList {
+        static QAtomicInt serial;
+        const QString connectionName = QString("library_rebuild_%1").arg(serial.fetchAndAddRelaxed(1));
+        QStringList errors;
+        {
+            QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+            db.setDatabaseName(path);
+            // 汇总事务持有写锁期间前台的借还书在忙等待中排队
+            db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+            if (!db.open()) {
+                errors.append("无法打开数据库：" + db.lastError().text());
+            } else {
+                // 归档库附加失败时只汇总主库，与打开数据库时的处理相同
+                HistoryArchiver::attach(db);
+                errors = rebuildStale(db);
+                db.close();
+            }
+        }
+        QSqlDatabase::removeDatabase(connectionName);
+        return errors;
+    });
+}
+
+LibraryCore::BorrowResult LibraryCore::borrowBook(int bookId, int readerId, int days)
+{
+    ScopedTimer timer("借书");
+    return retrying<BorrowResult>([&]() { return attemptBorrow(bookId, 0, readerId, days); });
+}
+
+LibraryCore::BorrowResult LibraryCore::borrowCopy(int copyId, int readerId, int days)
+{
+    ScopedTimer timer("借书(单册)");
+    return retrying<BorrowResult>([&]() { return attemptBorrow(0, copyId, readerId, days); });
+}
+
+LibraryCore::ReturnResult LibraryCore::returnBook(int recordId)
+{
+    ScopedTimer timer("还书");
+    return retrying<ReturnResult>([&]() { return attemptReturn(recordId); });
+}
+
+LibraryCore::RenewResult LibraryCore::renewBook(int recordId)
+{
+    ScopedTimer timer("续借");
+    return retrying<RenewResult>([&]() { return attemptRenew(recordId); });
+}
+
+LibraryCore::BorrowResult LibraryCore::attemptBorrow(int bookId, int copyId, int readerId, int days)
+{
+    QSqlDatabase db = database();
+    beginOperation();
+
+    try {
+        // 按单册借出时图书取自单册；按图书借出且该书登记了单册时挑一册在架的，
+        // 一册都没有登记时按书目的可借数量借出
+        Schema::CopyRow copy;
+        if (copyId > 0) {
+            if (!fetchCopy(copyId, &copy)) {
+                throw QString("单册不存在！");
+            }
+            bookId = copy.bookId;
+        }
+
+        // 读者来取为其保留的书：借出保留的那一册，它不在书架上，也不占可借数量
+        TimedQuery holdQuery(db);
+        holdQuery.prepare("SELECT id, copy_id FROM holds WHERE reader_id = ? AND book_id = ? AND status = '待取'");
+        holdQuery.addBindValue(readerId);
+        holdQuery.addBindValue(bookId);
+        if (!holdQuery.exec()) {
+            throwSqlError(holdQuery.lastError(), "查询预约失败：");
+        }
+        const int pickupHold = holdQuery.next() ? holdQuery.value(0).toInt() : 0;
+        const int heldCopy = pickupHold ? holdQuery.value(1).toInt() : 0;
+        const bool pickup = pickupHold > 0;
+
+        if (pickup && copyId > 0 && copyId != heldCopy) {
+            throw QString("已为该读者保留了此书，请借出为其保留的那一册！");
+        }
+        if (heldCopy > 0 && copyId <= 0) {
+            if (!fetchCopy(heldCopy, &copy)) {
+                throw QString("为该读者保留的单册不存在！");
+            }
+        } else if (copyId <= 0 && !pickup) {
+            TimedQuery copyQuery(db);
+            copyQuery.prepare(QString("SELECT %1 FROM copies WHERE book_id = ? ORDER BY state <> '在架', id LIMIT 1")
+                                  .arg(Schema::columnList(Schema::kCopies)));
+            copyQuery.addBindValue(bookId);
+            if (!copyQuery.exec()) {
+                throwSqlError(copyQuery.lastError(), "查询单册失败：");
+            }
+            if (copyQuery.next()) {
+                copy = Schema::readCopy(copyQuery);
+            }
+        }
+        const bool byCopy = copy.id > 0;
+        const QString shelfState = pickup ? "预留" : "在架";
+
+        // 检查图书是否存在且可借：可借数量与版本号在事务中读取，不用缓存
+        Schema::BookRow book;
+        if (!fetchBookForCirculation(bookId, &book)) {
+            throw QString("图书ID不存在！");
+        }
+        if (byCopy && copy.state != shelfState) {
+            throw copyId > 0 ? QString("该单册当前%1，无法借出！").arg(copy.state) : QString("该图书已全部借出，可为读者预约！");
+        }
+        if (!byCopy && !pickup && book.availableCopies <= 0) {
+            throw QString("该图书已全部借出，可为读者预约！");
+        }
+
+        BorrowResult result;
+        result.bookId = bookId;
+        result.bookTitle = book.title;
+        result.copyBarcode = copy.barcode;
+
+        // 检查读者是否存在且可借
+        Schema::ReaderRow reader;
+        if (!fetchReaderForCirculation(readerId, &reader)) {
+            throw QString("读者ID不存在！");
+        }
+        if (reader.status != "正常") {
+            throw QString("该读者状态异常，无法借书！");
+        }
+
+        result.readerName = reader.name;
+        int maxBorrow = reader.maxBorrow;
+
+        // 检查读者当前借书数量
+        TimedQuery countQuery(db);
+        countQuery.prepare("SELECT COUNT(*) FROM borrow_records WHERE reader_id = ? AND status = '借出'");
+        countQuery.addBindValue(readerId);
+        if (countQuery.exec() && countQuery.next() && countQuery.value(0).toInt() >= maxBorrow) {
+            throw QString("该读者已达到最大借书数量限制！");
+        }
+
+        // 检查是否已借过同一本书
+        TimedQuery duplicateQuery(db);
+        duplicateQuery.prepare("SELECT COUNT(*) FROM borrow_records WHERE book_id = ? AND reader_id = ? AND status = '借出'");
+        duplicateQuery.addBindValue(bookId);
+        duplicateQuery.addBindValue(readerId);
+        if (duplicateQuery.exec() && duplicateQuery.next() && duplicateQuery.value(0).toInt() > 0) {
+            throw QString("该读者已借阅此书，请勿重复借阅！");
+        }
+
+        // 借期不超过读者的最长借期（默认30天）
+        int maxDays = reader.maxDays > 0 ? reader.maxDays : 30;
+        int borrowDays = qMin(days, maxDays);
+
+        QDate borrowDate = QDate::currentDate();
+        result.dueDate = borrowDate.addDays(borrowDays);
+
+        // 插入借阅记录
+        TimedQuery borrowQuery(db);
+        borrowQuery.prepare("INSERT INTO borrow_records (book_id, reader_id, borrow_date, due_date, copy_id) "
+                          "VALUES (?, ?, ?, ?, ?)");
+        borrowQuery.addBindValue(bookId);
+        borrowQuery.addBindValue(readerId);
+        borrowQuery.addBindValue(borrowDate);
+        borrowQuery.addBindValue(result.dueDate);
+        borrowQuery.addBindValue(byCopy ? QVariant(copy.id) : QVariant(QVariant::Int));
+
+        if (!borrowQuery.exec()) {
+            throwSqlError(borrowQuery.lastError(), "借阅记录创建失败：");
+        }
+        result.recordId = borrowQuery.lastInsertId().toInt();
+
+        if (byCopy) {
+            // 按单册的版本号比对，只与借同一册的操作冲突；冲突后重试时挑另一册
+            TimedQuery updateCopyQuery(db);
+            updateCopyQuery.prepare("UPDATE copies SET state = '借出', version = version + 1 "
+                                    "WHERE id = ? AND version = ? AND state = ?");
+            updateCopyQuery.addBindValue(copy.id);
+            updateCopyQuery.addBindValue(copy.version);
+            updateCopyQuery.addBindValue(shelfState);
+
+            if (!updateCopyQuery.exec()) {
+                throwSqlError(updateCopyQuery.lastError(), "更新单册状态失败：");
+            }
+            if (updateCopyQuery.numRowsAffected() == 0) {
+                throw Conflict{copyId > 0 ? "该单册已被借出！" : "该图书已全部借出，可为读者预约！"};
+            }
+        }
+
+        if (pickup) {
+            // 预约被其他服务台取消或判为过期时重新执行
+            TimedQuery pickupQuery(db);
+            pickupQuery.prepare("UPDATE holds SET status = '已借' WHERE id = ? AND status = '待取'");
+            pickupQuery.addBindValue(pickupHold);
+            if (!pickupQuery.exec()) {
+                throwSqlError(pickupQuery.lastError(), "更新预约失败：");
+            }
+            if (pickupQuery.numRowsAffected() == 0) {
+                throw Conflict{"为该读者保留的书已被取消保留！"};
+            }
+        } else {
+            // 读者排队期间从书架上借到了这本书，他在队列中的预约随之完成
+            TimedQuery holdDoneQuery(db);
+            holdDoneQuery.prepare("UPDATE holds SET status = '已借' WHERE reader_id = ? AND book_id = ? AND status = '等待'");
+            holdDoneQuery.addBindValue(readerId);
+            holdDoneQuery.addBindValue(bookId);
+            if (!holdDoneQuery.exec()) {
+                throwSqlError(holdDoneQuery.lastError(), "更新预约失败：");
+            }
+        }
+
+        // 保留的书本来就不计入可借数量，来取时不再扣减
+        if (!pickup && byCopy) {
+            // 图书的可借数量只是汇总，相对减一，不比对也不改变图书的版本号
+            TimedQuery updateBookQuery(db);
+            updateBookQuery.prepare("UPDATE books SET available_copies = available_copies - 1 WHERE id = ?");
+            updateBookQuery.addBindValue(bookId);
+            if (!updateBookQuery.exec()) {
+                throwSqlError(updateBookQuery.lastError(), "更新图书信息失败：");
+            }
+        } else if (!pickup) {
+            // 更新图书可用数量：按读到的版本号比对后再减，其间图书被其他连接借出或修改时
+            // 不更新任何行，作废缓存后重新读取再试
+            TimedQuery updateBookQuery(db);
+            updateBookQuery.prepare("UPDATE books SET available_copies = available_copies - 1, version = version + 1 "
+                                    "WHERE id = ? AND version = ? AND available_copies > 0");
+            updateBookQuery.addBindValue(bookId);
+            updateBookQuery.addBindValue(book.version);
+
+            if (!updateBookQuery.exec()) {
+                throwSqlError(updateBookQuery.lastError(), "更新图书信息失败：");
+            }
+            if (updateBookQuery.numRowsAffected() == 0) {
+                bookCache.remove(bookId);
+                throw Conflict{"该图书已全部借出，可为读者预约！"};
+            }
+        }
+
+        // 记录历史（提交后交给后写队列）
+        HistoryLog::Event event;
+        event.action = "借出";
+        event.bookId = bookId;
+        event.readerId = readerId;
+        event.recordId = result.recordId;
+        event.dueDate = result.dueDate;
+        recordHistory(event);
+
+        commitOperation("借书提交失败：");
+        if (!pickup) {
+            bookCache.update(bookId, [byCopy](Schema::BookRow &row) {
+                --row.availableCopies;
+                if (!byCopy) {
+                    ++row.version;
+                }
+            });
+        }
+        return result;
+
+    } catch (...) {
+        rollbackOperation();
+        throw;
+    }
+}
+
+LibraryCore::ReturnResult LibraryCore::attemptReturn(int recordId)
+{
+    QSqlDatabase db = database();
+    beginOperation();
+
+    try {
+        // 检查借阅记录
+        // 书名与读者姓名取自记录缓存，不再与图书、读者表连接查询
+        TimedQuery borrowQuery(db);
+        borrowQuery.prepare(QString("SELECT %1 FROM borrow_records WHERE id = ? AND status = '借出'")
+                                .arg(Schema::columnList(Schema::kBorrowRecords)));
+        borrowQuery.addBindValue(recordId);
+
+        Schema::BookRow book;
+        Schema::ReaderRow reader;
+        if (!borrowQuery.exec()) {
+            throwSqlError(borrowQuery.lastError(), "查询借阅记录失败：");
+        }
+        if (!borrowQuery.next()) {
+            throw QString("无效的借阅记录ID或图书已归还！");
+        }
+        const Schema::BorrowRecordRow record = Schema::readBorrowRecord(borrowQuery);
+        if (!fetchBook(record.bookId, &book) || !fetchReader(record.readerId, &reader)) {
+            throw QString("无效的借阅记录ID或图书已归还！");
+        }
+
+        ReturnResult result;
+        result.bookId = record.bookId;
+        result.bookTitle = book.title;
+        result.readerName = reader.name;
+        QDate dueDate = record.dueDate;
+        QDate returnDate = QDate::currentDate();
+
+        // 计算逾期天数和费用
+        if (returnDate > dueDate) {
+            result.overdueDays = dueDate.daysTo(returnDate);
+            result.overdueFee = result.overdueDays * 0.5; // 每天0.5元逾期费
+        }
+
+        // 更新借阅记录；其他服务台抢先归还了同一条记录时不更新任何行
+        TimedQuery updateBorrowQuery(db);
+        updateBorrowQuery.prepare("UPDATE borrow_records SET return_date = ?, status = '已还', "
+                              "overdue_fee = ? WHERE id = ? AND status = '借出'");
+        updateBorrowQuery.addBindValue(returnDate);
+        updateBorrowQuery.addBindValue(result.overdueFee);
+        updateBorrowQuery.addBindValue(recordId);
+
+        if (!updateBorrowQuery.exec()) {
+            throwSqlError(updateBorrowQuery.lastError(), "更新借阅记录失败：");
+        }
+        if (updateBorrowQuery.numRowsAffected() == 0) {
+            throw QString("无效的借阅记录ID或图书已归还！");
+        }
+
+        // 记录历史（提交后交给后写队列）
+        HistoryLog::Event event;
+        event.action = "归还";
+        event.bookId = result.bookId;
+        event.readerId = record.readerId;
+        event.recordId = recordId;
+        event.overdueDays = result.overdueDays;
+        event.fee = result.overdueFee;
+        recordHistory(event);
+
+        // 按单册借出而单册已被删除时，既不分给预约也不增加图书数量
+        const bool byCopy = record.copyId > 0;
+        Schema::CopyRow copy;
+        const bool present = !byCopy || (fetchCopy(record.copyId, &copy) && copy.state == "借出");
+
+        // 有读者排队时这一册留给队首的预约，不放回书架，也不计入可借数量
+        const bool held = present && allocateHold(record.bookId, record.copyId, &result);
+        if (byCopy && present) {
+            TimedQuery updateCopyQuery(db);
+            updateCopyQuery.prepare("UPDATE copies SET state = ?, version = version + 1 WHERE id = ? AND version = ?");
+            updateCopyQuery.addBindValue(QString(held ? "预留" : "在架"));
+            updateCopyQuery.addBindValue(record.copyId);
+            updateCopyQuery.addBindValue(copy.version);
+            if (!updateCopyQuery.exec()) {
+                throwSqlError(updateCopyQuery.lastError(), "更新单册状态失败：");
+            }
+            if (updateCopyQuery.numRowsAffected() == 0) {
+                throw Conflict{"该单册刚被其他服务台修改，请重试！"};
+            }
+        }
+
+        // 更新图书可用数量（相对加一，不依赖读到的值）；按单册借还不改变图书的版本号
+        const bool shelved = present && !held;
+        if (shelved) {
+            TimedQuery updateBookQuery(db);
+            updateBookQuery.prepare(byCopy
+                ? "UPDATE books SET available_copies = available_copies + 1 WHERE id = ?"
+                : "UPDATE books SET available_copies = available_copies + 1, version = version + 1 WHERE id = ?");
+            updateBookQuery.addBindValue(result.bookId);
+
+            if (!updateBookQuery.exec()) {
+                throwSqlError(updateBookQuery.lastError(), "更新图书信息失败：");
+            }
+        }
+
+        commitOperation("还书提交失败：");
+        if (shelved) {
+            bookCache.update(result.bookId, [byCopy](Schema::BookRow &row) {
+                ++row.availableCopies;
+                if (!byCopy) {
+                    ++row.version;
+                }
+            });
+        }
+        return result;
+
+    } catch (...) {
+        rollbackOperation();
+        throw;
+    }
+}
+
+LibraryCore::RenewResult LibraryCore::attemptRenew(int recordId)
+{
+    QSqlDatabase db = database();
+    beginOperation();
+
+    try {
+        // 检查借阅记录
+        // 书名、读者姓名与最长借期取自记录缓存
+        TimedQuery borrowQuery(db);
+        borrowQuery.prepare(QString("SELECT %1 FROM borrow_records WHERE id = ? AND status = '借出'")
+                                .arg(Schema::columnList(Schema::kBorrowRecords)));
+        borrowQuery.addBindValue(recordId);
+
+        Schema::BookRow book;
+        Schema::ReaderRow reader;
+        if (!borrowQuery.exec()) {
+            throwSqlError(borrowQuery.lastError(), "查询借阅记录失败：");
+        }
+        if (!borrowQuery.next()) {
+            throw QString("无效的借阅记录ID或图书已归还！");
+        }
+        const Schema::BorrowRecordRow record = Schema::readBorrowRecord(borrowQuery);
+        if (!fetchBook(record.bookId, &book) || !fetchReaderForCirculation(record.readerId, &reader)) {
+            throw QString("无效的借阅记录ID或图书已归还！");
+        }
+        if (record.renewCount >= 2) { // 最多续借2次
+            throw QString("该书已续借2次，无法再次续借！");
+        }
+
+        QDate currentDueDate = record.dueDate;
+
+        RenewResult result;
+        result.bookTitle = book.title;
+        result.readerName = reader.name;
+        result.newDueDate = QDate::currentDate().addDays(reader.maxDays);
+
+        if (result.newDueDate <= currentDueDate) {
+            throw QString("续借后日期必须晚于当前应还日期！");
+        }
+
+        // 更新借阅记录：续借次数与读到的一致时才更新，否则重新读取再试
+        TimedQuery updateQuery(db);
+        updateQuery.prepare("UPDATE borrow_records SET due_date = ?, renew_count = renew_count + 1 "
+                            "WHERE id = ? AND status = '借出' AND renew_count = ?");
+        updateQuery.addBindValue(result.newDueDate);
+        updateQuery.addBindValue(recordId);
+        updateQuery.addBindValue(record.renewCount);
+
+        if (!updateQuery.exec()) {
+            throwSqlError(updateQuery.lastError(), "续借失败：");
+        }
+        if (updateQuery.numRowsAffected() == 0) {
+            throw Conflict{"借阅记录已被其他服务台修改，请重试！"};
+        }
+
+        // 记录历史（提交后交给后写队列）
+        HistoryLog::Event event;
+        event.action = "续借";
+        event.bookId = record.bookId;
+        event.readerId = record.readerId;
+        event.recordId = recordId;
+        event.dueDate = result.newDueDate;
+        recordHistory(event);
+
+        commitOperation("续借提交失败：");
+        return result;
+
+    } catch (...) {
+        rollbackOperation();
+        throw;
+    }
+}
+
+LibraryCore::HoldResult LibraryCore::placeHold(int bookId, int readerId)
+{
+    ScopedTimer timer("预约");
+    return retrying<HoldResult>([&]() -> HoldResult {
+        QSqlDatabase db = database();
+        beginOperation();
+        try {
+            // 可借数量以数据库为准，缓存的记录可能落后于其他服务台的借还
+            Schema::BookRow book;
+            if (!fetchBookForCirculation(bookId, &book)) {
+                throw QString("图书ID不存在！");
+            }
+            Schema::ReaderRow reader;
+            if (!fetchReaderForCirculation(readerId, &reader)) {
+                throw QString("读者ID不存在！");
+            }
+            if (reader.status != "正常") {
+                throw QString("该读者状态异常，无法预约！");
+            }
+            if (book.availableCopies > 0) {
+                throw QString("该图书尚有可借的册，请直接借阅！");
+            }
+
+            TimedQuery duplicateQuery(db);
+            duplicateQuery.prepare("SELECT COUNT(*) FROM holds WHERE reader_id = ? AND book_id = ? "
+                                   "AND status IN ('等待', '待取')");
+            duplicateQuery.addBindValue(readerId);
+            duplicateQuery.addBindValue(bookId);
+            if (duplicateQuery.exec() && duplicateQuery.next() && duplicateQuery.value(0).toInt() > 0) {
+                throw QString("该读者已预约此书，请勿重复预约！");
+            }
+
+            TimedQuery loanQuery(db);
+            loanQuery.prepare("SELECT COUNT(*) FROM borrow_records WHERE book_id = ? AND reader_id = ? AND status = '借出'");
+            loanQuery.addBindValue(bookId);
+            loanQuery.addBindValue(readerId);
+            if (loanQuery.exec() && loanQuery.next() && loanQuery.value(0).toInt() > 0) {
+                throw QString("该读者正在借阅此书，无需预约！");
+            }
+
+            const int priority = holdPriority(reader.readerType);
+            TimedQuery insertQuery(db);
+            insertQuery.prepare("INSERT INTO holds (book_id, reader_id, priority) VALUES (?, ?, ?)");
+            insertQuery.addBindValue(bookId);
+            insertQuery.addBindValue(readerId);
+            insertQuery.addBindValue(priority);
+            if (!insertQuery.exec()) {
+                throwSqlError(insertQuery.lastError(), "预约失败：");
+            }
+
+            HoldResult result;
+            result.holdId = insertQuery.lastInsertId().toInt();
+            result.bookTitle = book.title;
+            result.readerName = reader.name;
+
+            // 排在前面的：优先级更高，或优先级相同而更早提出
+            TimedQuery positionQuery(db);
+            positionQuery.prepare("SELECT COUNT(*) FROM holds WHERE book_id = ? AND status = '等待' "
+                                  "AND (priority > ? OR (priority = ? AND id < ?))");
+            positionQuery.addBindValue(bookId);
+            positionQuery.addBindValue(priority);
+            positionQuery.addBindValue(priority);
+            positionQuery.addBindValue(result.holdId);
+            result.position = (positionQuery.exec() && positionQuery.next()) ? positionQuery.value(0).toInt() + 1 : 1;
+
+            commitOperation("预约提交失败：");
+            return result;
+
+        } catch (...) {
+            rollbackOperation();
+            throw;
+        }
+    });
+}
+
+void LibraryCore::cancelHold(int holdId)
+{
+    ScopedTimer timer("取消预约");
+    retrying<void>([&]() {
+        QSqlDatabase db = database();
+        beginOperation();
+        try {
+            Schema::HoldRow hold;
+            if (!fetchHold(holdId, &hold)) {
+                throw QString("预约不存在！");
+            }
+            if (hold.status != "等待" && hold.status != "待取") {
+                throw QString("该预约已%1，无法取消！").arg(hold.status);
+            }
+
+            TimedQuery cancelQuery(db);
+            cancelQuery.prepare("UPDATE holds SET status = '已取消' WHERE id = ? AND status = ?");
+            cancelQuery.addBindValue(holdId);
+            cancelQuery.addBindValue(hold.status);
+            if (!cancelQuery.exec()) {
+                throwSqlError(cancelQuery.lastError(), "取消预约失败：");
+            }
+            if (cancelQuery.numRowsAffected() == 0) {
+                throw Conflict{"该预约刚被其他服务台处理，请刷新后重试！"};
+            }
+
+            // 已经为其保留的书顺延给下一位
+            if (hold.status == "待取") {
+                releaseHold(hold);
+            }
+            commitOperation("取消预约提交失败：");
+
+        } catch (...) {
+            rollbackOperation();
+            throw;
+        }
+    });
+}
+
+int LibraryCore::expireHolds()
+{
+    ScopedTimer timer("预约过期");
+    QList<int> expired;
+    {
+        TimedQuery query(database());
+        query.prepare("SELECT id FROM holds WHERE status = '待取' AND pickup_deadline < ?");
+        query.addBindValue(QDate::currentDate());
+        if (!query.exec()) {
+            throw QString("查询预约失败：" + query.lastError().text());
+        }
+        while (query.next()) {
+            expired.append(query.value(0).toInt());
+        }
+    }
+
+    // 逐条在各自的事务中过期，保留的书顺延给下一位；其间已被借走或取消的跳过
+    int count = 0;
+    for (int holdId : expired) {
+        count += retrying<int>([&]() -> int {
+            QSqlDatabase db = database();
+            beginOperation();
+            try {
+                int changed = 0;
+                Schema::HoldRow hold;
+                if (fetchHold(holdId, &hold) && hold.status == "待取") {
+                    TimedQuery expireQuery(db);
+                    expireQuery.prepare("UPDATE holds SET status = '已过期' WHERE id = ? AND status = '待取'");
+                    expireQuery.addBindValue(holdId);
+                    if (!expireQuery.exec()) {
+                        throwSqlError(expireQuery.lastError(), "更新预约失败：");
+                    }
+                    if (expireQuery.numRowsAffected() == 0) {
+                        throw Conflict{"该预约刚被其他服务台处理，请重试！"};
+                    }
+                    releaseHold(hold);
+                    changed = 1;
+                }
+                commitOperation("预约过期提交失败：");
+                return changed;
+
+            } catch (...) {
+                rollbackOperation();
+                throw;
+            }
+        });
+    }
+    return count;
+}
+
+int LibraryCore::addCopy(int bookId, const QString &barcode, const QString &location)
+{
+    ScopedTimer timer("登记单册");
+    const QString code = barcode.trimmed();
+    if (code.isEmpty()) {
+        throw QString("单册条码不能为空！");
+    }
+
+    return retrying<int>([&]() -> int {
+        QSqlDatabase db = database();
+        beginOperation();
+        try {
+            Schema::BookRow book;
+            if (!fetchBook(bookId, &book)) {
+                throw QString("图书ID不存在！");
+            }
+
+            TimedQuery duplicateQuery(db);
+            duplicateQuery.prepare("SELECT 1 FROM copies WHERE barcode = ?");
+            duplicateQuery.addBindValue(code);
+            if (duplicateQuery.exec() && duplicateQuery.next()) {
+                throw QString("条码 %1 已被其他单册使用！").arg(code);
+            }
+
+            TimedQuery insertQuery(db);
+            insertQuery.prepare("INSERT INTO copies (book_id, barcode, location) VALUES (?, ?, ?)");
+            insertQuery.addBindValue(bookId);
+            insertQuery.addBindValue(code);
+            insertQuery.addBindValue(location.trimmed().isEmpty() ? book.location : location.trimmed());
+            if (!insertQuery.exec()) {
+                throwSqlError(insertQuery.lastError(), "登记单册失败：");
+            }
+            const int copyId = insertQuery.lastInsertId().toInt();
+
+            // 有读者排队时新登记的这一册直接留给队首的预约
+            ReturnResult allocation;
+            if (allocateHold(bookId, copyId, &allocation)) {
+                TimedQuery reserveQuery(db);
+                reserveQuery.prepare("UPDATE copies SET state = '预留' WHERE id = ?");
+                reserveQuery.addBindValue(copyId);
+                if (!reserveQuery.exec()) {
+                    throwSqlError(reserveQuery.lastError(), "更新单册状态失败：");
+                }
+            }
+
+            syncCopyCounts(bookId);
+            commitOperation("登记单册提交失败：");
+            return copyId;
+
+        } catch (...) {
+            rollbackOperation();
+            throw;
+        }
+    });
+}
+
+void LibraryCore::updateCopy(int copyId, const QString &location, const QString &state)
+{
+    ScopedTimer timer("修改单册");
+    if (state != "在架" && state != "维护中" && state != "遗失") {
+        throw QString("单册状态只能设为在架、维护中或遗失！");
+    }
+
+    retrying<void>([&]() {
+        QSqlDatabase db = database();
+        beginOperation();
+        try {
+            Schema::CopyRow copy;
+            if (!fetchCopy(copyId, &copy)) {
+                throw QString("单册不存在！");
+            }
+            if (copy.state == "借出") {
+                throw QString("该单册已借出，归还后才能修改！");
+            }
+            if (copy.state == "预留") {
+                throw QString("该单册正为预约的读者保留，取消预约后才能修改！");
+            }
+
+            // 重新上架的单册有读者排队时留给队首的预约
+            QString newState = state;
+            ReturnResult allocation;
+            if (state == "在架" && copy.state != "在架" && allocateHold(copy.bookId, copyId, &allocation)) {
+                newState = "预留";
+            }
+
+            TimedQuery updateQuery(db);
+            updateQuery.prepare("UPDATE copies SET location = ?, state = ?, version = version + 1 "
+                                "WHERE id = ? AND version = ?");
+            updateQuery.addBindValue(location.trimmed());
+            updateQuery.addBindValue(newState);
+            updateQuery.addBindValue(copyId);
+            updateQuery.addBindValue(copy.version);
+            if (!updateQuery.exec()) {
+                throwSqlError(updateQuery.lastError(), "修改单册失败：");
+            }
+            if (updateQuery.numRowsAffected() == 0) {
+                throw Conflict{"该单册刚被其他服务台借出或修改，请刷新后重试！"};
+            }
+
+            syncCopyCounts(copy.bookId);
+            commitOperation("修改单册提交失败：");
+
+        } catch (...) {
+            rollbackOperation();
+            throw;
+        }
+    });
+}
+
+void LibraryCore::removeCopy(int copyId)
+{
+    ScopedTimer timer("删除单册");
+    retrying<void>([&]() {
+        QSqlDatabase db = database();
+        beginOperation();
+        try {
+            Schema::CopyRow copy;
+            if (!fetchCopy(copyId, &copy)) {
+                throw QString("单册不存在！");
+            }
+            if (copy.state == "借出") {
+                throw QString("该单册已借出，无法删除！");
+            }
+            if (copy.state == "预留") {
+                throw QString("该单册正为预约的读者保留，无法删除！");
+            }
+
+            TimedQuery deleteQuery(db);
+            deleteQuery.prepare("DELETE FROM copies WHERE id = ? AND version = ?");
+            deleteQuery.addBindValue(copyId);
+            deleteQuery.addBindValue(copy.version);
+            if (!deleteQuery.exec()) {
+                throwSqlError(deleteQuery.lastError(), "删除单册失败：");
+            }
+            if (deleteQuery.numRowsAffected() == 0) {
+                throw Conflict{"该单册刚被其他服务台借出或修改，请刷新后重试！"};
+            }
+
+            syncCopyCounts(copy.bookId);
+            commitOperation("删除单册提交失败：");
+
+        } catch (...) {
+            rollbackOperation();
+            throw;
+        }
+    });
+}
+
+LibraryCore::Statistics LibraryCore::statistics() const
+{
+    ScopedTimer timer("刷新统计");
+    Statistics stats;
+    TimedQuery query(database());
+
+    // 总图书数量
+    query.exec("SELECT COUNT(*) FROM books");
+    if (query.next()) {
+        stats.totalBooks = query.value(0).toInt();
+    }
+
+    // 总读者数量
+    query.exec("SELECT COUNT(*) FROM readers");
+    if (query.next()) {
+        stats.totalReaders = query.value(0).toInt();
+    }
+
+    // 已借出图书数量
+    query.exec("SELECT COUNT(*) FROM borrow_records WHERE status = '借出'");
+    if (query.next()) {
+        stats.borrowedBooks = query.value(0).toInt();
+    }
+
+    // 逾期图书数量
+    query.exec("SELECT COUNT(*) FROM borrow_records WHERE status = '借出' AND due_date < date('now')");
+    if (query.next()) {
+        stats.overdueBooks = query.value(0).toInt();
+    }
+
+    // 热门分类
+    query.exec("SELECT category, COUNT(*) as count FROM books GROUP BY category ORDER BY count DESC LIMIT 1");
+    if (query.next()) {
+        stats.popularCategory = query.value(0).toString();
+    }
+
+    // 活跃读者（最近30天有借书记录的）
+    query.exec("SELECT COUNT(DISTINCT reader_id) FROM borrow_records "
+               "WHERE borrow_date >= date('now', '-30 days')");
+    if (query.next()) {
+        stats.activeReaders = query.value(0).toInt();
+    }
+
+    return stats;
+}
+
+LibraryCore::OverdueSummary LibraryCore::overdueSummary() const
+{
+    ScopedTimer timer("逾期检查");
+    OverdueSummary summary;
+    TimedQuery query(database());
+
+    query.exec("SELECT COUNT(*) as count FROM borrow_records "
+               "WHERE status = '借出' AND due_date = date('now')");
+    if (query.next()) {
+        summary.dueToday = query.value("count").toInt();
+    }
+
+    query.exec("SELECT COUNT(*) as count FROM borrow_records "
+               "WHERE status = '借出' AND due_date < date('now')");
+    if (query.next()) {
+        summary.overdue = query.value("count").toInt();
+    }
+
+    return summary;
+}
+
+QString LibraryCore::generateReport() const
+{
+    ScopedTimer timer("生成报告");
+    QString report = "===== 图书馆统计报告 =====\n";
+    report += "生成时间: " + QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss") + "\n\n";
+
+    TimedQuery query(database());
+
+    // 图书统计
+    report += "1. 图书统计\n";
+    report += "----------\n";
+
+    query.exec("SELECT COUNT(*) as total, "
+               "SUM(CASE WHEN status = '在库' THEN 1 ELSE 0 END) as available, "
+               "SUM(CASE WHEN status = '借出' THEN 1 ELSE 0 END) as borrowed, "
+               "SUM(CASE WHEN status = '维护中' THEN 1 ELSE 0 END) as maintenance "
+               "FROM books");
+    if (query.next()) {
+        report += QString("图书总数: %1 本\n").arg(query.value("total").toInt());
+        report += QString("在库图书: %1 本\n").arg(query.value("available").toInt());
+        report += QString("借出图书: %1 本\n").arg(query.value("borrowed").toInt());
+        report += QString("维护中图书: %1 本\n").arg(query.value("maintenance").toInt());
+    }
+
+    // 读者统计
+    report += "\n2. 读者统计\n";
+    report += "----------\n";
+
+    query.exec("SELECT COUNT(*) as total, "
+               "reader_type, COUNT(*) as count "
+               "FROM readers GROUP BY reader_type");
+    while (query.next()) {
+        report += QString("%1: %2 人\n").arg(query.value("reader_type").toString())
+                                       .arg(query.value("count").toInt());
+    }
+
+    // 借阅统计
+    report += "\n3. 借阅统计\n";
+    report += "----------\n";
+
+    query.exec("SELECT SUM(loans) as total_borrows FROM rollup_daily_book");
+    if (query.next()) {
+        report += QString("总借阅次数: %1 次\n").arg(query.value("total_borrows").toInt());
+    }
+
+    query.exec("SELECT COUNT(*) as current_borrows FROM borrow_records WHERE status = '借出'");
+    if (query.next()) {
+        report += QString("当前借出: %1 本\n").arg(query.value("current_borrows").toInt());
+    }
+
+    query.exec("SELECT COUNT(*) as overdue FROM borrow_records "
+               "WHERE status = '借出' AND due_date < date('now')");
+    if (query.next()) {
+        report += QString("逾期未还: %1 本\n").arg(query.value("overdue").toInt());
+    }
+
+    // 热门图书
+    report += "\n4. 热门图书（借阅次数前5）\n";
+    report += "-------------------------\n";
+
+    // 以下各节读取按天汇总表，不再扫描全部借阅记录
+    query.exec("SELECT b.title, t.borrow_count FROM "
+               "(SELECT book_id, SUM(loans) as borrow_count FROM rollup_daily_book "
+               "GROUP BY book_id ORDER BY borrow_count DESC LIMIT 5) t "
+               "JOIN books b ON t.book_id = b.id "
+               "ORDER BY t.borrow_count DESC");
+    int rank = 1;
+    while (query.next()) {
+        report += QString("%1. %2 (借阅%3次)\n")
+            .arg(rank++)
+            .arg(query.value("title").toString())
+            .arg(query.value("borrow_count").toInt());
+    }
+
+    // 本月热门图书
+    report += "\n5. 本月热门图书（借阅次数前5）\n";
+    report += "-----------------------------\n";
+
+    QDate today = QDate::currentDate();
+    query.prepare("SELECT b.title, t.borrow_count FROM "
+                  "(SELECT book_id, SUM(loans) as borrow_count FROM rollup_daily_book "
+                  "WHERE day >= ? GROUP BY book_id ORDER BY borrow_count DESC LIMIT 5) t "
+                  "JOIN books b ON t.book_id = b.id "
+                  "ORDER BY t.borrow_count DESC");
+    query.addBindValue(QDate(today.year(), today.month(), 1).toString("yyyy-MM-dd"));
+    query.exec();
+    rank = 1;
+    while (query.next()) {
+        report += QString("%1. %2 (借阅%3次)\n")
+            .arg(rank++)
+            .arg(query.value("title").toString())
+            .arg(query.value("borrow_count").toInt());
+    }
+    if (rank == 1) {
+        report += "本月暂无借阅\n";
+    }
+
+    // 活跃读者
+    report += "\n6. 活跃读者（借阅次数前5）\n";
+    report += "-------------------------\n";
+
+    query.exec("SELECT r.name, t.borrow_count FROM "
+               "(SELECT reader_id, SUM(loans) as borrow_count FROM rollup_daily_reader "
+               "GROUP BY reader_id ORDER BY borrow_count DESC LIMIT 5) t "
+               "JOIN readers r ON t.reader_id = r.id "
+               "ORDER BY t.borrow_count DESC");
+    rank = 1;
+    while (query.next()) {
+        report += QString("%1. %2 (借阅%3次)\n")
+            .arg(rank++)
+            .arg(query.value("name").toString())
+            .arg(query.value("borrow_count").toInt());
+    }
+
+    // 分类借阅趋势
+    report += "\n7. 近8周各分类借阅次数\n";
+    report += "---------------------\n";
+
+    query.prepare("SELECT strftime('%Y-%W', day) as week, category, SUM(loans) as loans "
+                  "FROM rollup_daily_category WHERE day >= ? "
+                  "GROUP BY week, category ORDER BY week DESC, loans DESC");
+    query.addBindValue(today.addDays(-7 * 8).toString("yyyy-MM-dd"));
+    query.exec();
+    QString currentWeek;
+    while (query.next()) {
+        QString week = query.value("week").toString();
+        if (week != currentWeek) {
+            currentWeek = week;
+            report += QString("第%1周:\n").arg(week);
+        }
+        report += QString("  %1: %2 次\n")
+            .arg(query.value("category").toString())
+            .arg(query.value("loans").toInt());
+    }
+    if (currentWeek.isEmpty()) {
+        report += "近8周暂无借阅\n";
+    }
+
+    // 逾期列表
+    report += "\n8. 逾期未还图书\n";
+    report += "--------------\n";
+
+    query.exec("SELECT br.id, b.title, r.name, br.due_date, "
+               "julianday('now') - julianday(br.due_date) as overdue_days "
+               "FROM borrow_records br "
+               "JOIN books b ON br.book_id = b.id "
+               "JOIN readers r ON br.reader_id = r.id "
+               "WHERE br.status = '借出' AND br.due_date < date('now') "
+               "ORDER BY br.due_date");
+
+    bool hasOverdue = false;
+    while (query.next()) {
+        hasOverdue = true;
+        report += QString("图书: %1, 读者: %2, 应还日期: %3, 逾期天数: %4\n")
+            .arg(query.value("title").toString())
+            .arg(query.value("name").toString())
+            .arg(query.value("due_date").toDate().toString("yyyy-MM-dd"))
+            .arg(query.value("overdue_days").toInt());
+    }
+
+    if (!hasOverdue) {
+        report += "无逾期记录\n";
+    }
+
+    // 借阅关联：每本热门图书取关联表中的前3条，各是一次主键前缀查找
+    report += "\n9. 借阅关联（借过热门图书的读者也借了）\n";
+    report += "-----------------------------------\n";
+
+    query.exec("SELECT t.book_id, b.title FROM "
+               "(SELECT book_id, SUM(loans) as borrow_count FROM rollup_daily_book "
+               "GROUP BY book_id ORDER BY borrow_count DESC LIMIT 5) t "
+               "JOIN books b ON t.book_id = b.id "
+               "ORDER BY t.borrow_count DESC");
+    bool hasRelated = false;
+    while (query.next()) {
+        const QVector<CoBorrowIndex::Recommendation> related =
+            CoBorrowIndex::recommend(database(), query.value("book_id").toInt(), 3);
+        if (related.isEmpty()) {
+            continue;
+        }
+        hasRelated = true;
+        QStringList titles;
+        for (const CoBorrowIndex::Recommendation &recommendation : related) {
+            titles.append(QString("%1 (%2人)").arg(recommendation.title).arg(recommendation.together));
+        }
+        report += QString("%1: %2\n").arg(query.value("title").toString(), titles.join("、"));
+    }
+    if (!hasRelated) {
+        report += "暂无借阅关联\n";
+    }
+
+    return report;
+}
+
+QString LibraryCore::bookFilter(const BookSearch &search)
+{
+    QStringList filters;
+
+    if (!search.id.isEmpty()) {
+        filters.append(QString("id = %1").arg(search.id.toInt()));
+    }
+    if (!search.title.isEmpty()) {
+        filters.append(containsFilter("title", search.title));
+    }
+    if (!search.author.isEmpty()) {
+        filters.append(containsFilter("author", search.author));
+    }
+    if (!search.isbn.isEmpty()) {
+        filters.append(containsFilter("isbn", search.isbn));
+    }
+    if (!search.category.isEmpty()) {
+        filters.append(QString("category = '%1'").arg(quoted(search.category)));
+    }
+    if (!search.status.isEmpty()) {
+        filters.append(QString("status = '%1'").arg(quoted(search.status)));
+    }
+
+    return filters.join(" AND ");
+}
+
+QString LibraryCore::readerFilter(const ReaderSearch &search)
+{
+    QStringList filters;
+
+    if (!search.id.isEmpty()) {
+        filters.append(QString("id = %1").arg(search.id.toInt()));
+    }
+    if (!search.name.isEmpty()) {
+        filters.append(containsFilter("name", search.name));
+    }
+    if (!search.phone.isEmpty()) {
+        filters.append(containsFilter("phone", search.phone));
+    }
+    if (!search.readerType.isEmpty()) {
+        filters.append(QString("reader_type = '%1'").arg(quoted(search.readerType)));
+    }
+
+    return filters.join(" AND ");
+}
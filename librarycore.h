@@ -0,0 +1,271 @@
+﻿// librarycore.h
+#ifndef LIBRARYCORE_H
+#define LIBRARYCORE_H
+
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QString>
+#include <QStringList>
+#include <QDate>
+#include <QAtomicInt>
+#include <QFuture>
+#include <QtConcurrent/QtConcurrentRun>
+#include <functional>
+#include "historylog.h"
+#include "recordcache.h"
+#include "schema.h"
+
+// 借还书、统计与报表等业务逻辑，不依赖任何界面组件。
+// 图形界面、基准测试与命令行工具共用这一份实现；业务错误以 QString 异常抛出，
+// 由调用方决定如何提示。
+class LibraryCore
+{
+public:
+    struct BorrowResult
+    {
+        int recordId = 0;
+        int bookId = 0;
+        QString bookTitle;
+        QString readerName;
+        QDate dueDate;
+        QString copyBarcode;  // 按书目借出时为空
+    };
+
+    struct ReturnResult
+    {
+        int bookId = 0;
+        QString bookTitle;
+        QString readerName;
+        int overdueDays = 0;
+        double overdueFee = 0.0;
+        int holdId = 0;           // 归还的这一册分给了哪条预约，没有时为 0
+        int holdReaderId = 0;
+        QString holdReaderName;
+        QDate pickupDeadline;
+    };
+
+    struct HoldResult
+    {
+        int holdId = 0;
+        QString bookTitle;
+        QString readerName;
+        int position = 0;  // 在队列中的位置，从 1 开始
+    };
+
+    struct RenewResult
+    {
+        QString bookTitle;
+        QString readerName;
+        QDate newDueDate;
+    };
+
+    // prepare 的结果：error 为数据库无法打开时的说明，warnings 为辅助组件安装失败的说明
+    struct PrepareResult
+    {
+        QString error;
+        QStringList warnings;
+    };
+
+    struct Statistics
+    {
+        int totalBooks = 0;
+        int totalReaders = 0;
+        int borrowedBooks = 0;
+        int overdueBooks = 0;
+        QString popularCategory;
+        int activeReaders = 0;
+    };
+
+    struct OverdueSummary
+    {
+        int dueToday = 0;
+        int overdue = 0;
+    };
+
+    // 搜索条件，空字符串表示不限
+    struct BookSearch
+    {
+        QString id;
+        QString title;
+        QString author;
+        QString isbn;
+        QString category;
+        QString status;
+    };
+
+    struct ReaderSearch
+    {
+        QString id;
+        QString name;
+        QString phone;
+        QString readerType;
+    };
+
+    explicit LibraryCore(const QString &connectionName = QLatin1String(QSqlDatabase::defaultConnection));
+
+    // 打开数据库、建表并安装变更日志、归档库与借阅汇总。
+    // 只有数据库本身无法打开时返回 false，辅助组件的失败记录在 warnings() 中
+    bool open(const QString &path, QString *error = nullptr);
+
+    // 只读打开，不建表也不安装辅助组件，供后台线程执行统计查询
+    bool openReadOnly(const QString &path, QString *error = nullptr);
+
+    // 在线程池中用独立的连接执行一次 open 并关闭：建表、升级表结构、安装辅助组件、
+    // 补写残留的借阅历史都在这里完成，调用线程之后用 openPrepared 打开
+    static QFuture<PrepareResult> prepare(const QString &path);
+
+    // 打开 prepare 过的数据库：表结构与触发器已在数据库文件中，只打开连接、
+    // 附加归档库（临时视图只对本连接有效）并占用借阅历史队列的槽位
+    bool openPrepared(const QString &path, QString *error = nullptr);
+
+    // 在线程池中用只读的独立连接执行查询，不占用调用线程；数据库打不开时返回默认值
+    template <typename Result>
+    static QFuture<Result> runReadOnly(const QString &path, const std::function<Result(const LibraryCore &)> &query);
+
+    // 借阅汇总与借阅关联首次安装时是空表，要按历史数据重建。rebuildStaleExtensions 在本连接上重建，
+    // InBackground 版本在线程池中用独立的读写连接重建，不占用打开数据库的线程。
+    // 返回失败说明，全部成功时为空
+    bool hasStaleExtensions() const;
+    QStringList rebuildStaleExtensions();
+    static QFuture<QStringList> rebuildStaleExtensionsInBackground(const QString &path);
+
+    // 数据库文件被恢复替换后重新打开，并重新安装辅助组件
+    bool reopen(QString *error = nullptr);
+    void close();
+
+    QSqlDatabase database() const;
+    QStringList warnings() const;
+
+    // 借还书在各自的事务中完成，失败时回滚并抛出错误说明。
+    // 借阅历史在提交后交给后写队列，由后台线程成批写入 borrow_history
+    BorrowResult borrowBook(int bookId, int readerId, int days);
+    ReturnResult returnBook(int recordId);
+    RenewResult renewBook(int recordId);
+
+    // 按单册借书，copyId 为扫描的单册条码对应的单册。borrowBook 借的图书登记了单册时
+    // 自动挑一册在架的借出；没有登记单册的图书仍按书目的可借数量借还
+    BorrowResult borrowCopy(int copyId, int readerId, int days);
+
+    // 预约：图书全部借出时排队，还书时队首的预约分到归还的这一册并保留到取书期限，
+    // 读者来借时直接借出保留的那一册。取消或过期的预约把保留的书顺延给下一位
+    HoldResult placeHold(int bookId, int readerId);
+    void cancelHold(int holdId);
+    int expireHolds();
+
+    // 单册的登记、修改与删除，同时按单册重新统计图书的总数量与可借数量。
+    // 借出中的单册只能通过还书改变状态；失败时抛出错误说明
+    int addCopy(int bookId, const QString &barcode, const QString &location);
+    void updateCopy(int copyId, const QString &location, const QString &state);
+    void removeCopy(int copyId);
+
+    // 成组提交：beginGroup 之后的借还书各在一个保存点中执行，失败只撤销自身，
+    // 整组由 commitGroup 一次提交；组提交失败时组内所有操作一并撤销
+    bool beginGroup(QString *error = nullptr);
+    bool commitGroup(QString *error = nullptr);
+    void rollbackGroup();
+
+    // 记录一次逾期提醒
+    void logReminder(int recordId, const QDate &dueDate, int overdueDays);
+
+    Statistics statistics() const;
+    OverdueSummary overdueSummary() const;
+    QString generateReport() const;
+
+    // 借还书校验所用图书与读者记录的缓存。借还书自身会维护缓存，
+    // 其他地方修改 books / readers 表后须调用 invalidateBook / invalidateReader
+    void invalidateBook(int id);
+    void invalidateReader(int id);
+    void clearRecordCache();
+    void setRecordCacheCapacity(int records);
+    RecordCache<Schema::BookRow>::Stats bookCacheStats() const { return bookCache.stats(); }
+    RecordCache<Schema::ReaderRow>::Stats readerCacheStats() const { return readerCache.stats(); }
+    void resetRecordCacheStats();
+
+    // 生成 QSqlTableModel::setFilter 使用的过滤条件
+    static QString bookFilter(const BookSearch &search);
+    static QString readerFilter(const ReaderSearch &search);
+
+private:
+    bool openConnection(const QString &path, QString *error);
+    void createSchema();
+    void upgradeSchema();
+    void installExtensions();
+    void openHistoryLog();
+
+    // 先查缓存，未命中时读数据库并放入缓存；记录不存在时返回 false
+    bool fetchBook(int id, Schema::BookRow *book);
+    bool fetchReader(int id, Schema::ReaderRow *reader);
+
+    // 读者的状态、可借册数与可借天数，以及图书的可借数量与版本号决定能否借书，
+    // 在事务中按主键直接读取并刷新缓存。其他进程修改读者或借还图书时本进程的缓存
+    // 不会失效，缓存只用于显示姓名、书名等
+    bool fetchBookForCirculation(int id, Schema::BookRow *book);
+    bool fetchReaderForCirculation(int id, Schema::ReaderRow *reader);
+
+    // 单册直接读数据库，借书时的状态比对以它为准
+    bool fetchCopy(int id, Schema::CopyRow *copy);
+    void syncCopyCounts(int bookId);
+
+    // 把空出的一册（copyId 为 0 时按书目）分给队首的预约并记下到书通知；没有人排队时返回 false。
+    // releaseHold 在预约取消或过期后把它保留的书顺延给下一位，没有人排队时放回书架
+    bool allocateHold(int bookId, int copyId, ReturnResult *result);
+    void releaseHold(const Schema::HoldRow &hold);
+    bool fetchHold(int id, Schema::HoldRow *hold);
+
+    // 可以重试的失败：版本号比对不一致（其他连接修改了同一行）或数据库忙
+    struct Conflict
+    {
+        QString message;
+    };
+
+    // 借还书的一次尝试；遇到 Conflict 时由 retrying 退避后重新执行，次数用尽后抛出其说明
+    BorrowResult attemptBorrow(int bookId, int copyId, int readerId, int days);
+    ReturnResult attemptReturn(int recordId);
+    RenewResult attemptRenew(int recordId);
+    template <typename Result>
+    Result retrying(const std::function<Result()> &operation);
+    static void throwSqlError(const QSqlError &error, const QString &context);
+
+    // 单个借还操作的边界：单独执行时是一个事务，成组提交时是组内的一个保存点。
+    // 提交失败时抛出错误（数据库忙时为 Conflict）
+    void beginOperation();
+    void commitOperation(const QString &context);
+    void rollbackOperation();
+
+    // 操作中记下的历史在操作（成组时为整组）提交之前追加到队列文件并在同一事务中登记，
+    // 提交后交给后台线程写入，回滚时从队列文件中截掉
+    void recordHistory(HistoryLog::Event event);
+    bool stageHistory(QString *error);
+    void publishHistory();
+
+    QString connectionName;
+    QStringList initWarnings;
+    RecordCache<Schema::BookRow> bookCache;
+    RecordCache<Schema::ReaderRow> readerCache;
+    bool grouped;
+    bool journalTransaction;  // 本事务在变更日志中标了事务编号，提交前要清除
+    HistoryLog historyLog;
+    QVector<HistoryLog::Event> pendingHistory;
+    int operationHistoryStart;
+};
+
+template <typename Result>
+QFuture<Result> LibraryCore::runReadOnly(const QString &path, const std::function<Result(const LibraryCore &)> &query)
+{
+    return QtConcurrent::run([path, query]() -> Result {
+        static QAtomicInt serial;
+        const QString connectionName = QString("library_reader_%1").arg(serial.fetchAndAddRelaxed(1));
+        Result result;
+        {
+            LibraryCore reader(connectionName);
+            if (reader.openReadOnly(path)) {
+                result = query(reader);
+            }
+            reader.close();
+        }
+        QSqlDatabase::removeDatabase(connectionName);
+        return result;
+    });
+}
+
+#endif // LIBRARYCORE_H
@@ -1,5 +1,17 @@
 ﻿// librarymanager.cpp
 #include "librarymanager.h"
+#include "onlinebackup.h"
+#include "changejournal.h"
+#include "backuparchive.h"
+#include "historyarchiver.h"
+#include "circulationrollup.h"
+#include "coborrowindex.h"
+#include "perfmonitor.h"
+#include "stallwatchdog.h"
+#include "schema.h"
+#include "circulationclient.h"
+#include "columnstoremodel.h"
+#include "textscan.h"
 #include <QtWidgets>
 #include <QtSql>
 #include <QMessageBox>
@@ -9,25 +21,97 @@
 #include <QPrintDialog>
 #include <QDesktopServices>
 #include <QMessageBox>
+#include <QtConcurrent>
+
+namespace {
+
+// 内存表已加载这一行时附上书名或姓名，扫码时不为此再查数据库
+QString scanLabel(const ColumnStoreModel *model, int id, int nameColumn)
+{
+    QString text = QString("ID %1").arg(id);
+    if (model) {
+        int row = model->store().rowOf(id);
+        if (row >= 0) {
+            text += "  " + model->store().value(row, nameColumn).toString();
+        }
+    }
+    return text;
+}
+
+} // namespace
 
 LibraryManager::LibraryManager(QWidget *parent)
     : QMainWindow(parent)
     , overdueTimer(new QTimer(this))
+    , incrementalBackupTimer(new QTimer(this))
+    , archiveTimer(new QTimer(this))
     , trayIcon(new QSystemTrayIcon(this))
+    , stallWatchdog(nullptr)
+    , statisticsWatcher(new QFutureWatcher<LibraryCore::Statistics>(this))
+    , overdueWatcher(new QFutureWatcher<LibraryCore::OverdueSummary>(this))
+    , rebuildWatcher(new QFutureWatcher<QStringList>(this))
+    , prepareWatcher(new QFutureWatcher<LibraryCore::PrepareResult>(this))
+    , scanIndexWatcher(new QFutureWatcher<CirculationIndex>(this))
+    , scanIndexPending(false)
+    , startupScheduled(false)
+    , statisticsPending(false)
 {
-    setupDatabase();
+    // 构造函数只搭窗口框架；数据库、标签页内容和统计在窗口画出来之后再加载
+    startupTimer.start();
     setupUI();
     createMenuBar();
     createToolBar();
     createStatusBar();
     createModels();
 
+    connect(statisticsWatcher, &QFutureWatcherBase::finished, this, &LibraryManager::showStatistics);
+    connect(overdueWatcher, &QFutureWatcherBase::finished, this, &LibraryManager::showOverdueSummary);
+    connect(prepareWatcher, &QFutureWatcherBase::finished, this, &LibraryManager::databasePrepared);
+    connect(rebuildWatcher, &QFutureWatcherBase::finished, [this]() {
+        const QStringList errors = rebuildWatcher->result();
+        if (!errors.isEmpty()) {
+            QMessageBox::warning(this, "警告", errors.join("\n"));
+            return;
+        }
+        statusBar()->showMessage("统计汇总已生成", 3000);
+        refreshStatistics();
+        // 生成期间又被标记为待重建的（如菜单中再次要求重建），接着再生成一轮
+        rebuildStaleExtensions();
+    });
+    connect(scanIndexWatcher, &QFutureWatcherBase::finished, [this]() {
+        // 加载期间又有图书或读者变动时，丢弃这一轮结果重新加载
+        if (scanIndexPending) {
+            scanIndexPending = false;
+            warmScanIndex();
+            return;
+        }
+        scanIndex = scanIndexWatcher->result();
+    });
+
+    // 借还书校验用的图书与读者记录缓存，各保留的条数
+    core.setRecordCacheCapacity(QSettings().value("cache/records", 2048).toInt());
+
     // 设置定时器检查逾期书籍（每小时检查一次）
     connect(overdueTimer, &QTimer::timeout, this, &LibraryManager::checkOverdueBooks);
     overdueTimer->start(3600000); // 1小时
 
-    // 启动时立即检查一次
-    checkOverdueBooks();
+    // 设置了增量备份目录时每小时导出一次变更日志
+    connect(incrementalBackupTimer, &QTimer::timeout, [this]() {
+        QString dir = QSettings().value("backup/incrementalDir").toString();
+        if (!dir.isEmpty()) {
+            runIncrementalBackup(dir, false);
+        }
+    });
+    incrementalBackupTimer->start(3600000);
+
+    // 每天把超过保留期的借阅记录和历史迁移到归档库
+    connect(archiveTimer, &QTimer::timeout, [this]() {
+        int retentionDays = QSettings().value("archive/retentionDays", 365).toInt();
+        if (retentionDays > 0) {
+            startHistoryArchiving(QDate::currentDate().addDays(-retentionDays), false);
+        }
+    });
+    archiveTimer->start(24 * 3600000);
 
     // 设置系统托盘
     trayIcon->setIcon(QIcon(":/icons/library.png"));
@@ -37,89 +121,301 @@ LibraryManager::LibraryManager(QWidget *parent)
 
 LibraryManager::~LibraryManager()
 {
-    if (db.isOpen()) {
-        db.close();
+    if (stallWatchdog) {
+        stallWatchdog->stopWatching();
+    }
+
+    waitForBackgroundQueries();
+
+    // 退出前中止尚未完成的备份
+    if (backupThread) {
+        if (backupWorker) {
+            backupWorker->cancel();
+        }
+        backupThread->wait();
+    }
+
+    // 归档按批提交，等待当前批次完成即可
+    if (archiveThread) {
+        archiveThread->wait();
+    }
+
+    delete circulationClient;
+    core.close();
+
+    // 设置了 LIBRARY_PERF_JSON 时退出前保存耗时统计
+    if (qEnvironmentVariableIsSet("LIBRARY_PERF_JSON")) {
+        PerfMonitor::writeJson(QString::fromLocal8Bit(qgetenv("LIBRARY_PERF_JSON")));
+    }
+}
+
+void LibraryManager::showEvent(QShowEvent *event)
+{
+    QMainWindow::showEvent(event);
+
+    if (!startupScheduled) {
+        startupScheduled = true;
+        QTimer::singleShot(0, this, &LibraryManager::finishStartup);
+    }
+}
+
+void LibraryManager::finishStartup()
+{
+    // 先把窗口框架画出来，再打开数据库
+    repaint();
+    qint64 shownMs = startupTimer.elapsed();
+    PerfMonitor::record(PerfMonitor::Operation, "启动-窗口显示", shownMs * 1000000);
+
+    // 建表、安装变更日志与汇总表、补写借阅历史都在后台连接上完成，
+    // 期间标签页、菜单和工具栏不可用，完成后界面线程只需打开连接
+    tabWidget->setEnabled(false);
+    menuBar()->setEnabled(false);
+    for (QToolBar *toolBar : findChildren<QToolBar *>()) {
+        toolBar->setEnabled(false);
+    }
+    statusBar()->showMessage("正在打开数据库……");
+    prepareWatcher->setFuture(LibraryCore::prepare("library.db"));
+}
+
+void LibraryManager::databasePrepared()
+{
+    qint64 preparedMs = startupTimer.elapsed();
+    PerfMonitor::record(PerfMonitor::Operation, "启动-数据库就绪", preparedMs * 1000000);
+
+    tabWidget->setEnabled(true);
+    menuBar()->setEnabled(true);
+    for (QToolBar *toolBar : findChildren<QToolBar *>()) {
+        toolBar->setEnabled(true);
+    }
+
+    // 打不开时菜单仍可用，可以从备份恢复数据库
+    const LibraryCore::PrepareResult prepared = prepareWatcher->result();
+    if (!prepared.error.isEmpty()) {
+        QMessageBox::critical(this, "错误", "无法打开数据库！\n" + prepared.error);
+        return;
+    }
+    for (const QString &warning : prepared.warnings) {
+        QMessageBox::warning(this, "警告", warning);
+    }
+    setupDatabase();
+    connectCirculationServer();
+    ensureTab(tabWidget->currentIndex());
+    qint64 readyMs = startupTimer.elapsed();
+    PerfMonitor::record(PerfMonitor::Operation, "启动-首页就绪", readyMs * 1000000);
+
+    // 逾期检查与扫码借书的条码索引都在后台线程中进行
+    checkOverdueBooks();
+    warmScanIndex();
+
+    if (!rebuildWatcher->isRunning()) {
+        statusBar()->showMessage(QString("启动完成：数据库 %1 ms，首页 %2 ms").arg(preparedMs).arg(readyMs), 10000);
+    }
+
+    // 界面线程卡顿监视，阈值设为 0 时关闭；启动耗时单独统计，不算作卡顿
+    int stallThreshold = QSettings().value("watchdog/thresholdMs", 250).toInt();
+    if (stallThreshold > 0) {
+        stallWatchdog = new StallWatchdog(stallThreshold,
+                                          QSettings().value("watchdog/logFile", "stalls.log").toString(), this);
+        stallWatchdog->startWatching();
+    }
+}
+
+void LibraryManager::waitForBackgroundQueries()
+{
+    if (bookModel) {
+        bookModel->waitForLoad();
+    }
+    if (readerModel) {
+        readerModel->waitForLoad();
+    }
+    statisticsWatcher->waitForFinished();
+    overdueWatcher->waitForFinished();
+    scanIndexWatcher->waitForFinished();
+    rebuildWatcher->waitForFinished();
+    prepareWatcher->waitForFinished();
+    if (restoreWatcher) {
+        restoreWatcher->waitForFinished();
+    }
+}
+
+// 在线备份与归档各自持有数据库连接，替换数据库文件前它们必须已经结束。
+// 对话框打开期间定时器仍可能启动它们，所以在真正替换之前还要再检查一次
+bool LibraryManager::canReplaceDatabase()
+{
+    if (backupThread || archiveThread || rebuildWatcher->isRunning()) {
+        QMessageBox::warning(this, "警告", QString("%1正在进行，请等它完成后再恢复数据库。")
+                                               .arg(backupThread ? "数据库备份"
+                                                    : archiveThread ? "历史数据归档" : "统计汇总生成"));
+        return false;
+    }
+    return true;
+}
+
+void LibraryManager::reloadModel(QSqlTableModel *model)
+{
+    // 所在标签页尚未创建时不需要加载，首次切换过去时再查询
+    if (model) {
+        model->select();
+    }
+}
+
+void LibraryManager::reloadModel(ColumnStoreModel *model)
+{
+    if (model) {
+        model->reload(db.databaseName());
+    }
+}
+
+void LibraryManager::refreshModelRow(ColumnStoreModel *model, int id)
+{
+    // 单行变动只重读这一行
+    if (model) {
+        model->refreshRow(db, id);
+    }
+}
+
+void LibraryManager::warmScanIndex()
+{
+    if (!db.isOpen()) {
+        return;
+    }
+    if (scanIndexWatcher->isRunning()) {
+        scanIndexPending = true;
+        return;
+    }
+    scanIndex.ready = false;
+    scanIndexWatcher->setFuture(LibraryCore::runReadOnly<CirculationIndex>(db.databaseName(),
+        [](const LibraryCore &reader) -> CirculationIndex {
+            CirculationIndex index;
+            index.load(reader.database());
+            return index;
+        }));
+}
+
+// 新建的汇总表与关联表是空的，在后台按历史数据生成，完成前统计报表与推荐不完整
+void LibraryManager::rebuildStaleExtensions()
+{
+    if (!db.isOpen() || rebuildWatcher->isRunning() || !core.hasStaleExtensions()) {
+        return;
+    }
+    statusBar()->showMessage("正在后台生成统计汇总……");
+    rebuildWatcher->setFuture(LibraryCore::rebuildStaleExtensionsInBackground(db.databaseName()));
+}
+
+void LibraryManager::refreshScanIndex(BarcodeIndex *index, int id)
+{
+    // 索引还在加载时，等它加载完再整体重来
+    if (scanIndexWatcher->isRunning()) {
+        scanIndexPending = true;
+        return;
+    }
+    if (scanIndex.ready && !index->refresh(db, id)) {
+        warmScanIndex();
+    }
+}
+
+// 索引中没有的条码再查一次数据库：借还书服务或其他服务台在索引加载之后新增的图书与读者
+int LibraryManager::resolveScan(BarcodeIndex &index, const QString &scanned)
+{
+    return scanIndex.ready ? index.resolveOrFetch(db, scanned) : index.resolveInDatabase(db, scanned);
+}
+
+int LibraryManager::resolveCopy(const QString &scanned)
+{
+    // 单册条码只按条码查找，数字不当作单册 ID
+    return scanIndex.ready ? scanIndex.copies.findCodeOrFetch(db, scanned)
+                           : scanIndex.copies.findCodeInDatabase(db, scanned);
+}
+
+bool LibraryManager::resolveBorrowItem(const QString &scanned, int *bookId, int *copyId)
+{
+    // 依次按单册条码、ISBN、图书 ID 查找；是单册时 bookId 为 0，由借书按单册取图书
+    *copyId = resolveCopy(scanned);
+    *bookId = *copyId >= 0 ? 0 : resolveScan(scanIndex.books, scanned);
+    return *copyId >= 0 || *bookId >= 0;
+}
+
+int LibraryManager::resolveRecord(const QString &scanned)
+{
+    // 扫描的是单册条码时取该册尚未归还的借阅记录，否则按借阅记录ID；找不到时为 0
+    const int copyId = resolveCopy(scanned);
+    if (copyId < 0) {
+        return scanned.trimmed().toInt();
+    }
+    TimedQuery query(db);
+    query.prepare("SELECT id FROM borrow_records WHERE copy_id = ? AND status = '借出'");
+    query.addBindValue(copyId);
+    return (query.exec() && query.next()) ? query.value(0).toInt() : 0;
+}
+
+void LibraryManager::connectCirculationServer()
+{
+    // 设置了借还书服务时借书、还书、续借都交给服务执行，检索与统计仍直接读数据库
+    QString address = QSettings().value("server/address").toString();
+    if (address.isEmpty()) {
+        return;
+    }
+
+    CirculationClient *client = new CirculationClient;
+    client->setToken(QSettings().value("server/token").toString());
+    QString error;
+    if (!client->connectTo(address, &error)) {
+        delete client;
+        QMessageBox::warning(this, "警告",
+            QString("无法连接借还书服务 %1：%2\n本次改为直接访问数据库。").arg(address, error));
+        return;
+    }
+    circulationClient = client;
+    statusBar()->showMessage("已连接借还书服务 " + address, 5000);
+}
+
+void LibraryManager::invalidateBook(int id)
+{
+    core.invalidateBook(id);
+    if (circulationClient) {
+        try {
+            circulationClient->invalidateBook(id);
+        } catch (const QString &error) {
+            statusBar()->showMessage("通知借还书服务失败：" + error, 5000);
+        }
+    }
+}
+
+void LibraryManager::invalidateReader(int id)
+{
+    core.invalidateReader(id);
+    if (circulationClient) {
+        try {
+            circulationClient->invalidateReader(id);
+        } catch (const QString &error) {
+            statusBar()->showMessage("通知借还书服务失败：" + error, 5000);
+        }
     }
 }
 
 void LibraryManager::setupDatabase()
 {
-    // 连接SQLite数据库
-    db = QSqlDatabase::addDatabase("QSQLITE");
-    db.setDatabaseName("library.db");
+    // 连接SQLite数据库；建表与安装辅助组件已由 LibraryCore::prepare 在后台完成
+    bool opened = core.openPrepared("library.db");
+    db = core.database();
 
-    if (!db.open()) {
+    if (!opened) {
         QMessageBox::critical(this, "错误", "无法打开数据库！");
         return;
     }
 
-    QSqlQuery query;
-
-    // 创建图书表
-    query.exec("CREATE TABLE IF NOT EXISTS books ("
-               "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-               "isbn TEXT UNIQUE NOT NULL,"
-               "title TEXT NOT NULL,"
-               "author TEXT NOT NULL,"
-               "publisher TEXT,"
-               "publish_date DATE,"
-               "category TEXT,"
-               "price REAL,"
-               "total_copies INTEGER DEFAULT 1,"
-               "available_copies INTEGER DEFAULT 1,"
-               "location TEXT,"
-               "description TEXT,"
-               "status TEXT DEFAULT '在库',"
-               "created_date TIMESTAMP DEFAULT CURRENT_TIMESTAMP)");
-
-    // 创建读者表
-    query.exec("CREATE TABLE IF NOT EXISTS readers ("
-               "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-               "card_number TEXT UNIQUE NOT NULL,"
-               "name TEXT NOT NULL,"
-               "gender TEXT,"
-               "birth_date DATE,"
-               "phone TEXT,"
-               "email TEXT,"
-               "address TEXT,"
-               "reader_type TEXT DEFAULT '普通读者',"
-               "max_borrow INTEGER DEFAULT 5,"
-               "max_days INTEGER DEFAULT 30,"
-               "status TEXT DEFAULT '正常',"
-               "registration_date DATE DEFAULT CURRENT_DATE,"
-               "expiry_date DATE,"
-               "notes TEXT)");
-
-    // 创建借阅记录表
-    query.exec("CREATE TABLE IF NOT EXISTS borrow_records ("
-               "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-               "book_id INTEGER NOT NULL,"
-               "reader_id INTEGER NOT NULL,"
-               "borrow_date DATE NOT NULL,"
-               "due_date DATE NOT NULL,"
-               "return_date DATE,"
-               "renew_count INTEGER DEFAULT 0,"
-               "status TEXT DEFAULT '借出',"
-               "overdue_fee REAL DEFAULT 0,"
-               "FOREIGN KEY(book_id) REFERENCES books(id),"
-               "FOREIGN KEY(reader_id) REFERENCES readers(id))");
-
-    // 创建借阅历史表
-    query.exec("CREATE TABLE IF NOT EXISTS borrow_history ("
-               "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-               "book_id INTEGER,"
-               "reader_id INTEGER,"
-               "action TEXT,"
-               "action_date TIMESTAMP DEFAULT CURRENT_TIMESTAMP,"
-               "details TEXT)");
-
-    // 插入一些示例数据（如果表为空）
-    query.exec("SELECT COUNT(*) FROM books");
-    if (query.next() && query.value(0).toInt() == 0) {
-        query.exec("INSERT INTO books (isbn, title, author, publisher, category, price, total_copies, available_copies) "
-                   "VALUES ('9787111636664', 'C++ Primer', 'Stanley Lippman', '机械工业出版社', '编程', 128.0, 5, 5)");
-        query.exec("INSERT INTO books (isbn, title, author, publisher, category, price, total_copies, available_copies) "
-                   "VALUES ('9787302518014', 'Qt5开发实战', '王维波', '清华大学出版社', '编程', 89.0, 3, 3)");
+    for (const QString &warning : core.warnings()) {
+        QMessageBox::warning(this, "警告", warning);
+    }
+
+    rebuildStaleExtensions();
+
+    // 变更日志只在做增量备份时记录，否则日志表会无限增长
+    if (!QSettings().value("backup/incrementalDir").toString().isEmpty()) {
+        QString error;
+        if (!ChangeJournal::enable(db, &error)) {
+            QMessageBox::warning(this, "警告", "变更日志启用失败，增量备份不可用：" + error);
+        }
     }
 }
 
@@ -128,15 +424,45 @@ void LibraryManager::setupUI()
     // 设置主窗口
     setMinimumSize(1200, 700);
 
-    // 创建标签页
+    // 创建标签页，内容在首次切换到该页时才创建
     tabWidget = new QTabWidget(this);
     setCentralWidget(tabWidget);
 
-    // 创建标签页内容
-    createBookManagementTab();
-    createReaderManagementTab();
-    createBorrowReturnTab();
-    createStatisticsTab();
+    const char *const titles[] = {"图书管理", "读者管理", "借还书管理", "统计报表", "性能诊断"};
+    for (const char *title : titles) {
+        QWidget *page = new QWidget;
+        QVBoxLayout *layout = new QVBoxLayout(page);
+        layout->setContentsMargins(0, 0, 0, 0);
+        tabWidget->addTab(page, title);
+    }
+    connect(tabWidget, &QTabWidget::currentChanged, this, &LibraryManager::ensureTab);
+}
+
+void LibraryManager::ensureTab(int index)
+{
+    if (!db.isOpen() || index < 0 || index >= TabCount || builtTabs.contains(index)) {
+        return;
+    }
+    builtTabs.insert(index);
+
+    ScopedTimer timer("创建标签页");
+    switch (index) {
+    case BookTab:
+        createBookManagementTab();
+        break;
+    case ReaderTab:
+        createReaderManagementTab();
+        break;
+    case BorrowTab:
+        createBorrowReturnTab();
+        break;
+    case StatisticsTab:
+        createStatisticsTab();
+        break;
+    case DiagnosticsTab:
+        createDiagnosticsTab();
+        break;
+    }
 }
 
 void LibraryManager::createBookManagementTab()
@@ -188,31 +514,14 @@ void LibraryManager::createBookManagementTab()
     searchGroup->setLayout(searchLayout);
     mainLayout->addWidget(searchGroup);
 
-    // 图书表格
+    // 图书表格，数据来自后台加载的目录缓存，加载完成后再调整列宽
     bookTableView = new QTableView;
-    bookModel = new QSqlTableModel(this, db);
-    bookModel->setTable("books");
-    bookModel->setEditStrategy(QSqlTableModel::OnManualSubmit);
-    bookModel->select();
-
-    // 设置表头
-    bookModel->setHeaderData(0, Qt::Horizontal, "ID");
-    bookModel->setHeaderData(1, Qt::Horizontal, "ISBN");
-    bookModel->setHeaderData(2, Qt::Horizontal, "书名");
-    bookModel->setHeaderData(3, Qt::Horizontal, "作者");
-    bookModel->setHeaderData(4, Qt::Horizontal, "出版社");
-    bookModel->setHeaderData(5, Qt::Horizontal, "出版日期");
-    bookModel->setHeaderData(6, Qt::Horizontal, "分类");
-    bookModel->setHeaderData(7, Qt::Horizontal, "价格");
-    bookModel->setHeaderData(8, Qt::Horizontal, "总数量");
-    bookModel->setHeaderData(9, Qt::Horizontal, "可借数量");
-    bookModel->setHeaderData(10, Qt::Horizontal, "位置");
-    bookModel->setHeaderData(11, Qt::Horizontal, "状态");
-
+    bookModel = new ColumnStoreModel(ColumnStore::books(), this);
+    connect(bookModel, &ColumnStoreModel::loaded, this, &LibraryManager::showBookCatalog);
     bookTableView->setModel(bookModel);
     bookTableView->setSelectionBehavior(QAbstractItemView::SelectRows);
     bookTableView->setSelectionMode(QAbstractItemView::SingleSelection);
-    bookTableView->resizeColumnsToContents();
+    reloadModel(bookModel);
 
     mainLayout->addWidget(bookTableView);
 
@@ -231,14 +540,24 @@ void LibraryManager::createBookManagementTab()
     connect(deleteButton, &QPushButton::clicked, this, &LibraryManager::deleteBook);
     buttonLayout->addWidget(deleteButton);
 
+    QPushButton *copiesButton = new QPushButton("单册管理");
+    connect(copiesButton, &QPushButton::clicked, this, &LibraryManager::manageCopies);
+    buttonLayout->addWidget(copiesButton);
+
+    QPushButton *relatedButton = new QPushButton("相关推荐");
+    connect(relatedButton, &QPushButton::clicked, this, &LibraryManager::showRecommendations);
+    buttonLayout->addWidget(relatedButton);
+
     QPushButton *refreshButton = new QPushButton("刷新");
-    connect(refreshButton, &QPushButton::clicked, [this]() { bookModel->select(); });
+    connect(refreshButton, &QPushButton::clicked, [this]() {
+        reloadModel(bookModel);
+    });
     buttonLayout->addWidget(refreshButton);
 
     buttonLayout->addStretch();
     mainLayout->addLayout(buttonLayout);
 
-    tabWidget->addTab(bookTab, "图书管理");
+    tabWidget->widget(BookTab)->layout()->addWidget(bookTab);
 }
 
 void LibraryManager::createReaderManagementTab()
@@ -280,27 +599,17 @@ void LibraryManager::createReaderManagementTab()
     searchGroup->setLayout(searchLayout);
     mainLayout->addWidget(searchGroup);
 
-    // 读者表格
+    // 读者表格，与图书表格一样读后台加载的内存表，加载完成后再调整列宽
     readerTableView = new QTableView;
-    readerModel = new QSqlTableModel(this, db);
-    readerModel->setTable("readers");
-    readerModel->setEditStrategy(QSqlTableModel::OnManualSubmit);
-    readerModel->select();
-
-    // 设置表头
-    readerModel->setHeaderData(0, Qt::Horizontal, "ID");
-    readerModel->setHeaderData(1, Qt::Horizontal, "借书证号");
-    readerModel->setHeaderData(2, Qt::Horizontal, "姓名");
-    readerModel->setHeaderData(3, Qt::Horizontal, "性别");
-    readerModel->setHeaderData(4, Qt::Horizontal, "电话");
-    readerModel->setHeaderData(5, Qt::Horizontal, "邮箱");
-    readerModel->setHeaderData(6, Qt::Horizontal, "类型");
-    readerModel->setHeaderData(7, Qt::Horizontal, "状态");
-
+    readerModel = new ColumnStoreModel(ColumnStore::readers(), this);
+    connect(readerModel, &ColumnStoreModel::loaded, [this]() {
+        ScopedTimer timer("调整列宽");
+        readerTableView->resizeColumnsToContents();
+    });
     readerTableView->setModel(readerModel);
     readerTableView->setSelectionBehavior(QAbstractItemView::SelectRows);
     readerTableView->setSelectionMode(QAbstractItemView::SingleSelection);
-    readerTableView->resizeColumnsToContents();
+    reloadModel(readerModel);
 
     mainLayout->addWidget(readerTableView);
 
@@ -320,13 +629,15 @@ void LibraryManager::createReaderManagementTab()
     buttonLayout->addWidget(deleteButton);
 
     QPushButton *refreshButton = new QPushButton("刷新");
-    connect(refreshButton, &QPushButton::clicked, [this]() { readerModel->select(); });
+    connect(refreshButton, &QPushButton::clicked, [this]() {
+        reloadModel(readerModel);
+    });
     buttonLayout->addWidget(refreshButton);
 
     buttonLayout->addStretch();
     mainLayout->addLayout(buttonLayout);
 
-    tabWidget->addTab(readerTab, "读者管理");
+    tabWidget->widget(ReaderTab)->layout()->addWidget(readerTab);
 }
 
 void LibraryManager::createBorrowReturnTab()
@@ -342,11 +653,22 @@ void LibraryManager::createBorrowReturnTab()
     QGroupBox *borrowGroup = new QGroupBox("借书");
     QFormLayout *borrowLayout = new QFormLayout;
 
+    // 扫码枪读完条码会发送回车：图书条码回车后跳到读者，读者条码回车后直接借出
     borrowBookId = new QLineEdit;
-    borrowLayout->addRow("图书ID:", borrowBookId);
+    borrowBookId->setPlaceholderText("扫描单册条码、ISBN或输入图书ID");
+    connect(borrowBookId, &QLineEdit::returnPressed, this, &LibraryManager::scanBorrowBook);
+    borrowLayout->addRow("图书:", borrowBookId);
+    borrowBookInfo = new QLabel;
+    connect(borrowBookId, &QLineEdit::textEdited, borrowBookInfo, &QLabel::clear);
+    borrowLayout->addRow("", borrowBookInfo);
 
     borrowReaderId = new QLineEdit;
-    borrowLayout->addRow("读者ID:", borrowReaderId);
+    borrowReaderId->setPlaceholderText("扫描借书证或输入读者ID");
+    connect(borrowReaderId, &QLineEdit::returnPressed, this, &LibraryManager::scanBorrowReader);
+    borrowLayout->addRow("读者:", borrowReaderId);
+    borrowReaderInfo = new QLabel;
+    connect(borrowReaderId, &QLineEdit::textEdited, borrowReaderInfo, &QLabel::clear);
+    borrowLayout->addRow("", borrowReaderInfo);
 
     borrowDays = new QSpinBox;
     borrowDays->setRange(1, 180);
@@ -357,6 +679,14 @@ void LibraryManager::createBorrowReturnTab()
     connect(borrowButton, &QPushButton::clicked, this, &LibraryManager::borrowBook);
     borrowLayout->addRow(borrowButton);
 
+    QPushButton *holdButton = new QPushButton("预约");
+    connect(holdButton, &QPushButton::clicked, this, &LibraryManager::placeHold);
+    borrowLayout->addRow(holdButton);
+
+    borrowResultLabel = new QLabel;
+    borrowResultLabel->setWordWrap(true);
+    borrowLayout->addRow(borrowResultLabel);
+
     borrowGroup->setLayout(borrowLayout);
     operationLayout->addWidget(borrowGroup);
 
@@ -365,7 +695,8 @@ void LibraryManager::createBorrowReturnTab()
     QFormLayout *returnLayout = new QFormLayout;
 
     returnRecordId = new QLineEdit;
-    returnLayout->addRow("借阅记录ID:", returnRecordId);
+    returnRecordId->setPlaceholderText("扫描单册条码或输入借阅记录ID");
+    returnLayout->addRow("借阅记录:", returnRecordId);
 
     QPushButton *returnButton = new QPushButton("还书");
     connect(returnButton, &QPushButton::clicked, this, &LibraryManager::returnBook);
@@ -383,6 +714,10 @@ void LibraryManager::createBorrowReturnTab()
     connect(overdueButton, &QPushButton::clicked, this, &LibraryManager::showOverdueList);
     operationLayout->addWidget(overdueButton);
 
+    QPushButton *holdListButton = new QPushButton("预约队列");
+    connect(holdListButton, &QPushButton::clicked, this, &LibraryManager::showHoldList);
+    operationLayout->addWidget(holdListButton);
+
     operationLayout->addStretch();
     mainLayout->addWidget(operationWidget, 1);
 
@@ -400,27 +735,25 @@ void LibraryManager::createBorrowReturnTab()
 
     borrowTableView = new QTableView;
     borrowModel = new QSqlTableModel(this, db);
-    borrowModel->setTable("borrow_records");
+    borrowModel->setTable(Schema::kBorrowRecords.name);
     borrowModel->setEditStrategy(QSqlTableModel::OnManualSubmit);
     borrowModel->setFilter("status = '借出'");
-    borrowModel->select();
+    reloadModel(borrowModel);
 
     // 设置表头
-    borrowModel->setHeaderData(0, Qt::Horizontal, "记录ID");
-    borrowModel->setHeaderData(1, Qt::Horizontal, "图书ID");
-    borrowModel->setHeaderData(2, Qt::Horizontal, "读者ID");
-    borrowModel->setHeaderData(3, Qt::Horizontal, "借书日期");
-    borrowModel->setHeaderData(4, Qt::Horizontal, "应还日期");
-    borrowModel->setHeaderData(5, Qt::Horizontal, "状态");
+    Schema::applyHeaders(borrowModel, Schema::kBorrowRecords);
 
     borrowTableView->setModel(borrowModel);
     borrowTableView->setSelectionBehavior(QAbstractItemView::SelectRows);
-    borrowTableView->resizeColumnsToContents();
+    {
+        ScopedTimer timer("调整列宽");
+        borrowTableView->resizeColumnsToContents();
+    }
 
     recordLayout->addWidget(borrowTableView);
     mainLayout->addWidget(recordWidget, 2);
 
-    tabWidget->addTab(borrowTab, "借还书管理");
+    tabWidget->widget(BorrowTab)->layout()->addWidget(borrowTab);
 }
 
 void LibraryManager::createStatisticsTab()
@@ -480,12 +813,58 @@ void LibraryManager::createStatisticsTab()
 
     mainLayout->addWidget(reportGroup);
 
-    tabWidget->addTab(statsTab, "统计报表");
+    tabWidget->widget(StatisticsTab)->layout()->addWidget(statsTab);
 
     // 初始刷新统计
     refreshStatistics();
 }
 
+void LibraryManager::createDiagnosticsTab()
+{
+    QWidget *diagnosticsTab = new QWidget;
+    QVBoxLayout *layout = new QVBoxLayout(diagnosticsTab);
+
+    cacheStatsLabel = new QLabel;
+    layout->addWidget(cacheStatsLabel);
+
+    perfTable = new QTableWidget(0, 7);
+    perfTable->setHorizontalHeaderLabels({"类型", "语句/操作", "次数", "平均(ms)", "P50(ms)", "P99(ms)", "最大(ms)"});
+    perfTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    perfTable->setSelectionBehavior(QAbstractItemView::SelectRows);
+    perfTable->verticalHeader()->hide();
+    perfTable->horizontalHeader()->setSectionResizeMode(1, QHeaderView::Stretch);
+    layout->addWidget(perfTable);
+
+    QHBoxLayout *buttonLayout = new QHBoxLayout;
+    QPushButton *refreshButton = new QPushButton("刷新");
+    connect(refreshButton, &QPushButton::clicked, this, &LibraryManager::refreshDiagnostics);
+    buttonLayout->addWidget(refreshButton);
+
+    QPushButton *resetButton = new QPushButton("清零");
+    connect(resetButton, &QPushButton::clicked, [this]() {
+        PerfMonitor::reset();
+        core.resetRecordCacheStats();
+        refreshDiagnostics();
+    });
+    buttonLayout->addWidget(resetButton);
+
+    QPushButton *exportButton = new QPushButton("导出JSON");
+    connect(exportButton, &QPushButton::clicked, this, &LibraryManager::exportDiagnostics);
+    buttonLayout->addWidget(exportButton);
+    buttonLayout->addStretch();
+    layout->addLayout(buttonLayout);
+
+    tabWidget->widget(DiagnosticsTab)->layout()->addWidget(diagnosticsTab);
+
+    // 切换到诊断页时刷新
+    connect(tabWidget, &QTabWidget::currentChanged, [this](int index) {
+        if (index == DiagnosticsTab) {
+            refreshDiagnostics();
+        }
+    });
+    refreshDiagnostics();
+}
+
 void LibraryManager::createMenuBar()
 {
     QMenu *fileMenu = menuBar()->addMenu("文件(&F)");
@@ -498,6 +877,49 @@ void LibraryManager::createMenuBar()
     connect(restoreAction, &QAction::triggered, this, &LibraryManager::restoreDatabase);
     fileMenu->addAction(restoreAction);
 
+    QAction *verifyAction = new QAction("校验备份归档", this);
+    connect(verifyAction, &QAction::triggered, this, &LibraryManager::verifyBackupArchive);
+    fileMenu->addAction(verifyAction);
+
+    fileMenu->addSeparator();
+
+    QAction *incrementalAction = new QAction("增量备份", this);
+    connect(incrementalAction, &QAction::triggered, this, &LibraryManager::incrementalBackup);
+    fileMenu->addAction(incrementalAction);
+
+    QAction *pitrAction = new QAction("按时间点恢复", this);
+    connect(pitrAction, &QAction::triggered, this, &LibraryManager::pointInTimeRestore);
+    fileMenu->addAction(pitrAction);
+
+    fileMenu->addSeparator();
+
+    QAction *archiveAction = new QAction("归档历史数据", this);
+    connect(archiveAction, &QAction::triggered, this, &LibraryManager::archiveHistory);
+    fileMenu->addAction(archiveAction);
+
+    QAction *rebuildRollupAction = new QAction("重建统计汇总", this);
+    connect(rebuildRollupAction, &QAction::triggered, [this]() {
+        // 重建要扫描全部历史，标记为待重建后交给后台连接，不占用界面线程
+        QString error;
+        if (!CirculationRollup::markStale(db, &error)) {
+            QMessageBox::warning(this, "错误", "重建统计汇总失败：" + error);
+            return;
+        }
+        rebuildStaleExtensions();
+    });
+    fileMenu->addAction(rebuildRollupAction);
+
+    QAction *rebuildCoBorrowAction = new QAction("重建借阅关联", this);
+    connect(rebuildCoBorrowAction, &QAction::triggered, [this]() {
+        QString error;
+        if (!CoBorrowIndex::markStale(db, &error)) {
+            QMessageBox::warning(this, "错误", "重建借阅关联失败：" + error);
+            return;
+        }
+        rebuildStaleExtensions();
+    });
+    fileMenu->addAction(rebuildCoBorrowAction);
+
     fileMenu->addSeparator();
 
     QAction *exitAction = new QAction("退出", this);
@@ -597,7 +1019,7 @@ void LibraryManager::addBook()
     connect(&buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
 
     if (dialog.exec() == QDialog::Accepted) {
-        QSqlQuery query;
+        TimedQuery query;
         query.prepare("INSERT INTO books (isbn, title, author, publisher, publish_date, "
                      "category, price, total_copies, available_copies, location, description) "
                      "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
@@ -615,7 +1037,8 @@ void LibraryManager::addBook()
 
         if (query.exec()) {
             QMessageBox::information(this, "成功", "图书添加成功！");
-            bookModel->select();
+            refreshModelRow(bookModel, query.lastInsertId().toInt());
+            refreshScanIndex(&scanIndex.books, query.lastInsertId().toInt());
             refreshStatistics();
         } else {
             QMessageBox::warning(this, "错误", "添加图书失败：" + query.lastError().text());
@@ -632,41 +1055,51 @@ void LibraryManager::editBook()
     }
 
     int row = selection.first().row();
-    int bookId = bookModel->data(bookModel->index(row, 0)).toInt();
+    int bookId = bookModel->data(bookModel->index(row, Schema::Books::Id)).toInt();
 
-    QSqlQuery query;
-    query.prepare("SELECT * FROM books WHERE id = ?");
+    TimedQuery query;
+    query.prepare(QString("SELECT %1 FROM books WHERE id = ?").arg(Schema::columnList(Schema::kBooks)));
     query.addBindValue(bookId);
     if (!query.exec() || !query.next()) {
         QMessageBox::warning(this, "错误", "未找到选择的图书！");
         return;
     }
+    const Schema::BookRow book = Schema::readBook(query);
+
+    // 登记了单册的图书，数量随单册的登记与借还维护，不能在这里修改
+    query.prepare("SELECT 1 FROM copies WHERE book_id = ? LIMIT 1");
+    query.addBindValue(bookId);
+    const bool hasCopies = query.exec() && query.next();
 
     QDialog dialog(this);
     dialog.setWindowTitle("编辑图书");
     QFormLayout layout(&dialog);
 
-    QLineEdit *isbnEdit = new QLineEdit(query.value("isbn").toString());
-    QLineEdit *titleEdit = new QLineEdit(query.value("title").toString());
-    QLineEdit *authorEdit = new QLineEdit(query.value("author").toString());
-    QLineEdit *publisherEdit = new QLineEdit(query.value("publisher").toString());
-    QDateEdit *publishDateEdit = new QDateEdit(query.value("publish_date").toDate());
+    QLineEdit *isbnEdit = new QLineEdit(book.isbn);
+    QLineEdit *titleEdit = new QLineEdit(book.title);
+    QLineEdit *authorEdit = new QLineEdit(book.author);
+    QLineEdit *publisherEdit = new QLineEdit(book.publisher);
+    QDateEdit *publishDateEdit = new QDateEdit(book.publishDate);
     QComboBox *categoryCombo = new QComboBox;
     categoryCombo->setEditable(true);
     categoryCombo->addItems({"编程", "文学", "科学", "历史", "艺术", "教育"});
-    categoryCombo->setCurrentText(query.value("category").toString());
+    categoryCombo->setCurrentText(book.category);
     QDoubleSpinBox *priceSpin = new QDoubleSpinBox;
     priceSpin->setRange(0, 9999);
     priceSpin->setDecimals(2);
-    priceSpin->setValue(query.value("price").toDouble());
+    priceSpin->setValue(book.price);
     QSpinBox *copiesSpin = new QSpinBox;
     copiesSpin->setRange(1, 1000);
-    copiesSpin->setValue(query.value("total_copies").toInt());
-    QLineEdit *locationEdit = new QLineEdit(query.value("location").toString());
-    QTextEdit *descEdit = new QTextEdit(query.value("description").toString());
+    copiesSpin->setValue(book.totalCopies);
+    if (hasCopies) {
+        copiesSpin->setEnabled(false);
+        copiesSpin->setToolTip("该图书已登记单册，数量请在单册管理中维护");
+    }
+    QLineEdit *locationEdit = new QLineEdit(book.location);
+    QTextEdit *descEdit = new QTextEdit(book.description);
     QComboBox *statusCombo = new QComboBox;
     statusCombo->addItems({"在库", "借出", "维护中"});
-    statusCombo->setCurrentText(query.value("status").toString());
+    statusCombo->setCurrentText(book.status);
 
     layout.addRow("ISBN:", isbnEdit);
     layout.addRow("书名:", titleEdit);
@@ -687,11 +1120,28 @@ void LibraryManager::editBook()
     connect(&buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
 
     if (dialog.exec() == QDialog::Accepted) {
-        QSqlQuery updateQuery;
-        updateQuery.prepare("UPDATE books SET isbn = ?, title = ?, author = ?, publisher = ?, "
-                          "publish_date = ?, category = ?, price = ?, total_copies = ?, "
-                          "available_copies = ?, location = ?, status = ?, description = ? "
-                          "WHERE id = ?");
+        // 可借数量 = 总数量 - 在借数量；总数量不能少于尚未归还的册数
+        TimedQuery loanQuery;
+        loanQuery.prepare("SELECT COUNT(*) FROM borrow_records WHERE book_id = ? AND status = '借出'");
+        loanQuery.addBindValue(bookId);
+        const int onLoan = loanQuery.exec() && loanQuery.next() ? loanQuery.value(0).toInt() : 0;
+        if (!hasCopies && copiesSpin->value() < onLoan) {
+            QMessageBox::warning(this, "错误", QString("该图书尚有 %1 本未归还，数量不能少于 %1！").arg(onLoan));
+            return;
+        }
+
+        // 按打开对话框时读到的版本号更新，其间被借还或被其他服务台修改过则不覆盖
+        TimedQuery updateQuery;
+        updateQuery.prepare(QString("UPDATE books SET isbn = ?, title = ?, author = ?, publisher = ?, "
+                                    "publish_date = ?, category = ?, price = ?, %1"
+                                    "location = ?, status = ?, description = ?, version = version + 1 "
+                                    "WHERE id = ? AND version = ?")
+                                .arg(hasCopies ? QString()
+                                               : QString("total_copies = ?, "
+                                                         "available_copies = ? - (SELECT COUNT(*) FROM borrow_records "
+                                                         "WHERE book_id = books.id AND status = '借出') "
+                                                         "- (SELECT COUNT(*) FROM holds WHERE book_id = books.id "
+                                                         "AND status = '待取' AND copy_id IS NULL), ")));
         updateQuery.addBindValue(isbnEdit->text());
         updateQuery.addBindValue(titleEdit->text());
         updateQuery.addBindValue(authorEdit->text());
@@ -699,18 +1149,27 @@ void LibraryManager::editBook()
         updateQuery.addBindValue(publishDateEdit->date());
         updateQuery.addBindValue(categoryCombo->currentText());
         updateQuery.addBindValue(priceSpin->value());
-        updateQuery.addBindValue(copiesSpin->value());
-        updateQuery.addBindValue(copiesSpin->value()); // 假设编辑时可用数量等于总数
+        if (!hasCopies) {
+            updateQuery.addBindValue(copiesSpin->value());
+            updateQuery.addBindValue(copiesSpin->value());
+        }
         updateQuery.addBindValue(locationEdit->text());
         updateQuery.addBindValue(statusCombo->currentText());
         updateQuery.addBindValue(descEdit->toPlainText());
         updateQuery.addBindValue(bookId);
+        updateQuery.addBindValue(book.version);
 
-        if (updateQuery.exec()) {
-            QMessageBox::information(this, "成功", "图书信息更新成功！");
-            bookModel->select();
-        } else {
+        if (!updateQuery.exec()) {
             QMessageBox::warning(this, "错误", "更新失败：" + updateQuery.lastError().text());
+        } else if (updateQuery.numRowsAffected() == 0) {
+            QMessageBox::warning(this, "错误", "编辑期间该图书已被借还或被其他服务台修改，请重新打开后再编辑！");
+            refreshModelRow(bookModel, bookId);
+            invalidateBook(bookId);
+        } else {
+            QMessageBox::information(this, "成功", "图书信息更新成功！");
+            refreshModelRow(bookModel, bookId);
+            invalidateBook(bookId);
+            refreshScanIndex(&scanIndex.books, bookId);
         }
     }
 }
@@ -724,17 +1183,17 @@ void LibraryManager::deleteBook()
     }
 
     int row = selection.first().row();
-    QString bookTitle = bookModel->data(bookModel->index(row, 2)).toString();
+    QString bookTitle = bookModel->data(bookModel->index(row, Schema::Books::Title)).toString();
 
     int result = QMessageBox::question(this, "确认删除",
         QString("确定要删除图书《%1》吗？").arg(bookTitle),
         QMessageBox::Yes | QMessageBox::No);
 
     if (result == QMessageBox::Yes) {
-        int bookId = bookModel->data(bookModel->index(row, 0)).toInt();
+        int bookId = bookModel->data(bookModel->index(row, Schema::Books::Id)).toInt();
 
         // 检查图书是否被借出
-        QSqlQuery checkQuery;
+        TimedQuery checkQuery;
         checkQuery.prepare("SELECT COUNT(*) FROM borrow_records WHERE book_id = ? AND status = '借出'");
         checkQuery.addBindValue(bookId);
         if (checkQuery.exec() && checkQuery.next() && checkQuery.value(0).toInt() > 0) {
@@ -742,72 +1201,286 @@ void LibraryManager::deleteBook()
             return;
         }
 
-        QSqlQuery deleteQuery;
+        // 图书与它登记的单册一起删除
+        if (!db.transaction()) {
+            QMessageBox::warning(this, "错误", "删除失败：" + db.lastError().text());
+            return;
+        }
+        bool journalTransaction = false;
+        QSqlError journalError;
+        if (!ChangeJournal::beginTransaction(db, &journalTransaction, &journalError)) {
+            db.rollback();
+            QMessageBox::warning(this, "错误", "删除失败：" + journalError.text());
+            return;
+        }
+
+        // 排队中或待取的预约指向这本书，删除后过期、顺延预约时会处理不存在的图书。
+        // 在删除的事务中检查，其间不会有新的预约
+        TimedQuery holdQuery;
+        holdQuery.prepare("SELECT COUNT(*) FROM holds WHERE book_id = ? AND status IN ('等待', '待取')");
+        holdQuery.addBindValue(bookId);
+        if (!holdQuery.exec() || !holdQuery.next() || holdQuery.value(0).toInt() > 0) {
+            const QString error = holdQuery.lastError().isValid() ? "删除失败：" + holdQuery.lastError().text()
+                                                                  : QString("该图书还有未完成的预约，请先取消预约再删除！");
+            db.rollback();
+            QMessageBox::warning(this, "错误", error);
+            return;
+        }
+
+        TimedQuery copiesQuery;
+        copiesQuery.prepare("DELETE FROM copies WHERE book_id = ?");
+        copiesQuery.addBindValue(bookId);
+        TimedQuery deleteQuery;
         deleteQuery.prepare("DELETE FROM books WHERE id = ?");
         deleteQuery.addBindValue(bookId);
 
-        if (deleteQuery.exec()) {
+        if (copiesQuery.exec() && deleteQuery.exec()
+            && (!journalTransaction || ChangeJournal::endTransaction(db)) && db.commit()) {
             QMessageBox::information(this, "成功", "图书删除成功！");
-            bookModel->select();
+            refreshModelRow(bookModel, bookId);
+            invalidateBook(bookId);
+            refreshScanIndex(&scanIndex.books, bookId);
+            if (copiesQuery.numRowsAffected() > 0) {
+                warmScanIndex();
+            }
             refreshStatistics();
         } else {
-            QMessageBox::warning(this, "错误", "删除失败：" + deleteQuery.lastError().text());
+            const QString error = copiesQuery.lastError().isValid() ? copiesQuery.lastError().text()
+                                                                    : deleteQuery.lastError().text();
+            db.rollback();
+            QMessageBox::warning(this, "错误", "删除失败：" + error);
         }
     }
 }
 
-void LibraryManager::searchBooks()
+void LibraryManager::manageCopies()
 {
-    QStringList filters;
-
-    if (!bookIdFilter->text().isEmpty()) {
-        filters.append(QString("id = %1").arg(bookIdFilter->text()));
-    }
-    if (!bookTitleFilter->text().isEmpty()) {
-        filters.append(QString("title LIKE '%%1%'").arg(bookTitleFilter->text()));
-    }
-    if (!bookAuthorFilter->text().isEmpty()) {
-        filters.append(QString("author LIKE '%%1%'").arg(bookAuthorFilter->text()));
-    }
-    if (!bookIsbnFilter->text().isEmpty()) {
-        filters.append(QString("isbn LIKE '%%1%'").arg(bookIsbnFilter->text()));
-    }
-    if (bookCategoryFilter->currentText() != "所有分类") {
-        filters.append(QString("category = '%1'").arg(bookCategoryFilter->currentText()));
-    }
-    if (bookStatusFilter->currentText() != "所有状态") {
-        filters.append(QString("status = '%1'").arg(bookStatusFilter->currentText()));
+    QModelIndexList selection = bookTableView->selectionModel()->selectedRows();
+    if (selection.isEmpty()) {
+        QMessageBox::warning(this, "警告", "请选择要管理单册的图书！");
+        return;
     }
 
-    QString filter = filters.join(" AND ");
-    bookModel->setFilter(filter);
-    bookModel->select();
+    int row = selection.first().row();
+    int bookId = bookModel->data(bookModel->index(row, Schema::Books::Id)).toInt();
+    QString bookTitle = bookModel->data(bookModel->index(row, Schema::Books::Title)).toString();
+    QString bookLocation = bookModel->data(bookModel->index(row, Schema::Books::Location)).toString();
 
-    statusBar()->showMessage(QString("找到 %1 本图书").arg(bookModel->rowCount()), 3000);
-}
+    QDialog dialog(this);
+    dialog.setWindowTitle(QString("单册管理 - 《%1》").arg(bookTitle));
+    dialog.resize(640, 420);
+    QVBoxLayout layout(&dialog);
+
+    QLabel *hint = new QLabel("登记单册后按单册条码借还，图书的总数量与可借数量按单册统计。");
+    hint->setWordWrap(true);
+    layout.addWidget(hint);
+
+    // 按 book_id 过滤走 idx_copies_book_state 索引
+    QSqlTableModel *copyModel = new QSqlTableModel(&dialog, db);
+    copyModel->setTable(Schema::kCopies.name);
+    copyModel->setFilter(QString("book_id = %1").arg(bookId));
+    copyModel->setSort(Schema::Copies::Id, Qt::AscendingOrder);
+    copyModel->select();
+    Schema::applyHeaders(copyModel, Schema::kCopies);
+
+    QTableView *copyView = new QTableView;
+    copyView->setModel(copyModel);
+    copyView->setSelectionBehavior(QAbstractItemView::SelectRows);
+    copyView->setSelectionMode(QAbstractItemView::SingleSelection);
+    copyView->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    copyView->hideColumn(Schema::Copies::BookId);
+    copyView->hideColumn(Schema::Copies::Version);
+    copyView->resizeColumnsToContents();
+    layout.addWidget(copyView);
+
+    QFormLayout *form = new QFormLayout;
+    QLineEdit *barcodeEdit = new QLineEdit;
+    barcodeEdit->setPlaceholderText("扫描或输入新单册的条码");
+    form->addRow("条码:", barcodeEdit);
+    QLineEdit *locationEdit = new QLineEdit(bookLocation);
+    form->addRow("位置:", locationEdit);
+    QComboBox *stateCombo = new QComboBox;
+    stateCombo->addItems({"在架", "维护中", "遗失"});
+    form->addRow("状态:", stateCombo);
+    layout.addLayout(form);
 
-void LibraryManager::clearBookSearch()
-{
-    bookIdFilter->clear();
-    bookTitleFilter->clear();
-    bookAuthorFilter->clear();
-    bookIsbnFilter->clear();
-    bookCategoryFilter->setCurrentIndex(0);
-    bookStatusFilter->setCurrentIndex(0);
+    QHBoxLayout *buttonLayout = new QHBoxLayout;
+    QPushButton *addButton = new QPushButton("登记单册");
+    QPushButton *updateButton = new QPushButton("修改所选");
+    QPushButton *removeButton = new QPushButton("删除所选");
+    QPushButton *closeButton = new QPushButton("关闭");
+    // 条码框里的回车只用于登记，不触发对话框的默认按钮
+    for (QPushButton *button : {addButton, updateButton, removeButton, closeButton}) {
+        button->setAutoDefault(false);
+    }
+    buttonLayout->addWidget(addButton);
+    buttonLayout->addWidget(updateButton);
+    buttonLayout->addWidget(removeButton);
+    buttonLayout->addStretch();
+    buttonLayout->addWidget(closeButton);
+    layout.addLayout(buttonLayout);
 
-    bookModel->setFilter("");
-    bookModel->select();
-}
+    auto selectedCopy = [copyView, copyModel]() -> int {
+        QModelIndexList rows = copyView->selectionModel()->selectedRows();
+        return rows.isEmpty() ? 0 : copyModel->data(copyModel->index(rows.first().row(), Schema::Copies::Id)).toInt();
+    };
 
-// 读者管理槽函数
-void LibraryManager::addReader()
-{
-    QDialog dialog(this);
-    dialog.setWindowTitle("添加读者");
-    dialog.setFixedWidth(400);
-    QFormLayout layout(&dialog);
+    // 每次改动后刷新列表、图书行与扫码索引，并通知借还书服务图书数量已变
+    auto copiesChanged = [this, bookId, copyModel](int copyId) {
+        copyModel->select();
+        refreshModelRow(bookModel, bookId);
+        invalidateBook(bookId);
+        refreshScanIndex(&scanIndex.copies, copyId);
+    };
 
-    QLineEdit *cardEdit = new QLineEdit;
+    connect(copyView->selectionModel(), &QItemSelectionModel::selectionChanged, &dialog,
+            [copyView, copyModel, locationEdit, stateCombo]() {
+        QModelIndexList rows = copyView->selectionModel()->selectedRows();
+        if (rows.isEmpty()) {
+            return;
+        }
+        const int row = rows.first().row();
+        locationEdit->setText(copyModel->data(copyModel->index(row, Schema::Copies::Location)).toString());
+        stateCombo->setCurrentText(copyModel->data(copyModel->index(row, Schema::Copies::State)).toString());
+    });
+
+    // 扫码枪回车即登记，连续扫描一摞新书
+    auto addCopy = [this, &dialog, bookId, barcodeEdit, locationEdit, copiesChanged]() {
+        try {
+            const int copyId = core.addCopy(bookId, barcodeEdit->text(), locationEdit->text());
+            copiesChanged(copyId);
+            barcodeEdit->clear();
+        } catch (const QString &error) {
+            QMessageBox::warning(&dialog, "登记失败", error);
+            barcodeEdit->selectAll();
+        }
+        barcodeEdit->setFocus();
+    };
+    connect(barcodeEdit, &QLineEdit::returnPressed, &dialog, addCopy);
+    connect(addButton, &QPushButton::clicked, &dialog, addCopy);
+
+    connect(updateButton, &QPushButton::clicked, &dialog,
+            [this, &dialog, selectedCopy, locationEdit, stateCombo, copiesChanged]() {
+        const int copyId = selectedCopy();
+        if (copyId <= 0) {
+            QMessageBox::warning(&dialog, "警告", "请选择要修改的单册！");
+            return;
+        }
+        try {
+            core.updateCopy(copyId, locationEdit->text(), stateCombo->currentText());
+            copiesChanged(copyId);
+        } catch (const QString &error) {
+            QMessageBox::warning(&dialog, "修改失败", error);
+        }
+    });
+
+    connect(removeButton, &QPushButton::clicked, &dialog, [this, &dialog, selectedCopy, copiesChanged]() {
+        const int copyId = selectedCopy();
+        if (copyId <= 0) {
+            QMessageBox::warning(&dialog, "警告", "请选择要删除的单册！");
+            return;
+        }
+        if (QMessageBox::question(&dialog, "确认删除", "确定要删除所选单册吗？",
+                                  QMessageBox::Yes | QMessageBox::No) != QMessageBox::Yes) {
+            return;
+        }
+        try {
+            core.removeCopy(copyId);
+            copiesChanged(copyId);
+        } catch (const QString &error) {
+            QMessageBox::warning(&dialog, "删除失败", error);
+        }
+    });
+
+    connect(closeButton, &QPushButton::clicked, &dialog, &QDialog::accept);
+    barcodeEdit->setFocus();
+    dialog.exec();
+}
+
+void LibraryManager::searchBooks()
+{
+    LibraryCore::BookSearch search;
+    search.id = bookIdFilter->text();
+    search.title = bookTitleFilter->text();
+    search.author = bookAuthorFilter->text();
+    search.isbn = bookIsbnFilter->text();
+    if (bookCategoryFilter->currentText() != "所有分类") {
+        search.category = bookCategoryFilter->currentText();
+    }
+    if (bookStatusFilter->currentText() != "所有状态") {
+        search.status = bookStatusFilter->currentText();
+    }
+
+    {
+        ScopedTimer timer("搜索图书");
+        bookModel->setFilter(ColumnStore::bookConditions(search));
+    }
+
+    statusBar()->showMessage(QString("找到 %1 本图书").arg(bookModel->rowCount()), 3000);
+}
+
+void LibraryManager::clearBookSearch()
+{
+    bookIdFilter->clear();
+    bookTitleFilter->clear();
+    bookAuthorFilter->clear();
+    bookIsbnFilter->clear();
+    bookCategoryFilter->setCurrentIndex(0);
+    bookStatusFilter->setCurrentIndex(0);
+
+    bookModel->setFilter(QVector<ColumnStore::Condition>());
+}
+
+void LibraryManager::showBookCatalog()
+{
+    {
+        ScopedTimer timer("调整列宽");
+        // 版本号只用于并发修改检查，不显示
+        bookTableView->setColumnHidden(Schema::Books::Version, true);
+        bookTableView->resizeColumnsToContents();
+    }
+    const ColumnStore &catalog = bookModel->store();
+    statusBar()->showMessage(QString("图书目录已加载：%1 本，内存约 %2 MB，文本匹配使用 %3")
+                                 .arg(catalog.rowCount())
+                                 .arg(catalog.memoryBytes() / (1024.0 * 1024.0), 0, 'f', 1)
+                                 .arg(TextScan::implementation()), 3000);
+}
+
+void LibraryManager::showRecommendations()
+{
+    QModelIndexList selection = bookTableView->selectionModel()->selectedRows();
+    if (selection.isEmpty()) {
+        QMessageBox::warning(this, "警告", "请选择要查看推荐的图书！");
+        return;
+    }
+
+    int row = selection.first().row();
+    int bookId = bookModel->data(bookModel->index(row, Schema::Books::Id)).toInt();
+    QString bookTitle = bookModel->data(bookModel->index(row, Schema::Books::Title)).toString();
+
+    const QVector<CoBorrowIndex::Recommendation> related = CoBorrowIndex::recommend(db, bookId, 10);
+    if (related.isEmpty()) {
+        QMessageBox::information(this, "相关推荐", QString("《%1》暂无借阅关联。").arg(bookTitle));
+        return;
+    }
+
+    QString message = QString("借过《%1》的读者也借了：\n").arg(bookTitle);
+    int rank = 1;
+    for (const CoBorrowIndex::Recommendation &recommendation : related) {
+        message += QString("\n%1. %2 (%3人)").arg(rank++).arg(recommendation.title).arg(recommendation.together);
+    }
+    QMessageBox::information(this, "相关推荐", message);
+}
+
+// 读者管理槽函数
+void LibraryManager::addReader()
+{
+    QDialog dialog(this);
+    dialog.setWindowTitle("添加读者");
+    dialog.setFixedWidth(400);
+    QFormLayout layout(&dialog);
+
+    QLineEdit *cardEdit = new QLineEdit;
     QLineEdit *nameEdit = new QLineEdit;
     QComboBox *genderCombo = new QComboBox;
     genderCombo->addItems({"男", "女"});
@@ -848,7 +1521,7 @@ void LibraryManager::addReader()
     connect(&buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
 
     if (dialog.exec() == QDialog::Accepted) {
-        QSqlQuery query;
+        TimedQuery query;
         query.prepare("INSERT INTO readers (card_number, name, gender, birth_date, phone, "
                      "email, address, reader_type, max_borrow, max_days, expiry_date, notes) "
                      "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
@@ -867,7 +1540,8 @@ void LibraryManager::addReader()
 
         if (query.exec()) {
             QMessageBox::information(this, "成功", "读者添加成功！");
-            readerModel->select();
+            refreshModelRow(readerModel, query.lastInsertId().toInt());
+            refreshScanIndex(&scanIndex.readers, query.lastInsertId().toInt());
             refreshStatistics();
         } else {
             QMessageBox::warning(this, "错误", "添加读者失败：" + query.lastError().text());
@@ -884,46 +1558,47 @@ void LibraryManager::editReader()
     }
 
     int row = selection.first().row();
-    int readerId = readerModel->data(readerModel->index(row, 0)).toInt();
+    int readerId = readerModel->data(readerModel->index(row, Schema::Readers::Id)).toInt();
 
-    QSqlQuery query;
-    query.prepare("SELECT * FROM readers WHERE id = ?");
+    TimedQuery query;
+    query.prepare(QString("SELECT %1 FROM readers WHERE id = ?").arg(Schema::columnList(Schema::kReaders)));
     query.addBindValue(readerId);
     if (!query.exec() || !query.next()) {
         QMessageBox::warning(this, "错误", "未找到选择的读者！");
         return;
     }
+    const Schema::ReaderRow reader = Schema::readReader(query);
 
     QDialog dialog(this);
     dialog.setWindowTitle("编辑读者");
     dialog.setFixedWidth(400);
     QFormLayout layout(&dialog);
 
-    QLineEdit *cardEdit = new QLineEdit(query.value("card_number").toString());
-    QLineEdit *nameEdit = new QLineEdit(query.value("name").toString());
+    QLineEdit *cardEdit = new QLineEdit(reader.cardNumber);
+    QLineEdit *nameEdit = new QLineEdit(reader.name);
     QComboBox *genderCombo = new QComboBox;
     genderCombo->addItems({"男", "女"});
-    genderCombo->setCurrentText(query.value("gender").toString());
-    QDateEdit *birthDateEdit = new QDateEdit(query.value("birth_date").toDate());
+    genderCombo->setCurrentText(reader.gender);
+    QDateEdit *birthDateEdit = new QDateEdit(reader.birthDate);
     birthDateEdit->setCalendarPopup(true);
-    QLineEdit *phoneEdit = new QLineEdit(query.value("phone").toString());
-    QLineEdit *emailEdit = new QLineEdit(query.value("email").toString());
-    QLineEdit *addressEdit = new QLineEdit(query.value("address").toString());
+    QLineEdit *phoneEdit = new QLineEdit(reader.phone);
+    QLineEdit *emailEdit = new QLineEdit(reader.email);
+    QLineEdit *addressEdit = new QLineEdit(reader.address);
     QComboBox *typeCombo = new QComboBox;
     typeCombo->addItems({"普通读者", "学生", "教师", "VIP"});
-    typeCombo->setCurrentText(query.value("reader_type").toString());
+    typeCombo->setCurrentText(reader.readerType);
     QSpinBox *maxBorrowSpin = new QSpinBox;
     maxBorrowSpin->setRange(1, 20);
-    maxBorrowSpin->setValue(query.value("max_borrow").toInt());
+    maxBorrowSpin->setValue(reader.maxBorrow);
     QSpinBox *maxDaysSpin = new QSpinBox;
     maxDaysSpin->setRange(7, 180);
-    maxDaysSpin->setValue(query.value("max_days").toInt());
+    maxDaysSpin->setValue(reader.maxDays);
     QComboBox *statusCombo = new QComboBox;
     statusCombo->addItems({"正常", "挂失", "停用"});
-    statusCombo->setCurrentText(query.value("status").toString());
-    QDateEdit *expiryDateEdit = new QDateEdit(query.value("expiry_date").toDate());
+    statusCombo->setCurrentText(reader.status);
+    QDateEdit *expiryDateEdit = new QDateEdit(reader.expiryDate);
     expiryDateEdit->setCalendarPopup(true);
-    QTextEdit *notesEdit = new QTextEdit(query.value("notes").toString());
+    QTextEdit *notesEdit = new QTextEdit(reader.notes);
 
     layout.addRow("借书证号:", cardEdit);
     layout.addRow("姓名:", nameEdit);
@@ -946,7 +1621,7 @@ void LibraryManager::editReader()
     connect(&buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
 
     if (dialog.exec() == QDialog::Accepted) {
-        QSqlQuery updateQuery;
+        TimedQuery updateQuery;
         updateQuery.prepare("UPDATE readers SET card_number = ?, name = ?, gender = ?, "
                           "birth_date = ?, phone = ?, email = ?, address = ?, reader_type = ?, "
                           "max_borrow = ?, max_days = ?, status = ?, expiry_date = ?, notes = ? "
@@ -968,7 +1643,9 @@ void LibraryManager::editReader()
 
         if (updateQuery.exec()) {
             QMessageBox::information(this, "成功", "读者信息更新成功！");
-            readerModel->select();
+            refreshModelRow(readerModel, readerId);
+            invalidateReader(readerId);
+            refreshScanIndex(&scanIndex.readers, readerId);
         } else {
             QMessageBox::warning(this, "错误", "更新失败：" + updateQuery.lastError().text());
         }
@@ -984,17 +1661,17 @@ void LibraryManager::deleteReader()
     }
 
     int row = selection.first().row();
-    QString readerName = readerModel->data(readerModel->index(row, 2)).toString();
+    QString readerName = readerModel->data(readerModel->index(row, Schema::Readers::Name)).toString();
 
     int result = QMessageBox::question(this, "确认删除",
         QString("确定要删除读者【%1】吗？").arg(readerName),
         QMessageBox::Yes | QMessageBox::No);
 
     if (result == QMessageBox::Yes) {
-        int readerId = readerModel->data(readerModel->index(row, 0)).toInt();
+        int readerId = readerModel->data(readerModel->index(row, Schema::Readers::Id)).toInt();
 
         // 检查读者是否有未归还的图书
-        QSqlQuery checkQuery;
+        TimedQuery checkQuery;
         checkQuery.prepare("SELECT COUNT(*) FROM borrow_records WHERE reader_id = ? AND status = '借出'");
         checkQuery.addBindValue(readerId);
         if (checkQuery.exec() && checkQuery.next() && checkQuery.value(0).toInt() > 0) {
@@ -1002,13 +1679,15 @@ void LibraryManager::deleteReader()
             return;
         }
 
-        QSqlQuery deleteQuery;
+        TimedQuery deleteQuery;
         deleteQuery.prepare("DELETE FROM readers WHERE id = ?");
         deleteQuery.addBindValue(readerId);
 
         if (deleteQuery.exec()) {
             QMessageBox::information(this, "成功", "读者删除成功！");
-            readerModel->select();
+            refreshModelRow(readerModel, readerId);
+            invalidateReader(readerId);
+            refreshScanIndex(&scanIndex.readers, readerId);
             refreshStatistics();
         } else {
             QMessageBox::warning(this, "错误", "删除失败：" + deleteQuery.lastError().text());
@@ -1018,24 +1697,18 @@ void LibraryManager::deleteReader()
 
 void LibraryManager::searchReaders()
 {
-    QStringList filters;
-
-    if (!readerIdFilter->text().isEmpty()) {
-        filters.append(QString("id = %1").arg(readerIdFilter->text()));
-    }
-    if (!readerNameFilter->text().isEmpty()) {
-        filters.append(QString("name LIKE '%%1%'").arg(readerNameFilter->text()));
-    }
-    if (!readerPhoneFilter->text().isEmpty()) {
-        filters.append(QString("phone LIKE '%%1%'").arg(readerPhoneFilter->text()));
-    }
+    LibraryCore::ReaderSearch search;
+    search.id = readerIdFilter->text();
+    search.name = readerNameFilter->text();
+    search.phone = readerPhoneFilter->text();
     if (readerTypeFilter->currentText() != "所有类型") {
-        filters.append(QString("reader_type = '%1'").arg(readerTypeFilter->currentText()));
+        search.readerType = readerTypeFilter->currentText();
     }
 
-    QString filter = filters.join(" AND ");
-    readerModel->setFilter(filter);
-    readerModel->select();
+    {
+        ScopedTimer timer("搜索读者");
+        readerModel->setFilter(ColumnStore::readerConditions(search));
+    }
 
     statusBar()->showMessage(QString("找到 %1 位读者").arg(readerModel->rowCount()), 3000);
 }
@@ -1047,230 +1720,180 @@ void LibraryManager::clearReaderSearch()
     readerPhoneFilter->clear();
     readerTypeFilter->setCurrentIndex(0);
 
-    readerModel->setFilter("");
-    readerModel->select();
+    readerModel->setFilter(QVector<ColumnStore::Condition>());
 }
 
 // 借还书管理槽函数
 void LibraryManager::borrowBook()
 {
-    QString bookId = borrowBookId->text().trimmed();
-    QString readerId = borrowReaderId->text().trimmed();
-
-    if (bookId.isEmpty() || readerId.isEmpty()) {
-        QMessageBox::warning(this, "错误", "请填写图书ID和读者ID！");
+    // 从工具栏触发时借还书页可能还没有创建
+    ensureTab(BorrowTab);
+    if (!borrowBookId) {
         return;
     }
 
-    QSqlDatabase::database().transaction();
-
-    try {
-        // 检查图书是否存在且可借
-        QSqlQuery bookQuery;
-        bookQuery.prepare("SELECT id, title, available_copies FROM books WHERE id = ?");
-        bookQuery.addBindValue(bookId.toInt());
-        if (!bookQuery.exec() || !bookQuery.next()) {
-            throw QString("图书ID不存在！");
-        }
-
-        int availableCopies = bookQuery.value("available_copies").toInt();
-        if (availableCopies <= 0) {
-            throw QString("该图书已全部借出！");
-        }
-
-        QString bookTitle = bookQuery.value("title").toString();
+    QString bookCode = borrowBookId->text().trimmed();
+    QString readerCode = borrowReaderId->text().trimmed();
 
-        // 检查读者是否存在且可借
-        QSqlQuery readerQuery;
-        readerQuery.prepare("SELECT id, name, max_borrow, status FROM readers WHERE id = ?");
-        readerQuery.addBindValue(readerId.toInt());
-        if (!readerQuery.exec() || !readerQuery.next()) {
-            throw QString("读者ID不存在！");
-        }
+    if (bookCode.isEmpty() || readerCode.isEmpty()) {
+        QMessageBox::warning(this, "错误", "请填写图书和读者！");
+        return;
+    }
 
-        if (readerQuery.value("status").toString() != "正常") {
-            throw QString("该读者状态异常，无法借书！");
-        }
+    // 输入框中可以是单册条码、ISBN / 借书证号，也可以是 ID
+    int bookId = 0;
+    int copyId = 0;
+    if (!resolveBorrowItem(bookCode, &bookId, &copyId)) {
+        QMessageBox::warning(this, "借书失败", "未找到图书：" + bookCode);
+        return;
+    }
+    int readerId = resolveScan(scanIndex.readers, readerCode);
+    if (readerId < 0) {
+        QMessageBox::warning(this, "借书失败", "未找到读者：" + readerCode);
+        return;
+    }
 
-        QString readerName = readerQuery.value("name").toString();
-        int maxBorrow = readerQuery.value("max_borrow").toInt();
+    LibraryCore::BorrowResult result;
+    QString error;
+    if (!checkout(bookId, copyId, readerId, &result, &error)) {
+        QMessageBox::warning(this, "借书失败", error);
+        return;
+    }
 
-        // 检查读者当前借书数量
-        QSqlQuery countQuery;
-        countQuery.prepare("SELECT COUNT(*) FROM borrow_records WHERE reader_id = ? AND status = '借出'");
-        countQuery.addBindValue(readerId.toInt());
-        if (countQuery.exec() && countQuery.next() && countQuery.value(0).toInt() >= maxBorrow) {
-            throw QString("该读者已达到最大借书数量限制！");
-        }
+    QString message = QString("借书成功！\n图书：%1\n读者：%2\n应还日期：%3")
+                      .arg(result.bookTitle)
+                      .arg(result.readerName)
+                      .arg(result.dueDate.toString("yyyy-MM-dd"));
+    if (!result.copyBarcode.isEmpty()) {
+        message += "\n单册条码：" + result.copyBarcode;
+    }
+    QMessageBox::information(this, "成功", message);
+}
 
-        // 检查是否已借过同一本书
-        QSqlQuery duplicateQuery;
-        duplicateQuery.prepare("SELECT COUNT(*) FROM borrow_records WHERE book_id = ? AND reader_id = ? AND status = '借出'");
-        duplicateQuery.addBindValue(bookId.toInt());
-        duplicateQuery.addBindValue(readerId.toInt());
-        if (duplicateQuery.exec() && duplicateQuery.next() && duplicateQuery.value(0).toInt() > 0) {
-            throw QString("该读者已借阅此书，请勿重复借阅！");
-        }
+void LibraryManager::scanBorrowBook()
+{
+    ScopedTimer timer("扫码-图书");
+    int bookId = 0;
+    int copyId = 0;
+    if (!resolveBorrowItem(borrowBookId->text(), &bookId, &copyId)) {
+        borrowBookInfo->setText("<font color='red'>未找到该图书</font>");
+        borrowBookId->selectAll();
+        return;
+    }
+    borrowBookInfo->setText(copyId >= 0 ? QString("单册 %1").arg(borrowBookId->text().trimmed().toHtmlEscaped())
+                                        : scanLabel(bookModel, bookId, Schema::Books::Title));
+    borrowReaderId->setFocus();
+    borrowReaderId->selectAll();
+}
 
-        // 获取最长借期
-        QSqlQuery maxDaysQuery;
-        maxDaysQuery.prepare("SELECT max_days FROM readers WHERE id = ?");
-        maxDaysQuery.addBindValue(readerId.toInt());
-        int maxDays = 30; // 默认30天
-        if (maxDaysQuery.exec() && maxDaysQuery.next()) {
-            maxDays = maxDaysQuery.value(0).toInt();
-        }
+void LibraryManager::scanBorrowReader()
+{
+    // 连续扫码借书时结果显示在借书区下方，不弹对话框打断下一次扫描
+    ScopedTimer timer("扫码借书");
+    int readerId = resolveScan(scanIndex.readers, borrowReaderId->text());
+    if (readerId < 0) {
+        borrowReaderInfo->setText("<font color='red'>未找到该读者</font>");
+        borrowReaderId->selectAll();
+        return;
+    }
+    borrowReaderInfo->setText(scanLabel(readerModel, readerId, Schema::Readers::Name));
 
-        int borrowDays = this->borrowDays->value();
-        if (borrowDays > maxDays) {
-            borrowDays = maxDays;
-        }
+    int bookId = 0;
+    int copyId = 0;
+    if (!resolveBorrowItem(borrowBookId->text(), &bookId, &copyId)) {
+        borrowBookId->setFocus();
+        borrowBookId->selectAll();
+        return;
+    }
 
-        QDate borrowDate = QDate::currentDate();
-        QDate dueDate = borrowDate.addDays(borrowDays);
+    LibraryCore::BorrowResult result;
+    QString error;
+    if (!checkout(bookId, copyId, readerId, &result, &error)) {
+        borrowResultLabel->setText(QString("<font color='red'>借书失败：%1</font>").arg(error.toHtmlEscaped()));
+        borrowBookId->setFocus();
+        borrowBookId->selectAll();
+        return;
+    }
 
-        // 插入借阅记录
-        QSqlQuery borrowQuery;
-        borrowQuery.prepare("INSERT INTO borrow_records (book_id, reader_id, borrow_date, due_date) "
-                          "VALUES (?, ?, ?, ?)");
-        borrowQuery.addBindValue(bookId.toInt());
-        borrowQuery.addBindValue(readerId.toInt());
-        borrowQuery.addBindValue(borrowDate);
-        borrowQuery.addBindValue(dueDate);
+    borrowResultLabel->setText(QString("借书成功：《%1》 → %2，应还日期 %3")
+                                   .arg(result.bookTitle)
+                                   .arg(result.readerName)
+                                   .arg(result.dueDate.toString("yyyy-MM-dd")));
+    borrowBookInfo->clear();
+    borrowReaderInfo->clear();
+    borrowBookId->setFocus();
+}
 
-        if (!borrowQuery.exec()) {
-            throw QString("借阅记录创建失败：" + borrowQuery.lastError().text());
+bool LibraryManager::checkout(int bookId, int copyId, int readerId, LibraryCore::BorrowResult *result, QString *error)
+{
+    // copyId 不小于 0 时借指定的单册
+    try {
+        if (copyId >= 0) {
+            *result = circulationClient ? circulationClient->borrowCopy(copyId, readerId, borrowDays->value())
+                                        : core.borrowCopy(copyId, readerId, borrowDays->value());
+        } else {
+            *result = circulationClient ? circulationClient->borrowBook(bookId, readerId, borrowDays->value())
+                                        : core.borrowBook(bookId, readerId, borrowDays->value());
         }
+    } catch (const QString &message) {
+        *error = message;
+        return false;
+    }
 
-        // 更新图书可用数量
-        QSqlQuery updateBookQuery;
-        updateBookQuery.prepare("UPDATE books SET available_copies = available_copies - 1 WHERE id = ?");
-        updateBookQuery.addBindValue(bookId.toInt());
+    // 清空输入框
+    borrowBookId->clear();
+    borrowReaderId->clear();
 
-        if (!updateBookQuery.exec()) {
-            throw QString("更新图书信息失败：" + updateBookQuery.lastError().text());
+    // 刷新显示
+    {
+        ScopedTimer timer("借还后刷新");
+        refreshModelRow(bookModel, result->bookId);
+        {
+            ScopedTimer timer("刷新借阅记录");
+            reloadModel(borrowModel);
         }
-
-        // 记录历史
-        QSqlQuery historyQuery;
-        historyQuery.prepare("INSERT INTO borrow_history (book_id, reader_id, action, details) "
-                           "VALUES (?, ?, ?, ?)");
-        historyQuery.addBindValue(bookId.toInt());
-        historyQuery.addBindValue(readerId.toInt());
-        historyQuery.addBindValue("借出");
-        historyQuery.addBindValue(QString("借阅《%1》，应还日期：%2").arg(bookTitle).arg(dueDate.toString("yyyy-MM-dd")));
-
-        historyQuery.exec();
-
-        QSqlDatabase::database().commit();
-
-        QMessageBox::information(this, "成功",
-            QString("借书成功！\n图书：%1\n读者：%2\n应还日期：%3")
-                .arg(bookTitle)
-                .arg(readerName)
-                .arg(dueDate.toString("yyyy-MM-dd")));
-
-        // 清空输入框
-        borrowBookId->clear();
-        borrowReaderId->clear();
-
-        // 刷新显示
-        bookModel->select();
-        borrowModel->select();
         refreshStatistics();
-
-    } catch (const QString &error) {
-        QSqlDatabase::database().rollback();
-        QMessageBox::warning(this, "借书失败", error);
     }
+    return true;
 }
 
 void LibraryManager::returnBook()
 {
-    QString recordId = returnRecordId->text().trimmed();
-
-    if (recordId.isEmpty()) {
-        QMessageBox::warning(this, "错误", "请输入借阅记录ID！");
+    // 从工具栏触发时借还书页可能还没有创建
+    ensureTab(BorrowTab);
+    if (!borrowBookId) {
         return;
     }
 
-    QSqlDatabase::database().transaction();
-
-    try {
-        // 检查借阅记录
-        QSqlQuery borrowQuery;
-        borrowQuery.prepare("SELECT br.*, b.title, r.name FROM borrow_records br "
-                          "JOIN books b ON br.book_id = b.id "
-                          "JOIN readers r ON br.reader_id = r.id "
-                          "WHERE br.id = ? AND br.status = '借出'");
-        borrowQuery.addBindValue(recordId.toInt());
-
-        if (!borrowQuery.exec() || !borrowQuery.next()) {
-            throw QString("无效的借阅记录ID或图书已归还！");
-        }
-
-        int bookId = borrowQuery.value("book_id").toInt();
-        QDate dueDate = borrowQuery.value("due_date").toDate();
-        QDate returnDate = QDate::currentDate();
-
-        // 计算逾期天数和费用
-        int overdueDays = 0;
-        double overdueFee = 0.0;
-
-        if (returnDate > dueDate) {
-            overdueDays = dueDate.daysTo(returnDate);
-            overdueFee = overdueDays * 0.5; // 每天0.5元逾期费
-        }
-
-        // 更新借阅记录
-        QSqlQuery updateBorrowQuery;
-        updateBorrowQuery.prepare("UPDATE borrow_records SET return_date = ?, status = '已还', "
-                              "overdue_fee = ? WHERE id = ?");
-        updateBorrowQuery.addBindValue(returnDate);
-        updateBorrowQuery.addBindValue(overdueFee);
-        updateBorrowQuery.addBindValue(recordId.toInt());
-
-        if (!updateBorrowQuery.exec()) {
-            throw QString("更新借阅记录失败！");
-        }
-
-        // 更新图书可用数量
-        QSqlQuery updateBookQuery;
-        updateBookQuery.prepare("UPDATE books SET available_copies = available_copies + 1 WHERE id = ?");
-        updateBookQuery.addBindValue(bookId);
+    QString scanned = returnRecordId->text().trimmed();
 
-        if (!updateBookQuery.exec()) {
-            throw QString("更新图书信息失败！");
-        }
-
-        // 记录历史
-        QString bookTitle = borrowQuery.value("title").toString();
-        QString readerName = borrowQuery.value("name").toString();
-
-        QSqlQuery historyQuery;
-        historyQuery.prepare("INSERT INTO borrow_history (book_id, reader_id, action, details) "
-                           "VALUES (?, ?, ?, ?)");
-        historyQuery.addBindValue(bookId);
-        historyQuery.addBindValue(borrowQuery.value("reader_id").toInt());
-        historyQuery.addBindValue("归还");
-        QString details = QString("归还《%1》").arg(bookTitle);
-        if (overdueDays > 0) {
-            details += QString("，逾期%1天，费用：%2元").arg(overdueDays).arg(overdueFee, 0, 'f', 2);
-        }
-        historyQuery.addBindValue(details);
+    if (scanned.isEmpty()) {
+        QMessageBox::warning(this, "错误", "请输入借阅记录ID或扫描单册条码！");
+        return;
+    }
 
-        historyQuery.exec();
+    // 输入框中可以是借阅记录ID，也可以是所借单册的条码
+    const int recordId = resolveRecord(scanned);
 
-        QSqlDatabase::database().commit();
+    try {
+        LibraryCore::ReturnResult result = circulationClient ? circulationClient->returnBook(recordId)
+                                                             : core.returnBook(recordId);
 
         QString message = QString("还书成功！\n图书：%1\n读者：%2")
-                          .arg(bookTitle)
-                          .arg(readerName);
+                          .arg(result.bookTitle)
+                          .arg(result.readerName);
 
-        if (overdueDays > 0) {
+        if (result.overdueDays > 0) {
             message += QString("\n逾期%1天，需支付费用：%2元")
-                      .arg(overdueDays)
-                      .arg(overdueFee, 0, 'f', 2);
+                      .arg(result.overdueDays)
+                      .arg(result.overdueFee, 0, 'f', 2);
+        }
+
+        // 归还的这一册已分给排队的预约，不上架，放到预约书架
+        if (result.holdId > 0) {
+            message += QString("\n\n该书已为预约读者 %1 保留至 %2，请放到预约书架！")
+                      .arg(result.holdReaderName)
+                      .arg(result.pickupDeadline.toString("yyyy-MM-dd"));
         }
 
         QMessageBox::information(this, "成功", message);
@@ -1279,276 +1902,306 @@ void LibraryManager::returnBook()
         returnRecordId->clear();
 
         // 刷新显示
-        bookModel->select();
-        borrowModel->select();
-        refreshStatistics();
+        {
+            ScopedTimer timer("借还后刷新");
+            refreshModelRow(bookModel, result.bookId);
+            {
+                ScopedTimer timer("刷新借阅记录");
+                reloadModel(borrowModel);
+            }
+            refreshStatistics();
+        }
 
     } catch (const QString &error) {
-        QSqlDatabase::database().rollback();
         QMessageBox::warning(this, "还书失败", error);
     }
 }
 
 void LibraryManager::renewBook()
 {
-    QString recordId = returnRecordId->text().trimmed();
-
-    if (recordId.isEmpty()) {
-        QMessageBox::warning(this, "错误", "请输入借阅记录ID！");
+    // 从工具栏触发时借还书页可能还没有创建
+    ensureTab(BorrowTab);
+    if (!borrowBookId) {
         return;
     }
 
-    QSqlDatabase::database().transaction();
-
-    try {
-        // 检查借阅记录
-        QSqlQuery borrowQuery;
-        borrowQuery.prepare("SELECT br.*, b.title, r.name, r.max_days FROM borrow_records br "
-                          "JOIN books b ON br.book_id = b.id "
-                          "JOIN readers r ON br.reader_id = r.id "
-                          "WHERE br.id = ? AND br.status = '借出'");
-        borrowQuery.addBindValue(recordId.toInt());
-
-        if (!borrowQuery.exec() || !borrowQuery.next()) {
-            throw QString("无效的借阅记录ID或图书已归还！");
-        }
-
-        int renewCount = borrowQuery.value("renew_count").toInt();
-        if (renewCount >= 2) { // 最多续借2次
-            throw QString("该书已续借2次，无法再次续借！");
-        }
-
-        QDate currentDueDate = borrowQuery.value("due_date").toDate();
-        int maxDays = borrowQuery.value("max_days").toInt();
-        QDate newDueDate = QDate::currentDate().addDays(maxDays);
-
-        if (newDueDate <= currentDueDate) {
-            throw QString("续借后日期必须晚于当前应还日期！");
-        }
-
-        // 更新借阅记录
-        QSqlQuery updateQuery;
-        updateQuery.prepare("UPDATE borrow_records SET due_date = ?, renew_count = renew_count + 1 WHERE id = ?");
-        updateQuery.addBindValue(newDueDate);
-        updateQuery.addBindValue(recordId.toInt());
+    QString scanned = returnRecordId->text().trimmed();
 
-        if (!updateQuery.exec()) {
-            throw QString("续借失败！");
-        }
-
-        // 记录历史
-        QString bookTitle = borrowQuery.value("title").toString();
-        QString readerName = borrowQuery.value("name").toString();
-
-        QSqlQuery historyQuery;
-        historyQuery.prepare("INSERT INTO borrow_history (book_id, reader_id, action, details) "
-                           "VALUES (?, ?, ?, ?)");
-        historyQuery.addBindValue(borrowQuery.value("book_id").toInt());
-        historyQuery.addBindValue(borrowQuery.value("reader_id").toInt());
-        historyQuery.addBindValue("续借");
-        historyQuery.addBindValue(QString("续借《%1》至%2").arg(bookTitle).arg(newDueDate.toString("yyyy-MM-dd")));
+    if (scanned.isEmpty()) {
+        QMessageBox::warning(this, "错误", "请输入借阅记录ID或扫描单册条码！");
+        return;
+    }
 
-        historyQuery.exec();
+    // 输入框中可以是借阅记录ID，也可以是所借单册的条码
+    const int recordId = resolveRecord(scanned);
 
-        QSqlDatabase::database().commit();
+    try {
+        LibraryCore::RenewResult result = circulationClient ? circulationClient->renewBook(recordId)
+                                                           : core.renewBook(recordId);
 
         QMessageBox::information(this, "成功",
             QString("续借成功！\n图书：%1\n读者：%2\n新应还日期：%3")
-                .arg(bookTitle)
-                .arg(readerName)
-                .arg(newDueDate.toString("yyyy-MM-dd")));
+                .arg(result.bookTitle)
+                .arg(result.readerName)
+                .arg(result.newDueDate.toString("yyyy-MM-dd")));
 
         // 清空输入框
         returnRecordId->clear();
 
         // 刷新显示
-        borrowModel->select();
+        reloadModel(borrowModel);
 
     } catch (const QString &error) {
-        QSqlDatabase::database().rollback();
         QMessageBox::warning(this, "续借失败", error);
     }
 }
 
-// 统计功能
-void LibraryManager::refreshStatistics()
+void LibraryManager::placeHold()
 {
-    QSqlQuery query;
+    QString bookCode = borrowBookId->text().trimmed();
+    QString readerCode = borrowReaderId->text().trimmed();
 
-    // 总图书数量
-    query.exec("SELECT COUNT(*) FROM books");
-    if (query.next()) {
-        totalBooksLabel->setText(QString("总计: %1 本").arg(query.value(0).toInt()));
+    if (bookCode.isEmpty() || readerCode.isEmpty()) {
+        QMessageBox::warning(this, "错误", "请填写要预约的图书和读者！");
+        return;
     }
 
-    // 总读者数量
-    query.exec("SELECT COUNT(*) FROM readers");
-    if (query.next()) {
-        totalReadersLabel->setText(QString("读者: %1 人").arg(query.value(0).toInt()));
+    // 预约按书目排队，扫描的是单册条码时取它所属的图书
+    int bookId = 0;
+    int copyId = 0;
+    if (!resolveBorrowItem(bookCode, &bookId, &copyId)) {
+        QMessageBox::warning(this, "预约失败", "未找到图书：" + bookCode);
+        return;
     }
-
-    // 已借出图书数量
-    query.exec("SELECT COUNT(*) FROM borrow_records WHERE status = '借出'");
-    if (query.next()) {
-        borrowedBooksLabel->setText(QString("已借: %1 本").arg(query.value(0).toInt()));
+    if (copyId >= 0) {
+        TimedQuery query(db);
+        query.prepare("SELECT book_id FROM copies WHERE id = ?");
+        query.addBindValue(copyId);
+        bookId = (query.exec() && query.next()) ? query.value(0).toInt() : 0;
     }
-
-    // 逾期图书数量
-    query.exec("SELECT COUNT(*) FROM borrow_records WHERE status = '借出' AND due_date < date('now')");
-    if (query.next()) {
-        overdueBooksLabel->setText(QString("逾期: %1 本").arg(query.value(0).toInt()));
+    int readerId = resolveScan(scanIndex.readers, readerCode);
+    if (readerId < 0) {
+        QMessageBox::warning(this, "预约失败", "未找到读者：" + readerCode);
+        return;
     }
 
-    // 热门分类
-    query.exec("SELECT category, COUNT(*) as count FROM books GROUP BY category ORDER BY count DESC LIMIT 1");
-    if (query.next()) {
-        popularCategoryLabel->setText(QString("热门分类: %1").arg(query.value(0).toString()));
-    }
+    try {
+        LibraryCore::HoldResult result = circulationClient ? circulationClient->placeHold(bookId, readerId)
+                                                           : core.placeHold(bookId, readerId);
+        QMessageBox::information(this, "成功",
+            QString("预约成功！\n图书：%1\n读者：%2\n当前排在第 %3 位，到书后将通知读者。")
+                .arg(result.bookTitle)
+                .arg(result.readerName)
+                .arg(result.position));
 
-    // 活跃读者（最近30天有借书记录的）
-    query.exec("SELECT COUNT(DISTINCT reader_id) FROM borrow_records "
-               "WHERE borrow_date >= date('now', '-30 days')");
-    if (query.next()) {
-        activeReadersLabel->setText(QString("活跃读者: %1 人").arg(query.value(0).toInt()));
+        borrowBookId->clear();
+        borrowReaderId->clear();
+        borrowBookInfo->clear();
+        borrowReaderInfo->clear();
+    } catch (const QString &error) {
+        QMessageBox::warning(this, "预约失败", error);
     }
 }
 
-void LibraryManager::generateReport()
+void LibraryManager::showHoldList()
 {
-    QString report = "===== 图书馆统计报告 =====\n";
-    report += "生成时间: " + QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss") + "\n\n";
+    QDialog dialog(this);
+    dialog.setWindowTitle("预约队列");
+    dialog.resize(720, 400);
 
-    QSqlQuery query;
+    QVBoxLayout *layout = new QVBoxLayout(&dialog);
 
-    // 图书统计
-    report += "1. 图书统计\n";
-    report += "----------\n";
+    QTableView *holdView = new QTableView;
+    QSqlQueryModel *holdModel = new QSqlQueryModel(&dialog);
+
+    // 待取的排在前面，同一图书按出队顺序（优先级、预约先后）排列，列与表头见 Schema::kHoldListColumns
+    const QString queryStr = QString(
+        "SELECT %1 "
+        "FROM holds h "
+        "JOIN books b ON h.book_id = b.id "
+        "JOIN readers r ON h.reader_id = r.id "
+        "LEFT JOIN copies c ON h.copy_id = c.id "
+        "WHERE h.status IN ('等待', '待取') "
+        "ORDER BY h.status = '等待', h.pickup_deadline, h.book_id, h.priority DESC, h.id"
+    ).arg(Schema::columnList(Schema::kHoldListColumns, Schema::HoldList::ColumnCount));
+
+    auto reload = [this, holdModel, holdView, queryStr]() {
+        holdModel->setQuery(queryStr, db);
+        Schema::applyHeaders(holdModel, Schema::kHoldListColumns, Schema::HoldList::ColumnCount);
+        holdView->resizeColumnsToContents();
+    };
 
-    query.exec("SELECT COUNT(*) as total, "
-               "SUM(CASE WHEN status = '在库' THEN 1 ELSE 0 END) as available, "
-               "SUM(CASE WHEN status = '借出' THEN 1 ELSE 0 END) as borrowed, "
-               "SUM(CASE WHEN status = '维护中' THEN 1 ELSE 0 END) as maintenance "
-               "FROM books");
-    if (query.next()) {
-        report += QString("图书总数: %1 本\n").arg(query.value("total").toInt());
-        report += QString("在库图书: %1 本\n").arg(query.value("available").toInt());
-        report += QString("借出图书: %1 本\n").arg(query.value("borrowed").toInt());
-        report += QString("维护中图书: %1 本\n").arg(query.value("maintenance").toInt());
-    }
+    holdView->setModel(holdModel);
+    holdView->setSelectionBehavior(QAbstractItemView::SelectRows);
+    holdView->setSelectionMode(QAbstractItemView::SingleSelection);
+    holdView->setAlternatingRowColors(true);
+    reload();
+    layout->addWidget(holdView);
 
-    // 读者统计
-    report += "\n2. 读者统计\n";
-    report += "----------\n";
+    QHBoxLayout *buttonLayout = new QHBoxLayout;
 
-    query.exec("SELECT COUNT(*) as total, "
-               "reader_type, COUNT(*) as count "
-               "FROM readers GROUP BY reader_type");
-    while (query.next()) {
-        report += QString("%1: %2 人\n").arg(query.value("reader_type").toString())
-                                       .arg(query.value("count").toInt());
-    }
+    QPushButton *cancelButton = new QPushButton("取消预约");
+    connect(cancelButton, &QPushButton::clicked, &dialog, [this, &dialog, holdView, holdModel, reload]() {
+        QModelIndexList selection = holdView->selectionModel()->selectedRows();
+        if (selection.isEmpty()) {
+            QMessageBox::warning(&dialog, "警告", "请选择要取消的预约！");
+            return;
+        }
+        const int row = selection.first().row();
+        const int holdId = holdModel->data(holdModel->index(row, Schema::HoldList::HoldId)).toInt();
+        if (QMessageBox::question(&dialog, "确认取消", "确定要取消所选预约吗？已保留的书将顺延给下一位预约。",
+                                  QMessageBox::Yes | QMessageBox::No) != QMessageBox::Yes) {
+            return;
+        }
+        try {
+            if (circulationClient) {
+                circulationClient->cancelHold(holdId);
+            } else {
+                core.cancelHold(holdId);
+            }
+            reload();
+            reloadModel(bookModel);
+        } catch (const QString &error) {
+            QMessageBox::warning(&dialog, "取消失败", error);
+        }
+    });
+    buttonLayout->addWidget(cancelButton);
+
+    // 通常由命令行工具 expire-holds 定时执行，这里供手动处理
+    QPushButton *expireButton = new QPushButton("处理过期预约");
+    connect(expireButton, &QPushButton::clicked, &dialog, [this, &dialog, reload]() {
+        try {
+            const int expired = circulationClient ? circulationClient->expireHolds() : core.expireHolds();
+            reload();
+            reloadModel(bookModel);
+            QMessageBox::information(&dialog, "完成", QString("已过期的预约：%1 条").arg(expired));
+        } catch (const QString &error) {
+            QMessageBox::warning(&dialog, "处理失败", error);
+        }
+    });
+    buttonLayout->addWidget(expireButton);
 
-    // 借阅统计
-    report += "\n3. 借阅统计\n";
-    report += "----------\n";
+    buttonLayout->addStretch();
 
-    query.exec("SELECT COUNT(*) as total_borrows FROM borrow_records");
-    if (query.next()) {
-        report += QString("总借阅次数: %1 次\n").arg(query.value("total_borrows").toInt());
+    QPushButton *closeButton = new QPushButton("关闭");
+    connect(closeButton, &QPushButton::clicked, &dialog, &QDialog::accept);
+    buttonLayout->addWidget(closeButton);
+
+    layout->addLayout(buttonLayout);
+    dialog.exec();
+}
+
+// 统计功能
+void LibraryManager::refreshStatistics()
+{
+    // 统计页尚未创建时无处显示
+    if (!totalBooksLabel || !db.isOpen()) {
+        return;
     }
 
-    query.exec("SELECT COUNT(*) as current_borrows FROM borrow_records WHERE status = '借出'");
-    if (query.next()) {
-        report += QString("当前借出: %1 本\n").arg(query.value("current_borrows").toInt());
+    // 统计查询要扫描整张借阅表，放到后台线程；查询期间再次请求的合并为一次
+    if (statisticsWatcher->isRunning()) {
+        statisticsPending = true;
+        return;
     }
+    statisticsWatcher->setFuture(LibraryCore::runReadOnly<LibraryCore::Statistics>(db.databaseName(),
+        [](const LibraryCore &reader) { return reader.statistics(); }));
+}
 
-    query.exec("SELECT COUNT(*) as overdue FROM borrow_records "
-               "WHERE status = '借出' AND due_date < date('now')");
-    if (query.next()) {
-        report += QString("逾期未还: %1 本\n").arg(query.value("overdue").toInt());
+void LibraryManager::showStatistics()
+{
+    LibraryCore::Statistics stats = statisticsWatcher->result();
+
+    totalBooksLabel->setText(QString("总计: %1 本").arg(stats.totalBooks));
+    totalReadersLabel->setText(QString("读者: %1 人").arg(stats.totalReaders));
+    borrowedBooksLabel->setText(QString("已借: %1 本").arg(stats.borrowedBooks));
+    overdueBooksLabel->setText(QString("逾期: %1 本").arg(stats.overdueBooks));
+    if (!stats.popularCategory.isNull()) {
+        popularCategoryLabel->setText(QString("热门分类: %1").arg(stats.popularCategory));
     }
+    activeReadersLabel->setText(QString("活跃读者: %1 人").arg(stats.activeReaders));
 
-    // 热门图书
-    report += "\n4. 热门图书（借阅次数前5）\n";
-    report += "-------------------------\n";
+    if (statisticsPending) {
+        statisticsPending = false;
+        refreshStatistics();
+    }
+}
 
-    query.exec("SELECT b.title, COUNT(br.id) as borrow_count "
-               "FROM borrow_records br "
-               "JOIN books b ON br.book_id = b.id "
-               "GROUP BY b.id ORDER BY borrow_count DESC LIMIT 5");
-    int rank = 1;
-    while (query.next()) {
-        report += QString("%1. %2 (借阅%3次)\n")
-            .arg(rank++)
-            .arg(query.value("title").toString())
-            .arg(query.value("borrow_count").toInt());
-    }
-
-    // 活跃读者
-    report += "\n5. 活跃读者（借阅次数前5）\n";
-    report += "-------------------------\n";
-
-    query.exec("SELECT r.name, COUNT(br.id) as borrow_count "
-               "FROM borrow_records br "
-               "JOIN readers r ON br.reader_id = r.id "
-               "GROUP BY r.id ORDER BY borrow_count DESC LIMIT 5");
-    rank = 1;
-    while (query.next()) {
-        report += QString("%1. %2 (借阅%3次)\n")
-            .arg(rank++)
-            .arg(query.value("name").toString())
-            .arg(query.value("borrow_count").toInt());
-    }
-
-    // 逾期列表
-    report += "\n6. 逾期未还图书\n";
-    report += "--------------\n";
-
-    query.exec("SELECT br.id, b.title, r.name, br.due_date, "
-               "julianday('now') - julianday(br.due_date) as overdue_days "
-               "FROM borrow_records br "
-               "JOIN books b ON br.book_id = b.id "
-               "JOIN readers r ON br.reader_id = r.id "
-               "WHERE br.status = '借出' AND br.due_date < date('now') "
-               "ORDER BY br.due_date");
-
-    bool hasOverdue = false;
-    while (query.next()) {
-        hasOverdue = true;
-        report += QString("图书: %1, 读者: %2, 应还日期: %3, 逾期天数: %4\n")
-            .arg(query.value("title").toString())
-            .arg(query.value("name").toString())
-            .arg(query.value("due_date").toDate().toString("yyyy-MM-dd"))
-            .arg(query.value("overdue_days").toInt());
-    }
-
-    if (!hasOverdue) {
-        report += "无逾期记录\n";
-    }
-
-    reportTextEdit->setPlainText(report);
+void LibraryManager::generateReport()
+{
+    reportTextEdit->setPlainText(core.generateReport());
     statusBar()->showMessage("报告生成完成", 3000);
 }
 
-// 逾期提醒功能
-void LibraryManager::checkOverdueBooks()
+// 性能诊断
+void LibraryManager::refreshDiagnostics()
 {
-    QSqlQuery query;
-    query.exec("SELECT COUNT(*) as count FROM borrow_records "
-               "WHERE status = '借出' AND due_date = date('now')");
+    QList<PerfMonitor::Entry> entries = PerfMonitor::snapshot();
+
+    perfTable->setSortingEnabled(false);
+    perfTable->setRowCount(entries.size());
+    for (int row = 0; row < entries.size(); ++row) {
+        const PerfMonitor::Entry &entry = entries.at(row);
+        auto number = [](double value) -> QTableWidgetItem * {
+            QTableWidgetItem *item = new QTableWidgetItem;
+            item->setData(Qt::DisplayRole, value);
+            item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+            return item;
+        };
+        perfTable->setItem(row, 0, new QTableWidgetItem(entry.kind == PerfMonitor::Sql ? "SQL" : "操作"));
+        perfTable->setItem(row, 1, new QTableWidgetItem(QString::fromUtf8(entry.shape)));
+        perfTable->setItem(row, 2, number(static_cast<double>(entry.count)));
+        perfTable->setItem(row, 3, number(qRound(entry.meanUs) / 1000.0));
+        perfTable->setItem(row, 4, number(qRound(entry.p50Us) / 1000.0));
+        perfTable->setItem(row, 5, number(qRound(entry.p99Us) / 1000.0));
+        perfTable->setItem(row, 6, number(qRound(entry.maxUs) / 1000.0));
+    }
+    perfTable->setSortingEnabled(true);
 
-    int dueToday = 0;
-    if (query.next()) {
-        dueToday = query.value("count").toInt();
+    auto cacheText = [](const QString &name, quint64 hits, quint64 misses, int size, int capacity) {
+        quint64 total = hits + misses;
+        return QString("%1 %2/%3 条，命中 %4，未命中 %5，命中率 %6%")
+            .arg(name).arg(size).arg(capacity).arg(hits).arg(misses)
+            .arg(total ? 100.0 * hits / total : 0.0, 0, 'f', 1);
+    };
+    const auto books = core.bookCacheStats();
+    const auto readers = core.readerCacheStats();
+    cacheStatsLabel->setText("记录缓存：" + cacheText("图书", books.hits, books.misses, books.size, books.capacity)
+                             + "；" + cacheText("读者", readers.hits, readers.misses, readers.size, readers.capacity));
+}
+
+void LibraryManager::exportDiagnostics()
+{
+    QString fileName = QFileDialog::getSaveFileName(this, "导出性能数据",
+        QString("perf_%1.json").arg(QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss")),
+        "JSON 文件 (*.json)");
+    if (fileName.isEmpty()) {
+        return;
     }
 
-    query.exec("SELECT COUNT(*) as count FROM borrow_records "
-               "WHERE status = '借出' AND due_date < date('now')");
+    QString error;
+    if (PerfMonitor::writeJson(fileName, &error)) {
+        statusBar()->showMessage("性能数据已导出到 " + fileName, 3000);
+    } else {
+        QMessageBox::warning(this, "导出失败", error);
+    }
+}
 
-    int overdue = 0;
-    if (query.next()) {
-        overdue = query.value("count").toInt();
+// 逾期提醒功能
+void LibraryManager::checkOverdueBooks()
+{
+    if (!db.isOpen() || overdueWatcher->isRunning()) {
+        return;
     }
+    overdueWatcher->setFuture(LibraryCore::runReadOnly<LibraryCore::OverdueSummary>(db.databaseName(),
+        [](const LibraryCore &reader) { return reader.overdueSummary(); }));
+}
+
+void LibraryManager::showOverdueSummary()
+{
+    LibraryCore::OverdueSummary summary = overdueWatcher->result();
+    int dueToday = summary.dueToday;
+    int overdue = summary.overdue;
 
     if (dueToday > 0 || overdue > 0) {
         QString message;
@@ -1582,29 +2235,24 @@ void LibraryManager::showOverdueList()
     QTableView *overdueView = new QTableView;
     QSqlQueryModel *overdueModel = new QSqlQueryModel(this);  // 使用 QSqlQueryModel
 
-    // 创建包含详细信息的视图
+    // 创建包含详细信息的视图，列与表头见 Schema::kOverdueListColumns
     QString queryStr = QString(
-        "SELECT br.id as '记录ID', "
-        "b.title as '图书名称', "
-        "r.name as '读者姓名', "
-        "br.borrow_date as '借书日期', "
-        "br.due_date as '应还日期', "
-        "julianday('now') - julianday(br.due_date) as '逾期天数', "
-        "r.phone as '读者电话' "
+        "SELECT %1 "
         "FROM borrow_records br "
         "JOIN books b ON br.book_id = b.id "
         "JOIN readers r ON br.reader_id = r.id "
         "WHERE br.status = '借出' AND br.due_date < date('now') "
         "ORDER BY br.due_date ASC"
-    );
+    ).arg(Schema::columnList(Schema::kOverdueListColumns, Schema::OverdueList::ColumnCount));
 
     overdueModel->setQuery(queryStr, db);  // 添加数据库连接参数
-
-    // 注意：QSqlQueryModel 的表头是自动设置的，但您可能需要手动设置
-    // 由于我们使用了列别名，SQL会使用这些别名作为表头
+    Schema::applyHeaders(overdueModel, Schema::kOverdueListColumns, Schema::OverdueList::ColumnCount);
 
     overdueView->setModel(overdueModel);
-    overdueView->resizeColumnsToContents();
+    {
+        ScopedTimer timer("调整列宽");
+        overdueView->resizeColumnsToContents();
+    }
     overdueView->setSelectionBehavior(QAbstractItemView::SelectRows);
     overdueView->setAlternatingRowColors(true);
 
@@ -1620,8 +2268,7 @@ void LibraryManager::showOverdueList()
         {
             QStyledItemDelegate::initStyleOption(option, index);
 
-            // 第5列是逾期天数（从0开始计数）
-            if (index.column() == 5) {
+            if (index.column() == Schema::OverdueList::OverdueDays) {
                 bool ok;
                 int days = index.data().toInt(&ok);
                 if (ok && days > 0) {
@@ -1634,7 +2281,7 @@ void LibraryManager::showOverdueList()
 
     // 应用委托
     OverdueDelegate *delegate = new OverdueDelegate(overdueView);
-    overdueView->setItemDelegateForColumn(5, delegate);
+    overdueView->setItemDelegateForColumn(Schema::OverdueList::OverdueDays, delegate);
 
     layout->addWidget(overdueView);
 
@@ -1650,9 +2297,9 @@ void LibraryManager::showOverdueList()
         }
 
         int row = selection.first().row();
-        int recordId = overdueView->model()->data(overdueView->model()->index(row, 0)).toInt();
+        int recordId = overdueView->model()->data(overdueView->model()->index(row, Schema::OverdueList::RecordId)).toInt();
 
-        QSqlQuery query;
+        TimedQuery query;
         query.prepare("SELECT r.phone, r.email, r.name, b.title, br.due_date, "
                      "julianday('now') - julianday(br.due_date) as overdue_days "
                      "FROM borrow_records br "
@@ -1682,15 +2329,7 @@ void LibraryManager::showOverdueList()
                 .arg(email.isEmpty() ? "无" : email));
 
             // 记录提醒历史
-            QSqlQuery historyQuery;
-            historyQuery.prepare("INSERT INTO borrow_history (book_id, reader_id, action, details) "
-                               "VALUES ((SELECT book_id FROM borrow_records WHERE id = ?), "
-                               "(SELECT reader_id FROM borrow_records WHERE id = ?), "
-                               "'逾期提醒', ?)");
-            historyQuery.addBindValue(recordId);
-            historyQuery.addBindValue(recordId);
-            historyQuery.addBindValue(reminder);
-            historyQuery.exec();
+            core.logReminder(recordId, dueDate, overdueDays);
 
             statusBar()->showMessage("提醒发送完成", 3000);
         }
@@ -1767,7 +2406,7 @@ void LibraryManager::showOverdueList()
                     QModelIndex index = overdueView->model()->index(row, col);
                     QString data = overdueView->model()->data(index).toString();
                     // 逾期天数用红色显示
-                    if (col == 5 && overdueView->model()->data(index).toInt() > 0) {
+                    if (col == Schema::OverdueList::OverdueDays && overdueView->model()->data(index).toInt() > 0) {
                         html += QString("<td style='color:red;'>%1</td>").arg(data);
                     } else {
                         html += "<td>" + data + "</td>";
@@ -1797,60 +2436,459 @@ void LibraryManager::showOverdueList()
 // 数据库备份与恢复
 void LibraryManager::backupDatabase()
 {
+    if (backupThread) {
+        QMessageBox::information(this, "提示", "已有备份正在进行中，请稍候。");
+        return;
+    }
+
+    const QString archiveFilter = "压缩备份归档 (*.lmba)";
+    QString selectedFilter;
     QString fileName = QFileDialog::getSaveFileName(this, "备份数据库",
                                                    "library_backup_" + QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss"),
-                                                   "SQLite数据库文件 (*.db);;所有文件 (*.*)");
+                                                   "SQLite数据库文件 (*.db);;" + archiveFilter + ";;所有文件 (*.*)",
+                                                   &selectedFilter);
     if (fileName.isEmpty()) return;
 
-    if (db.isOpen()) {
-        db.close();
+    bool compressed = selectedFilter == archiveFilter || fileName.endsWith(".lmba", Qt::CaseInsensitive);
+    if (compressed && !fileName.endsWith(".lmba", Qt::CaseInsensitive)) {
+        fileName += ".lmba";
     }
 
-    if (QFile::copy("library.db", fileName)) {
-        QMessageBox::information(this, "成功", "数据库备份成功！");
+    startOnlineBackup(fileName, compressed, [this](bool ok, const QString &message) {
+        if (ok) {
+            statusBar()->showMessage(message, 5000);
+            QMessageBox::information(this, "成功", message);
+        } else {
+            QMessageBox::warning(this, "错误", message);
+        }
+    });
+}
+
+bool LibraryManager::startOnlineBackup(const QString &fileName, bool compressed,
+                                       const std::function<void(bool, const QString &)> &onFinished)
+{
+    if (backupThread) {
+        return false;
+    }
+
+    // 在后台线程中分批复制数据页，数据库保持打开，借还书不受影响
+    QThread *thread = new QThread(this);
+    OnlineBackupWorker *worker = new OnlineBackupWorker(db.databaseName(), fileName);
+    worker->setCompressed(compressed);
+    worker->moveToThread(thread);
+    backupThread = thread;
+    backupWorker = worker;
+
+    QProgressDialog *progressDialog = new QProgressDialog("正在备份数据库...", "取消", 0, 100, this);
+    progressDialog->setWindowModality(Qt::NonModal);
+    progressDialog->setAttribute(Qt::WA_DeleteOnClose);
+    progressDialog->setMinimumDuration(500);
+    progressDialog->setAutoClose(false);
+    progressDialog->setAutoReset(false);
+
+    connect(thread, &QThread::started, worker, &OnlineBackupWorker::run);
+    connect(progressDialog, &QProgressDialog::canceled, worker, [worker]() { worker->cancel(); },
+            Qt::DirectConnection);
+    connect(worker, &OnlineBackupWorker::stageChanged, progressDialog, &QProgressDialog::setLabelText);
+    connect(worker, &OnlineBackupWorker::progress, progressDialog, [progressDialog](int copied, int total) {
+        progressDialog->setMaximum(qMax(total, 1));
+        progressDialog->setValue(copied);
+    });
+    connect(worker, &OnlineBackupWorker::finished, this, [progressDialog, onFinished](bool ok, const QString &message) {
+        progressDialog->close();
+        onFinished(ok, message);
+    });
+    connect(worker, &OnlineBackupWorker::finished, thread, &QThread::quit);
+    connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+    connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+
+    thread->start(QThread::LowPriority);
+    statusBar()->showMessage("正在后台备份数据库...");
+    return true;
+}
+
+// 在线程池中执行 job 生成替换用的数据库文件，期间显示进度并挡住主窗口的操作；
+// job 返回失败说明（成功时为空），可以通过传入的回调报告已完成数与总数。
+// 完成后在界面线程中调用 onFinished，由它检查并替换数据库
+void LibraryManager::runRestoreJob(const QString &label,
+                                   const std::function<QString(const std::function<void(int, int)> &)> &job,
+                                   const std::function<void(const QString &)> &onFinished)
+{
+    QProgressDialog *progressDialog = new QProgressDialog(label, QString(), 0, 0, this);
+    progressDialog->setWindowModality(Qt::WindowModal);
+    progressDialog->setAttribute(Qt::WA_DeleteOnClose);
+    progressDialog->setMinimumDuration(0);
+    progressDialog->setAutoClose(false);
+    progressDialog->setAutoReset(false);
+    progressDialog->show();
+
+    // 对话框在 job 结束之后才关闭，回调排队发给它时它一定还在
+    const auto progress = [progressDialog](int done, int total) {
+        QMetaObject::invokeMethod(progressDialog, "setMaximum", Qt::QueuedConnection, Q_ARG(int, qMax(total, 1)));
+        QMetaObject::invokeMethod(progressDialog, "setValue", Qt::QueuedConnection, Q_ARG(int, done));
+    };
+
+    QFutureWatcher<QString> *watcher = new QFutureWatcher<QString>(this);
+    restoreWatcher = watcher;
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, progressDialog, onFinished]() {
+        progressDialog->close();
+        restoreWatcher = nullptr;
+        watcher->deleteLater();
+        onFinished(watcher->result());
+    });
+    watcher->setFuture(QtConcurrent::run([job, progress]() -> QString {
+        return job(progress);
+    }));
+}
+
+void LibraryManager::incrementalBackup()
+{
+    QSettings settings;
+    QString dir = QFileDialog::getExistingDirectory(this, "选择增量备份目录",
+                                                    settings.value("backup/incrementalDir").toString());
+    if (dir.isEmpty()) return;
+
+    // 记住目录，之后每小时自动导出
+    settings.setValue("backup/incrementalDir", dir);
+    runIncrementalBackup(dir, true);
+}
+
+void LibraryManager::runIncrementalBackup(const QString &dir, bool interactive)
+{
+    if (backupThread) {
+        if (interactive) {
+            QMessageBox::information(this, "提示", "已有备份正在进行中，请稍候。");
+        }
+        return;
+    }
+
+    QString enableError;
+    if (!ChangeJournal::enable(db, &enableError)) {
+        if (interactive) {
+            QMessageBox::warning(this, "错误", "变更日志启用失败：" + enableError);
+        }
+        return;
+    }
+
+    // 首次备份、出现断档或快照过旧时先做一次基础快照，之后只导出变更日志
+    if (ChangeJournal::needsBaseSnapshot(db, dir)) {
+        QDateTime startedAt = QDateTime::currentDateTime();
+        QString snapshotPath = QDir(dir).filePath("base_pending.db");
+        startOnlineBackup(snapshotPath, false, [this, dir, snapshotPath, startedAt, interactive](bool ok, const QString &message) {
+            QString error = message;
+            if (ok && ChangeJournal::registerBaseSnapshot(db, dir, snapshotPath, startedAt, &error)) {
+                statusBar()->showMessage("基础快照已完成", 5000);
+                if (interactive) {
+                    QMessageBox::information(this, "成功", "已生成新的基础快照，之后的备份只记录变更。");
+                }
+            } else if (interactive) {
+                QMessageBox::warning(this, "错误", "基础快照失败：" + error);
+            } else {
+                statusBar()->showMessage("基础快照失败：" + error, 10000);
+            }
+        });
+        return;
+    }
+
+    ChangeJournal::BackupStats stats;
+    QString error;
+    if (ChangeJournal::exportSegment(db, dir, &stats, &error)) {
+        QString message = QString("增量备份完成：%1 条变更，%2 字节").arg(stats.entries).arg(stats.bytes);
+        statusBar()->showMessage(message, 5000);
+        if (interactive) {
+            QMessageBox::information(this, "成功", message);
+        }
+    } else if (interactive) {
+        QMessageBox::warning(this, "错误", "增量备份失败：" + error);
     } else {
-        QMessageBox::warning(this, "错误", "数据库备份失败！");
+        statusBar()->showMessage("增量备份失败：" + error, 10000);
     }
+}
 
-    // 重新打开数据库
-    db.open();
-    bookModel->select();
-    readerModel->select();
-    borrowModel->select();
+void LibraryManager::pointInTimeRestore()
+{
+    // 借还书服务还持有数据库，服务台不能替换它的数据文件
+    if (circulationClient) {
+        QMessageBox::warning(this, "警告", "已连接借还书服务，请在服务器上停止服务后再恢复数据库。");
+        return;
+    }
+    if (!canReplaceDatabase()) {
+        return;
+    }
+
+    QSettings settings;
+    QString dir = QFileDialog::getExistingDirectory(this, "选择增量备份目录",
+                                                    settings.value("backup/incrementalDir").toString());
+    if (dir.isEmpty()) return;
+
+    QDialog dialog(this);
+    dialog.setWindowTitle("按时间点恢复");
+    QFormLayout layout(&dialog);
+
+    QDateTimeEdit *targetEdit = new QDateTimeEdit(QDateTime::currentDateTime());
+    targetEdit->setCalendarPopup(true);
+    targetEdit->setDisplayFormat("yyyy-MM-dd hh:mm:ss");
+    layout.addRow("恢复到:", targetEdit);
+
+    QDialogButtonBox buttons(QDialogButtonBox::Ok | QDialogButtonBox::Cancel);
+    layout.addRow(&buttons);
+
+    connect(&buttons, &QDialogButtonBox::accepted, &dialog, &QDialog::accept);
+    connect(&buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+
+    if (dialog.exec() != QDialog::Accepted) return;
+
+    int result = QMessageBox::warning(this, "警告",
+                                     "恢复数据库将覆盖当前所有数据，是否继续？",
+                                     QMessageBox::Yes | QMessageBox::No);
+    if (result != QMessageBox::Yes) return;
+
+    // 先在线程池中把日志重放到临时文件，成功后再回到界面线程替换当前数据库
+    const QString restoredPath = "library.db.restore";
+    const QDateTime target = targetEdit->dateTime();
+    QSharedPointer<ChangeJournal::BackupStats> replayed(new ChangeJournal::BackupStats);
+    runRestoreJob("正在重放变更日志……",
+        [dir, target, restoredPath, replayed](const std::function<void(int, int)> &) -> QString {
+            QString error;
+            if (ChangeJournal::restoreToPointInTime(dir, target, restoredPath, replayed.data(), &error)) {
+                return QString();
+            }
+            return error.isEmpty() ? QString("重放变更日志失败") : error;
+        },
+        [this, dir, target, restoredPath, replayed](const QString &error) {
+            if (!error.isEmpty()) {
+                QMessageBox::critical(this, "错误", "按时间点恢复失败：" + error);
+                return;
+            }
+            replaceWithPointInTime(dir, target, restoredPath, *replayed);
+        });
+}
+
+void LibraryManager::replaceWithPointInTime(const QString &dir, const QDateTime &target,
+                                            const QString &restoredPath, const ChangeJournal::BackupStats &stats)
+{
+    // 重放期间定时的备份与归档可能已经开始
+    if (!canReplaceDatabase()) {
+        QFile::remove(restoredPath);
+        return;
+    }
+
+    waitForBackgroundQueries();
+    core.close();
+    QFile::remove("library.db-wal");
+    QFile::remove("library.db-shm");
+
+    if (QFile::remove("library.db") && QFile::rename(restoredPath, "library.db")) {
+        core.reopen();
+        ChangeJournal::enable(db);
+        ChangeJournal::retireLaterHistory(dir, stats.lastSeq);
+
+        // 归档库没有随主库回退：恢复点之后才归档或才产生的行要从归档库中去掉
+        QString archiveError;
+        if (!HistoryArchiver::reconcile(db, &archiveError)) {
+            QMessageBox::warning(this, "警告", "归档库与恢复后的数据库对齐失败：" + archiveError);
+        }
+
+        // 重放日志时触发器会重复累计，汇总表需要按恢复后的数据在后台重建
+        CirculationRollup::markStale(db);
+        CoBorrowIndex::markStale(db);
+
+        reloadModel(bookModel);
+        reloadModel(readerModel);
+        reloadModel(borrowModel);
+        refreshStatistics();
+        warmScanIndex();
+        rebuildStaleExtensions();
+
+        QMessageBox::information(this, "成功",
+            QString("已恢复到 %1，重放了 %2 条变更。")
+                .arg(target.toString("yyyy-MM-dd hh:mm:ss"))
+                .arg(stats.entries));
+    } else {
+        QMessageBox::critical(this, "错误", "数据库恢复失败！");
+        core.reopen();
+    }
 }
 
 void LibraryManager::restoreDatabase()
 {
+    // 借还书服务还持有数据库，服务台不能替换它的数据文件
+    if (circulationClient) {
+        QMessageBox::warning(this, "警告", "已连接借还书服务，请在服务器上停止服务后再恢复数据库。");
+        return;
+    }
+    if (!canReplaceDatabase()) {
+        return;
+    }
+
     QString fileName = QFileDialog::getOpenFileName(this, "恢复数据库",
                                                    "",
-                                                   "SQLite数据库文件 (*.db);;所有文件 (*.*)");
+                                                   "SQLite数据库文件 (*.db);;压缩备份归档 (*.lmba);;所有文件 (*.*)");
     if (fileName.isEmpty()) return;
 
     int result = QMessageBox::warning(this, "警告",
                                      "恢复数据库将覆盖当前所有数据，是否继续？",
                                      QMessageBox::Yes | QMessageBox::No);
 
-    if (result == QMessageBox::Yes) {
-        if (db.isOpen()) {
-            db.close();
+    if (result != QMessageBox::Yes) {
+        return;
+    }
+
+    // 备份归档先在线程池中并行解压并逐块校验，全部通过后才回到界面线程替换当前数据库
+    if (!BackupArchive::isArchive(fileName)) {
+        replaceWithBackup(fileName, fileName);
+        return;
+    }
+    const QString extractedPath = "library.db.restore";
+    runRestoreJob("正在解压并校验备份归档……",
+        [fileName, extractedPath](const std::function<void(int, int)> &progress) -> QString {
+            BackupArchive::Result archiveResult;
+            QString error;
+            if (BackupArchive::extract(fileName, extractedPath, &archiveResult, &error, progress)) {
+                return QString();
+            }
+            return error.isEmpty() ? QString("解压失败") : error;
+        },
+        [this, fileName, extractedPath](const QString &error) {
+            if (!error.isEmpty()) {
+                QMessageBox::critical(this, "错误", "备份归档校验失败：" + error);
+                return;
+            }
+            replaceWithBackup(fileName, extractedPath);
+        });
+}
+
+// sourcePath 为用来替换的数据库文件；与 fileName 不同时是解压出的临时文件，用完删除
+void LibraryManager::replaceWithBackup(const QString &fileName, const QString &sourcePath)
+{
+    if (!canReplaceDatabase()) {
+        if (sourcePath != fileName) {
+            QFile::remove(sourcePath);
         }
+        return;
+    }
 
-        if (QFile::remove("library.db") && QFile::copy(fileName, "library.db")) {
-            QMessageBox::information(this, "成功", "数据库恢复成功！");
+    waitForBackgroundQueries();
+    core.close();
 
-            // 重新打开数据库
-            db.open();
-            bookModel->select();
-            readerModel->select();
-            borrowModel->select();
-            refreshStatistics();
-        } else {
-            QMessageBox::critical(this, "错误", "数据库恢复失败！");
-            db.open();
+    // WAL 模式下还需清理旧的日志文件，否则会被重放到恢复后的数据库上
+    QFile::remove("library.db-wal");
+    QFile::remove("library.db-shm");
+
+    bool restored = QFile::remove("library.db") && QFile::copy(sourcePath, "library.db");
+    if (sourcePath != fileName) {
+        QFile::remove(sourcePath);
+    }
+
+    if (restored) {
+        QMessageBox::information(this, "成功", "数据库恢复成功！");
+
+        // 重新打开数据库，旧备份可能还没有变更日志
+        core.reopen();
+        QString archiveError;
+        if (!HistoryArchiver::reconcile(db, &archiveError)) {
+            QMessageBox::warning(this, "警告", "归档库与恢复后的数据库对齐失败：" + archiveError);
         }
+        reloadModel(bookModel);
+        reloadModel(readerModel);
+        reloadModel(borrowModel);
+        refreshStatistics();
+        warmScanIndex();
+        rebuildStaleExtensions();
+    } else {
+        QMessageBox::critical(this, "错误", "数据库恢复失败！");
+        core.reopen();
     }
 }
 
+void LibraryManager::verifyBackupArchive()
+{
+    QString fileName = QFileDialog::getOpenFileName(this, "校验备份归档",
+                                                   "",
+                                                   "压缩备份归档 (*.lmba);;所有文件 (*.*)");
+    if (fileName.isEmpty()) return;
+
+    BackupArchive::Result result;
+    QString error;
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    bool ok = BackupArchive::verify(fileName, &result, &error);
+    QApplication::restoreOverrideCursor();
+
+    if (ok) {
+        QMessageBox::information(this, "校验通过",
+            QString("备份归档完好。\n块数：%1\n原始大小：%2 MB\n归档大小：%3 MB")
+                .arg(result.chunks)
+                .arg(result.originalBytes / 1048576.0, 0, 'f', 1)
+                .arg(result.archiveBytes / 1048576.0, 0, 'f', 1));
+    } else {
+        QMessageBox::warning(this, "校验失败", error);
+    }
+}
+
+void LibraryManager::archiveHistory()
+{
+    QDialog dialog(this);
+    dialog.setWindowTitle("归档历史数据");
+    QFormLayout layout(&dialog);
+
+    QSettings settings;
+    int retentionDays = settings.value("archive/retentionDays", 365).toInt();
+    QDateEdit *cutoffEdit = new QDateEdit(QDate::currentDate().addDays(-retentionDays));
+    cutoffEdit->setCalendarPopup(true);
+    layout.addRow("归档此日期之前已归还的记录:", cutoffEdit);
+
+    QDialogButtonBox buttons(QDialogButtonBox::Ok | QDialogButtonBox::Cancel);
+    layout.addRow(&buttons);
+
+    connect(&buttons, &QDialogButtonBox::accepted, &dialog, &QDialog::accept);
+    connect(&buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+
+    if (dialog.exec() == QDialog::Accepted) {
+        // 记住保留天数，之后每天自动按此归档
+        settings.setValue("archive/retentionDays", cutoffEdit->date().daysTo(QDate::currentDate()));
+        startHistoryArchiving(cutoffEdit->date(), true);
+    }
+}
+
+void LibraryManager::startHistoryArchiving(const QDate &cutoff, bool interactive)
+{
+    if (archiveThread) {
+        if (interactive) {
+            QMessageBox::information(this, "提示", "归档正在进行中，请稍候。");
+        }
+        return;
+    }
+
+    // 后台线程使用独立连接分批迁移，每批单独提交，不长时间占用写锁
+    QThread *thread = new QThread(this);
+    HistoryArchiver *archiver = new HistoryArchiver(db.databaseName(), cutoff);
+    archiver->moveToThread(thread);
+    archiveThread = thread;
+
+    connect(thread, &QThread::started, archiver, &HistoryArchiver::run);
+    connect(archiver, &HistoryArchiver::progress, this, [this](int records, int history) {
+        statusBar()->showMessage(QString("正在归档：借阅记录 %1 条，历史记录 %2 条").arg(records).arg(history));
+    });
+    connect(archiver, &HistoryArchiver::finished, this, [this, interactive](bool ok, const QString &message) {
+        statusBar()->showMessage(message, 5000);
+        if (ok) {
+            reloadModel(borrowModel);
+        }
+        if (interactive) {
+            if (ok) {
+                QMessageBox::information(this, "成功", message);
+            } else {
+                QMessageBox::warning(this, "错误", message);
+            }
+        }
+    });
+    connect(archiver, &HistoryArchiver::finished, thread, &QThread::quit);
+    connect(thread, &QThread::finished, archiver, &QObject::deleteLater);
+    connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+
+    thread->start(QThread::LowPriority);
+}
+
 void LibraryManager::about()
 {
     QString aboutText =
@@ -8,6 +8,16 @@
 #include <QStandardItemModel>
 #include <QTimer>
 #include <QSystemTrayIcon>
+#include <QPointer>
+#include <QThread>
+#include <QDate>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QSet>
+#include <functional>
+#include "barcodeindex.h"
+#include "changejournal.h"
+#include "librarycore.h"
 
 class QTabWidget;
 class QTableView;
@@ -20,6 +30,11 @@ class QTextEdit;
 class QGroupBox;
 class QSpinBox;
 class QCheckBox;
+class QTableWidget;
+class OnlineBackupWorker;
+class StallWatchdog;
+class ColumnStoreModel;
+class CirculationClient;
 
 class LibraryManager : public QMainWindow
 {
@@ -34,8 +49,11 @@ private slots:
     void addBook();
     void editBook();
     void deleteBook();
+    void manageCopies();
+    void showRecommendations();
     void searchBooks();
     void clearBookSearch();
+    void showBookCatalog();
 
     // 读者管理
     void addReader();
@@ -46,85 +64,185 @@ private slots:
 
     // 借还书管理
     void borrowBook();
+    void scanBorrowBook();
+    void scanBorrowReader();
     void returnBook();
     void renewBook();
+    void placeHold();
+    void showHoldList();
 
     // 统计
     void refreshStatistics();
+    void showStatistics();
     void generateReport();
 
+    // 性能诊断
+    void refreshDiagnostics();
+    void exportDiagnostics();
+
     // 逾期提醒
     void checkOverdueBooks();
+    void showOverdueSummary();
     void showOverdueList();
 
     // 系统
     void setupDatabase();
+    void finishStartup();
+    void databasePrepared();
     void backupDatabase();
     void restoreDatabase();
+    void verifyBackupArchive();
+    void incrementalBackup();
+    void pointInTimeRestore();
+    void archiveHistory();
     void about();
 
     void createBookManagementTab();
     void createReaderManagementTab();
     void createBorrowReturnTab();
     void createStatisticsTab();
+    void createDiagnosticsTab();
+    void ensureTab(int index);
 
     QIcon createIcon(const QString &color, const QString &symbol);
 
+protected:
+    void showEvent(QShowEvent *event) override;
+
 private:
+    // 标签页顺序
+    enum Tab { BookTab, ReaderTab, BorrowTab, StatisticsTab, DiagnosticsTab, TabCount };
+
     void setupUI();
     void createMenuBar();
     void createToolBar();
     void createStatusBar();
     void createModels();
     void applyFilters();
+    bool startOnlineBackup(const QString &fileName, bool compressed,
+                           const std::function<void(bool, const QString &)> &onFinished);
+    void runIncrementalBackup(const QString &dir, bool interactive);
+    void replaceWithPointInTime(const QString &dir, const QDateTime &target,
+                                const QString &restoredPath, const ChangeJournal::BackupStats &stats);
+    void replaceWithBackup(const QString &fileName, const QString &sourcePath);
+    void runRestoreJob(const QString &label,
+                       const std::function<QString(const std::function<void(int, int)> &)> &job,
+                       const std::function<void(const QString &)> &onFinished);
+    void startHistoryArchiving(const QDate &cutoff, bool interactive);
+    void reloadModel(QSqlTableModel *model);
+    void reloadModel(ColumnStoreModel *model);
+    void refreshModelRow(ColumnStoreModel *model, int id);
+    void connectCirculationServer();
+    void invalidateBook(int id);
+    void invalidateReader(int id);
+    void warmScanIndex();
+    void rebuildStaleExtensions();
+    void refreshScanIndex(BarcodeIndex *index, int id);
+    int resolveScan(BarcodeIndex &index, const QString &scanned);
+    int resolveCopy(const QString &scanned);
+    bool resolveBorrowItem(const QString &scanned, int *bookId, int *copyId);
+    int resolveRecord(const QString &scanned);
+    bool checkout(int bookId, int copyId, int readerId, LibraryCore::BorrowResult *result, QString *error);
+    void waitForBackgroundQueries();
+    bool canReplaceDatabase();
 
     // UI组件
     QTabWidget *tabWidget;
 
+    // 各标签页的内容在首次切换到该页时创建，之前均为空指针
     // 图书管理页
-    QTableView *bookTableView;
-    QSqlTableModel *bookModel;
-    QLineEdit *bookIdFilter;
-    QLineEdit *bookTitleFilter;
-    QLineEdit *bookAuthorFilter;
-    QLineEdit *bookIsbnFilter;
-    QComboBox *bookCategoryFilter;
-    QComboBox *bookStatusFilter;
+    QTableView *bookTableView = nullptr;
+    ColumnStoreModel *bookModel = nullptr;
+    QLineEdit *bookIdFilter = nullptr;
+    QLineEdit *bookTitleFilter = nullptr;
+    QLineEdit *bookAuthorFilter = nullptr;
+    QLineEdit *bookIsbnFilter = nullptr;
+    QComboBox *bookCategoryFilter = nullptr;
+    QComboBox *bookStatusFilter = nullptr;
 
     // 读者管理页
-    QTableView *readerTableView;
-    QSqlTableModel *readerModel;
-    QLineEdit *readerIdFilter;
-    QLineEdit *readerNameFilter;
-    QLineEdit *readerPhoneFilter;
-    QComboBox *readerTypeFilter;
+    QTableView *readerTableView = nullptr;
+    ColumnStoreModel *readerModel = nullptr;
+    QLineEdit *readerIdFilter = nullptr;
+    QLineEdit *readerNameFilter = nullptr;
+    QLineEdit *readerPhoneFilter = nullptr;
+    QComboBox *readerTypeFilter = nullptr;
 
     // 借阅记录页
-    QTableView *borrowTableView;
-    QSqlTableModel *borrowModel;
+    QTableView *borrowTableView = nullptr;
+    QSqlTableModel *borrowModel = nullptr;
 
     // 借还书操作
-    QLineEdit *borrowBookId;
-    QLineEdit *borrowReaderId;
-    QSpinBox *borrowDays;
-    QLineEdit *returnRecordId;
+    QLineEdit *borrowBookId = nullptr;
+    QLineEdit *borrowReaderId = nullptr;
+    QLabel *borrowBookInfo = nullptr;
+    QLabel *borrowReaderInfo = nullptr;
+    QLabel *borrowResultLabel = nullptr;
+    QSpinBox *borrowDays = nullptr;
+    QLineEdit *returnRecordId = nullptr;
 
     // 统计页
-    QLabel *totalBooksLabel;
-    QLabel *totalReadersLabel;
-    QLabel *borrowedBooksLabel;
-    QLabel *overdueBooksLabel;
-    QLabel *popularCategoryLabel;
-    QLabel *activeReadersLabel;
-    QTextEdit *reportTextEdit;
-
-    // 数据库
+    QLabel *totalBooksLabel = nullptr;
+    QLabel *totalReadersLabel = nullptr;
+    QLabel *borrowedBooksLabel = nullptr;
+    QLabel *overdueBooksLabel = nullptr;
+    QLabel *popularCategoryLabel = nullptr;
+    QLabel *activeReadersLabel = nullptr;
+    QTextEdit *reportTextEdit = nullptr;
+
+    // 性能诊断页
+    QTableWidget *perfTable = nullptr;
+    QLabel *cacheStatsLabel = nullptr;
+
+    // 数据库与业务逻辑
+    LibraryCore core;
     QSqlDatabase db;
 
+    // 设置了借还书服务时由服务执行借还书，否则为空
+    CirculationClient *circulationClient = nullptr;
+
+    // 正在进行的在线备份线程
+    QPointer<QThread> backupThread;
+    QPointer<OnlineBackupWorker> backupWorker;
+
     // 定时器用于逾期检查
     QTimer *overdueTimer;
+
+    // 定时增量备份
+    QTimer *incrementalBackupTimer;
+
+    // 冷数据归档
+    QTimer *archiveTimer;
+    QPointer<QThread> archiveThread;
     QSystemTrayIcon *trayIcon;
 
+    // 界面卡顿监视
+    StallWatchdog *stallWatchdog;
+
+    // 后台统计与逾期检查
+    QFutureWatcher<LibraryCore::Statistics> *statisticsWatcher;
+    QFutureWatcher<LibraryCore::OverdueSummary> *overdueWatcher;
+
+    // 首次安装的借阅汇总在后台按历史数据生成
+    QFutureWatcher<QStringList> *rebuildWatcher;
+
+    // 启动时在后台建表并安装辅助组件
+    QFutureWatcher<LibraryCore::PrepareResult> *prepareWatcher;
+
+    // 恢复数据库时在后台生成替换用的文件（重放变更日志、解压备份归档）
+    QPointer<QFutureWatcher<QString> > restoreWatcher;
+
+    // 扫码借书用的条码索引，后台加载完成前按数据库查询
+    CirculationIndex scanIndex;
+    QFutureWatcher<CirculationIndex> *scanIndexWatcher;
+    bool scanIndexPending;
+
+    // 延迟加载与启动计时
+    QSet<int> builtTabs;
+    QElapsedTimer startupTimer;
+    bool startupScheduled;
+    bool statisticsPending;
+
     // 模型
     QStandardItemModel *statisticsModel;
 };
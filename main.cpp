@@ -1,6 +1,8 @@
 ﻿// main.cpp
+#include "kioskwindow.h"
 #include "librarymanager.h"
 #include <QApplication>
+#include <QCommandLineParser>
 
 int main(int argc, char *argv[])
 {
@@ -11,6 +13,21 @@ int main(int argc, char *argv[])
     app.setOrganizationName("LibrarySoft");
     app.setApplicationVersion("1.0.0");
 
+    // --kiosk <快照文件> 以公共检索终端方式运行，只读查询目录快照，不打开数据库
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption kioskOption("kiosk", "以检索终端方式运行，查询给定的目录快照", "snapshot");
+    parser.addOption(kioskOption);
+    parser.process(app);
+
+    if (parser.isSet(kioskOption)) {
+        KioskWindow kiosk(parser.value(kioskOption));
+        kiosk.setWindowTitle("馆藏查询");
+        kiosk.showFullScreen();
+        return app.exec();
+    }
+
     LibraryManager window;
     window.setWindowTitle("图书馆管理系统");
     window.show();
@@ -0,0 +1,245 @@
+﻿// onlinebackup.cpp
+#include "onlinebackup.h"
+#include "backuparchive.h"
+#include <QFile>
+#include <QSqlDriver>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QStringList>
+#include <QThread>
+#include <sqlite3.h>
+
+namespace {
+
+// QSQLITE 连接底层的 sqlite3 句柄
+sqlite3 *nativeHandle(const QSqlDatabase &db)
+{
+    const QVariant handle = db.driver()->handle();
+    if (handle.isValid() && qstrcmp(handle.typeName(), "sqlite3*") == 0) {
+        return *static_cast<sqlite3 *const *>(handle.constData());
+    }
+    return nullptr;
+}
+
+// 备份 API 必须与 QSQLITE 使用同一份 SQLite（Qt 以 -system-sqlite 构建）。
+// 软堆上限是库内的全局设置：经 QSQLITE 设置后从本模块链接的库读出，一致才是同一份
+bool sameSqliteLibrary(QSqlDatabase db)
+{
+    QSqlQuery query(db);
+    if (!query.exec("PRAGMA soft_heap_limit") || !query.next()) {
+        return false;
+    }
+    const qint64 previous = query.value(0).toLongLong();
+    const qint64 probe = sqlite3_soft_heap_limit64(-1) == (qint64(1) << 40) ? (qint64(1) << 40) + 1 : qint64(1) << 40;
+    query.exec(QString("PRAGMA soft_heap_limit = %1").arg(probe));
+    const bool same = sqlite3_soft_heap_limit64(-1) == probe;
+    query.exec(QString("PRAGMA soft_heap_limit = %1").arg(previous));
+    return same;
+}
+
+} // namespace
+
+OnlineBackupWorker::OnlineBackupWorker(const QString &sourcePath, const QString &targetPath,
+                                       QObject *parent)
+    : QObject(parent)
+    , sourcePath(sourcePath)
+    , targetPath(targetPath)
+    , pagesPerStep(64)
+    , throttleMs(20)
+    , compressed(false)
+    , standalone(false)
+    , cancelled(0)
+{
+}
+
+void OnlineBackupWorker::setPagesPerStep(int pages)
+{
+    pagesPerStep = qMax(1, pages);
+}
+
+void OnlineBackupWorker::setThrottleMs(int ms)
+{
+    throttleMs = qMax(0, ms);
+}
+
+void OnlineBackupWorker::setCompressed(bool compressed)
+{
+    this->compressed = compressed;
+}
+
+void OnlineBackupWorker::setStandalone(bool standalone)
+{
+    this->standalone = standalone;
+}
+
+void OnlineBackupWorker::cancel()
+{
+    cancelled.storeRelease(1);
+}
+
+void OnlineBackupWorker::run()
+{
+    // 先写入临时文件，校验通过后再改名，避免留下不完整的备份
+    const QString partPath = targetPath + ".part";
+    QFile::remove(partPath);
+
+    // 源库与目标库都经 QSQLITE 打开，备份 API 只操作它们的句柄。若另用一份 SQLite
+    // 打开同一文件，一方关闭文件描述符会释放另一方持有的 POSIX 锁，可能损坏数据库
+    static QAtomicInt serial;
+    const int id = serial.fetchAndAddRelaxed(1);
+    const QString sourceName = QString("online_backup_source_%1").arg(id);
+    const QString targetName = QString("online_backup_target_%1").arg(id);
+
+    int rc = SQLITE_OK;
+    QString error;
+    {
+        QSqlDatabase source = QSqlDatabase::addDatabase("QSQLITE", sourceName);
+        source.setDatabaseName(sourcePath);
+        source.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000");
+        QSqlDatabase target = QSqlDatabase::addDatabase("QSQLITE", targetName);
+        target.setDatabaseName(partPath);
+
+        sqlite3 *sourceHandle = nullptr;
+        sqlite3 *targetHandle = nullptr;
+        bool ownHandles = false;
+        if (!source.open()) {
+            error = "无法打开源数据库：" + source.lastError().text();
+        } else if (!target.open()) {
+            error = "无法创建备份文件：" + target.lastError().text();
+        } else if (sameSqliteLibrary(source)) {
+            sourceHandle = nativeHandle(source);
+            targetHandle = nativeHandle(target);
+        } else if (standalone) {
+            // 本进程没有其他连接打开源库，关闭 QSQLITE 连接后改用本模块链接的 SQLite 打开
+            source.close();
+            target.close();
+            ownHandles = true;
+            if (sqlite3_open_v2(QFile::encodeName(sourcePath).constData(), &sourceHandle,
+                                SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+                error = QString("无法打开源数据库：%1").arg(sqlite3_errmsg(sourceHandle));
+            } else if (sqlite3_open_v2(QFile::encodeName(partPath).constData(), &targetHandle,
+                                       SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK) {
+                error = QString("无法创建备份文件：%1").arg(sqlite3_errmsg(targetHandle));
+            }
+            sqlite3_busy_timeout(sourceHandle, 5000);
+        } else {
+            error = "Qt 的 SQLite 驱动没有使用系统 SQLite 库（需以 -system-sqlite 构建 Qt），"
+                    "请改用命令行工具 library_cli backup 备份";
+        }
+        if (error.isEmpty() && (!sourceHandle || !targetHandle)) {
+            error = "无法取得数据库连接的句柄";
+        }
+
+        if (error.isEmpty()) {
+            // 在源连接上保持一个读事务：WAL 模式下备份读取的是同一快照，
+            // 前台的写入不会导致备份从头重来，也不会被备份阻塞
+            sqlite3_exec(sourceHandle, "BEGIN; SELECT COUNT(*) FROM sqlite_master;", nullptr, nullptr, nullptr);
+
+            sqlite3_backup *backup = sqlite3_backup_init(targetHandle, "main", sourceHandle, "main");
+            if (!backup) {
+                error = QString("无法开始备份：%1").arg(sqlite3_errmsg(targetHandle));
+            } else {
+                while (true) {
+                    if (cancelled.loadAcquire()) {
+                        rc = SQLITE_INTERRUPT;
+                        break;
+                    }
+
+                    rc = sqlite3_backup_step(backup, pagesPerStep);
+
+                    int total = sqlite3_backup_pagecount(backup);
+                    emit progress(total - sqlite3_backup_remaining(backup), total);
+
+                    if (rc == SQLITE_DONE) {
+                        break;
+                    }
+                    if (rc != SQLITE_OK && rc != SQLITE_BUSY && rc != SQLITE_LOCKED) {
+                        break;
+                    }
+
+                    // 让出磁盘与 CPU，保证前台操作的响应速度
+                    QThread::msleep(rc == SQLITE_OK ? throttleMs : qMax(throttleMs, 50));
+                }
+
+                sqlite3_backup_finish(backup);
+                if (rc == SQLITE_INTERRUPT) {
+                    error = "备份已取消";
+                } else if (rc != SQLITE_DONE) {
+                    error = QString("备份失败：%1").arg(QString::fromUtf8(sqlite3_errmsg(targetHandle)));
+                }
+            }
+            sqlite3_exec(sourceHandle, "COMMIT", nullptr, nullptr, nullptr);
+        }
+        if (ownHandles) {
+            sqlite3_close(targetHandle);
+            sqlite3_close(sourceHandle);
+            if (error.isEmpty() && !target.open()) {
+                error = "无法打开备份文件：" + target.lastError().text();
+            }
+        }
+
+        if (error.isEmpty()) {
+            QString integrityError;
+            if (!checkIntegrity(target, &integrityError)) {
+                error = QString("备份文件完整性校验失败：%1").arg(integrityError);
+            }
+        }
+        target.close();
+        source.close();
+    }
+    QSqlDatabase::removeDatabase(targetName);
+    QSqlDatabase::removeDatabase(sourceName);
+
+    if (!error.isEmpty()) {
+        QFile::remove(partPath);
+        emit finished(false, error);
+        return;
+    }
+
+    if (compressed) {
+        // 快照校验通过后再分块并行压缩，快照本身随后删除
+        emit stageChanged("正在压缩备份归档...");
+        BackupArchive::Result result;
+        QString archiveError;
+        bool ok = BackupArchive::create(partPath, targetPath, &result, &archiveError,
+                                        [this](int done, int total) { emit progress(done, total); });
+        QFile::remove(partPath);
+        if (ok) {
+            emit finished(true, QString("备份归档已生成：%1 MB 压缩为 %2 MB，共 %3 块，校验通过！")
+                                    .arg(result.originalBytes / 1048576.0, 0, 'f', 1)
+                                    .arg(result.archiveBytes / 1048576.0, 0, 'f', 1)
+                                    .arg(result.chunks));
+        } else {
+            emit finished(false, "生成备份归档失败：" + archiveError);
+        }
+        return;
+    }
+
+    QFile::remove(targetPath);
+    if (!QFile::rename(partPath, targetPath)) {
+        QFile::remove(partPath);
+        emit finished(false, "无法写入备份文件！");
+        return;
+    }
+
+    emit finished(true, "数据库备份成功，完整性校验通过！");
+}
+
+bool OnlineBackupWorker::checkIntegrity(QSqlDatabase db, QString *error)
+{
+    // 校验通过时只返回一行 "ok"，否则逐行返回错误描述
+    QSqlQuery query(db);
+    if (!query.exec("PRAGMA integrity_check")) {
+        *error = query.lastError().text();
+        return false;
+    }
+    QStringList problems;
+    while (query.next()) {
+        problems.append(query.value(0).toString());
+    }
+    const bool ok = problems.size() == 1 && problems.first() == "ok";
+    if (!ok) {
+        *error = problems.join("; ");
+    }
+    return ok;
+}
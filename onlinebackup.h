@@ -0,0 +1,55 @@
+﻿// onlinebackup.h
+#ifndef ONLINEBACKUP_H
+#define ONLINEBACKUP_H
+
+#include <QObject>
+#include <QSqlDatabase>
+#include <QString>
+#include <QAtomicInt>
+
+// 在线热备份：在后台线程中使用 SQLite 备份 API 分批复制数据页，
+// 备份期间主连接无需关闭，借还书操作不受影响。
+// 源库与备份文件都经 QSQLITE 打开，要求 Qt 以 -system-sqlite 构建（与本程序链接同一份 SQLite）。
+class OnlineBackupWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    OnlineBackupWorker(const QString &sourcePath, const QString &targetPath,
+                       QObject *parent = nullptr);
+
+    // 每批复制的页数与批次间的休眠时间（毫秒），用于限制对前台的影响
+    void setPagesPerStep(int pages);
+    void setThrottleMs(int ms);
+
+    // 生成压缩备份归档（.lmba）而不是普通数据库文件
+    void setCompressed(bool compressed);
+
+    // 本进程中没有其他连接打开源库时（如命令行工具）设为 true：Qt 未以 -system-sqlite
+    // 构建时改用本模块链接的 SQLite 自行打开。默认为 false，此时只能经 QSQLITE 备份
+    void setStandalone(bool standalone);
+
+    // 可在任意线程调用
+    void cancel();
+
+public slots:
+    void run();
+
+signals:
+    void stageChanged(const QString &stage);
+    void progress(int done, int total);
+    void finished(bool ok, const QString &message);
+
+private:
+    bool checkIntegrity(QSqlDatabase db, QString *error);
+
+    QString sourcePath;
+    QString targetPath;
+    int pagesPerStep;
+    int throttleMs;
+    bool compressed;
+    bool standalone;
+    QAtomicInt cancelled;
+};
+
+#endif // ONLINEBACKUP_H
@@ -0,0 +1,351 @@
+﻿// perfmonitor.cpp
+#include "perfmonitor.h"
+#include <QAtomicInteger>
+#include <QFile>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSharedPointer>
+#include <QThread>
+#include <QThreadStorage>
+#include <QVector>
+#include <algorithm>
+#include <cctype>
+
+namespace {
+
+// 对数-线性分桶：小于 2^kSubBits 纳秒逐一计数，之后每个 2 的幂区间再等分
+// 2^(kSubBits-1) 份，相对误差约 3%，覆盖完整的 64 位范围
+const int kSubBits = 5;
+const int kSubHalf = 1 << (kSubBits - 1);
+const int kBucketCount = (64 - kSubBits + 1) * kSubHalf + kSubHalf * 2;
+
+int bucketOf(quint64 value)
+{
+    if (value < (1u << kSubBits)) {
+        return static_cast<int>(value);
+    }
+    int highest = 63;
+    while (!(value >> highest)) --highest;
+    int shift = highest - kSubBits + 1;
+    return shift * kSubHalf + static_cast<int>(value >> shift);
+}
+
+// 桶内最大值，统计结果宁可偏大
+quint64 bucketUpper(int bucket)
+{
+    if (bucket < (1 << kSubBits)) {
+        return static_cast<quint64>(bucket);
+    }
+    int shift = bucket / kSubHalf - 1;
+    quint64 mantissa = static_cast<quint64>(bucket - shift * kSubHalf);
+    return ((mantissa + 1) << shift) - 1;
+}
+
+} // namespace
+
+// 只有所属线程写入，其他线程读取，计数用原子变量即可免锁
+struct PerfMonitor::Histogram
+{
+    explicit Histogram(const QByteArray &shape)
+        : shape(shape.constData(), shape.size())
+        , buckets(new QAtomicInteger<quint64>[kBucketCount])
+    {
+        for (int i = 0; i < kBucketCount; ++i) buckets[i].store(0);
+    }
+    ~Histogram() { delete[] buckets; }
+
+    void add(quint64 nanoseconds)
+    {
+        buckets[bucketOf(nanoseconds)].fetchAndAddRelaxed(1);
+        total.fetchAndAddRelaxed(nanoseconds);
+        if (nanoseconds > maximum.load()) maximum.store(nanoseconds);
+    }
+
+    void clear()
+    {
+        for (int i = 0; i < kBucketCount; ++i) buckets[i].store(0);
+        total.store(0);
+        maximum.store(0);
+    }
+
+    const QByteArray shape;  // 创建后不再修改，其他线程可直接读取
+    QAtomicInteger<quint64> *buckets;
+    QAtomicInteger<quint64> total;
+    QAtomicInteger<quint64> maximum;
+
+private:
+    Q_DISABLE_COPY(Histogram)
+};
+
+namespace {
+
+typedef PerfMonitor::Histogram Histogram;
+
+struct Registration
+{
+    PerfMonitor::Kind kind;
+    QSharedPointer<Histogram> histogram;
+};
+
+struct ThreadHistograms
+{
+    QHash<QByteArray, Histogram *> byShape[2];
+    QAtomicPointer<Histogram> active[2];  // 正在执行的操作与语句
+};
+
+// 所有线程的直方图，线程退出后数据仍然保留；直方图从不释放，
+// 公布出去的活动指针因此始终有效
+QMutex registryMutex;
+QList<Registration> registry;
+QHash<QThread *, QWeakPointer<ThreadHistograms> > threads;
+
+QThreadStorage<QSharedPointer<ThreadHistograms> > threadHistograms;
+
+ThreadHistograms *localHistograms()
+{
+    if (!threadHistograms.hasLocalData()) {
+        QSharedPointer<ThreadHistograms> local(new ThreadHistograms);
+        threadHistograms.setLocalData(local);
+
+        QMutexLocker locker(&registryMutex);
+        threads.insert(QThread::currentThread(), local);
+    }
+    return threadHistograms.localData().data();
+}
+
+double percentile(const QVector<quint64> &buckets, quint64 count, double fraction)
+{
+    quint64 rank = qMax<quint64>(1, static_cast<quint64>(fraction * count + 0.5));
+    quint64 seen = 0;
+    for (int i = 0; i < buckets.size(); ++i) {
+        seen += buckets.at(i);
+        if (seen >= rank) return bucketUpper(i) / 1000.0;
+    }
+    return 0.0;
+}
+
+} // namespace
+
+void PerfMonitor::record(Kind kind, const QByteArray &shape, qint64 nanoseconds)
+{
+    histogram(kind, shape)->add(static_cast<quint64>(qMax<qint64>(0, nanoseconds)));
+}
+
+PerfMonitor::Histogram *PerfMonitor::histogram(Kind kind, const QByteArray &shape)
+{
+    QHash<QByteArray, Histogram *> &local = localHistograms()->byShape[kind];
+    Histogram *histogram = local.value(shape);
+    if (!histogram) {
+        Registration registration;
+        registration.kind = kind;
+        registration.histogram.reset(new Histogram(shape));
+        histogram = registration.histogram.data();
+        local.insert(histogram->shape, histogram);
+
+        QMutexLocker locker(&registryMutex);
+        registry.append(registration);
+    }
+    return histogram;
+}
+
+PerfMonitor::Histogram *PerfMonitor::enter(Kind kind, Histogram *histogram)
+{
+    return localHistograms()->active[kind].fetchAndStoreRelease(histogram);
+}
+
+void PerfMonitor::leave(Kind kind, Histogram *histogram, Histogram *previous, qint64 nanoseconds)
+{
+    histogram->add(static_cast<quint64>(qMax<qint64>(0, nanoseconds)));
+    localHistograms()->active[kind].storeRelease(previous);
+}
+
+PerfMonitor::Activity PerfMonitor::activity(QThread *thread)
+{
+    QSharedPointer<ThreadHistograms> histograms;
+    {
+        QMutexLocker locker(&registryMutex);
+        histograms = threads.value(thread).toStrongRef();
+    }
+
+    Activity activity;
+    if (histograms) {
+        if (Histogram *operation = histograms->active[Operation].loadAcquire()) {
+            activity.operation = operation->shape;
+        }
+        if (Histogram *statement = histograms->active[Sql].loadAcquire()) {
+            activity.statement = statement->shape;
+        }
+    }
+    return activity;
+}
+
+QList<PerfMonitor::Entry> PerfMonitor::snapshot()
+{
+    QList<Registration> registrations;
+    {
+        QMutexLocker locker(&registryMutex);
+        registrations = registry;
+    }
+
+    // 同一形状可能分布在多个线程中，先按形状合并
+    QHash<QPair<int, QByteArray>, QVector<quint64> > merged;
+    QHash<QPair<int, QByteArray>, QPair<quint64, quint64> > totals;  // 累计耗时、最大值
+    for (const Registration &registration : registrations) {
+        QPair<int, QByteArray> key(registration.kind, registration.histogram->shape);
+        QVector<quint64> &buckets = merged[key];
+        if (buckets.isEmpty()) buckets.fill(0, kBucketCount);
+        const Histogram &histogram = *registration.histogram;
+        for (int i = 0; i < kBucketCount; ++i) {
+            buckets[i] += histogram.buckets[i].load();
+        }
+        QPair<quint64, quint64> &total = totals[key];
+        total.first += histogram.total.load();
+        total.second = qMax(total.second, histogram.maximum.load());
+    }
+
+    QList<Entry> entries;
+    for (auto it = merged.constBegin(); it != merged.constEnd(); ++it) {
+        quint64 count = 0;
+        for (quint64 value : it.value()) count += value;
+        if (count == 0) continue;
+
+        const QPair<quint64, quint64> &total = totals.value(it.key());
+        Entry entry;
+        entry.kind = static_cast<Kind>(it.key().first);
+        entry.shape = it.key().second;
+        entry.count = count;
+        entry.meanUs = total.first / 1000.0 / count;
+        entry.p50Us = percentile(it.value(), count, 0.50);
+        entry.p99Us = percentile(it.value(), count, 0.99);
+        entry.maxUs = total.second / 1000.0;
+        entries.append(entry);
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.meanUs * a.count > b.meanUs * b.count;
+    });
+    return entries;
+}
+
+void PerfMonitor::reset()
+{
+    QMutexLocker locker(&registryMutex);
+    for (const Registration &registration : registry) {
+        registration.histogram->clear();
+    }
+}
+
+QJsonArray PerfMonitor::toJson()
+{
+    QJsonArray array;
+    for (const Entry &entry : snapshot()) {
+        QJsonObject object;
+        object["kind"] = entry.kind == Sql ? "sql" : "operation";
+        object["shape"] = QString::fromUtf8(entry.shape);
+        object["count"] = static_cast<double>(entry.count);
+        object["mean_us"] = entry.meanUs;
+        object["p50_us"] = entry.p50Us;
+        object["p99_us"] = entry.p99Us;
+        object["max_us"] = entry.maxUs;
+        array.append(object);
+    }
+    return array;
+}
+
+bool PerfMonitor::writeJson(const QString &path, QString *error)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        if (error) *error = file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(toJson()).toJson());
+    return true;
+}
+
+QByteArray PerfMonitor::normalizeSql(const QString &sql)
+{
+    const QByteArray text = sql.toUtf8();
+    QByteArray shape;
+    shape.reserve(text.size());
+
+    bool space = false;
+    for (int i = 0; i < text.size(); ++i) {
+        char c = text.at(i);
+        if (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
+            space = !shape.isEmpty();
+            continue;
+        }
+        if (space) {
+            shape.append(' ');
+            space = false;
+        }
+
+        bool wordBefore = !shape.isEmpty() && (std::isalnum(static_cast<unsigned char>(shape.at(shape.size() - 1)))
+                                               || shape.at(shape.size() - 1) == '_');
+        if (c == '\'') {
+            // 字符串字面量，'' 为转义的单引号
+            for (++i; i < text.size(); ++i) {
+                if (text.at(i) == '\'') {
+                    if (i + 1 < text.size() && text.at(i + 1) == '\'') ++i;
+                    else break;
+                }
+            }
+            shape.append('?');
+        } else if (std::isdigit(static_cast<unsigned char>(c)) && !wordBefore) {
+            while (i + 1 < text.size() && (std::isdigit(static_cast<unsigned char>(text.at(i + 1))) || text.at(i + 1) == '.')) ++i;
+            shape.append('?');
+        } else {
+            shape.append(c);
+        }
+    }
+    return shape;
+}
+
+ScopedTimer::ScopedTimer(const char *operation)
+    : histogram(PerfMonitor::histogram(PerfMonitor::Operation, QByteArray::fromRawData(operation, int(qstrlen(operation)))))
+    , previous(PerfMonitor::enter(PerfMonitor::Operation, histogram))
+{
+    timer.start();
+}
+
+ScopedTimer::~ScopedTimer()
+{
+    PerfMonitor::leave(PerfMonitor::Operation, histogram, previous, timer.nsecsElapsed());
+}
+
+TimedQuery::TimedQuery(QSqlDatabase db)
+    : QSqlQuery(db)
+{
+}
+
+bool TimedQuery::prepare(const QString &query)
+{
+    shape = PerfMonitor::normalizeSql(query);
+    return QSqlQuery::prepare(query);
+}
+
+bool TimedQuery::exec(const QString &query)
+{
+    PerfMonitor::Histogram *histogram = PerfMonitor::histogram(PerfMonitor::Sql, PerfMonitor::normalizeSql(query));
+    PerfMonitor::Histogram *previous = PerfMonitor::enter(PerfMonitor::Sql, histogram);
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = QSqlQuery::exec(query);
+    PerfMonitor::leave(PerfMonitor::Sql, histogram, previous, timer.nsecsElapsed());
+    return ok;
+}
+
+bool TimedQuery::exec()
+{
+    PerfMonitor::Histogram *histogram = PerfMonitor::histogram(PerfMonitor::Sql, shape);
+    PerfMonitor::Histogram *previous = PerfMonitor::enter(PerfMonitor::Sql, histogram);
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = QSqlQuery::exec();
+    PerfMonitor::leave(PerfMonitor::Sql, histogram, previous, timer.nsecsElapsed());
+    return ok;
+}
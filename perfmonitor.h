@@ -0,0 +1,94 @@
+﻿// perfmonitor.h
+#ifndef PERFMONITOR_H
+#define PERFMONITOR_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QList>
+#include <QSqlQuery>
+#include <QString>
+
+class QThread;
+
+// 热路径耗时统计：每条 SQL（按去掉字面量后的语句形状归类）与每个界面操作的耗时
+// 记入分桶直方图。每个线程写自己的直方图，记录时不加锁，只在线程第一次遇到某个
+// 形状时登记一次；读取时把各线程的直方图合并。
+// 各线程同时公布正在执行的操作与语句，供卡顿监视线程归因。
+class PerfMonitor
+{
+public:
+    enum Kind { Sql, Operation };
+
+    struct Histogram;
+
+    // 某个线程此刻正在执行的最内层操作与语句，空表示没有
+    struct Activity
+    {
+        QByteArray operation;
+        QByteArray statement;
+    };
+
+    struct Entry
+    {
+        Kind kind = Sql;
+        QByteArray shape;
+        quint64 count = 0;
+        double meanUs = 0.0;
+        double p50Us = 0.0;
+        double p99Us = 0.0;
+        double maxUs = 0.0;
+    };
+
+    static void record(Kind kind, const QByteArray &shape, qint64 nanoseconds);
+
+    // 计时开始时公布当前活动并返回之前的活动；结束时记录耗时并恢复之前的活动
+    static Histogram *histogram(Kind kind, const QByteArray &shape);
+    static Histogram *enter(Kind kind, Histogram *histogram);
+    static void leave(Kind kind, Histogram *histogram, Histogram *previous, qint64 nanoseconds);
+
+    // 可从任意线程调用
+    static Activity activity(QThread *thread);
+
+    // 各形状按累计耗时从高到低排列
+    static QList<Entry> snapshot();
+    static void reset();
+
+    static QJsonArray toJson();
+    static bool writeJson(const QString &path, QString *error = nullptr);
+
+    // 去掉字符串与数字字面量、合并空白，使参数不同的同一条语句归为一类
+    static QByteArray normalizeSql(const QString &sql);
+};
+
+// 作用域计时，析构时记录一次界面操作耗时
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(const char *operation);
+    ~ScopedTimer();
+
+private:
+    PerfMonitor::Histogram *histogram;
+    PerfMonitor::Histogram *previous;
+    QElapsedTimer timer;
+
+    Q_DISABLE_COPY(ScopedTimer)
+};
+
+// 记录每次 exec() 耗时的 QSqlQuery。exec/prepare 不是虚函数，
+// 只有以 TimedQuery 类型调用时才计时。
+class TimedQuery : public QSqlQuery
+{
+public:
+    explicit TimedQuery(QSqlDatabase db = QSqlDatabase());
+
+    bool prepare(const QString &query);
+    bool exec(const QString &query);
+    bool exec();
+
+private:
+    QByteArray shape;
+};
+
+#endif // PERFMONITOR_H
@@ -0,0 +1,71 @@
+﻿// recordcache.h
+#ifndef RECORDCACHE_H
+#define RECORDCACHE_H
+
+#include <QCache>
+
+// 按主键缓存已解码的整行记录，条数有上限，超出时淘汰最久未用的记录（QCache 的 LRU）。
+// 命中与未命中分别计数，供调整容量时参考。
+// 缓存不会自己发现数据库中的变动，写入方须在提交后调用 update/remove/clear。
+template <typename Row>
+class RecordCache
+{
+public:
+    struct Stats
+    {
+        int size = 0;
+        int capacity = 0;
+        quint64 hits = 0;
+        quint64 misses = 0;
+    };
+
+    explicit RecordCache(int capacity) : rows(capacity) {}
+
+    // 命中时复制到 *row；未命中时 *row 不变
+    bool find(int id, Row *row)
+    {
+        const Row *cached = rows.object(id);
+        if (!cached) {
+            ++misses;
+            return false;
+        }
+        ++hits;
+        *row = *cached;
+        return true;
+    }
+
+    void insert(int id, const Row &row) { rows.insert(id, new Row(row)); }
+
+    // 只在缓存中已有这一行时修改，不影响淘汰顺序以外的内容
+    template <typename Update>
+    void update(int id, Update change)
+    {
+        if (Row *cached = rows.object(id)) {
+            change(*cached);
+        }
+    }
+
+    void remove(int id) { rows.remove(id); }
+    void clear() { rows.clear(); }
+
+    void setCapacity(int capacity) { rows.setMaxCost(capacity); }
+
+    Stats stats() const
+    {
+        Stats result;
+        result.size = rows.size();
+        result.capacity = rows.maxCost();
+        result.hits = hits;
+        result.misses = misses;
+        return result;
+    }
+
+    void resetStats() { hits = misses = 0; }
+
+private:
+    QCache<int, Row> rows;
+    quint64 hits = 0;
+    quint64 misses = 0;
+};
+
+#endif // RECORDCACHE_H
@@ -0,0 +1,155 @@
+﻿// schema.cpp
+#include "schema.h"
+#include <QAbstractItemModel>
+#include <QSqlQuery>
+#include <QSqlTableModel>
+#include <QStringList>
+#include <QVariant>
+
+namespace Schema {
+
+const Table *findTable(const QString &name)
+{
+    for (const Table *table : {&kBooks, &kReaders, &kBorrowRecords, &kBorrowHistory, &kCopies, &kHolds}) {
+        if (name == QLatin1String(table->name)) {
+            return table;
+        }
+    }
+    return nullptr;
+}
+
+QString createSql(const Table &table, const QString &schema)
+{
+    QStringList definitions;
+    for (int i = 0; i < table.columnCount; ++i) {
+        definitions.append(QString("%1 %2").arg(table.columns[i].name, table.columns[i].definition));
+    }
+    if (table.constraints) {
+        definitions.append(table.constraints);
+    }
+
+    QString name = schema.isEmpty() ? QString(table.name) : schema + "." + table.name;
+    return QString("CREATE TABLE IF NOT EXISTS %1 (%2)").arg(name, definitions.join(","));
+}
+
+QString columnList(const Table &table, const QString &prefix)
+{
+    QStringList names;
+    for (int i = 0; i < table.columnCount; ++i) {
+        names.append(prefix + table.columns[i].name);
+    }
+    return names.join(", ");
+}
+
+QString columnList(const ResultColumn *columns, int count)
+{
+    QStringList expressions;
+    for (int i = 0; i < count; ++i) {
+        expressions.append(columns[i].expression);
+    }
+    return expressions.join(", ");
+}
+
+void applyHeaders(QAbstractItemModel *model, const Table &table)
+{
+    // 表模型按实际的列位置设置，旧库后来添加的列不会错位
+    QSqlTableModel *tableModel = qobject_cast<QSqlTableModel *>(model);
+    for (int i = 0; i < table.columnCount; ++i) {
+        int section = tableModel ? tableModel->fieldIndex(table.columns[i].name) : i;
+        if (section >= 0 && section < model->columnCount()) {
+            model->setHeaderData(section, Qt::Horizontal, QString(table.columns[i].label));
+        }
+    }
+}
+
+void applyHeaders(QAbstractItemModel *model, const ResultColumn *columns, int count)
+{
+    for (int i = 0; i < count && i < model->columnCount(); ++i) {
+        model->setHeaderData(i, Qt::Horizontal, QString(columns[i].label));
+    }
+}
+
+BookRow readBook(const QSqlQuery &query, int offset)
+{
+    BookRow row;
+    row.id = query.value(offset + Books::Id).toInt();
+    row.isbn = query.value(offset + Books::Isbn).toString();
+    row.title = query.value(offset + Books::Title).toString();
+    row.author = query.value(offset + Books::Author).toString();
+    row.publisher = query.value(offset + Books::Publisher).toString();
+    row.publishDate = query.value(offset + Books::PublishDate).toDate();
+    row.category = query.value(offset + Books::Category).toString();
+    row.price = query.value(offset + Books::Price).toDouble();
+    row.totalCopies = query.value(offset + Books::TotalCopies).toInt();
+    row.availableCopies = query.value(offset + Books::AvailableCopies).toInt();
+    row.location = query.value(offset + Books::Location).toString();
+    row.description = query.value(offset + Books::Description).toString();
+    row.status = query.value(offset + Books::Status).toString();
+    row.version = query.value(offset + Books::Version).toInt();
+    return row;
+}
+
+ReaderRow readReader(const QSqlQuery &query, int offset)
+{
+    ReaderRow row;
+    row.id = query.value(offset + Readers::Id).toInt();
+    row.cardNumber = query.value(offset + Readers::CardNumber).toString();
+    row.name = query.value(offset + Readers::Name).toString();
+    row.gender = query.value(offset + Readers::Gender).toString();
+    row.birthDate = query.value(offset + Readers::BirthDate).toDate();
+    row.phone = query.value(offset + Readers::Phone).toString();
+    row.email = query.value(offset + Readers::Email).toString();
+    row.address = query.value(offset + Readers::Address).toString();
+    row.readerType = query.value(offset + Readers::ReaderType).toString();
+    row.maxBorrow = query.value(offset + Readers::MaxBorrow).toInt();
+    row.maxDays = query.value(offset + Readers::MaxDays).toInt();
+    row.status = query.value(offset + Readers::Status).toString();
+    row.registrationDate = query.value(offset + Readers::RegistrationDate).toDate();
+    row.expiryDate = query.value(offset + Readers::ExpiryDate).toDate();
+    row.notes = query.value(offset + Readers::Notes).toString();
+    return row;
+}
+
+BorrowRecordRow readBorrowRecord(const QSqlQuery &query, int offset)
+{
+    BorrowRecordRow row;
+    row.id = query.value(offset + BorrowRecords::Id).toInt();
+    row.bookId = query.value(offset + BorrowRecords::BookId).toInt();
+    row.readerId = query.value(offset + BorrowRecords::ReaderId).toInt();
+    row.borrowDate = query.value(offset + BorrowRecords::BorrowDate).toDate();
+    row.dueDate = query.value(offset + BorrowRecords::DueDate).toDate();
+    row.returnDate = query.value(offset + BorrowRecords::ReturnDate).toDate();
+    row.renewCount = query.value(offset + BorrowRecords::RenewCount).toInt();
+    row.status = query.value(offset + BorrowRecords::Status).toString();
+    row.overdueFee = query.value(offset + BorrowRecords::OverdueFee).toDouble();
+    row.copyId = query.value(offset + BorrowRecords::CopyId).toInt();
+    return row;
+}
+
+CopyRow readCopy(const QSqlQuery &query, int offset)
+{
+    CopyRow row;
+    row.id = query.value(offset + Copies::Id).toInt();
+    row.bookId = query.value(offset + Copies::BookId).toInt();
+    row.barcode = query.value(offset + Copies::Barcode).toString();
+    row.location = query.value(offset + Copies::Location).toString();
+    row.state = query.value(offset + Copies::State).toString();
+    row.version = query.value(offset + Copies::Version).toInt();
+    return row;
+}
+
+HoldRow readHold(const QSqlQuery &query, int offset)
+{
+    HoldRow row;
+    row.id = query.value(offset + Holds::Id).toInt();
+    row.bookId = query.value(offset + Holds::BookId).toInt();
+    row.readerId = query.value(offset + Holds::ReaderId).toInt();
+    row.priority = query.value(offset + Holds::Priority).toInt();
+    row.status = query.value(offset + Holds::Status).toString();
+    row.copyId = query.value(offset + Holds::CopyId).toInt();
+    row.readyDate = query.value(offset + Holds::ReadyDate).toDate();
+    row.pickupDeadline = query.value(offset + Holds::PickupDeadline).toDate();
+    return row;
+}
+
+} // namespace Schema
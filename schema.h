@@ -0,0 +1,351 @@
+﻿// schema.h
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include <QDate>
+#include <QString>
+
+class QAbstractItemModel;
+class QSqlQuery;
+
+// 数据表结构的唯一定义：建表语句、界面表头和列下标都从这里生成。
+// 列下标枚举与 SELECT * 以及 QSqlTableModel 的列顺序一致，
+// 热点代码按下标读取整行到普通结构体，不再按列名逐个查找。
+namespace Schema {
+
+struct Column
+{
+    const char *name;
+    const char *definition;  // 类型与列约束
+    const char *label;       // 界面表头
+};
+
+struct Table
+{
+    const char *name;
+    const Column *columns;
+    int columnCount;
+    const char *constraints;  // 表级约束，没有时为 nullptr
+};
+
+// 查询结果列：表达式与表头
+struct ResultColumn
+{
+    const char *expression;
+    const char *label;
+};
+
+// 编译期比较列名，保证枚举与列定义的顺序一致
+constexpr bool sameName(const char *a, const char *b)
+{
+    return *a == *b && (*a == '\0' || sameName(a + 1, b + 1));
+}
+
+// ---- books ----
+namespace Books {
+enum Column {
+    Id, Isbn, Title, Author, Publisher, PublishDate, Category, Price,
+    TotalCopies, AvailableCopies, Location, Description, Status, CreatedDate, Version,
+    ColumnCount
+};
+}
+
+constexpr Column kBookColumns[] = {
+    {"id", "INTEGER PRIMARY KEY AUTOINCREMENT", "ID"},
+    {"isbn", "TEXT UNIQUE NOT NULL", "ISBN"},
+    {"title", "TEXT NOT NULL", "书名"},
+    {"author", "TEXT NOT NULL", "作者"},
+    {"publisher", "TEXT", "出版社"},
+    {"publish_date", "DATE", "出版日期"},
+    {"category", "TEXT", "分类"},
+    {"price", "REAL", "价格"},
+    {"total_copies", "INTEGER DEFAULT 1", "总数量"},
+    {"available_copies", "INTEGER DEFAULT 1", "可借数量"},
+    {"location", "TEXT", "位置"},
+    {"description", "TEXT", "简介"},
+    {"status", "TEXT DEFAULT '在库'", "状态"},
+    {"created_date", "TIMESTAMP DEFAULT CURRENT_TIMESTAMP", "入库时间"},
+    // 每次修改加一，更新时比对以发现其他连接的并发修改
+    {"version", "INTEGER NOT NULL DEFAULT 0", "版本"},
+};
+static_assert(sizeof(kBookColumns) / sizeof(kBookColumns[0]) == Books::ColumnCount, "books 列数与枚举不一致");
+static_assert(sameName(kBookColumns[Books::AvailableCopies].name, "available_copies"), "books 列顺序与枚举不一致");
+static_assert(sameName(kBookColumns[Books::Status].name, "status"), "books 列顺序与枚举不一致");
+static_assert(sameName(kBookColumns[Books::Version].name, "version"), "books 列顺序与枚举不一致");
+
+constexpr Table kBooks = {"books", kBookColumns, Books::ColumnCount, nullptr};
+
+// ---- readers ----
+namespace Readers {
+enum Column {
+    Id, CardNumber, Name, Gender, BirthDate, Phone, Email, Address, ReaderType,
+    MaxBorrow, MaxDays, Status, RegistrationDate, ExpiryDate, Notes,
+    ColumnCount
+};
+}
+
+constexpr Column kReaderColumns[] = {
+    {"id", "INTEGER PRIMARY KEY AUTOINCREMENT", "ID"},
+    {"card_number", "TEXT UNIQUE NOT NULL", "借书证号"},
+    {"name", "TEXT NOT NULL", "姓名"},
+    {"gender", "TEXT", "性别"},
+    {"birth_date", "DATE", "出生日期"},
+    {"phone", "TEXT", "电话"},
+    {"email", "TEXT", "邮箱"},
+    {"address", "TEXT", "地址"},
+    {"reader_type", "TEXT DEFAULT '普通读者'", "类型"},
+    {"max_borrow", "INTEGER DEFAULT 5", "可借册数"},
+    {"max_days", "INTEGER DEFAULT 30", "可借天数"},
+    {"status", "TEXT DEFAULT '正常'", "状态"},
+    {"registration_date", "DATE DEFAULT CURRENT_DATE", "注册日期"},
+    {"expiry_date", "DATE", "有效期至"},
+    {"notes", "TEXT", "备注"},
+};
+static_assert(sizeof(kReaderColumns) / sizeof(kReaderColumns[0]) == Readers::ColumnCount, "readers 列数与枚举不一致");
+static_assert(sameName(kReaderColumns[Readers::MaxDays].name, "max_days"), "readers 列顺序与枚举不一致");
+static_assert(sameName(kReaderColumns[Readers::Status].name, "status"), "readers 列顺序与枚举不一致");
+
+constexpr Table kReaders = {"readers", kReaderColumns, Readers::ColumnCount, nullptr};
+
+// ---- borrow_records ----
+namespace BorrowRecords {
+enum Column {
+    Id, BookId, ReaderId, BorrowDate, DueDate, ReturnDate, RenewCount, Status, OverdueFee, CopyId,
+    ColumnCount
+};
+}
+
+constexpr Column kBorrowRecordColumns[] = {
+    {"id", "INTEGER PRIMARY KEY AUTOINCREMENT", "记录ID"},
+    {"book_id", "INTEGER NOT NULL", "图书ID"},
+    {"reader_id", "INTEGER NOT NULL", "读者ID"},
+    {"borrow_date", "DATE NOT NULL", "借书日期"},
+    {"due_date", "DATE NOT NULL", "应还日期"},
+    {"return_date", "DATE", "归还日期"},
+    {"renew_count", "INTEGER DEFAULT 0", "续借次数"},
+    {"status", "TEXT DEFAULT '借出'", "状态"},
+    {"overdue_fee", "REAL DEFAULT 0", "逾期费用"},
+    // 按单册借出时为所借的单册，按书目借出（该书没有登记单册）时为空
+    {"copy_id", "INTEGER", "单册ID"},
+};
+static_assert(sizeof(kBorrowRecordColumns) / sizeof(kBorrowRecordColumns[0]) == BorrowRecords::ColumnCount,
+              "borrow_records 列数与枚举不一致");
+static_assert(sameName(kBorrowRecordColumns[BorrowRecords::RenewCount].name, "renew_count"),
+              "borrow_records 列顺序与枚举不一致");
+static_assert(sameName(kBorrowRecordColumns[BorrowRecords::CopyId].name, "copy_id"),
+              "borrow_records 列顺序与枚举不一致");
+
+constexpr Table kBorrowRecords = {"borrow_records", kBorrowRecordColumns, BorrowRecords::ColumnCount,
+                                  "FOREIGN KEY(book_id) REFERENCES books(id),"
+                                  "FOREIGN KEY(reader_id) REFERENCES readers(id)"};
+
+// ---- copies ----
+// 每册实体书一行。登记了单册的图书按单册条码借还，同一书目的不同单册互不争用；
+// books 中的总数量与可借数量随单册的登记与借还同步维护
+namespace Copies {
+enum Column { Id, BookId, Barcode, Location, State, Version, CreatedDate, ColumnCount };
+}
+
+constexpr Column kCopyColumns[] = {
+    {"id", "INTEGER PRIMARY KEY AUTOINCREMENT", "单册ID"},
+    {"book_id", "INTEGER NOT NULL", "图书ID"},
+    {"barcode", "TEXT UNIQUE NOT NULL", "条码"},
+    {"location", "TEXT", "位置"},
+    {"state", "TEXT NOT NULL DEFAULT '在架'", "状态"},  // 在架、借出、预留、维护中、遗失
+    {"version", "INTEGER NOT NULL DEFAULT 0", "版本"},
+    {"created_date", "TIMESTAMP DEFAULT CURRENT_TIMESTAMP", "登记时间"},
+};
+static_assert(sizeof(kCopyColumns) / sizeof(kCopyColumns[0]) == Copies::ColumnCount, "copies 列数与枚举不一致");
+static_assert(sameName(kCopyColumns[Copies::State].name, "state"), "copies 列顺序与枚举不一致");
+
+constexpr Table kCopies = {"copies", kCopyColumns, Copies::ColumnCount,
+                           "FOREIGN KEY(book_id) REFERENCES books(id)"};
+
+// ---- holds ----
+// 图书全部借出时读者排队预约。等待中的预约按 (优先级降序, id) 排队，
+// 还书时队首的预约分到归还的这一册，转为待取并在取书期限前为其保留
+namespace Holds {
+enum Column { Id, BookId, ReaderId, Priority, RequestDate, Status, CopyId, ReadyDate, PickupDeadline, ColumnCount };
+}
+
+constexpr Column kHoldColumns[] = {
+    {"id", "INTEGER PRIMARY KEY AUTOINCREMENT", "预约ID"},
+    {"book_id", "INTEGER NOT NULL", "图书ID"},
+    {"reader_id", "INTEGER NOT NULL", "读者ID"},
+    {"priority", "INTEGER NOT NULL DEFAULT 0", "优先级"},  // 预约时按读者类型确定
+    {"request_date", "TIMESTAMP DEFAULT CURRENT_TIMESTAMP", "预约时间"},
+    {"status", "TEXT NOT NULL DEFAULT '等待'", "状态"},  // 等待、待取、已借、已取消、已过期
+    {"copy_id", "INTEGER", "保留单册"},                   // 待取时保留的单册，按书目保留时为空
+    {"ready_date", "DATE", "到书日期"},
+    {"pickup_deadline", "DATE", "取书截止"},
+};
+static_assert(sizeof(kHoldColumns) / sizeof(kHoldColumns[0]) == Holds::ColumnCount, "holds 列数与枚举不一致");
+static_assert(sameName(kHoldColumns[Holds::Status].name, "status"), "holds 列顺序与枚举不一致");
+
+constexpr Table kHolds = {"holds", kHoldColumns, Holds::ColumnCount,
+                          "FOREIGN KEY(book_id) REFERENCES books(id),"
+                          "FOREIGN KEY(reader_id) REFERENCES readers(id)"};
+
+// ---- borrow_history ----
+namespace BorrowHistory {
+enum Column { Id, BookId, ReaderId, Action, ActionDate, Details, RecordId, DueDate, OverdueDays, Fee, ColumnCount };
+}
+
+// details 只有旧版本写入的历史才有；现在的历史只记结构化的字段，
+// 书名与读者姓名需要时再按编号查询。新增的列只能加在末尾（旧库用 ALTER TABLE 补上）
+
+constexpr Column kBorrowHistoryColumns[] = {
+    {"id", "INTEGER PRIMARY KEY AUTOINCREMENT", "ID"},
+    {"book_id", "INTEGER", "图书ID"},
+    {"reader_id", "INTEGER", "读者ID"},
+    {"action", "TEXT", "操作"},
+    {"action_date", "TIMESTAMP DEFAULT CURRENT_TIMESTAMP", "时间"},
+    {"details", "TEXT", "说明"},
+    {"record_id", "INTEGER", "借阅记录"},
+    {"due_date", "DATE", "应还日期"},
+    {"overdue_days", "INTEGER", "逾期天数"},
+    {"fee", "REAL", "费用"},
+};
+static_assert(sizeof(kBorrowHistoryColumns) / sizeof(kBorrowHistoryColumns[0]) == BorrowHistory::ColumnCount,
+              "borrow_history 列数与枚举不一致");
+static_assert(sameName(kBorrowHistoryColumns[BorrowHistory::RecordId].name, "record_id"),
+              "borrow_history 列顺序与枚举不一致");
+
+constexpr Table kBorrowHistory = {"borrow_history", kBorrowHistoryColumns, BorrowHistory::ColumnCount, nullptr};
+
+// ---- 逾期列表（查询结果） ----
+namespace OverdueList {
+enum Column { RecordId, BookTitle, ReaderName, BorrowDate, DueDate, OverdueDays, ReaderPhone, ColumnCount };
+}
+
+constexpr ResultColumn kOverdueListColumns[] = {
+    {"br.id", "记录ID"},
+    {"b.title", "图书名称"},
+    {"r.name", "读者姓名"},
+    {"br.borrow_date", "借书日期"},
+    {"br.due_date", "应还日期"},
+    {"julianday('now') - julianday(br.due_date)", "逾期天数"},
+    {"r.phone", "读者电话"},
+};
+static_assert(sizeof(kOverdueListColumns) / sizeof(kOverdueListColumns[0]) == OverdueList::ColumnCount,
+              "逾期列表列数与枚举不一致");
+
+// ---- 预约队列（查询结果） ----
+namespace HoldList {
+enum Column { HoldId, BookTitle, ReaderName, Status, RequestDate, PickupDeadline, CopyBarcode, ColumnCount };
+}
+
+constexpr ResultColumn kHoldListColumns[] = {
+    {"h.id", "预约ID"},
+    {"b.title", "图书名称"},
+    {"r.name", "读者姓名"},
+    {"h.status", "状态"},
+    {"h.request_date", "预约时间"},
+    {"h.pickup_deadline", "取书期限"},
+    {"c.barcode", "保留单册"},
+};
+static_assert(sizeof(kHoldListColumns) / sizeof(kHoldListColumns[0]) == HoldList::ColumnCount,
+              "预约队列列数与枚举不一致");
+
+constexpr const char *columnName(const Table &table, int column)
+{
+    return table.columns[column].name;
+}
+
+// 按表名查找上面定义的表，没有时返回空指针
+const Table *findTable(const QString &name);
+
+// CREATE TABLE IF NOT EXISTS 语句；schema 非空时建在该附加库中
+QString createSql(const Table &table, const QString &schema = QString());
+
+// 逗号分隔的列名，prefix 非空时每列加上表别名，例如 "br."
+QString columnList(const Table &table, const QString &prefix = QString());
+QString columnList(const ResultColumn *columns, int count);
+
+// 按列定义设置模型的水平表头
+void applyHeaders(QAbstractItemModel *model, const Table &table);
+void applyHeaders(QAbstractItemModel *model, const ResultColumn *columns, int count);
+
+// 整行读取：查询须按 columnList() 的顺序选出各列，offset 为该表第一列在结果中的位置
+struct BookRow
+{
+    int id = 0;
+    QString isbn;
+    QString title;
+    QString author;
+    QString publisher;
+    QDate publishDate;
+    QString category;
+    double price = 0.0;
+    int totalCopies = 0;
+    int availableCopies = 0;
+    QString location;
+    QString description;
+    QString status;
+    int version = 0;
+};
+
+struct ReaderRow
+{
+    int id = 0;
+    QString cardNumber;
+    QString name;
+    QString gender;
+    QDate birthDate;
+    QString phone;
+    QString email;
+    QString address;
+    QString readerType;
+    int maxBorrow = 0;
+    int maxDays = 0;  // 未设置时为 0
+    QString status;
+    QDate registrationDate;
+    QDate expiryDate;
+    QString notes;
+};
+
+struct BorrowRecordRow
+{
+    int id = 0;
+    int bookId = 0;
+    int readerId = 0;
+    QDate borrowDate;
+    QDate dueDate;
+    QDate returnDate;
+    int renewCount = 0;
+    QString status;
+    double overdueFee = 0.0;
+    int copyId = 0;  // 按书目借出时为 0
+};
+
+struct CopyRow
+{
+    int id = 0;
+    int bookId = 0;
+    QString barcode;
+    QString location;
+    QString state;
+    int version = 0;
+};
+
+struct HoldRow
+{
+    int id = 0;
+    int bookId = 0;
+    int readerId = 0;
+    int priority = 0;
+    QString status;
+    int copyId = 0;  // 按书目保留或尚未分到书时为 0
+    QDate readyDate;
+    QDate pickupDeadline;
+};
+
+BookRow readBook(const QSqlQuery &query, int offset = 0);
+ReaderRow readReader(const QSqlQuery &query, int offset = 0);
+BorrowRecordRow readBorrowRecord(const QSqlQuery &query, int offset = 0);
+CopyRow readCopy(const QSqlQuery &query, int offset = 0);
+HoldRow readHold(const QSqlQuery &query, int offset = 0);
+
+} // namespace Schema
+
+#endif // SCHEMA_H
@@ -0,0 +1,135 @@
+﻿// stallwatchdog.cpp
+#include "stallwatchdog.h"
+#include "perfmonitor.h"
+#include <QDateTime>
+#include <QFile>
+#include <QMap>
+#include <QTextStream>
+#include <QTimer>
+#include <algorithm>
+
+StallWatchdog::StallWatchdog(int thresholdMs, const QString &logFile, QObject *parent)
+    : QThread(parent)
+    , watchedThread(QThread::currentThread())
+    , thresholdMs(qMax(20, thresholdMs))
+    , intervalMs(qBound(5, thresholdMs / 4, 100))
+    , logFile(logFile)
+    , maxBytes(1024 * 1024)
+    , keepFiles(3)
+    , heartbeatTimer(new QTimer(this))
+    , lastBeat(0)
+    , stopping(0)
+{
+    clock.start();
+
+    // 打点只在事件循环空转时发生，模态对话框的嵌套事件循环同样会打点
+    heartbeatTimer->setInterval(intervalMs);
+    connect(heartbeatTimer, &QTimer::timeout, [this]() {
+        lastBeat.storeRelease(clock.elapsed());
+    });
+}
+
+StallWatchdog::~StallWatchdog()
+{
+    stopWatching();
+}
+
+void StallWatchdog::setRotation(qint64 maxBytes, int keepFiles)
+{
+    this->maxBytes = qMax<qint64>(4096, maxBytes);
+    this->keepFiles = qMax(1, keepFiles);
+}
+
+void StallWatchdog::startWatching()
+{
+    if (isRunning()) {
+        return;
+    }
+    stopping.storeRelease(0);
+    lastBeat.storeRelease(clock.elapsed());
+    heartbeatTimer->start();
+    start(QThread::LowPriority);
+}
+
+void StallWatchdog::stopWatching()
+{
+    heartbeatTimer->stop();
+    stopping.storeRelease(1);
+    wait();
+}
+
+void StallWatchdog::run()
+{
+    qint64 currentBeat = lastBeat.loadAcquire();
+    QMap<QString, int> samples;  // 本次打点间隔内采样到的活动及次数
+
+    while (!stopping.loadAcquire()) {
+        msleep(static_cast<unsigned long>(intervalMs));
+
+        qint64 beat = lastBeat.loadAcquire();
+        if (beat != currentBeat) {
+            // 事件循环恢复，上一个间隔过长即为一次卡顿
+            qint64 stallMs = beat - currentBeat - intervalMs;
+            if (stallMs >= thresholdMs) {
+                QList<QPair<int, QString> > ranked;
+                for (auto it = samples.constBegin(); it != samples.constEnd(); ++it) {
+                    ranked.append(qMakePair(it.value(), it.key()));
+                }
+                std::sort(ranked.begin(), ranked.end(),
+                          [](const QPair<int, QString> &a, const QPair<int, QString> &b) {
+                              return a.first > b.first;
+                          });
+                QStringList activities;
+                for (const QPair<int, QString> &entry : ranked) {
+                    activities.append(QString("%1 ×%2").arg(entry.second).arg(entry.first));
+                }
+                PerfMonitor::record(PerfMonitor::Operation, "界面卡顿", stallMs * 1000000);
+                writeReport(stallMs, activities.isEmpty() ? QString("（未记录到操作）") : activities.join("; "));
+            }
+            currentBeat = beat;
+            samples.clear();
+            continue;
+        }
+
+        // 打点未更新：记录被监视线程此刻在做什么
+        PerfMonitor::Activity activity = PerfMonitor::activity(watchedThread);
+        QString key = activity.operation.isEmpty() ? QString("（未计时的操作）")
+                                                   : QString::fromUtf8(activity.operation);
+        if (!activity.statement.isEmpty()) {
+            key += " / " + QString::fromUtf8(activity.statement);
+        }
+        ++samples[key];
+    }
+}
+
+void StallWatchdog::writeReport(qint64 stallMs, const QString &activities)
+{
+    if (logFile.isEmpty()) {
+        return;
+    }
+
+    rotateLog();
+
+    QFile file(logFile);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        return;
+    }
+    QTextStream out(&file);
+    out.setCodec("UTF-8");
+    out << QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss.zzz")
+        << " 卡顿 " << stallMs << " ms: " << activities << "\n";
+}
+
+void StallWatchdog::rotateLog()
+{
+    QFile file(logFile);
+    if (!file.exists() || file.size() < maxBytes) {
+        return;
+    }
+
+    QFile::remove(QString("%1.%2").arg(logFile).arg(keepFiles));
+    for (int i = keepFiles - 1; i >= 1; --i) {
+        QFile::rename(QString("%1.%2").arg(logFile).arg(i), QString("%1.%2").arg(logFile).arg(i + 1));
+    }
+    QFile::rename(logFile, logFile + ".1");
+}
@@ -0,0 +1,50 @@
+﻿// stallwatchdog.h
+#ifndef STALLWATCHDOG_H
+#define STALLWATCHDOG_H
+
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QString>
+#include <QThread>
+
+class QTimer;
+
+// 界面卡顿监视：被监视线程的事件循环定时打点，监视线程发现打点中断超过阈值时，
+// 按中断期间采样到的操作与 SQL（来自 PerfMonitor 公布的当前活动）写一条卡顿记录。
+// 记录写入按大小轮转的日志文件，卡顿时长同时计入 PerfMonitor 的“界面卡顿”。
+class StallWatchdog : public QThread
+{
+    Q_OBJECT
+
+public:
+    // 监视创建者所在的线程，须在该线程中创建
+    explicit StallWatchdog(int thresholdMs, const QString &logFile, QObject *parent = nullptr);
+    ~StallWatchdog();
+
+    // 日志超过 maxBytes 时轮转为 .1、.2…，最多保留 keepFiles 个旧文件
+    void setRotation(qint64 maxBytes, int keepFiles);
+
+    void startWatching();
+    void stopWatching();
+
+protected:
+    void run() override;
+
+private:
+    void writeReport(qint64 stallMs, const QString &activities);
+    void rotateLog();
+
+    QThread *watchedThread;
+    int thresholdMs;
+    int intervalMs;
+    QString logFile;
+    qint64 maxBytes;
+    int keepFiles;
+
+    QTimer *heartbeatTimer;
+    QElapsedTimer clock;
+    QAtomicInteger<qint64> lastBeat;
+    QAtomicInt stopping;
+};
+
+#endif // STALLWATCHDOG_H
@@ -0,0 +1,224 @@
+﻿// tableio.cpp
+#include "tableio.h"
+#include "changejournal.h"
+#include "perfmonitor.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSaveFile>
+#include <QSqlError>
+#include <QStringList>
+#include <QTextStream>
+#include <QVariant>
+
+namespace {
+
+// 读一条记录；引号内的换行属于字段内容，记录可能跨越多行。到达文件末尾时返回 false
+bool readRecord(QTextStream &in, QStringList *fields)
+{
+    fields->clear();
+    if (in.atEnd()) {
+        return false;
+    }
+
+    QString field;
+    bool quoted = false;
+    QString line = in.readLine();
+    for (;;) {
+        for (int i = 0; i < line.size(); ++i) {
+            const QChar c = line.at(i);
+            if (quoted) {
+                if (c == '"') {
+                    if (i + 1 < line.size() && line.at(i + 1) == '"') {
+                        field.append('"');
+                        ++i;
+                    } else {
+                        quoted = false;
+                    }
+                } else {
+                    field.append(c);
+                }
+            } else if (c == '"') {
+                quoted = true;
+            } else if (c == ',') {
+                fields->append(field);
+                field.clear();
+            } else {
+                field.append(c);
+            }
+        }
+        if (!quoted || in.atEnd()) {
+            break;
+        }
+        field.append('\n');
+        line = in.readLine();
+    }
+    fields->append(field);
+    return true;
+}
+
+} // namespace
+
+namespace TableIO {
+
+QString csvField(const QString &value)
+{
+    if (value.contains(',') || value.contains('"') || value.contains('\n') || value.contains('\r')) {
+        QString escaped = value;
+        escaped.replace("\"", "\"\"");
+        return "\"" + escaped + "\"";
+    }
+    return value;
+}
+
+bool exportCsv(const QSqlDatabase &db, const Schema::Table &table, const QString &path,
+               Result *result, QString *error, const QString &where)
+{
+    ScopedTimer timer("导出CSV");
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    TimedQuery query(db);
+    query.setForwardOnly(true);
+    QString sql = QString("SELECT %1 FROM %2").arg(Schema::columnList(table), table.name);
+    if (!where.isEmpty()) {
+        sql += " WHERE " + where;
+    }
+    sql += QString(" ORDER BY %1").arg(table.columns[0].name);
+    if (!query.exec(sql)) {
+        if (error) *error = query.lastError().text();
+        return false;
+    }
+
+    // 写完才替换目标文件，定时任务中途失败不会留下半个文件
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        if (error) *error = QString("无法写入 %1：%2").arg(path, file.errorString());
+        return false;
+    }
+    QTextStream out(&file);
+    out.setCodec("UTF-8");
+
+    QStringList fields;
+    for (int i = 0; i < table.columnCount; ++i) {
+        fields.append(table.columns[i].name);
+    }
+    out << fields.join(',') << '\n';
+
+    qint64 rows = 0;
+    while (query.next()) {
+        fields.clear();
+        for (int i = 0; i < table.columnCount; ++i) {
+            fields.append(csvField(query.value(i).toString()));
+        }
+        out << fields.join(',') << '\n';
+        ++rows;
+    }
+    out.flush();
+
+    if (!file.commit()) {
+        if (error) *error = QString("无法写入 %1：%2").arg(path, file.errorString());
+        return false;
+    }
+    if (result) {
+        result->rows = rows;
+        result->elapsedMs = elapsed.elapsed();
+    }
+    return true;
+}
+
+bool importCsv(const QSqlDatabase &db, const Schema::Table &table, const QString &path,
+               bool replace, Result *result, QString *error)
+{
+    ScopedTimer timer("导入CSV");
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        if (error) *error = QString("无法读取 %1：%2").arg(path, file.errorString());
+        return false;
+    }
+    QTextStream in(&file);
+    in.setCodec("UTF-8");
+
+    QStringList header;
+    if (!readRecord(in, &header) || header.isEmpty()) {
+        if (error) *error = "文件为空";
+        return false;
+    }
+    for (QString &name : header) {
+        name = name.trimmed();
+        bool known = false;
+        for (int i = 0; i < table.columnCount && !known; ++i) {
+            known = name == QLatin1String(table.columns[i].name);
+        }
+        if (!known) {
+            if (error) *error = QString("表 %1 没有列 %2").arg(table.name, name);
+            return false;
+        }
+    }
+
+    QStringList placeholders;
+    for (int i = 0; i < header.size(); ++i) {
+        placeholders.append("?");
+    }
+
+    QSqlDatabase connection = db;
+    connection.transaction();
+
+    // 整个导入在变更日志中是一个事务，按时间点恢复时不会只恢复一部分
+    bool journalTransaction = false;
+    QSqlError journalError;
+    if (!ChangeJournal::beginTransaction(connection, &journalTransaction, &journalError)) {
+        if (error) *error = journalError.text();
+        connection.rollback();
+        return false;
+    }
+
+    TimedQuery insert(connection);
+    if (!insert.prepare(QString("%1 INTO %2 (%3) VALUES (%4)")
+                            .arg(replace ? "INSERT OR REPLACE" : "INSERT", table.name,
+                                 header.join(", "), placeholders.join(", ")))) {
+        if (error) *error = insert.lastError().text();
+        connection.rollback();
+        return false;
+    }
+
+    // 出错时报告的是第几条数据记录（不含列名行）
+    qint64 rows = 0;
+    int record = 0;
+    QStringList fields;
+    while (readRecord(in, &fields)) {
+        ++record;
+        if (fields.size() == 1 && fields.first().isEmpty()) {
+            continue;  // 空行
+        }
+        if (fields.size() != header.size()) {
+            if (error) *error = QString("第 %1 条记录有 %2 个字段，应为 %3 个").arg(record).arg(fields.size()).arg(header.size());
+            connection.rollback();
+            return false;
+        }
+        for (int i = 0; i < fields.size(); ++i) {
+            insert.bindValue(i, fields.at(i).isEmpty() ? QVariant(QVariant::String) : QVariant(fields.at(i)));
+        }
+        if (!insert.exec()) {
+            if (error) *error = QString("第 %1 条记录：%2").arg(record).arg(insert.lastError().text());
+            connection.rollback();
+            return false;
+        }
+        ++rows;
+    }
+
+    if ((journalTransaction && !ChangeJournal::endTransaction(connection, &journalError)) || !connection.commit()) {
+        if (error) *error = journalError.isValid() ? journalError.text() : connection.lastError().text();
+        connection.rollback();
+        return false;
+    }
+    if (result) {
+        result->rows = rows;
+        result->elapsedMs = elapsed.elapsed();
+    }
+    return true;
+}
+
+} // namespace TableIO
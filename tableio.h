@@ -0,0 +1,33 @@
+﻿// tableio.h
+#ifndef TABLEIO_H
+#define TABLEIO_H
+
+#include <QSqlDatabase>
+#include <QString>
+#include "schema.h"
+
+// 整表的 CSV 导入导出（UTF-8，首行为列名），供命令行工具的批处理任务使用。
+// 字段含逗号、引号或换行时按 RFC 4180 加引号；导入时空字段写入 NULL。
+namespace TableIO {
+
+struct Result
+{
+    qint64 rows = 0;
+    qint64 elapsedMs = 0;
+};
+
+// 需要时加引号的单个字段
+QString csvField(const QString &value);
+
+// 按 Schema 中的列顺序导出整张表，where 非空时只导出满足条件的行
+bool exportCsv(const QSqlDatabase &db, const Schema::Table &table, const QString &path,
+               Result *result, QString *error, const QString &where = QString());
+
+// 在一个事务中导入，任何一行失败都整体回滚。首行的列名须都属于该表，
+// 未出现的列取表的默认值；replace 为 true 时主键或唯一键冲突的行被覆盖
+bool importCsv(const QSqlDatabase &db, const Schema::Table &table, const QString &path,
+               bool replace, Result *result, QString *error);
+
+} // namespace TableIO
+
+#endif // TABLEIO_H
@@ -0,0 +1,18 @@
+# 核心模块的正确性测试（QtTest）：备份归档、按时间点恢复、预约与成组提交。
+#
+#   qmake && make && ./tst_librarycore
+#
+# 每个测试在临时目录中新建数据库，不依赖已有数据，也不读写当前目录。
+
+QT += testlib
+QT -= gui
+
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_librarycore
+
+include(../core.pri)
+
+SOURCES += \
+    tst_librarycore.cpp
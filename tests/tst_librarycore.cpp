@@ -0,0 +1,379 @@
+﻿// tst_librarycore.cpp
+#include "librarycore.h"
+#include "backuparchive.h"
+#include "changejournal.h"
+#include "historylog.h"
+#include <QtTest>
+#include <QtSql>
+#include <QProcess>
+#include <QTemporaryDir>
+#include <cstdio>
+
+// 以无界面方式驱动 LibraryCore 与备份模块，检查结果是否正确。
+// 每个测试函数在新的临时目录中建库，互不影响。
+class LibraryCoreTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void archiveRoundTrip();
+    void pointInTimeRestore();
+    void holdQueue();
+    void groupCommitIsolation();
+    void historyReplayAfterCrash();
+    void historyQueueChild();
+
+private:
+    bool openCore();
+    void closeCore();
+    int addBook(const QString &title, int copies);
+    int addReader(const QString &cardNumber);
+    QVariant value(QSqlDatabase db, const QString &sql);
+
+    QTemporaryDir *dir = nullptr;
+    LibraryCore *core = nullptr;
+    QString path;
+};
+
+namespace {
+
+const char *const kCoreConnection = "tst_librarycore";
+
+QByteArray fileContents(const QString &path)
+{
+    QFile file(path);
+    return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+}
+
+} // namespace
+
+void LibraryCoreTest::init()
+{
+    dir = new QTemporaryDir;
+    QVERIFY(dir->isValid());
+    path = dir->filePath("library.db");
+    QVERIFY(openCore());
+}
+
+void LibraryCoreTest::cleanup()
+{
+    closeCore();
+    delete dir;
+    dir = nullptr;
+}
+
+bool LibraryCoreTest::openCore()
+{
+    core = new LibraryCore(QLatin1String(kCoreConnection));
+    QString error;
+    if (!core->open(path, &error)) {
+        qWarning("无法打开测试库：%s", qPrintable(error));
+        return false;
+    }
+    // 新建的汇总表直接生成，测试中不需要后台线程
+    core->rebuildStaleExtensions();
+    return core->warnings().isEmpty();
+}
+
+// 关闭后主库的 WAL 已合并，文件本身就是一致的快照
+void LibraryCoreTest::closeCore()
+{
+    if (core) {
+        core->close();
+        delete core;
+        core = nullptr;
+    }
+    QSqlDatabase::removeDatabase(QLatin1String(kCoreConnection));
+}
+
+int LibraryCoreTest::addBook(const QString &title, int copies)
+{
+    QSqlQuery query(core->database());
+    query.prepare("INSERT INTO books (isbn, title, author, category, total_copies, available_copies) "
+                  "VALUES (?, ?, '测试作者', '测试', ?, ?)");
+    query.addBindValue(QString("978%1").arg(qHash(title), 10, 10, QChar('0')));
+    query.addBindValue(title);
+    query.addBindValue(copies);
+    query.addBindValue(copies);
+    return query.exec() ? query.lastInsertId().toInt() : 0;
+}
+
+int LibraryCoreTest::addReader(const QString &cardNumber)
+{
+    QSqlQuery query(core->database());
+    query.prepare("INSERT INTO readers (card_number, name) VALUES (?, ?)");
+    query.addBindValue(cardNumber);
+    query.addBindValue("读者" + cardNumber);
+    return query.exec() ? query.lastInsertId().toInt() : 0;
+}
+
+QVariant LibraryCoreTest::value(QSqlDatabase db, const QString &sql)
+{
+    QSqlQuery query(db);
+    return query.exec(sql) && query.next() ? query.value(0) : QVariant();
+}
+
+void LibraryCoreTest::archiveRoundTrip()
+{
+    for (int i = 0; i < 500; ++i) {
+        QVERIFY(addBook(QString("归档测试图书%1").arg(i), 1 + i % 3) > 0);
+    }
+    closeCore();
+
+    const QString archivePath = dir->filePath("library.lmba");
+    const QString extractedPath = dir->filePath("extracted.db");
+    BackupArchive::Result result;
+    QString error;
+    QVERIFY2(BackupArchive::create(path, archivePath, &result, &error), qPrintable(error));
+    QCOMPARE(result.originalBytes, QFileInfo(path).size());
+    QVERIFY(BackupArchive::isArchive(archivePath));
+    QVERIFY2(BackupArchive::verify(archivePath, &result, &error), qPrintable(error));
+    QVERIFY2(BackupArchive::extract(archivePath, extractedPath, &result, &error), qPrintable(error));
+    QCOMPARE(fileContents(extractedPath), fileContents(path));
+
+    // 改动第一个压缩块中的一个字节，校验与解压都要发现
+    {
+        QFile archive(archivePath);
+        QVERIFY(archive.open(QIODevice::ReadWrite));
+        const qint64 offset = 8 + 16;
+        char byte = 0;
+        QVERIFY(archive.seek(offset) && archive.getChar(&byte));
+        QVERIFY(archive.seek(offset) && archive.putChar(char(byte ^ 0x5A)));
+    }
+    error.clear();
+    QVERIFY(!BackupArchive::verify(archivePath, &result, &error));
+    QVERIFY(!error.isEmpty());
+    const QString corruptPath = dir->filePath("corrupt.db");
+    QVERIFY(!BackupArchive::extract(archivePath, corruptPath, &result, &error));
+    QVERIFY(!QFile::exists(corruptPath));
+}
+
+void LibraryCoreTest::pointInTimeRestore()
+{
+    const QString backupDir = dir->filePath("incremental");
+    QVERIFY(QDir().mkpath(backupDir));
+    QString error;
+    QVERIFY2(ChangeJournal::enable(core->database(), &error), qPrintable(error));
+
+    const int before = addBook("恢复点之前借出", 1);
+    const int after = addBook("恢复点之后借出", 1);
+    const int reader = addReader("PITR0001");
+    QVERIFY(before > 0 && after > 0 && reader > 0);
+
+    // 基础快照：关闭数据库后复制文件
+    const QDateTime startedAt = QDateTime::currentDateTime();
+    closeCore();
+    const QString snapshotPath = QDir(backupDir).filePath("base_pending.db");
+    QVERIFY(QFile::copy(path, snapshotPath));
+    QVERIFY(openCore());
+    QVERIFY2(ChangeJournal::registerBaseSnapshot(core->database(), backupDir, snapshotPath, startedAt, &error),
+             qPrintable(error));
+
+    const int firstRecord = core->borrowBook(before, reader, 14).recordId;
+    QTest::qSleep(50);
+    const QDateTime midpoint = QDateTime::currentDateTime();
+    QTest::qSleep(50);
+    core->borrowBook(after, reader, 14);
+
+    ChangeJournal::BackupStats stats;
+    QVERIFY2(ChangeJournal::exportSegment(core->database(), backupDir, &stats, &error), qPrintable(error));
+    QVERIFY(stats.entries > 0);
+
+    const QString restoredPath = dir->filePath("restored.db");
+    QVERIFY2(ChangeJournal::restoreToPointInTime(backupDir, midpoint, restoredPath, &stats, &error),
+             qPrintable(error));
+    QVERIFY(stats.entries > 0);
+
+    // 恢复点之前的借书完整重放，之后的一条也没有
+    {
+        QSqlDatabase restored = QSqlDatabase::addDatabase("QSQLITE", "tst_restored");
+        restored.setDatabaseName(restoredPath);
+        QVERIFY(restored.open());
+        QCOMPARE(value(restored, "SELECT COUNT(*) FROM borrow_records").toInt(), 1);
+        QCOMPARE(value(restored, "SELECT id FROM borrow_records").toInt(), firstRecord);
+        QCOMPARE(value(restored, QString("SELECT available_copies FROM books WHERE id = %1").arg(before)).toInt(), 0);
+        QCOMPARE(value(restored, QString("SELECT available_copies FROM books WHERE id = %1").arg(after)).toInt(), 1);
+        restored.close();
+    }
+    QSqlDatabase::removeDatabase("tst_restored");
+}
+
+void LibraryCoreTest::holdQueue()
+{
+    const int book = addBook("预约测试图书", 1);
+    const int borrower = addReader("HOLD0001");
+    const int waiting = addReader("HOLD0002");
+    const int other = addReader("HOLD0003");
+
+    const LibraryCore::BorrowResult loan = core->borrowBook(book, borrower, 14);
+    QVERIFY(loan.recordId > 0);
+
+    const LibraryCore::HoldResult hold = core->placeHold(book, waiting);
+    QVERIFY(hold.holdId > 0);
+    QCOMPARE(hold.position, 1);
+
+    // 归还的这一册分给队首的预约，不回到书架
+    const LibraryCore::ReturnResult returned = core->returnBook(loan.recordId);
+    QCOMPARE(returned.holdId, hold.holdId);
+    QCOMPARE(returned.holdReaderId, waiting);
+    QVERIFY(returned.pickupDeadline.isValid());
+    QCOMPARE(value(core->database(), QString("SELECT status FROM holds WHERE id = %1").arg(hold.holdId)).toString(),
+             QString("待取"));
+    QCOMPARE(value(core->database(), QString("SELECT available_copies FROM books WHERE id = %1").arg(book)).toInt(), 0);
+
+    // 保留的书不借给其他读者
+    bool refused = false;
+    try {
+        core->borrowBook(book, other, 14);
+    } catch (const QString &) {
+        refused = true;
+    }
+    QVERIFY(refused);
+
+    const LibraryCore::BorrowResult pickup = core->borrowBook(book, waiting, 14);
+    QVERIFY(pickup.recordId > 0);
+    QCOMPARE(value(core->database(), QString("SELECT status FROM holds WHERE id = %1").arg(hold.holdId)).toString(),
+             QString("已借"));
+    QCOMPARE(value(core->database(), QString("SELECT available_copies FROM books WHERE id = %1").arg(book)).toInt(), 0);
+}
+
+void LibraryCoreTest::groupCommitIsolation()
+{
+    const int first = addBook("成组提交一", 1);
+    const int second = addBook("成组提交二", 1);
+    const int discarded = addBook("整组撤销", 1);
+    const int reader = addReader("GROUP0001");
+    const QString loans = QString("SELECT COUNT(*) FROM borrow_records WHERE reader_id = %1").arg(reader);
+
+    // 组内失败的操作只撤销自身，其余操作随整组提交
+    QString error;
+    QVERIFY2(core->beginGroup(&error), qPrintable(error));
+    core->borrowBook(first, reader, 14);
+    bool failed = false;
+    try {
+        core->borrowBook(first, reader, 14);
+    } catch (const QString &) {
+        failed = true;
+    }
+    QVERIFY(failed);
+    failed = false;
+    try {
+        core->borrowBook(999999, reader, 14);
+    } catch (const QString &) {
+        failed = true;
+    }
+    QVERIFY(failed);
+    core->borrowBook(second, reader, 14);
+    QVERIFY2(core->commitGroup(&error), qPrintable(error));
+
+    QCOMPARE(value(core->database(), loans).toInt(), 2);
+    QCOMPARE(value(core->database(), QString("SELECT available_copies FROM books WHERE id = %1").arg(first)).toInt(), 0);
+    QCOMPARE(value(core->database(), QString("SELECT available_copies FROM books WHERE id = %1").arg(second)).toInt(), 0);
+
+    // 整组撤销时组内成功的操作也不留痕迹
+    QVERIFY2(core->beginGroup(&error), qPrintable(error));
+    core->borrowBook(discarded, reader, 14);
+    core->rollbackGroup();
+    QCOMPARE(value(core->database(), loans).toInt(), 2);
+    QCOMPARE(value(core->database(), QString("SELECT available_copies FROM books WHERE id = %1").arg(discarded)).toInt(), 1);
+
+    // 撤销后缓存不能还记着组内的借出
+    const LibraryCore::BorrowResult again = core->borrowBook(discarded, reader, 14);
+    QVERIFY(again.recordId > 0);
+    QCOMPARE(value(core->database(), loans).toInt(), 3);
+
+    // 提交的借出写入了借阅历史，撤销的没有
+    closeCore();
+    QVERIFY(openCore());
+    QCOMPARE(value(core->database(), QString("SELECT COUNT(*) FROM borrow_history WHERE reader_id = %1 AND action = '借出'")
+                                         .arg(reader)).toInt(), 3);
+}
+
+void LibraryCoreTest::historyReplayAfterCrash()
+{
+    const int book = addBook("历史补写", 1);
+    const int reader = addReader("HIST0001");
+    closeCore();
+
+    // 子进程提交三条事件后，在另一个事务中追加两条但不提交，随即被杀掉
+    QProcessEnvironment childEnvironment = QProcessEnvironment::systemEnvironment();
+    childEnvironment.insert("LIBRARY_TEST_HISTORY_DB", path);
+    childEnvironment.insert("LIBRARY_TEST_HISTORY_BOOK", QString::number(book));
+    childEnvironment.insert("LIBRARY_TEST_HISTORY_READER", QString::number(reader));
+    QProcess child;
+    child.setProcessEnvironment(childEnvironment);
+    child.start(QCoreApplication::applicationFilePath(), QStringList() << "historyQueueChild");
+    bool staged = false;
+    while (!staged && child.waitForReadyRead(30000)) {
+        while (child.canReadLine()) {
+            staged = staged || child.readLine().trimmed() == "staged";
+        }
+    }
+    child.kill();
+    child.waitForFinished();
+    QVERIFY(staged);
+
+    // 重新打开时补写已提交而未写入的 1～3，跳过没有提交的 4、5
+    QVERIFY(openCore());
+    QCOMPARE(value(core->database(), QString("SELECT GROUP_CONCAT(overdue_days) FROM (SELECT overdue_days "
+                                             "FROM borrow_history WHERE reader_id = %1 ORDER BY overdue_days)")
+                                         .arg(reader)).toString(),
+             QString("1,2,3"));
+    QCOMPARE(value(core->database(), "SELECT MAX(applied_seq) FROM history_queue").toLongLong(), qint64(3));
+
+    // 再次打开不会重复补写
+    closeCore();
+    QVERIFY(openCore());
+    QCOMPARE(value(core->database(), QString("SELECT COUNT(*) FROM borrow_history WHERE reader_id = %1").arg(reader)).toInt(),
+             3);
+}
+
+void LibraryCoreTest::historyQueueChild()
+{
+    const QString childPath = QString::fromLocal8Bit(qgetenv("LIBRARY_TEST_HISTORY_DB"));
+    if (childPath.isEmpty()) {
+        QSKIP("由 historyReplayAfterCrash 启动的子进程执行");
+    }
+    const int book = qgetenv("LIBRARY_TEST_HISTORY_BOOK").toInt();
+    const int reader = qgetenv("LIBRARY_TEST_HISTORY_READER").toInt();
+    auto events = [book, reader](int first, int last) -> QVector<HistoryLog::Event> {
+        QVector<HistoryLog::Event> batch;
+        for (int marker = first; marker <= last; ++marker) {
+            HistoryLog::Event event;
+            event.action = "逾期提醒";
+            event.timestamp = QDateTime::currentMSecsSinceEpoch();
+            event.bookId = book;
+            event.readerId = reader;
+            event.overdueDays = marker;  // 用逾期天数标出是第几条
+            batch.append(event);
+        }
+        return batch;
+    };
+
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "tst_history_child");
+    db.setDatabaseName(childPath);
+    QVERIFY(db.open());
+    HistoryLog log;
+    QString error;
+    QVERIFY2(log.open(db, &error), qPrintable(error));
+    // 后台线程在进程被杀之前不写入，事件只在队列文件中
+    log.setBatchLimits(1000, 600000);
+
+    QVERIFY(db.transaction());
+    QVERIFY(log.stage(db, events(1, 3)));
+    QVERIFY(db.commit());
+    log.publish();
+
+    QVERIFY(db.transaction());
+    QVERIFY(log.stage(db, events(4, 5)));
+    std::printf("staged\n");
+    std::fflush(stdout);
+    QThread::sleep(60);
+}
+
+QTEST_GUILESS_MAIN(LibraryCoreTest)
+
+#include "tst_librarycore.moc"
@@ -0,0 +1,236 @@
+﻿// textscan.cpp
+#include "textscan.h"
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#  define TEXTSCAN_X86
+#  define TEXTSCAN_TARGET(isa) __attribute__((target(isa)))
+#  include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#  define TEXTSCAN_X86
+#  define TEXTSCAN_TARGET(isa)
+#  include <immintrin.h>
+#  include <intrin.h>
+#endif
+
+namespace {
+
+// 返回第一个匹配位置，没有时返回 -1
+typedef int (*Kernel)(const ushort *text, int length, const ushort *needle, int size);
+
+inline ushort fold(ushort c)
+{
+    return (c >= 'A' && c <= 'Z') ? ushort(c | 0x20) : c;
+}
+
+// needle 已折叠，逐个比较 size 个编码单元
+inline bool matchesAt(const ushort *text, const ushort *needle, int size)
+{
+    for (int i = 0; i < size; ++i) {
+        if (fold(text[i]) != needle[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int findScalar(const ushort *text, int length, const ushort *needle, int size)
+{
+    const ushort first = needle[0];
+    for (int i = 0; i + size <= length; ++i) {
+        if (fold(text[i]) == first && matchesAt(text + i + 1, needle + 1, size - 1)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// 向量循环结束后剩余部分用标量查找，位置换算回整段文本
+inline int findTail(const ushort *text, int length, int from, const ushort *needle, int size)
+{
+    int found = findScalar(text + from, length - from, needle, size);
+    return found < 0 ? -1 : from + found;
+}
+
+#ifdef TEXTSCAN_X86
+
+inline int lowestBit(unsigned mask)
+{
+#  ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int>(index);
+#  else
+    return __builtin_ctz(mask);
+#  endif
+}
+
+// 每次比较一整块起点：块内各位置的首字符与末字符同时相等时才逐个核对，
+// 大部分位置在这一步就被排除。有符号比较下 0x8000 以上的字符不会落入 A-Z，不受折叠影响。
+TEXTSCAN_TARGET("sse2")
+inline __m128i foldSse2(__m128i block)
+{
+    const __m128i upper = _mm_and_si128(_mm_cmpgt_epi16(block, _mm_set1_epi16('A' - 1)),
+                                        _mm_cmplt_epi16(block, _mm_set1_epi16('Z' + 1)));
+    return _mm_or_si128(block, _mm_and_si128(upper, _mm_set1_epi16(0x20)));
+}
+
+TEXTSCAN_TARGET("sse2")
+int findSse2(const ushort *text, int length, const ushort *needle, int size)
+{
+    const __m128i first = _mm_set1_epi16(static_cast<short>(needle[0]));
+    const __m128i last = _mm_set1_epi16(static_cast<short>(needle[size - 1]));
+
+    int i = 0;
+    for (; i + size - 1 + 8 <= length; i += 8) {
+        const __m128i blockFirst = foldSse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i)));
+        const __m128i blockLast = foldSse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i + size - 1)));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi16(blockFirst, first), _mm_cmpeq_epi16(blockLast, last))));
+        while (mask) {
+            int bit = lowestBit(mask);
+            if (matchesAt(text + i + bit / 2 + 1, needle + 1, size - 2 > 0 ? size - 2 : 0)) {
+                return i + bit / 2;
+            }
+            mask &= ~(3u << bit);
+        }
+    }
+    return findTail(text, length, i, needle, size);
+}
+
+TEXTSCAN_TARGET("avx2")
+inline __m256i foldAvx2(__m256i block)
+{
+    const __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi16(block, _mm256_set1_epi16('A' - 1)),
+                                           _mm256_cmpgt_epi16(_mm256_set1_epi16('Z' + 1), block));
+    return _mm256_or_si256(block, _mm256_and_si256(upper, _mm256_set1_epi16(0x20)));
+}
+
+TEXTSCAN_TARGET("avx2")
+int findAvx2(const ushort *text, int length, const ushort *needle, int size)
+{
+    // 不足一块的短文本直接交给 SSE2（AVX2 处理器必然支持 SSE2）
+    if (length < size - 1 + 16) {
+        return findSse2(text, length, needle, size);
+    }
+
+    const __m256i first = _mm256_set1_epi16(static_cast<short>(needle[0]));
+    const __m256i last = _mm256_set1_epi16(static_cast<short>(needle[size - 1]));
+
+    int i = 0;
+    for (; i + size - 1 + 16 <= length; i += 16) {
+        const __m256i blockFirst = foldAvx2(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(text + i)));
+        const __m256i blockLast = foldAvx2(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(text + i + size - 1)));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi16(blockFirst, first), _mm256_cmpeq_epi16(blockLast, last))));
+        while (mask) {
+            int bit = lowestBit(mask);
+            if (matchesAt(text + i + bit / 2 + 1, needle + 1, size - 2 > 0 ? size - 2 : 0)) {
+                return i + bit / 2;
+            }
+            mask &= ~(3u << bit);
+        }
+    }
+    _mm256_zeroupper();
+    return findTail(text, length, i, needle, size);
+}
+
+bool cpuHasSse2()
+{
+#  ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#  else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#  endif
+}
+
+bool cpuHasAvx2()
+{
+#  ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    // 还需操作系统保存 YMM 寄存器
+    __cpuid(info, 1);
+    if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#  else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#  endif
+}
+
+#endif // TEXTSCAN_X86
+
+struct Selection
+{
+    Kernel kernel;
+    const char *name;
+};
+
+Selection select()
+{
+    const char *requested = std::getenv("LIBRARY_TEXTSCAN");
+    const bool any = !requested || !*requested;
+#ifdef TEXTSCAN_X86
+    if ((any || std::strcmp(requested, "avx2") == 0) && cpuHasAvx2()) {
+        return Selection{findAvx2, "avx2"};
+    }
+    if ((any || std::strcmp(requested, "sse2") == 0) && cpuHasSse2()) {
+        return Selection{findSse2, "sse2"};
+    }
+#else
+    Q_UNUSED(any);
+#endif
+    return Selection{findScalar, "scalar"};
+}
+
+const Selection &selection()
+{
+    static const Selection selected = select();
+    return selected;
+}
+
+} // namespace
+
+namespace TextScan {
+
+Needle::Needle(const QString &text)
+{
+    folded.reserve(text.size());
+    for (QChar c : text) {
+        folded.append(fold(c.unicode()));
+    }
+}
+
+bool contains(const QChar *text, int length, const Needle &needle)
+{
+    return find(text, length, needle) >= 0;
+}
+
+int find(const QChar *text, int length, const Needle &needle)
+{
+    if (needle.isEmpty()) {
+        return 0;
+    }
+    if (needle.size() > length) {
+        return -1;
+    }
+    return selection().kernel(reinterpret_cast<const ushort *>(text), length, needle.data(), needle.size());
+}
+
+const char *implementation()
+{
+    return selection().name;
+}
+
+} // namespace TextScan
@@ -0,0 +1,38 @@
+﻿// textscan.h
+#ifndef TEXTSCAN_H
+#define TEXTSCAN_H
+
+#include <QString>
+#include <QVector>
+
+// 内存表的子串匹配，语义与转义了通配符的 SQLite LIKE '%...%' 相同：
+// 只有 ASCII 字母不区分大小写，其余字符按 UTF-16 编码单元逐个比较。
+// x86 上运行时检测 CPU，依次选用 AVX2、SSE2 与标量实现；
+// 设置环境变量 LIBRARY_TEXTSCAN=scalar/sse2/avx2 可指定实现（不支持时退回标量）。
+namespace TextScan {
+
+// 预处理后的查找串，可在多个线程中共用
+class Needle
+{
+public:
+    explicit Needle(const QString &text = QString());
+
+    bool isEmpty() const { return folded.isEmpty(); }
+    int size() const { return folded.size(); }
+    const ushort *data() const { return folded.constData(); }
+
+private:
+    QVector<ushort> folded;
+};
+
+bool contains(const QChar *text, int length, const Needle &needle);
+
+// 第一个匹配的位置，没有匹配时返回 -1。用于在多行首尾相接的连续文本中一次扫描
+int find(const QChar *text, int length, const Needle &needle);
+
+// 当前使用的实现名称
+const char *implementation();
+
+} // namespace TextScan
+
+#endif // TEXTSCAN_H
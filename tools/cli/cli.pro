@@ -0,0 +1,20 @@
+# 无界面的命令行工具，供定时任务与服务器上的批处理使用
+#
+#   library_cli --db library.db report --output report.txt
+#   library_cli overdue-sweep --remind
+#   library_cli backup backups/library_20240101.lmba --compress
+#   library_cli import books books.csv
+#   library_cli export readers readers.csv
+#   library_cli bench --iterations 20 --json perf.json
+
+QT -= gui
+
+CONFIG += console
+CONFIG -= app_bundle
+
+TARGET = library_cli
+
+include(../../core.pri)
+
+SOURCES += \
+    main.cpp
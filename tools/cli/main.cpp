@@ -0,0 +1,515 @@
+﻿// main.cpp
+#include "analyticsexport.h"
+#include "barcodeindex.h"
+#include "catalogsnapshot.h"
+#include "coborrowindex.h"
+#include "columnstore.h"
+#include "librarycore.h"
+#include "onlinebackup.h"
+#include "perfmonitor.h"
+#include "schema.h"
+#include "tableio.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDate>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSaveFile>
+#include <QSqlError>
+#include <QTextStream>
+
+namespace {
+
+// 退出码：0 成功，1 执行失败，2 命令行参数错误
+enum ExitCode { Success = 0, Failure = 1, Usage = 2 };
+
+QTextStream &out()
+{
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+QTextStream &err()
+{
+    static QTextStream stream(stderr);
+    return stream;
+}
+
+int fail(const QString &message)
+{
+    err() << message << endl;
+    return Failure;
+}
+
+// 只读命令用只读连接，不建表也不安装触发器，启动更快，也不会与前台争写锁
+bool openCore(LibraryCore *core, const QString &path, bool writable)
+{
+    if (!QFile::exists(path)) {
+        err() << "数据库不存在：" << path << endl;
+        return false;
+    }
+    QString error;
+    bool opened = writable ? core->open(path, &error) : core->openReadOnly(path, &error);
+    if (!opened) {
+        err() << "无法打开数据库：" << error << endl;
+        return false;
+    }
+    for (const QString &warning : core->warnings()) {
+        err() << "警告：" << warning << endl;
+    }
+    // 新建的汇总表是空的，命令行没有界面可卡，直接在本连接上生成
+    if (writable) {
+        for (const QString &warning : core->rebuildStaleExtensions()) {
+            err() << "警告：" << warning << endl;
+        }
+    }
+    return true;
+}
+
+bool writeText(const QString &path, const QString &text, QString *error)
+{
+    if (path.isEmpty() || path == "-") {
+        out() << text;
+        out().flush();
+        return true;
+    }
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        *error = file.errorString();
+        return false;
+    }
+    QTextStream stream(&file);
+    stream.setCodec("UTF-8");
+    stream << text;
+    stream.flush();
+    if (!file.commit()) {
+        *error = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+int runReport(const QString &dbPath, const QString &output)
+{
+    LibraryCore core;
+    if (!openCore(&core, dbPath, false)) {
+        return Failure;
+    }
+    QString error;
+    if (!writeText(output, core.generateReport(), &error)) {
+        return fail("无法写入报告：" + error);
+    }
+    return Success;
+}
+
+// 超过取书期限的预约判为过期，保留的书顺延给下一位预约或放回书架
+int runExpireHolds(const QString &dbPath)
+{
+    LibraryCore core;
+    if (!openCore(&core, dbPath, true)) {
+        return Failure;
+    }
+    try {
+        const int expired = core.expireHolds();
+        out() << "已过期的预约：" << expired << endl;
+    } catch (const QString &error) {
+        core.close();
+        return fail(error);
+    }
+    // 顺延产生的到书通知在关闭时写完
+    core.close();
+    return Success;
+}
+
+// 借过该书的读者还借得最多的图书（CSV）
+int runRecommend(const QString &dbPath, int bookId, int limit)
+{
+    LibraryCore core;
+    if (!openCore(&core, dbPath, false)) {
+        return Failure;
+    }
+    out() << "图书ID,图书名称,共同借阅人数" << endl;
+    for (const CoBorrowIndex::Recommendation &recommendation : CoBorrowIndex::recommend(core.database(), bookId, limit)) {
+        out() << recommendation.bookId << ',' << TableIO::csvField(recommendation.title) << ','
+              << recommendation.together << endl;
+    }
+    return Success;
+}
+
+// 按全部借阅记录（含归档）重新生成借阅关联
+int runRebuildCoBorrow(const QString &dbPath)
+{
+    LibraryCore core;
+    if (!openCore(&core, dbPath, true)) {
+        return Failure;
+    }
+    QString error;
+    const bool ok = CoBorrowIndex::rebuild(core.database(), &error);
+    core.close();
+    return ok ? Success : fail("重建借阅关联失败：" + error);
+}
+
+// 列出全部逾期记录（CSV）；remind 为 true 时为每条记录写入一条逾期提醒历史
+int runOverdueSweep(const QString &dbPath, const QString &output, bool remind)
+{
+    LibraryCore core;
+    if (!openCore(&core, dbPath, remind)) {
+        return Failure;
+    }
+    QSqlDatabase db = core.database();
+
+    TimedQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec(QString("SELECT %1 FROM borrow_records br "
+                            "JOIN books b ON br.book_id = b.id "
+                            "JOIN readers r ON br.reader_id = r.id "
+                            "WHERE br.status = '借出' AND br.due_date < date('now') "
+                            "ORDER BY br.due_date ASC")
+                        .arg(Schema::columnList(Schema::kOverdueListColumns, Schema::OverdueList::ColumnCount)))) {
+        return fail("查询逾期记录失败：" + query.lastError().text());
+    }
+
+    QStringList header;
+    for (int i = 0; i < Schema::OverdueList::ColumnCount; ++i) {
+        header.append(Schema::kOverdueListColumns[i].label);
+    }
+    QString csv = header.join(',') + "\n";
+
+    struct Reminder
+    {
+        int recordId;
+        QDate dueDate;
+        int overdueDays;
+    };
+    QVector<Reminder> reminders;
+    int overdue = 0;
+
+    while (query.next()) {
+        ++overdue;
+        QStringList fields;
+        for (int i = 0; i < Schema::OverdueList::ColumnCount; ++i) {
+            QString value = i == Schema::OverdueList::OverdueDays
+                ? QString::number(query.value(i).toInt())
+                : query.value(i).toString();
+            fields.append(TableIO::csvField(value));
+        }
+        csv += fields.join(',') + "\n";
+
+        if (remind) {
+            reminders.append(Reminder{
+                query.value(Schema::OverdueList::RecordId).toInt(),
+                query.value(Schema::OverdueList::DueDate).toDate(),
+                query.value(Schema::OverdueList::OverdueDays).toInt()});
+        }
+    }
+    query.finish();
+
+    QString error;
+    if (!writeText(output, csv, &error)) {
+        return fail("无法写入逾期列表：" + error);
+    }
+
+    if (remind) {
+        // 与界面中“发送提醒”写入的历史相同，经后写队列成批写入，关闭数据库前写完
+        for (const Reminder &reminder : reminders) {
+            core.logReminder(reminder.recordId, reminder.dueDate, reminder.overdueDays);
+        }
+        core.close();
+    }
+
+    err() << QString("逾期 %1 条%2").arg(overdue)
+                                      .arg(remind ? QString("，已记录 %1 条提醒").arg(reminders.size()) : QString())
+          << endl;
+    return Success;
+}
+
+// 与界面中的在线备份相同：备份期间数据库照常可写，完成后做完整性检查
+int runBackup(const QString &dbPath, const QString &target, bool compressed, int pagesPerStep)
+{
+    if (!QFile::exists(dbPath)) {
+        return fail("数据库不存在：" + dbPath);
+    }
+
+    OnlineBackupWorker worker(dbPath, target);
+    worker.setCompressed(compressed);
+    worker.setPagesPerStep(pagesPerStep);
+    worker.setThrottleMs(0);
+    // 命令行进程不经 QSQLITE 打开这个数据库，可以直接用系统的 SQLite 库
+    worker.setStandalone(true);
+
+    bool ok = false;
+    QString message;
+    QObject::connect(&worker, &OnlineBackupWorker::stageChanged, [](const QString &stage) {
+        err() << stage << endl;
+    });
+    QObject::connect(&worker, &OnlineBackupWorker::finished, [&ok, &message](bool success, const QString &text) {
+        ok = success;
+        message = text;
+    });
+    worker.run();
+
+    if (!ok) {
+        return fail("备份失败：" + message);
+    }
+    err() << message << endl;
+    return Success;
+}
+
+int runImport(const QString &dbPath, const QString &tableName, const QString &path, bool replace)
+{
+    const Schema::Table *table = Schema::findTable(tableName);
+    if (!table) {
+        err() << "未知的表：" << tableName << endl;
+        return Usage;
+    }
+    LibraryCore core;
+    if (!openCore(&core, dbPath, true)) {
+        return Failure;
+    }
+    TableIO::Result result;
+    QString error;
+    if (!TableIO::importCsv(core.database(), *table, path, replace, &result, &error)) {
+        return fail("导入失败：" + error);
+    }
+    err() << QString("已导入 %1 行到 %2，用时 %3 ms").arg(result.rows).arg(table->name).arg(result.elapsedMs) << endl;
+    return Success;
+}
+
+int runExport(const QString &dbPath, const QString &tableName, const QString &path, const QString &where)
+{
+    const Schema::Table *table = Schema::findTable(tableName);
+    if (!table) {
+        err() << "未知的表：" << tableName << endl;
+        return Usage;
+    }
+    LibraryCore core;
+    if (!openCore(&core, dbPath, false)) {
+        return Failure;
+    }
+    TableIO::Result result;
+    QString error;
+    if (!TableIO::exportCsv(core.database(), *table, path, &result, &error, where)) {
+        return fail("导出失败：" + error);
+    }
+    err() << QString("已导出 %1 的 %2 行，用时 %3 ms").arg(table->name).arg(result.rows).arg(result.elapsedMs) << endl;
+    return Success;
+}
+
+// 把借阅数据增量导出为 Arrow IPC 文件，供分析人员离线查询
+int runAnalyticsExport(const QString &dbPath, const QString &directory)
+{
+    if (!QFile::exists(dbPath)) {
+        return fail("数据库不存在：" + dbPath);
+    }
+    AnalyticsExport::Result result;
+    QString error;
+    const bool ok = AnalyticsExport::run(dbPath, directory, &result, &error);
+    for (const AnalyticsExport::TableResult &table : result.tables) {
+        err() << QString("%1：%2 行，%3 个文件").arg(table.table).arg(table.rows).arg(table.files);
+        if (table.watermark > 0) {
+            err() << QString("，水位线 %1").arg(table.watermark);
+        }
+        err() << endl;
+    }
+    if (!ok) {
+        return fail("导出失败：" + error);
+    }
+    err() << QString("用时 %1 ms").arg(result.elapsedMs) << endl;
+    return Success;
+}
+
+// 生成公共检索终端使用的目录快照
+int runCatalogSnapshot(const QString &dbPath, const QString &path)
+{
+    LibraryCore core;
+    if (!openCore(&core, dbPath, false)) {
+        return Failure;
+    }
+    CatalogSnapshot::BuildResult result;
+    QString error;
+    if (!CatalogSnapshot::build(core.database(), path, &result, &error)) {
+        return fail("生成快照失败：" + error);
+    }
+    err() << QString("已生成 %1 种图书的目录快照，%2 KB，用时 %3 ms")
+                 .arg(result.books).arg(result.bytes / 1024).arg(result.elapsedMs) << endl;
+    return Success;
+}
+
+// 在给定数据库上重复执行统计、报表、逾期检查、目录加载与过滤，输出各操作的耗时分布
+int runBench(const QString &dbPath, int iterations, const QString &jsonPath)
+{
+    LibraryCore core;
+    if (!openCore(&core, dbPath, false)) {
+        return Failure;
+    }
+    QSqlDatabase db = core.database();
+
+    PerfMonitor::reset();
+    for (int i = 0; i < iterations; ++i) {
+        core.statistics();
+        core.overdueSummary();
+        core.generateReport();
+
+        ColumnStore catalog = ColumnStore::books();
+        catalog.load(db);
+        LibraryCore::BookSearch search;
+        search.title = "12";
+        {
+            ScopedTimer timer("目录过滤");
+            catalog.filter(ColumnStore::bookConditions(search));
+        }
+
+        CirculationIndex index;
+        index.load(db);
+    }
+
+    out() << QString("%1\t%2\t%3\t%4\t%5").arg("操作", "次数", "平均(ms)", "P50(ms)", "P99(ms)") << endl;
+    for (const PerfMonitor::Entry &entry : PerfMonitor::snapshot()) {
+        if (entry.kind != PerfMonitor::Operation) {
+            continue;
+        }
+        out() << QString("%1\t%2\t%3\t%4\t%5")
+                     .arg(QString::fromUtf8(entry.shape))
+                     .arg(entry.count)
+                     .arg(entry.meanUs / 1000.0, 0, 'f', 3)
+                     .arg(entry.p50Us / 1000.0, 0, 'f', 3)
+                     .arg(entry.p99Us / 1000.0, 0, 'f', 3)
+              << endl;
+    }
+
+    if (!jsonPath.isEmpty()) {
+        QString error;
+        if (!PerfMonitor::writeJson(jsonPath, &error)) {
+            return fail("无法写入 " + jsonPath + "：" + error);
+        }
+    }
+    return Success;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("library_cli");
+    app.setOrganizationName("LibrarySoft");
+    app.setApplicationVersion("1.0.0");
+
+    out().setCodec("UTF-8");
+    err().setCodec("UTF-8");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("图书馆管理系统命令行工具\n\n"
+                                     "命令：\n"
+                                     "  report          生成统计报告\n"
+                                     "  overdue-sweep   列出逾期记录并可记录提醒\n"
+                                     "  expire-holds    处理超过取书期限的预约\n"
+                                     "  recommend       列出借过某本书的读者也借了的图书\n"
+                                     "  rebuild-coborrow 重建借阅关联\n"
+                                     "  backup          在线备份数据库\n"
+                                     "  import          从 CSV 导入一张表\n"
+                                     "  export          把一张表导出为 CSV\n"
+                                     "  analytics-export 增量导出借阅数据为 Arrow 文件\n"
+                                     "  catalog-snapshot 生成检索终端使用的目录快照\n"
+                                     "  bench           测量常用操作的耗时");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption dbOption("db", "数据库文件（默认 library.db）", "path", "library.db");
+    parser.addOption(dbOption);
+    parser.addPositionalArgument("command", "要执行的命令，见上");
+
+    // 先取出命令名，再按命令补充各自的参数后完整解析
+    parser.parse(app.arguments());
+    const QString command = parser.positionalArguments().value(0);
+
+    QCommandLineOption outputOption("output", "输出文件，默认写到标准输出", "file");
+    QCommandLineOption remindOption("remind", "为每条逾期记录写入一条提醒历史");
+    QCommandLineOption compressOption("compress", "生成压缩备份归档（.lmba）");
+    QCommandLineOption pagesOption("pages", "每批复制的页数", "N", "1000");
+    QCommandLineOption replaceOption("replace", "主键或唯一键冲突时覆盖已有的行");
+    QCommandLineOption whereOption("where", "只导出满足条件的行（SQL 表达式）", "condition");
+    QCommandLineOption iterationsOption("iterations", "重复次数", "N", "10");
+    QCommandLineOption jsonOption("json", "把耗时统计写入 JSON 文件", "file");
+    QCommandLineOption limitOption("limit", "最多列出的条数", "N", "10");
+
+    parser.clearPositionalArguments();
+    if (command == "report") {
+        parser.addPositionalArgument("report", "生成统计报告");
+        parser.addOption(outputOption);
+    } else if (command == "overdue-sweep") {
+        parser.addPositionalArgument("overdue-sweep", "列出逾期记录（CSV）");
+        parser.addOptions({outputOption, remindOption});
+    } else if (command == "expire-holds") {
+        parser.addPositionalArgument("expire-holds", "处理超过取书期限的预约");
+    } else if (command == "recommend") {
+        parser.addPositionalArgument("recommend", "列出借过某本书的读者也借了的图书（CSV）");
+        parser.addPositionalArgument("book-id", "图书ID");
+        parser.addOption(limitOption);
+    } else if (command == "rebuild-coborrow") {
+        parser.addPositionalArgument("rebuild-coborrow", "按全部借阅记录重建借阅关联");
+    } else if (command == "backup") {
+        parser.addPositionalArgument("backup", "在线备份数据库");
+        parser.addPositionalArgument("target", "备份文件");
+        parser.addOptions({compressOption, pagesOption});
+    } else if (command == "import" || command == "export") {
+        parser.addPositionalArgument(command, command == "import" ? "从 CSV 导入" : "导出为 CSV");
+        parser.addPositionalArgument("table", "books、readers、borrow_records、borrow_history、copies 或 holds");
+        parser.addPositionalArgument("file", "CSV 文件，首行为列名");
+        parser.addOption(command == "import" ? replaceOption : whereOption);
+    } else if (command == "analytics-export") {
+        parser.addPositionalArgument("analytics-export", "增量导出借阅记录、借阅历史与图书、读者表为 Arrow IPC 文件");
+        parser.addPositionalArgument("directory", "导出目录，已有的清单决定从哪里继续");
+    } else if (command == "catalog-snapshot") {
+        parser.addPositionalArgument("catalog-snapshot", "生成检索终端（--kiosk）使用的只读目录快照");
+        parser.addPositionalArgument("file", "快照文件，先写临时文件再替换");
+    } else if (command == "bench") {
+        parser.addPositionalArgument("bench", "测量常用操作的耗时");
+        parser.addOptions({iterationsOption, jsonOption});
+    } else {
+        parser.addPositionalArgument("command", "要执行的命令，见上");
+    }
+    parser.process(app);
+
+    const QString dbPath = parser.value(dbOption);
+    const QStringList args = parser.positionalArguments();
+
+    if (command == "report") {
+        return runReport(dbPath, parser.value(outputOption));
+    }
+    if (command == "overdue-sweep") {
+        return runOverdueSweep(dbPath, parser.value(outputOption), parser.isSet(remindOption));
+    }
+    if (command == "expire-holds") {
+        return runExpireHolds(dbPath);
+    }
+    if (command == "recommend" && args.size() == 2) {
+        return runRecommend(dbPath, args.at(1).toInt(), qMax(1, parser.value(limitOption).toInt()));
+    }
+    if (command == "rebuild-coborrow") {
+        return runRebuildCoBorrow(dbPath);
+    }
+    if (command == "backup" && args.size() == 2) {
+        return runBackup(dbPath, args.at(1), parser.isSet(compressOption), parser.value(pagesOption).toInt());
+    }
+    if (command == "import" && args.size() == 3) {
+        return runImport(dbPath, args.at(1), args.at(2), parser.isSet(replaceOption));
+    }
+    if (command == "export" && args.size() == 3) {
+        return runExport(dbPath, args.at(1), args.at(2), parser.value(whereOption));
+    }
+    if (command == "analytics-export" && args.size() == 2) {
+        return runAnalyticsExport(dbPath, args.at(1));
+    }
+    if (command == "catalog-snapshot" && args.size() == 2) {
+        return runCatalogSnapshot(dbPath, args.at(1));
+    }
+    if (command == "bench") {
+        return runBench(dbPath, qMax(1, parser.value(iterationsOption).toInt()), parser.value(jsonOption));
+    }
+
+    if (!command.isEmpty()) {
+        err() << "未知的命令或缺少参数：" << command << endl << endl;
+    }
+    err() << parser.helpText();
+    return Usage;
+}
@@ -0,0 +1,15 @@
+# 合成测试数据生成工具
+#
+#   library_datagen --books 1000000 --readers 500000 --loans 10000000 --seed 42 library.db
+
+QT -= gui
+
+CONFIG += console
+CONFIG -= app_bundle
+
+TARGET = library_datagen
+
+include(../../core.pri)
+
+SOURCES += \
+    main.cpp
@@ -0,0 +1,107 @@
+﻿// main.cpp
+#include "catalogsnapshot.h"
+#include "circulationprotocol.h"
+#include "circulationserver.h"
+#include "librarycore.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QFutureWatcher>
+#include <QTextStream>
+#include <QTimer>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("library_server");
+    app.setOrganizationName("LibrarySoft");
+    app.setApplicationVersion("1.0.0");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("借还书服务：独占数据库写入，为各服务台执行借书、还书、续借、检索与统计");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption dbOption("db", "数据库文件（默认 library.db）", "path", "library.db");
+    QCommandLineOption nameOption("name", "本地服务名", "name", CirculationProtocol::DefaultServerName);
+    QCommandLineOption portOption("port", "同时监听的 TCP 端口，0 表示不监听", "port", "0");
+    QCommandLineOption bindOption("bind", "TCP 监听的地址，非本机地址须同时给出 --token-file", "address", "127.0.0.1");
+    QCommandLineOption tokenOption("token-file", "访问令牌文件（第一行），TCP 客户端须在连接时出示", "file");
+    QCommandLineOption groupOpsOption("group-ops", "每组最多提交的借还操作数，1 表示逐个提交", "count", "64");
+    QCommandLineOption groupDelayOption("group-ms", "一组从开始到提交最多等待的毫秒数", "ms", "5");
+    QCommandLineOption snapshotOption("snapshot", "定期生成检索终端使用的目录快照", "file");
+    QCommandLineOption snapshotIntervalOption("snapshot-interval", "生成目录快照的间隔秒数", "seconds", "300");
+    parser.addOptions({dbOption, nameOption, portOption, bindOption, tokenOption, groupOpsOption, groupDelayOption,
+                       snapshotOption, snapshotIntervalOption});
+    parser.process(app);
+
+    QTextStream err(stderr);
+    err.setCodec("UTF-8");
+
+    const QString dbPath = parser.value(dbOption);
+    if (!QFile::exists(dbPath)) {
+        err << "数据库不存在：" << dbPath << endl;
+        return 1;
+    }
+
+    // 令牌从文件读取，不出现在进程的命令行中
+    QHostAddress bindAddress;
+    if (!bindAddress.setAddress(parser.value(bindOption))) {
+        err << "无效的监听地址：" << parser.value(bindOption) << endl;
+        return 1;
+    }
+    QByteArray token;
+    if (parser.isSet(tokenOption)) {
+        QFile tokenFile(parser.value(tokenOption));
+        if (!tokenFile.open(QIODevice::ReadOnly)) {
+            err << "无法读取访问令牌文件：" << tokenFile.errorString() << endl;
+            return 1;
+        }
+        token = tokenFile.readLine().trimmed();
+        if (token.isEmpty()) {
+            err << "访问令牌文件是空的" << endl;
+            return 1;
+        }
+    }
+
+    CirculationServer server(dbPath);
+    server.setGroupLimits(parser.value(groupOpsOption).toInt(), parser.value(groupDelayOption).toInt());
+    server.setTcpAccess(bindAddress, token);
+    QString error;
+    const quint16 port = parser.value(portOption).toUShort();
+    if (!server.listen(parser.value(nameOption), port, &error)) {
+        err << error << endl;
+        return 1;
+    }
+    err << QString("借还书服务已启动：%1%2，数据库 %3")
+               .arg(parser.value(nameOption))
+               .arg(port ? QString("，TCP %1:%2").arg(bindAddress.toString()).arg(port) : QString())
+               .arg(dbPath)
+        << endl;
+
+    // 目录快照在线程池中用只读连接生成，不占用处理借还书的线程；上一次没有完成时跳过这一次
+    QTimer snapshotTimer;
+    QFutureWatcher<QString> snapshotWatcher;
+    if (parser.isSet(snapshotOption)) {
+        const QString snapshotPath = parser.value(snapshotOption);
+        const auto buildSnapshot = [&]() {
+            if (snapshotWatcher.isRunning()) {
+                return;
+            }
+            snapshotWatcher.setFuture(LibraryCore::runReadOnly<QString>(dbPath, [snapshotPath](const LibraryCore &core) -> QString {
+                QString error;
+                return CatalogSnapshot::build(core.database(), snapshotPath, nullptr, &error)
+                           ? QString() : "生成目录快照失败：" + error;
+            }));
+        };
+        QObject::connect(&snapshotTimer, &QTimer::timeout, buildSnapshot);
+        QObject::connect(&snapshotWatcher, &QFutureWatcher<QString>::finished, [&]() {
+            if (!snapshotWatcher.result().isEmpty()) {
+                err << snapshotWatcher.result() << endl;
+            }
+        });
+        snapshotTimer.start(qMax(1, parser.value(snapshotIntervalOption).toInt()) * 1000);
+        buildSnapshot();
+    }
+
+    return app.exec();
+}
@@ -0,0 +1,18 @@
+# 借还书服务：独占数据库的写入，各服务台的界面作为客户端连接
+#
+#   library_server --db library.db --name library-circulation --port 7450
+#
+# 服务台在设置中填写 server/address（本地服务名或 主机:端口）后改由服务执行借还书。
+# 加上 --snapshot catalog.snapshot 时定期生成检索终端（Library_Management --kiosk）使用的目录快照。
+
+QT -= gui
+
+CONFIG += console
+CONFIG -= app_bundle
+
+TARGET = library_server
+
+include(../../core.pri)
+
+SOURCES += \
+    main.cpp